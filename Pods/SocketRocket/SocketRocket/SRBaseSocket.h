@@ -49,10 +49,31 @@ typedef enum {
 } SRStatusCode;
 
 
+typedef enum {
+    SRTraceEventFrameEncoded = 0, // a frame was framed and queued for writing
+    SRTraceEventStreamWrite, // bytes were written to the output stream
+    SRTraceEventStreamRead, // bytes were read from the input stream
+    SRTraceEventFrameDecoded, // a complete data frame was read
+} SRTraceEvent;
+
+typedef enum {
+    SRMessagePriorityNormal = 0,
+    SRMessagePriorityHigh, // sent ahead of queued normal messages, but never between the fragments of another message
+} SRMessagePriority;
+
+// Called on the socket's work queue, with the number of bytes involved.
+typedef void (^SRTraceHandler)(SRTraceEvent event, NSUInteger length);
+
 @class SRWebSocket;
 
 extern NSString *const SRWebSocketErrorDomain;
 
+// XORs length bytes of input with the 4 byte maskKey, starting maskOffset bytes into the key. input and output may be the same buffer.
+extern void SRMaskBytes(uint8_t *output, const uint8_t *input, size_t length, const uint8_t *maskKey, size_t maskOffset);
+
+// Returns the length of the longest prefix of data that is valid UTF-8, allowing a trailing partial codepoint, or -1 if data is invalid.
+extern int32_t SRValidUTF8PrefixLength(NSData *data);
+
 #pragma mark - SRWebSocketDelegate
 
 @protocol SRWebSocketDelegate;
@@ -70,6 +91,20 @@ extern NSString *const SRWebSocketErrorDomain;
 // It will be nil until after the handshake completes.
 @property (nonatomic, readonly, copy) NSString *protocol;
 
+// Called on the work queue, where it is also swapped, so it can be set at any time. nil by default.
+@property (nonatomic, copy) SRTraceHandler traceHandler;
+
+// Messages longer than this are sent as a series of continuation frames of at most this many bytes, so pings
+// and pongs can be written between them instead of waiting for the whole message. 0 sends every message as a
+// single frame. 64KB by default.
+@property (nonatomic, assign) NSUInteger fragmentSize;
+
+// Set before opening. Stream events are delivered straight onto the socket's work queue with
+// CFReadStreamSetDispatchQueue, instead of on a shared run loop thread that bounces each one over to the
+// work queue. Saves a thread hop per event and needs no network thread; libdispatch waits on kqueue, or on
+// epoll where it is built for Linux. NO by default, which uses the run loop.
+@property (nonatomic, assign) BOOL schedulesStreamsOnWorkQueue;
+
 // Protocols should be an array of strings that turn into Sec-WebSocket-Protocol.
 - (id)initWithURLRequest:(NSURLRequest *)request protocols:(NSArray *)protocols socketType:(SRSocketType)socketType;
 - (id)initWithURLRequest:(NSURLRequest *)request protocols:(NSArray *)protocols;
@@ -91,15 +126,37 @@ extern NSString *const SRWebSocketErrorDomain;
 // SRWebSockets are intended for one-time-use only.  Open should be called once and only once.
 - (void)open;
 
+// Connects this client to a server socket through two in-memory bound stream pairs instead of TCP. The
+// handshake and framing run exactly as they would over the network, minus the kernel. Call before -open;
+// the server opens itself as if it had accepted the connection. No TLS is negotiated over the loopback.
+- (void)connectToLoopbackServer:(SRBaseSocket *)server;
+
 - (void)close;
 - (void)closeWithCode:(SRStatusCode)code reason:(NSString *)reason;
 
 // Send a UTF8 String or Data.
 - (void)send:(id)data;
+- (void)send:(id)data priority:(SRMessagePriority)priority;
+
+// Send a ping with up to 125 bytes of application data, which the peer echoes back in a pong.
+- (void)sendPing:(NSData *)data;
 
-// If this is a server socket then the socket will be listening on a port
+// Drops the connection without a closing handshake, e.g. once the peer is known to be unreachable.
+- (void)failWithError:(NSError *)error;
+
+// Stops reading from the input stream, so once the OS buffers fill the peer is held back by TCP flow control.
+// Messages already read are still delivered. Resuming reads whatever arrived meanwhile.
+- (void)pauseReading;
+- (void)resumeReading;
+
+// If this is a server socket, starts listening on a port the OS picks and returns it. A server socket
+// only connected over the loopback never listens.
 - (NSUInteger)serverSocketPort;
 
+// Number of bytes queued for sending that have not yet been written to the stream, including frame headers
+// already encoded and the payload of messages not yet framed.
+- (NSUInteger)bufferedAmount;
+
 @end
 
 #pragma mark - SRWebSocketDelegate
@@ -115,6 +172,11 @@ extern NSString *const SRWebSocketErrorDomain;
 - (void)webSocketDidOpen:(SRWebSocket *)webSocket;
 - (void)webSocket:(SRWebSocket *)webSocket didFailWithError:(NSError *)error;
 - (void)webSocket:(SRWebSocket *)webSocket didCloseWithCode:(NSInteger)code reason:(NSString *)reason wasClean:(BOOL)wasClean;
+- (void)webSocket:(SRWebSocket *)webSocket didReceivePong:(NSData *)pongPayload;
+// Every ping is answered with a pong carrying the same payload right after this is called.
+- (void)webSocket:(SRWebSocket *)webSocket didReceivePing:(NSData *)pingPayload;
+- (void)webSocket:(SRWebSocket *)webSocket didSendCloseWithCode:(NSInteger)code;
+- (void)webSocket:(SRWebSocket *)webSocket didReceiveCloseWithCode:(NSInteger)code reason:(NSString *)reason;
 
 @end
 
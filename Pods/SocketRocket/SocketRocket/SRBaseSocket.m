@@ -57,6 +57,7 @@
 
 
 typedef enum  {
+    SROpCodeContinuation = 0x0,
     SROpCodeTextFrame = 0x1,
     SROpCodeBinaryFrame = 0x2,
     // 3-7 reserved.
@@ -76,8 +77,23 @@ typedef struct {
     uint64_t payload_length;
 } frame_header;
 
+// frames are read by a state machine working straight on _readBuffer, rather than through a chain of consumers
+typedef enum {
+    SRFrameReadStateIdle = 0,   // handshake not done, or reading stopped
+    SRFrameReadStateHeader,
+    SRFrameReadStatePayload,
+} SRFrameReadState;
+
 static NSString *const SRWebSocketAppendToSecKeyString = @"258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
 
+// reads land straight in _readBuffer, in chunks that double while the stream keeps filling them
+// and halve when it goes quiet, so bulk transfers take few reads and idle sockets stay small
+static const NSUInteger SRMinimumReadSize = 2048;
+static const NSUInteger SRMaximumReadSize = 256 * 1024;
+
+// room in each direction of a loopback connection, enough for a full read without stalling the writer
+static const CFIndex SRLoopbackBufferSize = 512 * 1024;
+
 static inline int32_t validate_dispatch_data_partial_string(NSData *data);
 static inline dispatch_queue_t log_queue();
 static inline void SRFastLog(NSString *format, ...);
@@ -182,6 +198,17 @@ typedef void (^data_callback)(SRBaseSocket *webSocket,  NSData *data);
 
 @end
 
+// A data message, or a close frame, waiting to be framed. Large messages are framed one fragment at a time.
+@interface SROutboundMessage : NSObject
+
+@property (nonatomic, assign, readonly) uint8_t opcode;
+@property (nonatomic, strong, readonly) NSData *data;
+@property (nonatomic, assign) NSUInteger offset;
+
+- (id)initWithOpcode:(uint8_t)opcode data:(NSData *)data;
+
+@end
+
 @interface SRBaseSocket ()  <NSStreamDelegate>
 
 - (void)_writeData:(NSData *)data;
@@ -192,8 +219,15 @@ typedef void (^data_callback)(SRBaseSocket *webSocket,  NSData *data);
 
 - (void)_readFrameNew;
 - (void)_readFrameContinue;
+- (void)_resetCurrentFrame;
 
 - (void)_pumpScanner;
+- (BOOL)_readFrameHeaderFromBuffer;
+- (BOOL)_readFramePayloadFromBuffer;
+- (void)_advanceReadBuffer:(size_t)length;
+- (void)_readAvailableBytes;
+- (void)_handleStreamEvent:(NSStreamEvent)eventCode stream:(NSStream *)aStream;
+- (void)_unscheduleStreamsFromWorkQueue;
 
 - (void)_pumpWriting;
 
@@ -204,12 +238,16 @@ typedef void (^data_callback)(SRBaseSocket *webSocket,  NSData *data);
 - (void)_readUntilHeaderCompleteWithCallback:(data_callback)dataHandler;
 
 - (void)_sendFrameWithOpcode:(SROpCode)opcode data:(id)data;
+- (void)_sendFrameWithOpcode:(SROpCode)opcode data:(id)data priority:(SRMessagePriority)priority;
+- (NSData *)_frameWithOpcode:(uint8_t)opcode fin:(BOOL)fin payload:(const uint8_t *)payload length:(size_t)payloadLength;
+- (void)_fillOutputBuffer;
 
 - (BOOL)_checkHandshake:(CFHTTPMessageRef)httpMessage;
 - (void)_SR_commonInit;
 
 - (void)_initializeServerStreams;
 - (void)_initializeStreams;
+- (void)_useInputStream:(NSInputStream *)inputStream outputStream:(NSOutputStream *)outputStream;
 - (void)_connect;
 
 @property (nonatomic) SRReadyState readyState;
@@ -236,13 +274,28 @@ typedef void (^data_callback)(SRBaseSocket *webSocket,  NSData *data);
 
     NSInputStream *_inputStream;
     NSOutputStream *_outputStream;
+    BOOL _streamsScheduled;
    
     NSMutableData *_readBuffer;
     NSUInteger _readBufferOffset;
+    NSUInteger _readSize;
+    BOOL _readingPaused;
  
     NSMutableData *_outputBuffer;
     NSUInteger _outputBufferOffset;
 
+    // frames are only moved into _outputBuffer as it drains, so pings and pongs can go out between fragments
+    NSMutableArray *_controlFrames;
+    NSMutableArray *_priorityMessages;
+    NSMutableArray *_outboundMessages;
+    SROutboundMessage *_currentMessage;
+    NSUInteger _queuedByteCount;
+
+    SRFrameReadState _frameReadState;
+    frame_header _currentFrameHeader;
+    uint64_t _currentFramePayloadRemaining;
+    NSMutableData *_controlFrameData;
+
     uint8_t _currentFrameOpcode;
     size_t _currentFrameCount;
     size_t _readOpCount;
@@ -290,6 +343,9 @@ typedef void (^data_callback)(SRBaseSocket *webSocket,  NSData *data);
 @synthesize url = _url;
 @synthesize readyState = _readyState;
 @synthesize protocol = _protocol;
+@synthesize traceHandler = _traceHandler;
+@synthesize fragmentSize = _fragmentSize;
+@synthesize schedulesStreamsOnWorkQueue = _schedulesStreamsOnWorkQueue;
 
 static __strong NSData *CRLFCRLF;
 
@@ -366,9 +422,15 @@ static __strong NSData *CRLFCRLF;
     sr_dispatch_retain(_delegateDispatchQueue);
     
     _readBuffer = [[NSMutableData alloc] init];
+    _readSize = SRMinimumReadSize;
     _outputBuffer = [[NSMutableData alloc] init];
+    _controlFrames = [[NSMutableArray alloc] init];
+    _priorityMessages = [[NSMutableArray alloc] init];
+    _outboundMessages = [[NSMutableArray alloc] init];
+    _fragmentSize = 64 * 1024;
     
     _currentFrameData = [[NSMutableData alloc] init];
+    _controlFrameData = [[NSMutableData alloc] init];
 
     _consumers = [[NSMutableArray alloc] init];
     
@@ -376,9 +438,8 @@ static __strong NSData *CRLFCRLF;
     
     _scheduledRunloops = [[NSMutableSet alloc] init];
     
-    if (_socketType == SRSocketTypeServer) {
-        [self _initializeServerStreams];
-    } else {
+    // a server only listens once asked for its port, so one connected over the loopback never binds a TCP port
+    if (_socketType == SRSocketTypeClient) {
         [self _initializeStreams];
     }
     
@@ -395,6 +456,7 @@ static __strong NSData *CRLFCRLF;
     _inputStream.delegate = nil;
     _outputStream.delegate = nil;
 
+    [self _unscheduleStreamsFromWorkQueue];
     [_inputStream close];
     [_outputStream close];
     
@@ -436,7 +498,91 @@ static __strong NSData *CRLFCRLF;
 
 - (NSUInteger)serverSocketPort;
 {
-    return _serverSocketPort;
+    if (_socketType != SRSocketTypeServer) {
+        return 0;
+    }
+    
+    __block NSUInteger serverSocketPort = 0;
+    dispatch_block_t block = ^{
+        if (!_listeningipv4Socket) {
+            [self _initializeServerStreams];
+        }
+        serverSocketPort = _serverSocketPort;
+    };
+    if (dispatch_get_specific((__bridge void *)self) == maybe_bridge(_workQueue)) {
+        block();
+    } else {
+        dispatch_sync(_workQueue, block);
+    }
+    return serverSocketPort;
+}
+
+- (void)connectToLoopbackServer:(SRBaseSocket *)server;
+{
+    NSAssert(_socketType == SRSocketTypeClient && server->_socketType == SRSocketTypeServer, @"Connect a client socket to a server socket");
+    NSAssert(_readyState == SR_CONNECTING, @"Cannot connect an SRWebSocket that is already open");
+    
+    CFReadStreamRef clientReadStream = NULL;
+    CFWriteStreamRef clientWriteStream = NULL;
+    CFReadStreamRef serverReadStream = NULL;
+    CFWriteStreamRef serverWriteStream = NULL;
+    CFStreamCreateBoundPair(NULL, &serverReadStream, &clientWriteStream, SRLoopbackBufferSize);
+    CFStreamCreateBoundPair(NULL, &clientReadStream, &serverWriteStream, SRLoopbackBufferSize);
+    
+    [self _useInputStream:CFBridgingRelease(clientReadStream) outputStream:CFBridgingRelease(clientWriteStream)];
+    _secure = NO; // no certificate to check on the loopback
+    [server _useInputStream:CFBridgingRelease(serverReadStream) outputStream:CFBridgingRelease(serverWriteStream)];
+    
+    [server open]; // open our streams to fulfill the connection
+}
+
+- (NSUInteger)bufferedAmount;
+{
+    __block NSUInteger bufferedAmount = 0;
+    dispatch_block_t block = ^{
+        bufferedAmount = _outputBuffer.length - _outputBufferOffset + _queuedByteCount;
+    };
+    if (dispatch_get_specific((__bridge void *)self) == maybe_bridge(_workQueue)) {
+        block();
+    } else {
+        dispatch_sync(_workQueue, block);
+    }
+    return bufferedAmount;
+}
+
+- (SRTraceHandler)traceHandler;
+{
+    __block SRTraceHandler traceHandler = nil;
+    dispatch_block_t block = ^{
+        traceHandler = _traceHandler;
+    };
+    if (dispatch_get_specific((__bridge void *)self) == maybe_bridge(_workQueue)) {
+        block();
+    } else {
+        dispatch_sync(_workQueue, block);
+    }
+    return traceHandler;
+}
+
+- (void)setTraceHandler:(SRTraceHandler)traceHandler;
+{
+    // only touched on the work queue, where the events are reported
+    traceHandler = [traceHandler copy];
+    dispatch_block_t block = ^{
+        _traceHandler = traceHandler;
+    };
+    if (dispatch_get_specific((__bridge void *)self) == maybe_bridge(_workQueue)) {
+        block();
+    } else {
+        dispatch_sync(_workQueue, block);
+    }
+}
+
+- (void)setSchedulesStreamsOnWorkQueue:(BOOL)schedulesStreamsOnWorkQueue;
+{
+    // the streams are scheduled once, when they open
+    NSAssert(_readyState == SR_CONNECTING && !_streamsScheduled, @"Set schedulesStreamsOnWorkQueue before opening the socket");
+    _schedulesStreamsOnWorkQueue = schedulesStreamsOnWorkQueue;
 }
 
 // Calls block on delegate queue
@@ -736,8 +882,7 @@ static void AcceptCallback(CFSocketRef socket, CFSocketCallBackType type, CFData
     CFReadStreamSetProperty(readStream, kCFStreamPropertyShouldCloseNativeSocket, kCFBooleanTrue);
     CFWriteStreamSetProperty(writeStream, kCFStreamPropertyShouldCloseNativeSocket, kCFBooleanTrue);
     
-    _outputStream = CFBridgingRelease(writeStream);
-    _inputStream = CFBridgingRelease(readStream);
+    [self _useInputStream:CFBridgingRelease(readStream) outputStream:CFBridgingRelease(writeStream)];
 
     // not supporting secure stuff on the server for now
     
@@ -760,13 +905,22 @@ static void AcceptCallback(CFSocketRef socket, CFSocketCallBackType type, CFData
     //                            forKey:(__bridge id)kCFStreamPropertySSLSettings];
     //    }
     
-    _inputStream.delegate = self;
-    _outputStream.delegate = self;
-    
     [self open]; // open our streams to fulfill the connection
     
 }
 
+- (void)_useInputStream:(NSInputStream *)inputStream outputStream:(NSOutputStream *)outputStream;
+{
+    _inputStream.delegate = nil;
+    _outputStream.delegate = nil;
+    
+    _inputStream = inputStream;
+    _outputStream = outputStream;
+    
+    _inputStream.delegate = self;
+    _outputStream.delegate = self;
+}
+
 - (void)_initializeServerStreams;
 {
 // this method should only be used for stubbing client connections
@@ -910,7 +1064,11 @@ static void AcceptCallback(CFSocketRef socket, CFSocketCallBackType type, CFData
 
 - (void)_connect;
 {
-    if (!_scheduledRunloops.count) {
+    _streamsScheduled = YES;
+    if (_schedulesStreamsOnWorkQueue) {
+        CFReadStreamSetDispatchQueue((__bridge CFReadStreamRef)_inputStream, _workQueue);
+        CFWriteStreamSetDispatchQueue((__bridge CFWriteStreamRef)_outputStream, _workQueue);
+    } else if (!_scheduledRunloops.count) {
         if (_socketType == SRSocketTypeServer) {
             [self scheduleInRunLoop:[NSRunLoop SR_networkServerRunLoop] forMode:NSDefaultRunLoopMode];
         } else {
@@ -923,6 +1081,15 @@ static void AcceptCallback(CFSocketRef socket, CFSocketCallBackType type, CFData
     [_inputStream open];
 }
 
+- (void)_unscheduleStreamsFromWorkQueue;
+{
+    if (!_schedulesStreamsOnWorkQueue) {
+        return;
+    }
+    CFReadStreamSetDispatchQueue((__bridge CFReadStreamRef)_inputStream, NULL);
+    CFWriteStreamSetDispatchQueue((__bridge CFWriteStreamRef)_outputStream, NULL);
+}
+
 - (void)scheduleInRunLoop:(NSRunLoop *)aRunLoop forMode:(NSString *)mode;
 {
     [_outputStream scheduleInRunLoop:aRunLoop forMode:mode];
@@ -986,6 +1153,11 @@ static void AcceptCallback(CFSocketRef socket, CFSocketCallBackType type, CFData
         
         
         [self _sendFrameWithOpcode:SROpCodeConnectionClose data:payload];
+        [self _performDelegateBlock:^{
+            if ([self.delegate respondsToSelector:@selector(webSocket:didSendCloseWithCode:)]) {
+                [self.delegate webSocket:self didSendCloseWithCode:code];
+            }
+        }];
     });
 }
 
@@ -1033,36 +1205,65 @@ static void AcceptCallback(CFSocketRef socket, CFSocketCallBackType type, CFData
     [self _pumpWriting];
 }
 - (void)send:(id)data;
+{
+    [self send:data priority:SRMessagePriorityNormal];
+}
+
+- (void)send:(id)data priority:(SRMessagePriority)priority;
 {
     NSAssert(self.readyState != SR_CONNECTING, @"Invalid State: Cannot call send: until connection is open");
     // TODO: maybe not copy this for performance
     data = [data copy];
     dispatch_async(_workQueue, ^{
         if ([data isKindOfClass:[NSString class]]) {
-            [self _sendFrameWithOpcode:SROpCodeTextFrame data:[(NSString *)data dataUsingEncoding:NSUTF8StringEncoding]];
+            [self _sendFrameWithOpcode:SROpCodeTextFrame data:[(NSString *)data dataUsingEncoding:NSUTF8StringEncoding] priority:priority];
         } else if ([data isKindOfClass:[NSData class]]) {
-            [self _sendFrameWithOpcode:SROpCodeBinaryFrame data:data];
+            [self _sendFrameWithOpcode:SROpCodeBinaryFrame data:data priority:priority];
         } else if (data == nil) {
-            [self _sendFrameWithOpcode:SROpCodeTextFrame data:data];
+            [self _sendFrameWithOpcode:SROpCodeTextFrame data:data priority:priority];
         } else {
             assert(NO);
         }
     });
 }
 
+- (void)sendPing:(NSData *)data;
+{
+    NSAssert(self.readyState != SR_CONNECTING, @"Invalid State: Cannot call sendPing: until connection is open");
+    NSAssert(data.length <= 125, @"Control frame payloads must be 125 bytes or less");
+    data = [data copy] ?: [NSData data];
+    dispatch_async(_workQueue, ^{
+        if (self.readyState == SR_OPEN) {
+            [self _sendFrameWithOpcode:SROpCodePing data:data];
+        }
+    });
+}
+
+- (void)failWithError:(NSError *)error;
+{
+    [self _failWithError:error];
+}
+
 - (void)handlePing:(NSData *)pingData;
 {
     // Need to pingpong this off _callbackQueue first to make sure messages happen in order
     [self _performDelegateBlock:^{
+        if ([self.delegate respondsToSelector:@selector(webSocket:didReceivePing:)]) {
+            [self.delegate webSocket:self didReceivePing:pingData];
+        }
         dispatch_async(_workQueue, ^{
             [self _sendFrameWithOpcode:SROpCodePong data:pingData];
         });
     }];
 }
 
-- (void)handlePong;
+- (void)handlePong:(NSData *)pongData;
 {
-    // NOOP
+    [self _performDelegateBlock:^{
+        if ([self.delegate respondsToSelector:@selector(webSocket:didReceivePong:)]) {
+            [self.delegate webSocket:self didReceivePong:pongData];
+        }
+    }];
 }
 
 - (void)_handleMessage:(id)message
@@ -1139,6 +1340,14 @@ static inline BOOL closeCodeIsValid(int closeCode) {
     
     [self assertOnWorkQueue];
     
+    NSInteger receivedCode = _closeCode;
+    NSString *receivedReason = _closeReason;
+    [self _performDelegateBlock:^{
+        if ([self.delegate respondsToSelector:@selector(webSocket:didReceiveCloseWithCode:reason:)]) {
+            [self.delegate webSocket:self didReceiveCloseWithCode:receivedCode reason:receivedReason];
+        }
+    }];
+    
     if (self.readyState == SR_OPEN) {
         [self closeWithCode:_closeCode reason:nil]; // per the spec "When sending a Close frame in response, the endpoint typically echos the status code it received.
     }
@@ -1169,6 +1378,12 @@ static inline BOOL closeCodeIsValid(int closeCode) {
         _receivedHTTPHeaders = NULL;
     }
     [_consumers removeAllObjects];
+    _frameReadState = SRFrameReadStateIdle;
+    [_controlFrames removeAllObjects];
+    [_priorityMessages removeAllObjects];
+    [_outboundMessages removeAllObjects];
+    _currentMessage = nil;
+    _queuedByteCount = 0;
     _closeWhenFinishedWriting = NO;
     _sentClose = NO;
 }
@@ -1178,12 +1393,8 @@ static inline BOOL closeCodeIsValid(int closeCode) {
     // Check that the current data is valid UTF8
     
     BOOL isControlFrame = (opcode == SROpCodePing || opcode == SROpCodePong || opcode == SROpCodeConnectionClose);
-    if (!isControlFrame) {
-        [self _readFrameNew];
-    } else {
-        dispatch_async(_workQueue, ^{
-            [self _readFrameContinue];
-        });
+    if (!isControlFrame && _traceHandler) {
+        _traceHandler(SRTraceEventFrameDecoded, frameData.length);
     }
     
     switch (opcode) {
@@ -1210,13 +1421,20 @@ static inline BOOL closeCodeIsValid(int closeCode) {
             [self handlePing:frameData];
             break;
         case SROpCodePong:
-            [self handlePong];
+            [self handlePong:frameData];
             break;
         default:
             [self _closeWithProtocolError:[NSString stringWithFormat:@"Unknown opcode %ld", (long)opcode]];
             // TODO: Handle invalid opcode
             break;
     }
+    
+    // the message has been handed off, so the next frame can reuse the buffers; a control frame
+    // may arrive between fragments, so it leaves the message being assembled alone
+    if (!isControlFrame) {
+        [self _resetCurrentFrame];
+    }
+    [self _readFrameContinue];
 }
 
 - (void)_handleFrameHeader:(frame_header)frame_header curData:(NSData *)curData;
@@ -1247,7 +1465,7 @@ static inline BOOL closeCodeIsValid(int closeCode) {
     
     if (frame_header.payload_length == 0) {
         if (isControlFrame) {
-            [self _handleFrameWithData:curData opCode:frame_header.opcode];
+            [self _handleFrameWithData:[NSData data] opCode:frame_header.opcode];
         } else {
             if (frame_header.fin) {
                 [self _handleFrameWithData:_currentFrameData opCode:frame_header.opcode];
@@ -1257,19 +1475,12 @@ static inline BOOL closeCodeIsValid(int closeCode) {
             }
         }
     } else {
-        [self _addConsumerWithDataLength:frame_header.payload_length callback:^(SRBaseSocket *self, NSData *newData) {
-            if (isControlFrame) {
-                [self _handleFrameWithData:newData opCode:frame_header.opcode];
-            } else {
-                if (frame_header.fin) {
-                    [self _handleFrameWithData:self->_currentFrameData opCode:frame_header.opcode];
-                } else {
-                    // TODO add assert that opcode is not a control;
-                    [self _readFrameContinue];
-                }
-                
-            }
-        } readToCurrentFrame:!isControlFrame unmaskBytes:frame_header.masked];
+        if (isControlFrame) {
+            [_controlFrameData setLength:0];
+        }
+        _currentFrameHeader = frame_header;
+        _currentFramePayloadRemaining = frame_header.payload_length;
+        _frameReadState = SRFrameReadStatePayload;
     }
 }
 
@@ -1304,111 +1515,195 @@ static const uint8_t SRPayloadLenMask   = 0x7F;
 
 - (void)_readFrameContinue;
 {
+    [self assertOnWorkQueue];
     assert((_currentFrameCount == 0 && _currentFrameOpcode == 0) || (_currentFrameCount > 0 && _currentFrameOpcode > 0));
-    __weak __typeof(self)weakSelf = self;
-    __typeof(_socketType)socketType = _socketType;
-    [self _addConsumerWithDataLength:2 callback:^(SRBaseSocket *self, NSData *data) {
-        __block frame_header header = {0};
-        
-        const uint8_t *headerBuffer = data.bytes;
-        assert(data.length >= 2);
-        
-        if (headerBuffer[0] & SRRsvMask) {
-            [self _closeWithProtocolError:@"Server used RSV bits"];
-            return;
-        }
-        
-        uint8_t receivedOpcode = (SROpCodeMask & headerBuffer[0]);
-        
-        BOOL isControlFrame = (receivedOpcode == SROpCodePing || receivedOpcode == SROpCodePong || receivedOpcode == SROpCodeConnectionClose);
-        
-        if (!isControlFrame && receivedOpcode != 0 && self->_currentFrameCount > 0) {
-            [weakSelf _closeWithProtocolError:@"all data frames after the initial data frame must have opcode 0"];
-            return;
-        }
-        
-        if (receivedOpcode == 0 && self->_currentFrameCount == 0) {
-            [weakSelf _closeWithProtocolError:@"cannot continue a message"];
-            return;
-        }
-        
-        header.opcode = receivedOpcode == 0 ? self->_currentFrameOpcode : receivedOpcode;
-        
-        header.fin = !!(SRFinMask & headerBuffer[0]);
-        
-        header.masked = !!(SRMaskMask & headerBuffer[1]);
-        header.payload_length = SRPayloadLenMask & headerBuffer[1];
-        
-        headerBuffer = NULL;
-        
-        // The server MUST close the connection upon receiving a frame that is not masked.
-        // A client MUST close a connection if it detects a masked frame.
-        if (header.masked && socketType == SRSocketTypeClient) {
-            [weakSelf _closeWithProtocolError:@"Client must receive unmasked data"];
-        } else if (!header.masked && socketType == SRSocketTypeServer) {
-            [weakSelf _closeWithProtocolError:@"Server must receive masked data"];
-        }
-        
-        size_t extra_bytes_needed = header.masked ? sizeof(_currentReadMaskKey) : 0;
-        
-        if (header.payload_length == 126) {
-            extra_bytes_needed += sizeof(uint16_t);
-        } else if (header.payload_length == 127) {
-            extra_bytes_needed += sizeof(uint64_t);
-        }
-        
-        if (extra_bytes_needed == 0) {
-            [weakSelf _handleFrameHeader:header curData:self->_currentFrameData];
-        } else {
-            [weakSelf _addConsumerWithDataLength:extra_bytes_needed callback:^(SRBaseSocket *self, NSData *data) {
-                size_t mapped_size = data.length;
-                const void *mapped_buffer = data.bytes;
-                size_t offset = 0;
-                
-                if (header.payload_length == 126) {
-                    assert(mapped_size >= sizeof(uint16_t));
-                    uint16_t newLen = EndianU16_BtoN(*(uint16_t *)(mapped_buffer));
-                    header.payload_length = newLen;
-                    offset += sizeof(uint16_t);
-                } else if (header.payload_length == 127) {
-                    assert(mapped_size >= sizeof(uint64_t));
-                    header.payload_length = EndianU64_BtoN(*(uint64_t *)(mapped_buffer));
-                    offset += sizeof(uint64_t);
-                } else {
-                    assert(header.payload_length < 126 && header.payload_length >= 0);
-                }
-                
-                
-                if (header.masked) {
-                    assert(mapped_size >= sizeof(_currentReadMaskOffset) + offset);
-                    memcpy(self->_currentReadMaskKey, ((uint8_t *)mapped_buffer) + offset, sizeof(self->_currentReadMaskKey));
-                }
-                
-                [weakSelf _handleFrameHeader:header curData:self->_currentFrameData];
-            } readToCurrentFrame:NO unmaskBytes:NO];
-        }
-    } readToCurrentFrame:NO unmaskBytes:NO];
+    
+    _frameReadState = SRFrameReadStateHeader;
+    [self _pumpScanner];
+}
+
+- (void)_resetCurrentFrame;
+{
+    [_currentFrameData setLength:0];
+    
+    _currentFrameOpcode = 0;
+    _currentFrameCount = 0;
+    _readOpCount = 0;
+    _currentStringScanPosition = 0;
+    _currentReadMaskOffset = 0;
 }
 
 - (void)_readFrameNew;
 {
     dispatch_async(_workQueue, ^{
-        [_currentFrameData setLength:0];
-        
-        _currentFrameOpcode = 0;
-        _currentFrameCount = 0;
-        _readOpCount = 0;
-        _currentStringScanPosition = 0;
-        _currentReadMaskOffset = 0;
-        
+        [self _resetCurrentFrame];
         [self _readFrameContinue];
     });
 }
 
+// Decodes a whole frame header in place once all of it has arrived; returns YES if it did.
+- (BOOL)_readFrameHeaderFromBuffer;
+{
+    size_t curSize = _readBuffer.length - _readBufferOffset;
+    if (curSize < 2) {
+        return NO;
+    }
+    
+    const uint8_t *headerBuffer = (const uint8_t *)_readBuffer.bytes + _readBufferOffset;
+    BOOL masked = !!(SRMaskMask & headerBuffer[1]);
+    uint8_t payloadLength = SRPayloadLenMask & headerBuffer[1];
+    
+    size_t headerLength = 2 + (masked ? sizeof(_currentReadMaskKey) : 0);
+    if (payloadLength == 126) {
+        headerLength += sizeof(uint16_t);
+    } else if (payloadLength == 127) {
+        headerLength += sizeof(uint64_t);
+    }
+    if (curSize < headerLength) {
+        return NO;
+    }
+    
+    _frameReadState = SRFrameReadStateIdle;
+    
+    if (headerBuffer[0] & SRRsvMask) {
+        [self _closeWithProtocolError:@"Server used RSV bits"];
+        return NO;
+    }
+    
+    uint8_t receivedOpcode = (SROpCodeMask & headerBuffer[0]);
+    
+    BOOL isControlFrame = (receivedOpcode == SROpCodePing || receivedOpcode == SROpCodePong || receivedOpcode == SROpCodeConnectionClose);
+    
+    if (!isControlFrame && receivedOpcode != 0 && _currentFrameCount > 0) {
+        [self _closeWithProtocolError:@"all data frames after the initial data frame must have opcode 0"];
+        return NO;
+    }
+    
+    if (receivedOpcode == 0 && _currentFrameCount == 0) {
+        [self _closeWithProtocolError:@"cannot continue a message"];
+        return NO;
+    }
+    
+    // The server MUST close the connection upon receiving a frame that is not masked.
+    // A client MUST close a connection if it detects a masked frame.
+    if (masked && _socketType == SRSocketTypeClient) {
+        [self _closeWithProtocolError:@"Client must receive unmasked data"];
+        return NO;
+    } else if (!masked && _socketType == SRSocketTypeServer) {
+        [self _closeWithProtocolError:@"Server must receive masked data"];
+        return NO;
+    }
+    
+    frame_header header = {0};
+    header.opcode = receivedOpcode == 0 ? _currentFrameOpcode : receivedOpcode;
+    header.fin = !!(SRFinMask & headerBuffer[0]);
+    header.masked = masked;
+    
+    size_t offset = 2;
+    if (payloadLength == 126) {
+        uint16_t extendedLength;
+        memcpy(&extendedLength, headerBuffer + offset, sizeof(extendedLength));
+        header.payload_length = EndianU16_BtoN(extendedLength);
+        offset += sizeof(uint16_t);
+    } else if (payloadLength == 127) {
+        uint64_t extendedLength;
+        memcpy(&extendedLength, headerBuffer + offset, sizeof(extendedLength));
+        header.payload_length = EndianU64_BtoN(extendedLength);
+        offset += sizeof(uint64_t);
+    } else {
+        header.payload_length = payloadLength;
+    }
+    
+    if (masked) {
+        memcpy(_currentReadMaskKey, headerBuffer + offset, sizeof(_currentReadMaskKey));
+    }
+    // each frame has its own masking key
+    _currentReadMaskOffset = 0;
+    
+    headerBuffer = NULL;
+    [self _advanceReadBuffer:headerLength];
+    
+    [self _handleFrameHeader:header curData:_currentFrameData];
+    return YES;
+}
+
+// Moves whatever part of the current frame's payload has arrived out of _readBuffer; returns YES if there was any.
+- (BOOL)_readFramePayloadFromBuffer;
+{
+    size_t curSize = _readBuffer.length - _readBufferOffset;
+    if (!curSize) {
+        return NO;
+    }
+    
+    uint8_t opcode = _currentFrameHeader.opcode;
+    BOOL isControlFrame = (opcode == SROpCodePing || opcode == SROpCodePong || opcode == SROpCodeConnectionClose);
+    NSMutableData *frameData = isControlFrame ? _controlFrameData : _currentFrameData;
+    
+    size_t length = (size_t)MIN((uint64_t)curSize, _currentFramePayloadRemaining);
+    NSUInteger start = frameData.length;
+    [frameData appendBytes:(const uint8_t *)_readBuffer.bytes + _readBufferOffset length:length];
+    [self _advanceReadBuffer:length];
+    _currentFramePayloadRemaining -= length;
+    
+    if (_currentFrameHeader.masked) {
+        uint8_t *bytes = (uint8_t *)frameData.mutableBytes + start;
+        SRMaskBytes(bytes, bytes, length, _currentReadMaskKey, _currentReadMaskOffset);
+        _currentReadMaskOffset += length;
+    }
+    
+    if (!isControlFrame) {
+        _readOpCount += 1;
+        
+        if (_currentFrameOpcode == SROpCodeTextFrame) {
+            // Validate UTF8 stuff, looking only at what arrived since the last valid prefix
+            size_t scanSize = frameData.length - _currentStringScanPosition;
+            NSData *scan_data = [NSData dataWithBytesNoCopy:(uint8_t *)frameData.mutableBytes + _currentStringScanPosition length:scanSize freeWhenDone:NO];
+            int32_t valid_utf8_size = validate_dispatch_data_partial_string(scan_data);
+            
+            if (valid_utf8_size == -1) {
+                _frameReadState = SRFrameReadStateIdle;
+                [self closeWithCode:SRStatusCodeInvalidUTF8 reason:@"Text frames must be valid UTF-8"];
+                dispatch_async(_workQueue, ^{
+                    [self _disconnect];
+                });
+                return NO;
+            } else {
+                _currentStringScanPosition += valid_utf8_size;
+            }
+        }
+    }
+    
+    if (_currentFramePayloadRemaining > 0) {
+        return YES;
+    }
+    
+    _frameReadState = SRFrameReadStateIdle;
+    if (isControlFrame) {
+        [self _handleFrameWithData:[_controlFrameData copy] opCode:opcode];
+    } else if (_currentFrameHeader.fin) {
+        [self _handleFrameWithData:_currentFrameData opCode:opcode];
+    } else {
+        [self _readFrameContinue];
+    }
+    return YES;
+}
+
+- (void)_advanceReadBuffer:(size_t)length;
+{
+    _readBufferOffset += length;
+    
+    if (_readBufferOffset > 4096 && _readBufferOffset > (_readBuffer.length >> 1)) {
+        _readBuffer = [[NSMutableData alloc] initWithBytes:(char *)_readBuffer.bytes + _readBufferOffset length:_readBuffer.length - _readBufferOffset];
+        _readBufferOffset = 0;
+    }
+}
+
 - (void)_pumpWriting;
 {
     [self assertOnWorkQueue];
     
+    [self _fillOutputBuffer];
+    
     NSUInteger dataLength = _outputBuffer.length;
     if (dataLength - _outputBufferOffset > 0 && _outputStream.hasSpaceAvailable) {
         NSInteger bytesWritten = [_outputStream write:_outputBuffer.bytes + _outputBufferOffset maxLength:dataLength - _outputBufferOffset];
@@ -1419,6 +1714,10 @@ static const uint8_t SRPayloadLenMask   = 0x7F;
         
         _outputBufferOffset += bytesWritten;
         
+        if (_traceHandler) {
+            _traceHandler(SRTraceEventStreamWrite, bytesWritten);
+        }
+        
         if (_outputBufferOffset > 4096 && _outputBufferOffset > (_outputBuffer.length >> 1)) {
             _outputBuffer = [[NSMutableData alloc] initWithBytes:(char *)_outputBuffer.bytes + _outputBufferOffset length:_outputBuffer.length - _outputBufferOffset];
             _outputBufferOffset = 0;
@@ -1427,6 +1726,7 @@ static const uint8_t SRPayloadLenMask   = 0x7F;
     
     if (_closeWhenFinishedWriting && 
         _outputBuffer.length - _outputBufferOffset == 0 && 
+        _controlFrames.count == 0 && !_currentMessage && _priorityMessages.count == 0 && _outboundMessages.count == 0 && 
         (_inputStream.streamStatus != NSStreamStatusNotOpen &&
          _inputStream.streamStatus != NSStreamStatusClosed) &&
         !_sentClose) {
@@ -1442,6 +1742,7 @@ static const uint8_t SRPayloadLenMask   = 0x7F;
         for (NSArray *runLoop in [_scheduledRunloops copy]) {
             [self unscheduleFromRunLoop:[runLoop objectAtIndex:0] forMode:[runLoop objectAtIndex:1]];
         }
+        [self _unscheduleStreamsFromWorkQueue];
         
         if (!_failed) {
             [self _performDelegateBlock:^{
@@ -1525,7 +1826,14 @@ static const char CRLFCRLFBytes[] = {'\r', '\n', '\r', '\n'};
     }
     
     if (!_consumers.count) {
-        return didWork;
+        switch (_frameReadState) {
+            case SRFrameReadStateHeader:
+                return [self _readFrameHeaderFromBuffer];
+            case SRFrameReadStatePayload:
+                return [self _readFramePayloadFromBuffer];
+            case SRFrameReadStateIdle:
+                return didWork;
+        }
     }
     
     size_t curSize = _readBuffer.length - _readBufferOffset;
@@ -1555,11 +1863,7 @@ static const char CRLFCRLFBytes[] = {'\r', '\n', '\r', '\n'};
         NSRange sliceRange = NSMakeRange(_readBufferOffset, foundSize);
         slice = [_readBuffer subdataWithRange:sliceRange];
         
-        _readBufferOffset += foundSize;
-        
-        if (_readBufferOffset > 4096 && _readBufferOffset > (_readBuffer.length >> 1)) {
-            _readBuffer = [[NSMutableData alloc] initWithBytes:(char *)_readBuffer.bytes + _readBufferOffset length:_readBuffer.length - _readBufferOffset];            _readBufferOffset = 0;
-        }
+        [self _advanceReadBuffer:foundSize];
         
         if (consumer.unmaskBytes) {
             NSMutableData *mutableSlice = [slice mutableCopy];
@@ -1567,10 +1871,8 @@ static const char CRLFCRLFBytes[] = {'\r', '\n', '\r', '\n'};
             NSUInteger len = mutableSlice.length;
             uint8_t *bytes = mutableSlice.mutableBytes;
             
-            for (NSUInteger i = 0; i < len; i++) {
-                bytes[i] = bytes[i] ^ _currentReadMaskKey[_currentReadMaskOffset % sizeof(_currentReadMaskKey)];
-                _currentReadMaskOffset += 1;
-            }
+            SRMaskBytes(bytes, bytes, len, _currentReadMaskKey, _currentReadMaskOffset);
+            _currentReadMaskOffset += len;
             
             slice = mutableSlice;
         }
@@ -1639,27 +1941,119 @@ static const char CRLFCRLFBytes[] = {'\r', '\n', '\r', '\n'};
     _isPumping = NO;
 }
 
+void SRMaskBytes(uint8_t *output, const uint8_t *input, size_t length, const uint8_t *maskKey, size_t maskOffset) {
+    for (size_t i = 0; i < length; i++) {
+        output[i] = input[i] ^ maskKey[(maskOffset + i) % sizeof(uint32_t)];
+    }
+}
+
+int32_t SRValidUTF8PrefixLength(NSData *data) {
+    return validate_dispatch_data_partial_string(data);
+}
+
 //#define NOMASK
 
 static const size_t SRFrameHeaderOverhead = 32;
 
+// Frames are encoded lazily, as the output buffer drains below this many bytes (or below fragmentSize, if larger).
+static const NSUInteger SROutputBufferLowWater = 4096;
+
 - (void)_sendFrameWithOpcode:(SROpCode)opcode data:(id)data;
+{
+    [self _sendFrameWithOpcode:opcode data:data priority:SRMessagePriorityNormal];
+}
+
+- (void)_sendFrameWithOpcode:(SROpCode)opcode data:(id)data priority:(SRMessagePriority)priority;
 {
     [self assertOnWorkQueue];
     
     NSAssert(data == nil || [data isKindOfClass:[NSData class]] || [data isKindOfClass:[NSString class]], @"Function expects nil, NSString or NSData");
     
-    size_t payloadLength = [data isKindOfClass:[NSString class]] ? [(NSString *)data lengthOfBytesUsingEncoding:NSUTF8StringEncoding] : [data length];
+    if (_closeWhenFinishedWriting) {
+        SRFastLog(@"Closing when finished writing");
+        return;
+    }
+    
+    if ([data isKindOfClass:[NSString class]]) {
+        data = [(NSString *)data dataUsingEncoding:NSUTF8StringEncoding];
+    }
+    
+    if (opcode == SROpCodePing || opcode == SROpCodePong) {
+        // pings and pongs may be sent between the fragments of a message, so they skip the message queues
+        NSData *frame = [self _frameWithOpcode:opcode fin:YES payload:[data bytes] length:[data length]];
+        if (frame) {
+            [_controlFrames addObject:frame];
+        }
+    } else {
+        // close frames stay in order behind queued messages: no data frame may follow a close frame, so sending it
+        // early would cut off anything still queued
+        SROutboundMessage *message = [[SROutboundMessage alloc] initWithOpcode:opcode data:data];
+        if (priority == SRMessagePriorityHigh && opcode != SROpCodeConnectionClose) {
+            [_priorityMessages addObject:message];
+        } else {
+            [_outboundMessages addObject:message];
+        }
+        _queuedByteCount += [data length];
+    }
+    
+    [self _pumpWriting];
+}
+
+- (void)_fillOutputBuffer;
+{
+    [self assertOnWorkQueue];
+    
+    NSUInteger lowWater = MAX(_fragmentSize, SROutputBufferLowWater);
+    while (_outputBuffer.length - _outputBufferOffset < lowWater) {
+        if (_controlFrames.count) {
+            [_outputBuffer appendData:[_controlFrames objectAtIndex:0]];
+            [_controlFrames removeObjectAtIndex:0];
+            continue;
+        }
+        
+        if (!_currentMessage) {
+            // a message, once started, has to finish before another one may begin
+            NSMutableArray *queue = _priorityMessages.count ? _priorityMessages : _outboundMessages;
+            if (!queue.count) {
+                return;
+            }
+            _currentMessage = [queue objectAtIndex:0];
+            [queue removeObjectAtIndex:0];
+        }
+        
+        SROutboundMessage *message = _currentMessage;
+        NSUInteger remaining = message.data.length - message.offset;
+        BOOL isControlFrame = message.opcode == SROpCodeConnectionClose;
+        NSUInteger length = (_fragmentSize == 0 || isControlFrame) ? remaining : MIN(remaining, _fragmentSize);
+        BOOL fin = (length == remaining);
+        uint8_t opcode = message.offset == 0 ? message.opcode : SROpCodeContinuation;
         
+        NSData *frame = [self _frameWithOpcode:opcode fin:fin payload:(const uint8_t *)message.data.bytes + message.offset length:length];
+        message.offset += length;
+        _queuedByteCount -= length;
+        if (fin) {
+            _currentMessage = nil;
+        }
+        if (!frame) {
+            return;
+        }
+        [_outputBuffer appendData:frame];
+    }
+}
+
+- (NSData *)_frameWithOpcode:(uint8_t)opcode fin:(BOOL)fin payload:(const uint8_t *)unmasked_payload length:(size_t)payloadLength;
+{
+    [self assertOnWorkQueue];
+    
     NSMutableData *frame = [[NSMutableData alloc] initWithLength:payloadLength + SRFrameHeaderOverhead];
     if (!frame) {
         [self closeWithCode:SRStatusCodeMessageTooBig reason:@"Message too big"];
-        return;
+        return nil;
     }
     uint8_t *frame_buffer = (uint8_t *)[frame mutableBytes];
     
     // set fin
-    frame_buffer[0] = SRFinMask | opcode;
+    frame_buffer[0] = (fin ? SRFinMask : 0) | opcode;
     
     BOOL useMask = YES; // default to Client
     // a client MUST mask all frames that it sends to the server
@@ -1678,15 +2072,6 @@ static const size_t SRFrameHeaderOverhead = 32;
     
     size_t frame_buffer_size = 2;
     
-    const uint8_t *unmasked_payload = NULL;
-    if ([data isKindOfClass:[NSData class]]) {
-        unmasked_payload = (uint8_t *)[data bytes];
-    } else if ([data isKindOfClass:[NSString class]]) {
-        unmasked_payload =  (const uint8_t *)[data UTF8String];
-    } else {
-        assert(NO);
-    }
-    
     if (payloadLength < 126) {
         frame_buffer[1] |= payloadLength;
     } else if (payloadLength <= UINT16_MAX) {
@@ -1700,26 +2085,94 @@ static const size_t SRFrameHeaderOverhead = 32;
     }
         
     if (!useMask) {
-        for (size_t i = 0; i < payloadLength; i++) {
-            frame_buffer[frame_buffer_size] = unmasked_payload[i];
-            frame_buffer_size += 1;
+        if (payloadLength) {
+            memcpy(frame_buffer + frame_buffer_size, unmasked_payload, payloadLength);
         }
+        frame_buffer_size += payloadLength;
     } else {
         uint8_t *mask_key = frame_buffer + frame_buffer_size;
         SecRandomCopyBytes(kSecRandomDefault, sizeof(uint32_t), (uint8_t *)mask_key);
         frame_buffer_size += sizeof(uint32_t);
         
         // TODO: could probably optimize this with SIMD
-        for (size_t i = 0; i < payloadLength; i++) {
-            frame_buffer[frame_buffer_size] = unmasked_payload[i] ^ mask_key[i % sizeof(uint32_t)];
-            frame_buffer_size += 1;
-        }
+        SRMaskBytes(frame_buffer + frame_buffer_size, unmasked_payload, payloadLength, mask_key, 0);
+        frame_buffer_size += payloadLength;
     }
 
     assert(frame_buffer_size <= [frame length]);
     frame.length = frame_buffer_size;
     
-    [self _writeData:frame];
+    if (_traceHandler) {
+        _traceHandler(SRTraceEventFrameEncoded, frame_buffer_size);
+    }
+    
+    return frame;
+}
+
+- (void)pauseReading;
+{
+    dispatch_async(_workQueue, ^{
+        _readingPaused = YES;
+    });
+}
+
+- (void)resumeReading;
+{
+    dispatch_async(_workQueue, ^{
+        if (!_readingPaused) {
+            return;
+        }
+        _readingPaused = NO;
+        // the stream won't signal again for bytes that arrived while paused, so read them now
+        [self _readAvailableBytes];
+    });
+}
+
+- (void)_readAvailableBytes;
+{
+    [self assertOnWorkQueue];
+    
+    if (_readingPaused) {
+        return;
+    }
+    
+    // bound each burst so the scanner still gets to run while a large message streams in
+    NSUInteger burstRemaining = SRMaximumReadSize * 4;
+    while (_inputStream.hasBytesAvailable && burstRemaining > 0) {
+        NSUInteger readSize = MIN(_readSize, burstRemaining);
+        NSUInteger length = _readBuffer.length;
+        [_readBuffer setLength:length + readSize];
+        NSInteger bytes_read = [_inputStream read:(uint8_t *)_readBuffer.mutableBytes + length maxLength:readSize];
+        [_readBuffer setLength:length + MAX(bytes_read, 0)];
+        
+        if (bytes_read > 0) {
+            burstRemaining -= bytes_read;
+            if (_traceHandler) {
+                _traceHandler(SRTraceEventStreamRead, bytes_read);
+            }
+        } else if (bytes_read < 0) {
+            [self _failWithError:_inputStream.streamError];
+        }
+        
+        if (bytes_read > 0 && (NSUInteger)bytes_read == readSize) {
+            if (readSize == _readSize) {
+                _readSize = MIN(_readSize * 2, SRMaximumReadSize);
+            }
+        } else {
+            if (bytes_read >= 0 && (NSUInteger)bytes_read < _readSize / 4) {
+                _readSize = MAX(_readSize / 2, SRMinimumReadSize);
+            }
+            break; // the stream has been drained
+        }
+    };
+    [self _pumpScanner];
+    
+    if (burstRemaining == 0) {
+        // more may be waiting; come back after anything else queued on the work queue
+        dispatch_async(_workQueue, ^{
+            [self _readAvailableBytes];
+        });
+    }
 }
 
 - (void)stream:(NSStream *)aStream handleEvent:(NSStreamEvent)eventCode;
@@ -1758,91 +2211,87 @@ static const size_t SRFrameHeaderOverhead = 32;
         }
     }
 
-    dispatch_async(_workQueue, ^{
-        switch (eventCode) {
-            case NSStreamEventOpenCompleted: {
-                SRFastLog(@"NSStreamEventOpenCompleted %@", aStream);
-                if (self.readyState >= SR_CLOSING) {
-                    return;
-                }
-                assert(_readBuffer);
-                
-                if (self.readyState == SR_CONNECTING && aStream == _inputStream) {
-                    [self didConnect];
-                }
-                [self _pumpWriting];
-                [self _pumpScanner];
-                break;
+    if (_schedulesStreamsOnWorkQueue) {
+        // the streams already call us on the work queue
+        [self _handleStreamEvent:eventCode stream:aStream];
+    } else {
+        dispatch_async(_workQueue, ^{
+            [self _handleStreamEvent:eventCode stream:aStream];
+        });
+    }
+}
+
+- (void)_handleStreamEvent:(NSStreamEvent)eventCode stream:(NSStream *)aStream;
+{
+    [self assertOnWorkQueue];
+    
+    switch (eventCode) {
+        case NSStreamEventOpenCompleted: {
+            SRFastLog(@"NSStreamEventOpenCompleted %@", aStream);
+            if (self.readyState >= SR_CLOSING) {
+                return;
             }
-                
-            case NSStreamEventErrorOccurred: {
-                SRFastLog(@"NSStreamEventErrorOccurred %@ %@", aStream, [[aStream streamError] copy]);
-                /// TODO specify error better!
-                [self _failWithError:aStream.streamError];
-                _readBufferOffset = 0;
-                [_readBuffer setLength:0];
-                break;
-                
+            assert(_readBuffer);
+            
+            if (self.readyState == SR_CONNECTING && aStream == _inputStream) {
+                [self didConnect];
             }
-                
-            case NSStreamEventEndEncountered: {
-                [self _pumpScanner];
-                SRFastLog(@"NSStreamEventEndEncountered %@", aStream);
-                if (aStream.streamError) {
-                    [self _failWithError:aStream.streamError];
-                } else {
-                    if (self.readyState != SR_CLOSED) {
-                        self.readyState = SR_CLOSED;
-                        _selfRetain = nil;
-                    }
+            [self _pumpWriting];
+            [self _pumpScanner];
+            break;
+        }
+            
+        case NSStreamEventErrorOccurred: {
+            SRFastLog(@"NSStreamEventErrorOccurred %@ %@", aStream, [[aStream streamError] copy]);
+            /// TODO specify error better!
+            [self _failWithError:aStream.streamError];
+            _readBufferOffset = 0;
+            [_readBuffer setLength:0];
+            break;
+            
+        }
+            
+        case NSStreamEventEndEncountered: {
+            [self _pumpScanner];
+            SRFastLog(@"NSStreamEventEndEncountered %@", aStream);
+            if (aStream.streamError) {
+                [self _failWithError:aStream.streamError];
+            } else {
+                if (self.readyState != SR_CLOSED) {
+                    self.readyState = SR_CLOSED;
+                    _selfRetain = nil;
+                }
 
-                    if (!_sentClose && !_failed) {
-                        _sentClose = YES;
-                        // If we get closed in this state it's probably not clean because we should be sending this when we send messages
-                        [self _performDelegateBlock:^{
-                            if ([self.delegate respondsToSelector:@selector(webSocket:didCloseWithCode:reason:wasClean:)]) {
-                                [self.delegate webSocket:self didCloseWithCode:0 reason:@"Stream end encountered" wasClean:NO];
-                            }
-                        }];
-                    }
+                if (!_sentClose && !_failed) {
+                    _sentClose = YES;
+                    // If we get closed in this state it's probably not clean because we should be sending this when we send messages
+                    [self _performDelegateBlock:^{
+                        if ([self.delegate respondsToSelector:@selector(webSocket:didCloseWithCode:reason:wasClean:)]) {
+                            [self.delegate webSocket:self didCloseWithCode:0 reason:@"Stream end encountered" wasClean:NO];
+                        }
+                    }];
                 }
-                
-                break;
             }
-                
-            case NSStreamEventHasBytesAvailable: {
-                SRFastLog(@"NSStreamEventHasBytesAvailable %@", aStream);
-                const int bufferSize = 2048;
-                uint8_t buffer[bufferSize];
-                
-                while (_inputStream.hasBytesAvailable) {
-                    int bytes_read = [_inputStream read:buffer maxLength:bufferSize];
-                    
-                    if (bytes_read > 0) {
-                        [_readBuffer appendBytes:buffer length:bytes_read];
-                    } else if (bytes_read < 0) {
-                        [self _failWithError:_inputStream.streamError];
-                    }
-                    
-                    if (bytes_read != bufferSize) {
-                        break;
-                    }
-                };
-                [self _pumpScanner];
-                break;
-            }
-                
-            case NSStreamEventHasSpaceAvailable: {
-                SRFastLog(@"NSStreamEventHasSpaceAvailable %@", aStream);
-                [self _pumpWriting];
-                break;
-            }
-                
-            default:
-                SRFastLog(@"(default)  %@", aStream);
-                break;
+            
+            break;
         }
-    });
+            
+        case NSStreamEventHasBytesAvailable: {
+            SRFastLog(@"NSStreamEventHasBytesAvailable %@", aStream);
+            [self _readAvailableBytes];
+            break;
+        }
+            
+        case NSStreamEventHasSpaceAvailable: {
+            SRFastLog(@"NSStreamEventHasSpaceAvailable %@", aStream);
+            [self _pumpWriting];
+            break;
+        }
+            
+        default:
+            SRFastLog(@"(default)  %@", aStream);
+            break;
+    }
 }
 
 @end
@@ -1870,6 +2319,25 @@ static const size_t SRFrameHeaderOverhead = 32;
 @end
 
 
+@implementation SROutboundMessage
+
+@synthesize opcode = _opcode;
+@synthesize data = _data;
+@synthesize offset = _offset;
+
+- (id)initWithOpcode:(uint8_t)opcode data:(NSData *)data;
+{
+    self = [super init];
+    if (self) {
+        _opcode = opcode;
+        _data = data ?: [NSData data];
+    }
+    return self;
+}
+
+@end
+
+
 @implementation SRIOConsumerPool {
     NSUInteger _poolSize;
     NSMutableArray *_bufferedConsumers;
@@ -0,0 +1,75 @@
+//
+//  RBKClock.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ A timer owned by a `RBKClock`. It fires at most once per arming; re-arm it from its handler to keep it going.
+ */
+@protocol RBKClockTimer <NSObject>
+
+/**
+ Arms the timer for `deadline`, a time on its clock in nanoseconds, replacing any earlier deadline. `RBKClockDistantFuture` disarms it.
+ */
+- (void)fireAtTime:(uint64_t)deadline leeway:(uint64_t)leeway;
+
+/**
+ Disarms the timer for good and releases its handler.
+ */
+- (void)cancel;
+
+@end
+
+extern const uint64_t RBKClockDistantFuture;
+
+/**
+ Where heartbeat and other timing decisions get the time from, so they can run against a `RBKVirtualClock` in tests.
+ */
+@protocol RBKClock <NSObject>
+
+/**
+ Monotonic time in nanoseconds.
+ */
+- (uint64_t)now;
+
+/**
+ @param handler Called on `queue`, which must be serial, each time the timer fires.
+ */
+- (id<RBKClockTimer>)timerWithQueue:(dispatch_queue_t)queue handler:(dispatch_block_t)handler;
+
+@end
+
+/**
+ Real time: `RBKMonotonicNanoseconds()` and dispatch timer sources.
+ */
+@interface RBKSystemClock : NSObject <RBKClock>
+
++ (instancetype)sharedClock;
+
+@end
+
+/**
+ Time that only moves when told to. Advancing fires every timer that falls due along the way, in deadline order and with the clock reading each timer's deadline while its handler runs, so hours of timer activity take as long as the handlers do.
+
+ Handlers are run synchronously on their queues, so advance the clock from a queue none of its timers use (the main thread, in tests).
+ */
+@interface RBKVirtualClock : NSObject <RBKClock>
+
+/**
+ The clock starts at 0 unless given another time.
+ */
+- (instancetype)initWithTime:(uint64_t)time;
+
+/**
+ The earliest deadline of any armed timer, or `RBKClockDistantFuture` if none is armed.
+ */
+- (uint64_t)nextDeadline;
+
+- (void)advanceToTime:(uint64_t)time;
+- (void)advanceByInterval:(NSTimeInterval)interval;
+
+@end
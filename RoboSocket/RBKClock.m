@@ -0,0 +1,220 @@
+//
+//  RBKClock.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKClock.h"
+#import "RBKSocketMetrics.h"
+
+const uint64_t RBKClockDistantFuture = UINT64_MAX;
+
+#pragma mark - RBKSystemClock
+
+@interface RBKSystemClockTimer : NSObject <RBKClockTimer>
+
+@property (strong, nonatomic) dispatch_source_t source;
+
+@end
+
+@implementation RBKSystemClockTimer
+
+- (instancetype)initWithQueue:(dispatch_queue_t)queue handler:(dispatch_block_t)handler {
+    self = [super init];
+    if (self) {
+        _source = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, queue);
+        dispatch_source_set_timer(_source, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        dispatch_source_set_event_handler(_source, handler);
+        dispatch_resume(_source);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    dispatch_source_cancel(_source);
+}
+
+- (void)fireAtTime:(uint64_t)deadline leeway:(uint64_t)leeway {
+    if (deadline == RBKClockDistantFuture) {
+        dispatch_source_set_timer(self.source, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        return;
+    }
+    uint64_t now = RBKMonotonicNanoseconds();
+    int64_t delay = deadline > now ? (int64_t)(deadline - now) : 0;
+    dispatch_source_set_timer(self.source, dispatch_time(DISPATCH_TIME_NOW, delay), DISPATCH_TIME_FOREVER, leeway);
+}
+
+- (void)cancel {
+    dispatch_source_cancel(self.source);
+}
+
+@end
+
+@implementation RBKSystemClock
+
++ (instancetype)sharedClock {
+    static RBKSystemClock *sharedClock = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedClock = [[self alloc] init];
+    });
+    return sharedClock;
+}
+
+- (uint64_t)now {
+    return RBKMonotonicNanoseconds();
+}
+
+- (id<RBKClockTimer>)timerWithQueue:(dispatch_queue_t)queue handler:(dispatch_block_t)handler {
+    NSParameterAssert(queue);
+    NSParameterAssert(handler);
+
+    return [[RBKSystemClockTimer alloc] initWithQueue:queue handler:handler];
+}
+
+@end
+
+#pragma mark - RBKVirtualClock
+
+@interface RBKVirtualClockTimer : NSObject <RBKClockTimer>
+
+@property (weak, nonatomic) RBKVirtualClock *clock;
+@property (strong, nonatomic) dispatch_queue_t queue;
+@property (copy, nonatomic) dispatch_block_t handler;
+@property (assign, nonatomic) uint64_t deadline; // RBKClockDistantFuture while disarmed; only touched with the clock's lock held
+
+@end
+
+@interface RBKVirtualClock ()
+
+@property (strong, nonatomic) NSLock *lock;
+@property (strong, nonatomic) NSMutableArray *timers;
+@property (assign, nonatomic) uint64_t currentTime;
+
+- (void)armTimer:(RBKVirtualClockTimer *)timer deadline:(uint64_t)deadline;
+- (void)removeTimer:(RBKVirtualClockTimer *)timer;
+
+@end
+
+@implementation RBKVirtualClockTimer
+
+- (void)fireAtTime:(uint64_t)deadline leeway:(uint64_t)leeway {
+    [self.clock armTimer:self deadline:deadline];
+}
+
+- (void)cancel {
+    [self.clock removeTimer:self];
+}
+
+@end
+
+@implementation RBKVirtualClock
+
+- (instancetype)init {
+    return [self initWithTime:0];
+}
+
+- (instancetype)initWithTime:(uint64_t)time {
+    self = [super init];
+    if (self) {
+        _lock = [[NSLock alloc] init];
+        _timers = [NSMutableArray array];
+        _currentTime = time;
+    }
+    return self;
+}
+
+- (uint64_t)now {
+    [self.lock lock];
+    uint64_t now = self.currentTime;
+    [self.lock unlock];
+    return now;
+}
+
+- (id<RBKClockTimer>)timerWithQueue:(dispatch_queue_t)queue handler:(dispatch_block_t)handler {
+    NSParameterAssert(queue);
+    NSParameterAssert(handler);
+
+    RBKVirtualClockTimer *timer = [[RBKVirtualClockTimer alloc] init];
+    timer.clock = self;
+    timer.queue = queue;
+    timer.handler = handler;
+    timer.deadline = RBKClockDistantFuture;
+
+    [self.lock lock];
+    [self.timers addObject:timer];
+    [self.lock unlock];
+    return timer;
+}
+
+- (uint64_t)nextDeadline {
+    [self.lock lock];
+    RBKVirtualClockTimer *timer = [self dueTimerBefore:RBKClockDistantFuture];
+    uint64_t deadline = timer ? timer.deadline : RBKClockDistantFuture;
+    [self.lock unlock];
+    return deadline;
+}
+
+- (void)advanceByInterval:(NSTimeInterval)interval {
+    [self advanceToTime:[self now] + (uint64_t)(MAX(interval, 0) * NSEC_PER_SEC)];
+}
+
+- (void)advanceToTime:(uint64_t)time {
+    while (YES) {
+        [self.lock lock];
+        RBKVirtualClockTimer *timer = [self dueTimerBefore:time];
+        if (!timer) {
+            self.currentTime = MAX(self.currentTime, time);
+            [self.lock unlock];
+            break;
+        }
+        self.currentTime = MAX(self.currentTime, timer.deadline);
+        timer.deadline = RBKClockDistantFuture;
+        dispatch_block_t handler = timer.handler;
+        dispatch_queue_t queue = timer.queue;
+        [self.lock unlock];
+
+        if (!handler) {
+            continue;
+        }
+        // wait for each handler, since it may re-arm its timer for a deadline still inside this advance
+        if (queue == dispatch_get_main_queue() && [NSThread isMainThread]) {
+            handler();
+        } else {
+            dispatch_sync(queue, handler);
+        }
+    }
+}
+
+#pragma mark - Private
+
+// call with the lock held; the earliest armed timer due at or before `time`, first armed first on a tie
+- (RBKVirtualClockTimer *)dueTimerBefore:(uint64_t)time {
+    RBKVirtualClockTimer *dueTimer = nil;
+    for (RBKVirtualClockTimer *timer in self.timers) {
+        if (timer.deadline == RBKClockDistantFuture || timer.deadline > time) {
+            continue;
+        }
+        if (!dueTimer || timer.deadline < dueTimer.deadline) {
+            dueTimer = timer;
+        }
+    }
+    return dueTimer;
+}
+
+- (void)armTimer:(RBKVirtualClockTimer *)timer deadline:(uint64_t)deadline {
+    [self.lock lock];
+    timer.deadline = deadline;
+    [self.lock unlock];
+}
+
+- (void)removeTimer:(RBKVirtualClockTimer *)timer {
+    [self.lock lock];
+    timer.deadline = RBKClockDistantFuture;
+    timer.handler = nil;
+    [self.timers removeObjectIdenticalTo:timer];
+    [self.lock unlock];
+}
+
+@end
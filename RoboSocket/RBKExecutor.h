@@ -0,0 +1,55 @@
+//
+//  RBKExecutor.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ Runs blocks one at a time, in the order they were submitted, off the thread that submits them.
+ */
+@protocol RBKOrderedExecutor <NSObject>
+
+- (void)executeBlock:(dispatch_block_t)block;
+
+@end
+
+/**
+ Runs blocks on a serial dispatch queue of your own.
+ */
+@interface RBKSerialQueueExecutor : NSObject <RBKOrderedExecutor>
+
+@property (readonly, nonatomic, strong) dispatch_queue_t queue;
+
+/**
+ @param queue Must be serial, or blocks may run out of order.
+ */
++ (instancetype)executorWithQueue:(dispatch_queue_t)queue;
+- (instancetype)initWithQueue:(dispatch_queue_t)queue;
+
+@end
+
+/**
+ A bounded set of workers shared by many mailboxes. Each mailbox is an ordered executor: its blocks run one at a time and in order, while different mailboxes run in parallel on up to `maximumConcurrency` workers. A worker runs at most `throughput` blocks from a mailbox before moving on, so a busy mailbox can't starve the others.
+ */
+@interface RBKWorkerPool : NSObject
+
+@property (readonly, nonatomic, assign) NSUInteger maximumConcurrency;
+
+/**
+ 8 by default.
+ */
+@property (assign, nonatomic) NSUInteger throughput;
+
+/**
+ A pool with one worker per active processor.
+ */
++ (instancetype)sharedPool;
+
+- (instancetype)initWithMaximumConcurrency:(NSUInteger)maximumConcurrency;
+
+- (id<RBKOrderedExecutor>)mailbox;
+
+@end
@@ -0,0 +1,149 @@
+//
+//  RBKExecutor.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKExecutor.h"
+
+@implementation RBKSerialQueueExecutor
+
++ (instancetype)executorWithQueue:(dispatch_queue_t)queue {
+    return [[self alloc] initWithQueue:queue];
+}
+
+- (instancetype)initWithQueue:(dispatch_queue_t)queue {
+    NSParameterAssert(queue);
+
+    self = [super init];
+    if (self) {
+        _queue = queue;
+    }
+    return self;
+}
+
+- (void)executeBlock:(dispatch_block_t)block {
+    dispatch_async(self.queue, block);
+}
+
+@end
+
+@class RBKWorkerPoolMailbox;
+
+@interface RBKWorkerPool ()
+
+@property (readwrite, nonatomic, assign) NSUInteger maximumConcurrency;
+@property (strong, nonatomic) NSLock *lock;
+@property (strong, nonatomic) NSMutableArray *readyMailboxes; // mailboxes with blocks and no worker, in the order they became ready
+@property (assign, nonatomic) NSUInteger workerCount;
+
+- (void)mailbox:(RBKWorkerPoolMailbox *)mailbox didEnqueueBlock:(dispatch_block_t)block;
+
+@end
+
+@interface RBKWorkerPoolMailbox : NSObject <RBKOrderedExecutor>
+
+@property (strong, nonatomic) RBKWorkerPool *pool;
+@property (strong, nonatomic) NSMutableArray *blocks; // guarded by the pool's lock
+@property (assign, nonatomic, getter = isScheduled) BOOL scheduled; // ready or being run by a worker
+
+@end
+
+@implementation RBKWorkerPoolMailbox
+
+- (void)executeBlock:(dispatch_block_t)block {
+    NSParameterAssert(block);
+    [self.pool mailbox:self didEnqueueBlock:block];
+}
+
+@end
+
+@implementation RBKWorkerPool
+
++ (instancetype)sharedPool {
+    static RBKWorkerPool *sharedPool = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedPool = [[RBKWorkerPool alloc] initWithMaximumConcurrency:[[NSProcessInfo processInfo] activeProcessorCount]];
+    });
+    return sharedPool;
+}
+
+- (instancetype)init {
+    return [self initWithMaximumConcurrency:[[NSProcessInfo processInfo] activeProcessorCount]];
+}
+
+- (instancetype)initWithMaximumConcurrency:(NSUInteger)maximumConcurrency {
+    self = [super init];
+    if (self) {
+        _maximumConcurrency = MAX(maximumConcurrency, 1u);
+        _throughput = 8;
+        _lock = [[NSLock alloc] init];
+        _readyMailboxes = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (id<RBKOrderedExecutor>)mailbox {
+    RBKWorkerPoolMailbox *mailbox = [[RBKWorkerPoolMailbox alloc] init];
+    mailbox.pool = self;
+    mailbox.blocks = [NSMutableArray array];
+    return mailbox;
+}
+
+#pragma mark - Private
+
+- (void)mailbox:(RBKWorkerPoolMailbox *)mailbox didEnqueueBlock:(dispatch_block_t)block {
+    [self.lock lock];
+    [mailbox.blocks addObject:[block copy]];
+    if (!mailbox.isScheduled) {
+        mailbox.scheduled = YES;
+        [self.readyMailboxes addObject:mailbox];
+    }
+    BOOL startWorker = self.workerCount < self.maximumConcurrency && [self.readyMailboxes count] > 0;
+    if (startWorker) {
+        self.workerCount += 1;
+    }
+    [self.lock unlock];
+
+    if (startWorker) {
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            [self runWorker];
+        });
+    }
+}
+
+- (void)runWorker {
+    while (YES) {
+        [self.lock lock];
+        if ([self.readyMailboxes count] == 0) {
+            self.workerCount -= 1;
+            [self.lock unlock];
+            return;
+        }
+        // a mailbox is only ever ready once, so no other worker runs it meanwhile and its blocks stay in order
+        RBKWorkerPoolMailbox *mailbox = self.readyMailboxes[0];
+        [self.readyMailboxes removeObjectAtIndex:0];
+        NSRange batchRange = NSMakeRange(0, MIN([mailbox.blocks count], MAX(self.throughput, 1u)));
+        NSArray *batch = [mailbox.blocks subarrayWithRange:batchRange];
+        [mailbox.blocks removeObjectsInRange:batchRange];
+        [self.lock unlock];
+
+        for (dispatch_block_t block in batch) {
+            @autoreleasepool {
+                block();
+            }
+        }
+
+        [self.lock lock];
+        if ([mailbox.blocks count] > 0) {
+            [self.readyMailboxes addObject:mailbox]; // to the back, so the other mailboxes get a turn
+        } else {
+            mailbox.scheduled = NO;
+        }
+        [self.lock unlock];
+    }
+}
+
+@end
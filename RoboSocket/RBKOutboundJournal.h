@@ -0,0 +1,81 @@
+//
+//  RBKOutboundJournal.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ A frame recorded in the journal and not yet retired.
+ */
+@interface RBKOutboundJournalEntry : NSObject
+
+@property (readonly, nonatomic, copy) NSString *key;
+@property (readonly, nonatomic, strong) NSData *data;
+
+@end
+
+/**
+ Called once an append is on disk with nil, or with the reason it isn't.
+ */
+typedef void (^RBKOutboundJournalCompletionBlock)(NSError *error);
+
+/**
+ A durable, append-only record of outbound frames that have not been confirmed yet, so they survive the process and can be sent again. Assign one to `-[RBKStompPublisher journal]`.
+
+ Records go into memory-mapped segment files in `directoryURL`. Appends are made durable in groups: everything appended while the previous fsync was running shares the next one. A segment that fills up is sealed and a new one started; if what is still unretired is small, it is copied into the new segment and every older segment deleted. Segments whose entries have all been retired are deleted as well.
+
+ All work happens on the journal's own serial queue, so it can be used from any thread. A journal directory must only be open in one journal at a time.
+ */
+@interface RBKOutboundJournal : NSObject
+
+@property (readonly, nonatomic, strong) NSURL *directoryURL;
+
+/**
+ The size, in bytes, at which a segment is sealed and a new one started. 4MB by default.
+ */
+@property (assign, nonatomic) NSUInteger segmentSize;
+
+@property (readonly, nonatomic, assign) NSUInteger numberOfEntries;
+@property (readonly, nonatomic, assign) NSUInteger numberOfSegments;
+
+/**
+ How many times the journal has been flushed to disk. Far fewer than appends when they arrive in bursts.
+ */
+@property (readonly, nonatomic, assign) NSUInteger numberOfCommits;
+
+/**
+ Opens the journal in `directoryURL`, creating the directory if need be, and recovers the entries left unretired by the previous session.
+ */
+- (instancetype)initWithDirectoryURL:(NSURL *)directoryURL error:(NSError *__autoreleasing *)error;
+
+/**
+ Records `data` under `key`, replacing any entry already there.
+
+ @param completion Called on a private serial queue, in the order of the appends, once the entry is on disk, or with an error if writing or syncing it failed or the journal is closed. Send the frame from here, and only without an error, to be sure it is never sent without being recorded.
+ */
+- (void)appendEntryWithKey:(NSString *)key data:(NSData *)data completion:(RBKOutboundJournalCompletionBlock)completion;
+
+/**
+ Forgets the entry under `key`, e.g. because its receipt arrived. Retirement is made durable with the next group of appends; should it be lost, the frame is only sent again.
+ */
+- (void)retireEntryWithKey:(NSString *)key;
+
+/**
+ The unretired entries in the order they were appended.
+ */
+- (NSArray *)unretiredEntries;
+
+/**
+ Waits until everything recorded so far is on disk.
+ */
+- (void)sync;
+
+/**
+ Syncs and closes the segment files. Later retirements are ignored, and later appends complete with an error.
+ */
+- (void)close;
+
+@end
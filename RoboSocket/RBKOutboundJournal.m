@@ -0,0 +1,524 @@
+//
+//  RBKOutboundJournal.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKOutboundJournal.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char RBKOutboundJournalMagic[8] = {'R', 'B', 'K', 'J', 'R', 'N', 'L', '\0'};
+static const uint32_t RBKOutboundJournalVersion = 1;
+static const NSUInteger RBKOutboundJournalDefaultSegmentSize = 4 * 1024 * 1024;
+static NSString * const RBKOutboundJournalSegmentExtension = @"journal";
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerLength;  // where the first record starts
+} RBKOutboundJournalFileHeader;
+
+typedef NS_ENUM(uint32_t, RBKOutboundJournalRecordType) {
+    RBKOutboundJournalRecordTypeAppend = 1,
+    RBKOutboundJournalRecordTypeRetire = 2, // 0 is the zeroed, unwritten rest of a segment
+};
+
+typedef struct {
+    uint32_t type;
+    uint32_t checksum;      // of the other fields, the key and the data
+    uint32_t keyLength;
+    uint32_t dataLength;
+} RBKOutboundJournalRecordHeader;
+
+static inline size_t RBKOutboundJournalRecordLength(size_t keyLength, size_t dataLength) {
+    // keep every record header 8 byte aligned
+    return (sizeof(RBKOutboundJournalRecordHeader) + keyLength + dataLength + 7) & ~(size_t)7;
+}
+
+static inline uint32_t RBKOutboundJournalHash(uint32_t hash, const void *bytes, size_t length) {
+    // FNV-1a
+    const uint8_t *octets = bytes;
+    for (size_t idx = 0; idx < length; idx++) {
+        hash ^= octets[idx];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t RBKOutboundJournalChecksum(RBKOutboundJournalRecordHeader header, const void *key, const void *data) {
+    uint32_t hash = 2166136261u;
+    hash = RBKOutboundJournalHash(hash, &header.type, sizeof(header.type));
+    hash = RBKOutboundJournalHash(hash, &header.keyLength, sizeof(header.keyLength));
+    hash = RBKOutboundJournalHash(hash, &header.dataLength, sizeof(header.dataLength));
+    hash = RBKOutboundJournalHash(hash, key, header.keyLength);
+    return RBKOutboundJournalHash(hash, data, header.dataLength);
+}
+
+static NSError *RBKOutboundJournalErrorWithCode(NSInteger code, NSURL *url) {
+    return [NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:@{NSURLErrorKey: url}];
+}
+
+#pragma mark -
+
+/**
+ One file of the journal. Only the newest segment is mapped and written; the others are sealed, trimmed and closed.
+ */
+@interface RBKOutboundJournalSegment : NSObject
+
+@property (strong, nonatomic) NSURL *URL;
+@property (assign, nonatomic) uint64_t sequence;
+@property (assign, nonatomic) int fd;           // -1 once sealed
+@property (assign, nonatomic) uint8_t *bytes;
+@property (assign, nonatomic) size_t capacity;
+@property (assign, nonatomic) size_t length;    // the header and every record written so far
+@property (assign, nonatomic) NSUInteger liveCount; // unretired entries appended here
+@property (assign, nonatomic, getter = isDirty) BOOL dirty;
+
+@end
+
+@implementation RBKOutboundJournalSegment
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _fd = -1;
+    }
+    return self;
+}
+
+@end
+
+@interface RBKOutboundJournalEntry ()
+
+@property (readwrite, nonatomic, copy) NSString *key;
+@property (readwrite, nonatomic, strong) NSData *data;
+@property (assign, nonatomic) uint64_t sequence;
+@property (strong, nonatomic) RBKOutboundJournalSegment *segment;
+
+@end
+
+@implementation RBKOutboundJournalEntry
+
+@end
+
+#pragma mark -
+
+@interface RBKOutboundJournal ()
+
+@property (readwrite, nonatomic, strong) NSURL *directoryURL;
+@property (readwrite, nonatomic, assign) NSUInteger numberOfCommits;
+@property (strong, nonatomic) dispatch_queue_t queue;
+@property (strong, nonatomic) dispatch_queue_t completionQueue;
+@property (strong, nonatomic) NSMutableArray *segments;           // oldest first; the last one is written
+@property (strong, nonatomic) NSMutableDictionary *entries;       // key -> entry
+@property (strong, nonatomic) NSMutableArray *pendingCompletions; // waiting for the next commit
+@property (assign, nonatomic, getter = isCommitScheduled) BOOL commitScheduled;
+@property (assign, nonatomic, getter = isClosed) BOOL closed;
+@property (assign, nonatomic) uint64_t nextSequence;
+
+@end
+
+@implementation RBKOutboundJournal
+
+- (instancetype)init {
+    @throw [NSException exceptionWithName:NSInternalInconsistencyException reason:[NSString stringWithFormat:@"%@ Failed to call designated initializer. Invoke `initWithDirectoryURL:error:` instead.", NSStringFromClass([self class])] userInfo:nil];
+}
+
+- (instancetype)initWithDirectoryURL:(NSURL *)directoryURL error:(NSError *__autoreleasing *)error {
+    NSParameterAssert(directoryURL);
+
+    self = [super init];
+    if (self) {
+        _directoryURL = directoryURL;
+        _segmentSize = RBKOutboundJournalDefaultSegmentSize;
+        _queue = dispatch_queue_create("com.robotsandpencils.networking.journal", DISPATCH_QUEUE_SERIAL);
+        _completionQueue = dispatch_queue_create("com.robotsandpencils.networking.journal.completion", DISPATCH_QUEUE_SERIAL);
+        _segments = [NSMutableArray array];
+        _entries = [NSMutableDictionary dictionary];
+        _pendingCompletions = [NSMutableArray array];
+
+        NSFileManager *fileManager = [NSFileManager defaultManager];
+        if (![fileManager createDirectoryAtURL:directoryURL withIntermediateDirectories:YES attributes:nil error:error]) {
+            return nil;
+        }
+        NSArray *contents = [fileManager contentsOfDirectoryAtURL:directoryURL includingPropertiesForKeys:nil options:NSDirectoryEnumerationSkipsHiddenFiles error:error];
+        if (!contents) {
+            return nil;
+        }
+        NSArray *segmentURLs = [[contents filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"pathExtension == %@", RBKOutboundJournalSegmentExtension]] sortedArrayUsingComparator:^NSComparisonResult(NSURL *url1, NSURL *url2) {
+            return [[url1 lastPathComponent] compare:[url2 lastPathComponent]];
+        }];
+        for (NSURL *segmentURL in segmentURLs) {
+            [self recoverSegmentAtURL:segmentURL];
+        }
+
+        // never append to a segment that may end in a torn record
+        RBKOutboundJournalSegment *segment = [self createSegmentWithCapacity:_segmentSize];
+        if (!segment) {
+            if (error) {
+                *error = RBKOutboundJournalErrorWithCode(errno, directoryURL);
+            }
+            return nil;
+        }
+        [_segments addObject:segment];
+        [self removeDeadSegments];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    // pending blocks retain the journal, so nothing else can be using it by now
+    if (!_closed) {
+        [self sealSegment:[_segments lastObject]];
+    }
+}
+
+- (NSUInteger)numberOfEntries {
+    __block NSUInteger count = 0;
+    dispatch_sync(self.queue, ^{
+        count = [self.entries count];
+    });
+    return count;
+}
+
+- (NSUInteger)numberOfSegments {
+    __block NSUInteger count = 0;
+    dispatch_sync(self.queue, ^{
+        count = [self.segments count];
+    });
+    return count;
+}
+
+#pragma mark - Public
+
+- (void)appendEntryWithKey:(NSString *)key data:(NSData *)data completion:(RBKOutboundJournalCompletionBlock)completion {
+    NSParameterAssert(key);
+    NSParameterAssert(data);
+
+    dispatch_async(self.queue, ^{
+        NSError *writeError = nil;
+        if (self.isClosed) {
+            writeError = RBKOutboundJournalErrorWithCode(EBADF, self.directoryURL);
+        } else {
+            NSData *keyData = [key dataUsingEncoding:NSUTF8StringEncoding];
+            if ([self writeRecordOfType:RBKOutboundJournalRecordTypeAppend key:keyData data:data]) {
+                [self addEntryWithKey:key data:data segment:[self.segments lastObject]];
+            } else {
+                writeError = RBKOutboundJournalErrorWithCode(errno, self.directoryURL);
+                NSLog(@"Failed to journal the frame for %@: %@", key, writeError);
+            }
+        }
+        if (completion) {
+            // a failed write fails its append even if the commit it shares succeeds
+            [self.pendingCompletions addObject:^(NSError *commitError) {
+                completion(writeError ?: commitError);
+            }];
+        }
+        [self scheduleCommit];
+    });
+}
+
+- (void)retireEntryWithKey:(NSString *)key {
+    NSParameterAssert(key);
+
+    dispatch_async(self.queue, ^{
+        if (self.isClosed || !self.entries[key]) {
+            return;
+        }
+        NSData *keyData = [key dataUsingEncoding:NSUTF8StringEncoding];
+        if (![self writeRecordOfType:RBKOutboundJournalRecordTypeRetire key:keyData data:[NSData data]]) {
+            return; // still unretired, so it is sent again rather than lost
+        }
+        [self removeEntryWithKey:key];
+        [self removeDeadSegments];
+        [self scheduleCommit];
+    });
+}
+
+- (NSArray *)unretiredEntries {
+    __block NSArray *entries = nil;
+    dispatch_sync(self.queue, ^{
+        entries = [self sortedEntries];
+    });
+    return entries;
+}
+
+- (void)sync {
+    dispatch_sync(self.queue, ^{
+        [self commit];
+    });
+}
+
+- (void)close {
+    dispatch_sync(self.queue, ^{
+        if (self.isClosed) {
+            return;
+        }
+        [self commit];
+        [self sealSegment:[self.segments lastObject]];
+        self.closed = YES;
+    });
+}
+
+#pragma mark - Private
+
+- (NSArray *)sortedEntries {
+    return [[self.entries allValues] sortedArrayUsingComparator:^NSComparisonResult(RBKOutboundJournalEntry *entry1, RBKOutboundJournalEntry *entry2) {
+        if (entry1.sequence == entry2.sequence) {
+            return NSOrderedSame;
+        }
+        return entry1.sequence < entry2.sequence ? NSOrderedAscending : NSOrderedDescending;
+    }];
+}
+
+- (void)addEntryWithKey:(NSString *)key data:(NSData *)data segment:(RBKOutboundJournalSegment *)segment {
+    [self removeEntryWithKey:key];
+
+    RBKOutboundJournalEntry *entry = [[RBKOutboundJournalEntry alloc] init];
+    entry.key = key;
+    entry.data = data;
+    entry.sequence = self.nextSequence++;
+    entry.segment = segment;
+    segment.liveCount += 1;
+    self.entries[key] = entry;
+}
+
+- (void)removeEntryWithKey:(NSString *)key {
+    RBKOutboundJournalEntry *entry = self.entries[key];
+    if (entry) {
+        entry.segment.liveCount -= 1;
+        [self.entries removeObjectForKey:key];
+    }
+}
+
+// all appends and retirements made so far share one flush
+- (void)scheduleCommit {
+    if (self.isCommitScheduled) {
+        return;
+    }
+    self.commitScheduled = YES;
+    dispatch_async(self.queue, ^{
+        [self commit];
+    });
+}
+
+- (void)commit {
+    self.commitScheduled = NO;
+
+    NSError *commitError = nil;
+    RBKOutboundJournalSegment *segment = [self.segments lastObject];
+    if (!self.isClosed && segment.isDirty) {
+        if (![self syncSegment:segment]) {
+            commitError = RBKOutboundJournalErrorWithCode(errno, segment.URL);
+            NSLog(@"Failed to sync the journal: %@", commitError);
+        }
+        self.numberOfCommits += 1;
+    }
+
+    NSArray *completions = self.pendingCompletions;
+    if ([completions count] == 0) {
+        return;
+    }
+    self.pendingCompletions = [NSMutableArray array];
+    dispatch_async(self.completionQueue, ^{
+        for (RBKOutboundJournalCompletionBlock completion in completions) {
+            completion(commitError);
+        }
+    });
+}
+
+- (BOOL)writeRecordOfType:(RBKOutboundJournalRecordType)type key:(NSData *)key data:(NSData *)data {
+    size_t recordLength = RBKOutboundJournalRecordLength([key length], [data length]);
+    RBKOutboundJournalSegment *segment = [self.segments lastObject];
+    if (segment.length + recordLength > segment.capacity) {
+        if (![self rotateForRecordLength:recordLength]) {
+            return NO;
+        }
+        segment = [self.segments lastObject];
+    }
+    [self writeRecordOfType:type key:[key bytes] keyLength:[key length] data:[data bytes] dataLength:[data length] toSegment:segment];
+    return YES;
+}
+
+- (void)writeRecordOfType:(RBKOutboundJournalRecordType)type key:(const void *)key keyLength:(size_t)keyLength data:(const void *)data dataLength:(size_t)dataLength toSegment:(RBKOutboundJournalSegment *)segment {
+    RBKOutboundJournalRecordHeader header;
+    header.type = type;
+    header.keyLength = (uint32_t)keyLength;
+    header.dataLength = (uint32_t)dataLength;
+    header.checksum = RBKOutboundJournalChecksum(header, key, data);
+
+    // the header goes last; a record torn by a crash fails its checksum and ends recovery of the segment
+    uint8_t *record = segment.bytes + segment.length;
+    memcpy(record + sizeof(header), key, keyLength);
+    memcpy(record + sizeof(header) + keyLength, data, dataLength);
+    memcpy(record, &header, sizeof(header));
+    segment.length += RBKOutboundJournalRecordLength(keyLength, dataLength);
+    segment.dirty = YES;
+}
+
+// seals the current segment and starts the next, carrying the unretired entries over when that is cheap
+- (BOOL)rotateForRecordLength:(size_t)recordLength {
+    size_t liveLength = 0;
+    for (RBKOutboundJournalEntry *entry in [self.entries allValues]) {
+        liveLength += RBKOutboundJournalRecordLength([entry.key lengthOfBytesUsingEncoding:NSUTF8StringEncoding], [entry.data length]);
+    }
+    BOOL compacts = liveLength <= self.segmentSize / 2;
+
+    RBKOutboundJournalSegment *segment = [self createSegmentWithCapacity:MAX(self.segmentSize, (compacts ? liveLength : 0) + recordLength + sizeof(RBKOutboundJournalFileHeader))];
+    if (!segment) {
+        return NO;
+    }
+    [self sealSegment:[self.segments lastObject]];
+    [self.segments addObject:segment];
+
+    if (compacts) {
+        for (RBKOutboundJournalEntry *entry in [self sortedEntries]) {
+            NSData *key = [entry.key dataUsingEncoding:NSUTF8StringEncoding];
+            [self writeRecordOfType:RBKOutboundJournalRecordTypeAppend key:[key bytes] keyLength:[key length] data:[entry.data bytes] dataLength:[entry.data length] toSegment:segment];
+            entry.segment.liveCount -= 1;
+            entry.segment = segment;
+            segment.liveCount += 1;
+        }
+        // the copies must be on disk before the older segments go
+        if (![self syncSegment:segment]) {
+            return NO;
+        }
+    }
+    [self removeDeadSegments];
+    return YES;
+}
+
+// oldest first, so a retirement is never lost while the append it retires is still on disk
+- (void)removeDeadSegments {
+    while ([self.segments count] > 1) {
+        RBKOutboundJournalSegment *segment = self.segments[0];
+        if (segment.liveCount > 0) {
+            break;
+        }
+        [self sealSegment:segment];
+        unlink([[segment.URL path] fileSystemRepresentation]);
+        [self.segments removeObjectAtIndex:0];
+    }
+}
+
+- (RBKOutboundJournalSegment *)createSegmentWithCapacity:(size_t)capacity {
+    RBKOutboundJournalSegment *lastSegment = [self.segments lastObject];
+    RBKOutboundJournalSegment *segment = [[RBKOutboundJournalSegment alloc] init];
+    segment.sequence = lastSegment ? lastSegment.sequence + 1 : 1;
+    segment.URL = [self.directoryURL URLByAppendingPathComponent:[NSString stringWithFormat:@"%020llu.%@", segment.sequence, RBKOutboundJournalSegmentExtension]];
+
+    const char *path = [[segment.URL path] fileSystemRepresentation];
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return nil;
+    }
+    // the file reads as zeroes past the last record, which ends recovery there
+    void *bytes = MAP_FAILED;
+    if (ftruncate(fd, (off_t)capacity) == 0) {
+        bytes = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (bytes == MAP_FAILED) {
+        int savedErrno = errno;
+        close(fd);
+        unlink(path);
+        errno = savedErrno;
+        return nil;
+    }
+
+    RBKOutboundJournalFileHeader header;
+    memcpy(header.magic, RBKOutboundJournalMagic, sizeof(header.magic));
+    header.version = RBKOutboundJournalVersion;
+    header.headerLength = sizeof(RBKOutboundJournalFileHeader);
+    memcpy(bytes, &header, sizeof(header));
+
+    segment.fd = fd;
+    segment.bytes = bytes;
+    segment.capacity = capacity;
+    segment.length = sizeof(header);
+    segment.dirty = YES;
+    return segment;
+}
+
+// returns NO, with errno set, if the segment may not be on disk; it stays dirty so the next commit tries again
+- (BOOL)syncSegment:(RBKOutboundJournalSegment *)segment {
+    if (msync(segment.bytes, segment.length, MS_SYNC) != 0) {
+        return NO;
+    }
+    // a plain fsync leaves the data in the drive's cache
+    if (fcntl(segment.fd, F_FULLFSYNC) != 0 && fsync(segment.fd) != 0) {
+        return NO;
+    }
+    segment.dirty = NO;
+    return YES;
+}
+
+// syncs, unmaps and trims the file to what has been written
+- (void)sealSegment:(RBKOutboundJournalSegment *)segment {
+    if (segment.fd < 0) {
+        return;
+    }
+    if (segment.isDirty) {
+        [self syncSegment:segment];
+    }
+    munmap(segment.bytes, segment.capacity);
+    ftruncate(segment.fd, (off_t)segment.length);
+    close(segment.fd);
+    segment.bytes = NULL;
+    segment.fd = -1;
+}
+
+- (void)recoverSegmentAtURL:(NSURL *)url {
+    RBKOutboundJournalSegment *segment = [[RBKOutboundJournalSegment alloc] init];
+    segment.URL = url;
+    segment.sequence = (uint64_t)[[[url lastPathComponent] stringByDeletingPathExtension] longLongValue];
+    [self.segments addObject:segment];
+
+    // a segment that can't be read holds nothing live, and is deleted once it is the oldest
+    NSData *data = [NSData dataWithContentsOfURL:url options:NSDataReadingMappedIfSafe error:nil];
+    const uint8_t *bytes = [data bytes];
+    size_t length = [data length];
+    RBKOutboundJournalFileHeader fileHeader;
+    if (length < sizeof(fileHeader)) {
+        return;
+    }
+    memcpy(&fileHeader, bytes, sizeof(fileHeader));
+    if (memcmp(fileHeader.magic, RBKOutboundJournalMagic, sizeof(fileHeader.magic)) != 0 || fileHeader.version != RBKOutboundJournalVersion) {
+        return;
+    }
+    segment.length = length;
+
+    size_t offset = fileHeader.headerLength;
+    while (offset <= length && length - offset >= sizeof(RBKOutboundJournalRecordHeader)) {
+        RBKOutboundJournalRecordHeader header;
+        memcpy(&header, bytes + offset, sizeof(header));
+        if (header.type != RBKOutboundJournalRecordTypeAppend && header.type != RBKOutboundJournalRecordTypeRetire) {
+            break;
+        }
+        if (header.keyLength > length || header.dataLength > length || RBKOutboundJournalRecordLength(header.keyLength, header.dataLength) > length - offset) {
+            break;
+        }
+        const uint8_t *key = bytes + offset + sizeof(header);
+        const uint8_t *payload = key + header.keyLength;
+        if (RBKOutboundJournalChecksum(header, key, payload) != header.checksum) {
+            break;
+        }
+        NSString *keyString = [[NSString alloc] initWithBytes:key length:header.keyLength encoding:NSUTF8StringEncoding];
+        if (!keyString) {
+            break;
+        }
+
+        if (header.type == RBKOutboundJournalRecordTypeAppend) {
+            [self addEntryWithKey:keyString data:[NSData dataWithBytes:payload length:header.dataLength] segment:segment];
+        } else {
+            [self removeEntryWithKey:keyString];
+        }
+        offset += RBKOutboundJournalRecordLength(header.keyLength, header.dataLength);
+    }
+}
+
+@end
@@ -9,9 +9,91 @@
 #import <Foundation/Foundation.h>
 
 #import "RBKWebSocket.h"
+#import "RBKStompPublisher.h"
+#import "RBKStompTransaction.h"
+#import "RBKExecutor.h"
+#import "RBKStompHeaderFilter.h"
+#import "RBKClock.h"
+#import "RBKStompLastValueCache.h"
+#import "RBKStompDuplicateWindow.h"
+
+/**
+ Returns the key a message is conflated under, or nil to deliver the message as usual.
+ */
+typedef NSString *(^RBKStompConflationKeyBlock)(RBKStompFrame *messageFrame);
 
 @interface RBKSTOMPSocket : RBKWebSocket<RBKSocketStompRequestSerializerDelegate, RBKSocketStompResponseSerializerDelegate>
 
+/**
+ Publishes SEND frames with receipts, keeping a window of them in flight.
+ */
+@property (readonly, nonatomic, strong) RBKStompPublisher *publisher;
+
+/**
+ Times heart-beats, sent and expected, and the heartbeat statistics below, and runs a new `timingWheel` for operation and receipt timeouts. `RBKSystemClock` by default; set a `RBKVirtualClock` to run heart-beat and timeout scenarios faster than real time. Set it before connecting.
+
+ When the server negotiated heart-beats and nothing arrives for twice its interval, `failureBlock` gets an `NSURLErrorTimedOut` error and the socket starts closing.
+ */
+@property (nonatomic, strong) id<RBKClock> clock;
+
+/**
+ Keeps the newest message of each destination, or of each conflation key of a conflated subscription, across launches. A new subscription's handler is first handed the cached messages of its destination, oldest first, so it has something to show before the broker answers. It gets them right away, on the thread that subscribes or on the subscription's executor, and always before live messages. Cached messages have no `subscription` or `ack` header and are not passed to `-completeMessage:`.
+ */
+@property (nonatomic, strong) RBKStompLastValueCache *lastValueCache;
+
+/**
+ Runs the handler of the subscription `subscriptionID` on `executor` instead of the thread that reads the socket, so a slow subscription doesn't hold up the others. Messages reach the handler in the order they arrived. Use a `RBKSerialQueueExecutor` for a queue of the subscription's own, or a mailbox of a `RBKWorkerPool` to share a bounded set of workers. Set it before subscribing; nil runs the handler on the reading thread again.
+
+ Acknowledgements don't wait for an executor. To acknowledge only once a message is handled, subscribe with a prefetch count and call `-completeMessage:`.
+ */
+- (void)setExecutor:(id<RBKOrderedExecutor>)executor forSubscriptionID:(NSString *)subscriptionID;
+
+/**
+ Drops messages of the subscription `subscriptionID` whose headers don't match `filter`. The filter runs on the raw frame, so a dropped message is never parsed or handed to the handler. Dropped messages of `client` and `client-individual` subscriptions are acknowledged; with `client`, that acknowledges the messages before them too. Pass nil to stop filtering.
+ */
+- (void)setHeaderFilter:(RBKStompHeaderFilter *)filter forSubscriptionID:(NSString *)subscriptionID;
+
+/**
+ Drops messages of the subscription `subscriptionID` whose `message-id` is still in `window`, such as those the broker sends again after a reconnect or a NACK. Like a header filter, the check runs on the raw frame, and dropped messages of `client` and `client-individual` subscriptions are acknowledged. An id enters the window only once its message reaches the handler, or is superseded by conflation; a message dropped before then, e.g. while it waited for prefetch credit when the connection closed, is delivered when sent again. Pass nil to stop.
+ */
+- (void)setDuplicateWindow:(RBKStompDuplicateWindow *)window forSubscriptionID:(NSString *)subscriptionID;
+
+/**
+ Makes the subscription `subscriptionID` keep only the newest message per key. A message waits in a slot for its key until the handler gets to it, and a newer message with the same key replaces it, so a handler that falls behind sees the latest value of each key rather than every update. Handlers of a conflating subscription always run after the message arrives, on the subscription's executor or else the main queue. Pass a nil `keyBlock` to stop conflating.
+ */
+- (void)conflateSubscriptionID:(NSString *)subscriptionID keyBlock:(RBKStompConflationKeyBlock)keyBlock;
+- (void)conflateSubscriptionID:(NSString *)subscriptionID byHeader:(NSString *)header;
+
+/**
+ How many messages of the subscription were replaced before its handler saw them.
+ */
+- (uint64_t)numberOfConflatedMessagesForSubscriptionID:(NSString *)subscriptionID;
+
+/**
+ Tells a subscription made with a prefetch count that its handler is done with `messageFrame`, making room for the next message and sending the ACK that was held back for `client` and `client-individual` subscriptions. Sending a NACK for the message makes room the same way, without the ACK. While every subscription is full, or any one has as many messages waiting as its prefetch count, the socket stops reading, so a stalled consumer holds the server back rather than filling memory. Incoming heart-beat checks and the keepalive are suspended meanwhile.
+ */
+- (void)completeMessage:(RBKStompFrame *)messageFrame;
+
+/**
+ Whether flow control has stopped reading from the network.
+ */
+@property (readonly, nonatomic, assign, getter = isReadingPaused) BOOL readingPaused;
+
+/**
+ Starts collecting frames for a transaction. Nothing goes out until it is committed.
+ */
+- (RBKStompTransaction *)beginTransaction;
+
+/**
+ Writes BEGIN, the transaction's frames and COMMIT as one WebSocket message, so the batch costs one round trip. Only the COMMIT asks for a receipt; it goes through `publisher` like any other confirmed frame, and `success` is called once the server has applied the whole transaction.
+ */
+- (void)commitTransaction:(RBKStompTransaction *)transaction success:(RBKStompPublishSuccessBlock)success failure:(RBKStompPublishFailureBlock)failure;
+
+/**
+ Discards the transaction's frames. Since none of them have been sent, the server never hears of it.
+ */
+- (void)abortTransaction:(RBKStompTransaction *)transaction;
+
 - (NSUInteger)numberOfReceivedHeartbeats;
 - (NSTimeInterval)timeSinceMostRecentHeartbeat;
 - (NSTimeInterval)timeIntervalBetweenPreviousHeartbeats;
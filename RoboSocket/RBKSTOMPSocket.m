@@ -9,19 +9,160 @@
 #import "RBKSTOMPSocket.h"
 #import "RoboSocket.h"
 #import "RBKSocketOperation.h"
+#import "RBKStompHeartbeatScheduler.h"
 
-@interface RBKSTOMPSocket () <RBKSocketStompRequestSerializerDelegate, RBKSocketStompResponseSerializerDelegate>
+@interface RBKWebSocket () <RBKSocketControlDelegate, RBKSocketFrameDelegate>
+@property (strong, nonatomic) RoboSocket *socket;
+@end
+
+/**
+ Only touched with the socket's credit lock held.
+ */
+@interface RBKStompSubscriptionCredit : NSObject
+
+@property (assign, nonatomic) NSUInteger prefetchCount;
+@property (assign, nonatomic) NSUInteger outstandingCount; // handed to the handler and not yet completed
+@property (strong, nonatomic) NSMutableSet *outstandingAckIdentifiers; // of those, the ones that can be completed or rejected by ack ID
+@property (strong, nonatomic) NSMutableArray *waitingFrames;
+
+- (BOOL)isExhausted;
+/**
+ As many messages are waiting as may be in progress; past that the socket stops reading.
+ */
+- (BOOL)isBacklogged;
+
+- (void)takeCreditForFrame:(RBKStompFrame *)messageFrame;
+/**
+ Returns NO if the message with `ackIdentifier` was already completed or rejected, so its credit isn't returned twice. Messages without an ack ID can't be told apart and always return one.
+ */
+- (BOOL)returnCreditForAckIdentifier:(NSString *)ackIdentifier;
+/**
+ Takes credit for as many waiting frames as there is room for and returns them.
+ */
+- (NSArray *)admitWaitingFrames;
+
+@end
+
+@implementation RBKStompSubscriptionCredit
+
+- (BOOL)isExhausted {
+    return self.outstandingCount >= self.prefetchCount;
+}
+
+- (BOOL)isBacklogged {
+    return [self.waitingFrames count] >= MAX(self.prefetchCount, 1u);
+}
+
+- (void)takeCreditForFrame:(RBKStompFrame *)messageFrame {
+    self.outstandingCount += 1;
+    NSString *ackIdentifier = [messageFrame headerValueForKey:RBKStompHeaderAck];
+    if (ackIdentifier) {
+        [self.outstandingAckIdentifiers addObject:ackIdentifier];
+    }
+}
+
+- (BOOL)returnCreditForAckIdentifier:(NSString *)ackIdentifier {
+    if (ackIdentifier) {
+        if (![self.outstandingAckIdentifiers containsObject:ackIdentifier]) {
+            return NO;
+        }
+        [self.outstandingAckIdentifiers removeObject:ackIdentifier];
+    }
+    if (self.outstandingCount > 0) {
+        self.outstandingCount -= 1;
+    }
+    return YES;
+}
+
+- (NSArray *)admitWaitingFrames {
+    NSMutableArray *admittedFrames = [NSMutableArray array];
+    while ([self.waitingFrames count] > 0 && ![self isExhausted]) {
+        RBKStompFrame *waitingFrame = self.waitingFrames[0];
+        [self.waitingFrames removeObjectAtIndex:0];
+        [self takeCreditForFrame:waitingFrame];
+        [admittedFrames addObject:waitingFrame];
+    }
+    return admittedFrames;
+}
+
+@end
+
+@interface RBKStompConflator : NSObject
+
+@property (copy, nonatomic) RBKStompConflationKeyBlock keyBlock;
+@property (strong, nonatomic) NSLock *lock;
+@property (strong, nonatomic) NSMutableDictionary *pendingFrames; // key -> newest RBKStompFrame not yet handled
+@property (assign, nonatomic) uint64_t conflatedCount;
+
+@end
+
+@implementation RBKStompConflator
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _lock = [[NSLock alloc] init];
+        _pendingFrames = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+/**
+ Makes `frame` the pending frame for `key`. Returns the frame it replaced, or nil if `key` had none and a delivery needs to be scheduled.
+ */
+- (RBKStompFrame *)offerFrame:(RBKStompFrame *)frame forKey:(NSString *)key {
+    [self.lock lock];
+    RBKStompFrame *replacedFrame = self.pendingFrames[key];
+    self.pendingFrames[key] = frame;
+    if (replacedFrame) {
+        self.conflatedCount += 1;
+    }
+    [self.lock unlock];
+    return replacedFrame;
+}
+
+- (RBKStompFrame *)takeFrameForKey:(NSString *)key {
+    [self.lock lock];
+    RBKStompFrame *frame = self.pendingFrames[key];
+    [self.pendingFrames removeObjectForKey:key];
+    [self.lock unlock];
+    return frame;
+}
+
+- (uint64_t)numberOfConflatedFrames {
+    [self.lock lock];
+    uint64_t count = self.conflatedCount;
+    [self.lock unlock];
+    return count;
+}
+
+@end
+
+@interface RBKSTOMPSocket () <RBKSocketStompRequestSerializerDelegate, RBKSocketStompResponseSerializerDelegate, RBKStompHeartbeatSchedulerDelegate>
 
 @property (strong, nonatomic) NSMutableDictionary *subscriptionHandlers;
 @property (strong, nonatomic) NSMutableDictionary *subscriptionAcknowledgementModes;
 
 @property (assign, nonatomic) NSUInteger heartbeatReceivedCounter;
-@property (strong, nonatomic) NSDate *previousReceivedHeartbeatDate;
-@property (strong, nonatomic) NSDate *mostRecentlyReceivedHeartbeatDate;
+@property (assign, nonatomic) uint64_t previousReceivedHeartbeatTime;
+@property (assign, nonatomic) uint64_t mostRecentlyReceivedHeartbeatTime;
 
 @property (assign, nonatomic) NSUInteger heartbeatSentCounter;
-@property (assign, nonatomic) NSTimeInterval heartbeatInterval;
-@property (strong, nonatomic) dispatch_source_t heartbeatTimer;
+@property (strong, nonatomic) RBKStompHeartbeatScheduler *heartbeatScheduler;
+@property (assign, nonatomic) RBKStompHeartbeat requestedHeartbeat;
+@property (assign, nonatomic, getter = hasRequestedHeartbeat) BOOL requestedHeartbeatKnown;
+
+@property (readwrite, nonatomic, strong) RBKStompPublisher *publisher;
+@property (assign, nonatomic) NSUInteger transactionCounter;
+
+@property (strong, nonatomic) NSLock *creditLock;
+@property (strong, nonatomic) NSMutableDictionary *subscriptionCredits; // subscription ID -> RBKStompSubscriptionCredit
+@property (readwrite, assign, nonatomic, getter = isReadingPaused) BOOL readingPaused;
+
+@property (copy, atomic) NSDictionary *subscriptionExecutors; // subscription ID -> id<RBKOrderedExecutor>, replaced whole so it can be read without a lock
+@property (copy, atomic) NSDictionary *subscriptionConflators; // subscription ID -> RBKStompConflator, likewise
+@property (copy, atomic) NSDictionary *subscriptionFilters; // subscription ID -> RBKStompHeaderFilter, likewise
+@property (copy, atomic) NSDictionary *subscriptionDuplicateWindows; // subscription ID -> RBKStompDuplicateWindow, likewise
 
 @end
 
@@ -34,31 +175,386 @@
         _subscriptionHandlers = [NSMutableDictionary dictionary];
         _subscriptionAcknowledgementModes = [NSMutableDictionary dictionary];
         _heartbeatReceivedCounter = 0;
-        _previousReceivedHeartbeatDate = [NSDate distantPast];
-        _mostRecentlyReceivedHeartbeatDate = [NSDate distantPast];
+        _previousReceivedHeartbeatTime = 0;
+        _mostRecentlyReceivedHeartbeatTime = 0;
         _heartbeatSentCounter = 0;
-        _heartbeatInterval = 0;
+        _clock = [RBKSystemClock sharedClock];
+        _heartbeatScheduler = [[RBKStompHeartbeatScheduler alloc] init];
+        _heartbeatScheduler.delegate = self;
+        _requestedHeartbeat = RBKStompHeartbeatZero;
+        _publisher = [[RBKStompPublisher alloc] initWithSocket:self];
+        _creditLock = [[NSLock alloc] init];
+        _subscriptionCredits = [NSMutableDictionary dictionary];
     }
 
     return self;
 }
 
+- (void)setClock:(id<RBKClock>)clock {
+    NSParameterAssert(clock);
+
+    _clock = clock;
+    [self.heartbeatScheduler stop];
+    self.heartbeatScheduler = [[RBKStompHeartbeatScheduler alloc] initWithQueue:dispatch_queue_create("com.robotsandpencils.stomp.heartbeat", DISPATCH_QUEUE_SERIAL) clock:clock];
+    self.heartbeatScheduler.delegate = self;
+    // receipt and operation timeouts keep the same time as the heart-beats
+    self.timingWheel = [[RBKTimingWheel alloc] initWithTickDuration:self.timingWheel.tickDuration slotCount:self.timingWheel.slotCount clock:clock];
+}
+
 - (NSUInteger)numberOfReceivedHeartbeats {
     return self.heartbeatReceivedCounter;
 }
 
 - (NSTimeInterval)timeSinceMostRecentHeartbeat {
-    return [[NSDate date] timeIntervalSinceDate:self.mostRecentlyReceivedHeartbeatDate];
+    return ([self.clock now] - self.mostRecentlyReceivedHeartbeatTime) / (double)NSEC_PER_SEC;
 }
 
 - (NSTimeInterval)timeIntervalBetweenPreviousHeartbeats {
-    return [self.mostRecentlyReceivedHeartbeatDate timeIntervalSinceDate:self.previousReceivedHeartbeatDate];
+    return (self.mostRecentlyReceivedHeartbeatTime - self.previousReceivedHeartbeatTime) / (double)NSEC_PER_SEC;
 }
 
 - (NSUInteger)numberOfSentHeartbeats {
     return self.heartbeatSentCounter;
 }
 
+#pragma mark - Executors
+
+- (void)setExecutor:(id<RBKOrderedExecutor>)executor forSubscriptionID:(NSString *)subscriptionID {
+    NSParameterAssert(subscriptionID);
+
+    @synchronized(self) {
+        NSMutableDictionary *subscriptionExecutors = [NSMutableDictionary dictionaryWithDictionary:self.subscriptionExecutors];
+        if (executor) {
+            subscriptionExecutors[subscriptionID] = executor;
+        } else {
+            [subscriptionExecutors removeObjectForKey:subscriptionID];
+        }
+        self.subscriptionExecutors = subscriptionExecutors;
+    }
+}
+
+- (void)deliverMessage:(RBKStompFrame *)messageFrame subscriptionID:(NSString *)subscriptionID frameHandler:(RBKStompFrameHandler)frameHandler {
+    [self.metrics recordMessageForSubscriptionID:subscriptionID];
+
+    // the id is remembered only once the handler has the message, so one dropped on the way in is taken when it is sent again
+    RBKStompDuplicateWindow *duplicateWindow = self.subscriptionDuplicateWindows[subscriptionID];
+    if (duplicateWindow) {
+        RBKStompFrameHandler messageHandler = frameHandler;
+        __weak typeof(self)weakSelf = self;
+        frameHandler = ^(RBKStompFrame *deliveredFrame) {
+            if ([duplicateWindow isDuplicateMessageID:[deliveredFrame headerValueForKey:RBKStompHeaderMessageID]]) {
+                [weakSelf.metrics recordDuplicateMessageForSubscriptionID:subscriptionID];
+                [weakSelf completeMessage:deliveredFrame]; // acknowledged on arrival, unless it holds credit
+            } else {
+                messageHandler(deliveredFrame);
+            }
+        };
+    }
+
+    id<RBKOrderedExecutor> executor = self.subscriptionExecutors[subscriptionID];
+    RBKStompConflator *conflator = self.subscriptionConflators[subscriptionID];
+    NSString *key = conflator ? conflator.keyBlock(messageFrame) : nil;
+    if (key) {
+        RBKStompFrame *replacedFrame = [conflator offerFrame:messageFrame forKey:key];
+        if (replacedFrame) {
+            // a delivery for this key is already scheduled and will pick up the newer frame
+            [self.metrics recordConflatedMessageForSubscriptionID:subscriptionID];
+            [duplicateWindow isDuplicateMessageID:[replacedFrame headerValueForKey:RBKStompHeaderMessageID]];
+            if ([self hasCreditForSubscriptionID:subscriptionID]) {
+                [self completeMessage:replacedFrame]; // superseded counts as handled, so its credit and ack aren't lost
+            }
+            return;
+        }
+
+        dispatch_block_t deliverLatest = ^{
+            RBKStompFrame *latestFrame = [conflator takeFrameForKey:key];
+            if (latestFrame) {
+                frameHandler(latestFrame);
+            }
+        };
+        // run later even without an executor, so frames arriving meanwhile can replace this one
+        if (executor) {
+            [executor executeBlock:deliverLatest];
+        } else {
+            dispatch_async(dispatch_get_main_queue(), deliverLatest);
+        }
+        return;
+    }
+
+    if (executor) {
+        [executor executeBlock:^{
+            frameHandler(messageFrame);
+        }];
+    } else {
+        frameHandler(messageFrame);
+    }
+}
+
+#pragma mark - Filters
+
+- (void)setHeaderFilter:(RBKStompHeaderFilter *)filter forSubscriptionID:(NSString *)subscriptionID {
+    NSParameterAssert(subscriptionID);
+
+    @synchronized(self) {
+        NSMutableDictionary *subscriptionFilters = [NSMutableDictionary dictionaryWithDictionary:self.subscriptionFilters];
+        if (filter) {
+            subscriptionFilters[subscriptionID] = filter;
+        } else {
+            [subscriptionFilters removeObjectForKey:subscriptionID];
+        }
+        self.subscriptionFilters = subscriptionFilters;
+    }
+}
+
+- (void)setDuplicateWindow:(RBKStompDuplicateWindow *)window forSubscriptionID:(NSString *)subscriptionID {
+    NSParameterAssert(subscriptionID);
+
+    @synchronized(self) {
+        NSMutableDictionary *subscriptionDuplicateWindows = [NSMutableDictionary dictionaryWithDictionary:self.subscriptionDuplicateWindows];
+        if (window) {
+            subscriptionDuplicateWindows[subscriptionID] = window;
+        } else {
+            [subscriptionDuplicateWindows removeObjectForKey:subscriptionID];
+        }
+        self.subscriptionDuplicateWindows = subscriptionDuplicateWindows;
+    }
+}
+
+#pragma mark - Conflation
+
+- (void)conflateSubscriptionID:(NSString *)subscriptionID keyBlock:(RBKStompConflationKeyBlock)keyBlock {
+    NSParameterAssert(subscriptionID);
+
+    RBKStompConflator *conflator = nil;
+    if (keyBlock) {
+        conflator = [[RBKStompConflator alloc] init];
+        conflator.keyBlock = keyBlock;
+    }
+
+    @synchronized(self) {
+        NSMutableDictionary *subscriptionConflators = [NSMutableDictionary dictionaryWithDictionary:self.subscriptionConflators];
+        if (conflator) {
+            subscriptionConflators[subscriptionID] = conflator;
+        } else {
+            [subscriptionConflators removeObjectForKey:subscriptionID];
+        }
+        self.subscriptionConflators = subscriptionConflators;
+    }
+}
+
+- (void)conflateSubscriptionID:(NSString *)subscriptionID byHeader:(NSString *)header {
+    NSParameterAssert(header);
+
+    [self conflateSubscriptionID:subscriptionID keyBlock:^NSString *(RBKStompFrame *messageFrame) {
+        return [messageFrame headerValueForKey:header];
+    }];
+}
+
+- (uint64_t)numberOfConflatedMessagesForSubscriptionID:(NSString *)subscriptionID {
+    RBKStompConflator *conflator = self.subscriptionConflators[subscriptionID];
+    return [conflator numberOfConflatedFrames];
+}
+
+#pragma mark - Last Values
+
+- (NSString *)lastValueKeyForMessage:(RBKStompFrame *)messageFrame {
+    NSString *subscriptionID = [messageFrame headerValueForKey:RBKStompHeaderSubscription];
+    RBKStompConflator *conflator = subscriptionID ? self.subscriptionConflators[subscriptionID] : nil;
+    return (conflator ? conflator.keyBlock(messageFrame) : nil) ?: @"";
+}
+
+/**
+ Hands the subscription the cached messages of its destination. The SUBSCRIBE hasn't been sent yet, so they come before any live message.
+ */
+- (void)primeSubscriptionID:(NSString *)subscriptionID destination:(NSString *)destination messageHandler:(RBKStompFrameHandler)messageHandler {
+    NSArray *cachedFrames = [self.lastValueCache messageFramesForDestination:destination];
+    if ([cachedFrames count] == 0) {
+        return;
+    }
+
+    dispatch_block_t deliverCached = ^{
+        for (RBKStompFrame *cachedFrame in cachedFrames) {
+            // without a subscription they can't be mistaken for messages owed an ack or a credit
+            messageHandler([cachedFrame frameByRemovingHeadersForKeys:@[RBKStompHeaderSubscription, RBKStompHeaderAck]]);
+        }
+    };
+    id<RBKOrderedExecutor> executor = self.subscriptionExecutors[subscriptionID];
+    if (executor) {
+        [executor executeBlock:deliverCached];
+    } else {
+        deliverCached();
+    }
+}
+
+#pragma mark - Flow Control
+
+- (void)completeMessage:(RBKStompFrame *)messageFrame {
+    NSString *destination = [messageFrame headerValueForKey:RBKStompHeaderDestination];
+    NSString *subscriptionID = [messageFrame headerValueForKey:RBKStompHeaderSubscription];
+    if (!subscriptionID) {
+        return;
+    }
+
+    NSString *ackIdentifier = [messageFrame headerValueForKey:RBKStompHeaderAck];
+    [self.creditLock lock];
+    RBKStompSubscriptionCredit *credit = self.subscriptionCredits[subscriptionID];
+    BOOL returned = [credit returnCreditForAckIdentifier:ackIdentifier];
+    NSArray *releasedFrames = returned ? [credit admitWaitingFrames] : nil;
+    [self.creditLock unlock];
+
+    if (!returned) {
+        return; // no credit, or already completed or rejected
+    }
+
+    // the ack was held back until now, so the server won't send more than the subscription can take
+    if (ackIdentifier && self.subscriptionAcknowledgementModes[destination][subscriptionID]) {
+        [self sendSocketOperationWithFrame:[RBKStompFrame ackFrameWithIdentifier:ackIdentifier]];
+    }
+
+    [self deliverReleasedFrames:releasedFrames destination:destination subscriptionID:subscriptionID];
+    [self updateReadingForCredits];
+}
+
+/**
+ A NACK is as final for the message as completing it, so it gives the credit back too. The server decides what happens to the message, so no ACK is sent.
+ */
+- (void)rejectedMessageWithAckIdentifier:(NSString *)ackIdentifier {
+    __block NSString *subscriptionID = nil;
+    __block NSArray *releasedFrames = nil;
+    [self.creditLock lock];
+    [self.subscriptionCredits enumerateKeysAndObjectsUsingBlock:^(NSString *creditSubscriptionID, RBKStompSubscriptionCredit *credit, BOOL *stop) {
+        if ([credit.outstandingAckIdentifiers containsObject:ackIdentifier]) {
+            [credit returnCreditForAckIdentifier:ackIdentifier];
+            subscriptionID = creditSubscriptionID;
+            releasedFrames = [credit admitWaitingFrames];
+            *stop = YES;
+        }
+    }];
+    [self.creditLock unlock];
+
+    if (!subscriptionID) {
+        return;
+    }
+
+    NSString *destination = [[releasedFrames firstObject] headerValueForKey:RBKStompHeaderDestination];
+    [self deliverReleasedFrames:releasedFrames destination:destination subscriptionID:subscriptionID];
+    [self updateReadingForCredits];
+}
+
+- (void)deliverReleasedFrames:(NSArray *)releasedFrames destination:(NSString *)destination subscriptionID:(NSString *)subscriptionID {
+    if ([releasedFrames count] == 0) {
+        return;
+    }
+
+    // hand over waiting messages on the main queue, where the socket delivers the others
+    dispatch_async(dispatch_get_main_queue(), ^{
+        RBKStompFrameHandler frameHandler = self.subscriptionHandlers[destination][subscriptionID];
+        if (!frameHandler) {
+            return;
+        }
+        for (RBKStompFrame *releasedFrame in releasedFrames) {
+            [self deliverMessage:releasedFrame subscriptionID:subscriptionID frameHandler:frameHandler];
+        }
+    });
+}
+
+/**
+ Returns YES if the message can go to the subscription's handler now. Otherwise it waits, or belongs to another subscription.
+ */
+- (BOOL)admitMessage:(RBKStompFrame *)messageFrame subscriptionID:(NSString *)subscriptionID {
+    [self.creditLock lock];
+    RBKStompSubscriptionCredit *credit = self.subscriptionCredits[subscriptionID];
+    BOOL admitted = YES;
+    if (credit) {
+        if (![[messageFrame headerValueForKey:RBKStompHeaderSubscription] isEqualToString:subscriptionID]) {
+            admitted = NO; // each credit has to be returned by completing the message, so only take our own
+        } else if ([credit.waitingFrames count] > 0 || [credit isExhausted]) {
+            [credit.waitingFrames addObject:messageFrame];
+            admitted = NO;
+        } else {
+            [credit takeCreditForFrame:messageFrame];
+        }
+    }
+    [self.creditLock unlock];
+    return admitted;
+}
+
+- (BOOL)hasCreditForSubscriptionID:(NSString *)subscriptionID {
+    [self.creditLock lock];
+    BOOL hasCredit = self.subscriptionCredits[subscriptionID] != nil;
+    [self.creditLock unlock];
+    return hasCredit;
+}
+
+/**
+ Stops reading from the network while every subscription has as many messages in progress as it allows, or while any one of them has a full backlog waiting, so TCP flow control holds the server back. Reads again once that is no longer so.
+ */
+- (void)updateReadingForCredits {
+    [self.creditLock lock];
+    NSUInteger subscriptionCount = 0;
+    for (NSDictionary *handlers in [self.subscriptionHandlers allValues]) {
+        subscriptionCount += [handlers count];
+    }
+    BOOL exhausted = [self.subscriptionCredits count] > 0 && [self.subscriptionCredits count] >= subscriptionCount;
+    BOOL backlogged = NO;
+    for (RBKStompSubscriptionCredit *credit in [self.subscriptionCredits allValues]) {
+        exhausted = exhausted && [credit isExhausted];
+        backlogged = backlogged || [credit isBacklogged];
+    }
+    // pause and resume inside the lock so they reach the socket in the order they were decided
+    BOOL shouldPause = exhausted || backlogged;
+    if (shouldPause && !self.isReadingPaused) {
+        self.readingPaused = YES;
+        [self pauseReading];
+    } else if (!shouldPause && self.isReadingPaused) {
+        self.readingPaused = NO;
+        [self resumeReading];
+    }
+    [self.creditLock unlock];
+}
+
+// heart-beats can't be read while paused, so don't hold their absence against the server
+- (void)pauseReading {
+    [self.heartbeatScheduler suspendIncoming];
+    [super pauseReading];
+}
+
+- (void)resumeReading {
+    [super resumeReading];
+    [self.heartbeatScheduler resumeIncoming];
+}
+
+#pragma mark - Transactions
+
+- (RBKStompTransaction *)beginTransaction {
+    NSString *identifier = [NSString stringWithFormat:@"tx-%p-%lu", self, (unsigned long)++self.transactionCounter];
+    return [[RBKStompTransaction alloc] initWithIdentifier:identifier];
+}
+
+- (void)commitTransaction:(RBKStompTransaction *)transaction success:(RBKStompPublishSuccessBlock)success failure:(RBKStompPublishFailureBlock)failure {
+    NSParameterAssert(transaction);
+
+    NSString *receiptID = [self.publisher nextReceiptID];
+    RBKStompFrame *batchFrame = [transaction finishWithCommitHeaders:@{RBKStompHeaderReceipt: receiptID}];
+    [self.publisher publishFrame:batchFrame receiptID:receiptID success:success failure:failure];
+}
+
+- (void)abortTransaction:(RBKStompTransaction *)transaction {
+    [transaction abort];
+}
+
+- (void)setMetrics:(RBKSocketMetrics *)metrics {
+    [super setMetrics:metrics];
+
+    __weak typeof(self)weakSelf = self;
+    [metrics setGaugeWithName:@"heartbeats_received" valueBlock:^NSNumber *{
+        return @([weakSelf numberOfReceivedHeartbeats]);
+    }];
+    [metrics setGaugeWithName:@"heartbeats_sent" valueBlock:^NSNumber *{
+        return @([weakSelf numberOfSentHeartbeats]);
+    }];
+}
+
 #pragma mark - RBKSocketStompRequestSerializerDelegate
 
 - (void)subscribedToDestination:(NSString *)destination subscriptionID:(NSString *)subscriptionID acknowledgeMode:(NSString *)acknowledgeMode messageHandler:(RBKStompFrameHandler)messageHandler {
@@ -77,6 +573,10 @@
         }
         self.subscriptionAcknowledgementModes[destination][subscriptionID] = acknowledgeMode;
     }
+
+    if (messageHandler && self.lastValueCache) {
+        [self primeSubscriptionID:subscriptionID destination:destination messageHandler:messageHandler];
+    }
 }
 
 - (void)unsubscribedFromDestination:(NSString *)destination subscriptionID:(NSString *)subscriptionID {
@@ -86,25 +586,65 @@
     if (self.subscriptionAcknowledgementModes[destination][subscriptionID]) {
         [self.subscriptionAcknowledgementModes[destination] removeObjectForKey:subscriptionID];
     }
+    [self.metrics removeSubscriptionID:subscriptionID];
+
+    [self setExecutor:nil forSubscriptionID:subscriptionID];
+    [self conflateSubscriptionID:subscriptionID keyBlock:nil];
+    [self setHeaderFilter:nil forSubscriptionID:subscriptionID];
+    [self setDuplicateWindow:nil forSubscriptionID:subscriptionID];
+
+    [self.creditLock lock];
+    [self.subscriptionCredits removeObjectForKey:subscriptionID];
+    [self.creditLock unlock];
+    [self updateReadingForCredits];
+}
+
+- (void)subscriptionID:(NSString *)subscriptionID limitedToPrefetchCount:(NSUInteger)prefetchCount {
+    RBKStompSubscriptionCredit *credit = [[RBKStompSubscriptionCredit alloc] init];
+    credit.prefetchCount = prefetchCount;
+    credit.outstandingAckIdentifiers = [NSMutableSet set];
+    credit.waitingFrames = [NSMutableArray array];
+
+    [self.creditLock lock];
+    self.subscriptionCredits[subscriptionID] = credit;
+    [self.creditLock unlock];
+}
+
+- (void)nackingMessageWithAckIdentifier:(NSString *)ackIdentifier {
+    [self rejectedMessageWithAckIdentifier:ackIdentifier];
 }
 
 - (void)heartbeatSent {
     self.heartbeatSentCounter += 1;
-    [self rescheduleHeartbeatTimer];
+    [self.heartbeatScheduler frameSent];
+}
+
+- (void)connectingWithHeartbeat:(RBKStompHeartbeat)heartbeat {
+    self.requestedHeartbeat = heartbeat;
+    self.requestedHeartbeatKnown = YES;
 }
 
 #pragma mark - RBKSocketStompResponseSerializerDelegate
 
+- (void)receivedMessageWithFrameData:(NSData *)frameData responseFrame:(RBKStompFrame *)responseFrame {
+    RBKStompLastValueCache *lastValueCache = self.lastValueCache;
+    NSString *destination = [responseFrame headerValueForKey:RBKStompHeaderDestination];
+    if (lastValueCache && destination) {
+        [lastValueCache storeFrameData:frameData destination:destination key:[self lastValueKeyForMessage:responseFrame]];
+    }
+}
+
 - (void)messageForDestination:(NSString *)destination responseFrame:(RBKStompFrame *)responseFrame {
     // use the stored destination, subscriptionID and handler
     // for each subscription, call its frameHandler
     NSDictionary *subscriptions = self.subscriptionHandlers[destination];
     [subscriptions enumerateKeysAndObjectsUsingBlock:^(NSString *subscriptionID, RBKStompFrameHandler frameHandler, BOOL *stop) {
         
-        if (frameHandler) {
-            frameHandler(responseFrame);
+        if (frameHandler && [self admitMessage:responseFrame subscriptionID:subscriptionID]) {
+            [self deliverMessage:responseFrame subscriptionID:subscriptionID frameHandler:frameHandler];
         }
     }];
+    [self updateReadingForCredits];
 }
 
 - (BOOL)shouldAcknowledgeMessageForDestination:(NSString *)destination responseFrame:(RBKStompFrame *)responseFrame {
@@ -113,7 +653,7 @@
     NSDictionary *subscriptionsToAcknowledge = self.subscriptionAcknowledgementModes[destination];
     [subscriptionsToAcknowledge enumerateKeysAndObjectsUsingBlock:^(NSString *subscriptionID, NSString *acknowledgeMode, BOOL *stop) {
         if ([subscriptionID isEqualToString:[responseFrame headerValueForKey:RBKStompHeaderSubscription]]) {
-            shouldAcknowldge = YES;
+            shouldAcknowldge = ![self hasCreditForSubscriptionID:subscriptionID]; // otherwise it's acknowledged once completed
             *stop = YES;
         }
     }];
@@ -152,57 +692,115 @@
 - (void)heartbeatReceived {
     // keep track of when the last heartbeat was received.
     self.heartbeatReceivedCounter += 1;
-    self.previousReceivedHeartbeatDate = self.mostRecentlyReceivedHeartbeatDate;
-    self.mostRecentlyReceivedHeartbeatDate = [NSDate date];
+    self.previousReceivedHeartbeatTime = self.mostRecentlyReceivedHeartbeatTime;
+    self.mostRecentlyReceivedHeartbeatTime = [self.clock now];
+    [self.heartbeatScheduler frameReceived];
 }
 
 /** 
  @param interval The interval within which a heartbeat should be sent, in seconds.
  */
 - (void)sendHeartbeatWithInterval:(NSTimeInterval)interval {
-    
-    // schedule a heartbeat to be sent in the interval, unless we send a message before that interval expires, at which point we should cancel our scheduled interval and reschedule another one
-    self.heartbeatInterval = interval;
-    [self rescheduleHeartbeatTimer];
+    [self.heartbeatScheduler startWithOutgoingInterval:interval incomingInterval:0];
 }
 
-#pragma mark - Private
+- (void)connectedWithHeartbeat:(RBKStompHeartbeat)heartbeat {
+    // negotiate as described in the STOMP 1.2 spec: each direction is on only if one side can send and the other wants to receive, at the slower of the two rates
+    // if we didn't see our own CONNECT frame, assume we can do whatever the server asks for and don't police the server
+    RBKStompHeartbeat requestedHeartbeat = self.requestedHeartbeat;
+    if (!self.hasRequestedHeartbeat) {
+        requestedHeartbeat.supportedTransmitIntervalMinimum = heartbeat.desiredReceptionIntervalMinimum;
+        requestedHeartbeat.desiredReceptionIntervalMinimum = 0;
+    }
 
-- (void)rescheduleHeartbeatTimer {
-    
-    if (self.heartbeatTimer) {
-        dispatch_source_cancel(self.heartbeatTimer);
+    NSUInteger outgoing = 0;
+    if (requestedHeartbeat.supportedTransmitIntervalMinimum > 0 && heartbeat.desiredReceptionIntervalMinimum > 0) {
+        outgoing = MAX(requestedHeartbeat.supportedTransmitIntervalMinimum, heartbeat.desiredReceptionIntervalMinimum);
     }
-    if (self.heartbeatInterval <= 0) {
-        return;
+    NSUInteger incoming = 0;
+    if (heartbeat.supportedTransmitIntervalMinimum > 0 && requestedHeartbeat.desiredReceptionIntervalMinimum > 0) {
+        incoming = MAX(heartbeat.supportedTransmitIntervalMinimum, requestedHeartbeat.desiredReceptionIntervalMinimum);
     }
-    
-    // Instead of an NSTimer (which needs a runloop) use a dispatch_source
-    // use 5% leeway
-    uint64_t leeway = self.heartbeatInterval / 5.0 * NSEC_PER_SEC;
-    self.heartbeatTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, socket_operation_processing_queue());
-
-    // set the timer to fire once.  Set the start time but set the interval to forever
-    dispatch_source_set_timer(self.heartbeatTimer,
-                              dispatch_time(DISPATCH_TIME_NOW, self.heartbeatInterval * NSEC_PER_SEC),
-                              DISPATCH_TIME_FOREVER,
-                              leeway);
-    
-    __weak typeof(self)weakSelf = self;
-    dispatch_source_set_event_handler(self.heartbeatTimer, ^{
-        __strong __typeof(weakSelf)strongSelf = weakSelf;
-        [strongSelf sendHeartbeat];
-        dispatch_source_cancel(strongSelf.heartbeatTimer); // after firing once, don't fire again
 
-    });
-    
-    // start the timer
-    dispatch_resume(self.heartbeatTimer);
+    // heart-beat values are in milliseconds
+    [self.heartbeatScheduler startWithOutgoingInterval:outgoing / 1000.0 incomingInterval:incoming / 1000.0];
+
+    // frames an earlier connection never got receipts for
+    [self.publisher resendJournaledFrames];
+}
+
+- (BOOL)shouldParseMessageWithFrameData:(NSData *)frameData {
+    NSDictionary *subscriptionFilters = self.subscriptionFilters;
+    NSDictionary *subscriptionDuplicateWindows = self.subscriptionDuplicateWindows;
+    if ([subscriptionFilters count] == 0 && [subscriptionDuplicateWindows count] == 0) {
+        return YES;
+    }
+
+    NSString *subscriptionID = [RBKStompFrame headerValueForKey:RBKStompHeaderSubscription inFrameData:frameData];
+    if (!subscriptionID) {
+        return YES;
+    }
+    RBKStompHeaderFilter *filter = subscriptionFilters[subscriptionID];
+    RBKStompDuplicateWindow *duplicateWindow = subscriptionDuplicateWindows[subscriptionID];
+    if (filter && ![filter matchesFrameData:frameData]) {
+        [self.metrics recordFilteredMessageForSubscriptionID:subscriptionID];
+    } else if (duplicateWindow && [duplicateWindow containsMessageIDOfFrameData:frameData]) {
+        [self.metrics recordDuplicateMessageForSubscriptionID:subscriptionID];
+    } else {
+        return YES;
+    }
+
+    // acknowledge what we drop, so the server doesn't hold on to it or send it again
+    NSString *destination = [RBKStompFrame headerValueForKey:RBKStompHeaderDestination inFrameData:frameData];
+    NSString *ackIdentifier = [RBKStompFrame headerValueForKey:RBKStompHeaderAck inFrameData:frameData];
+    if (ackIdentifier && destination && self.subscriptionAcknowledgementModes[destination][subscriptionID]) {
+        [self sendSocketOperationWithFrame:[RBKStompFrame ackFrameWithIdentifier:ackIdentifier]];
+    }
+    return NO;
+}
+
+- (void)receiptReceivedWithResponseFrame:(RBKStompFrame *)responseFrame {
+    [self.publisher handleReceiptFrame:responseFrame];
 }
 
-- (void)sendHeartbeat {
+#pragma mark - RBKStompHeartbeatSchedulerDelegate
+
+- (void)heartbeatSchedulerShouldSendHeartbeat:(RBKStompHeartbeatScheduler *)scheduler {
     RBKStompFrame *heartbeatFrame = [RBKStompFrame heartbeatFrame];
-    [self sendSocketOperationWithFrame:heartbeatFrame];
+    RBKSocketOperation *operation = [self socketOperationWithFrame:heartbeatFrame success:nil failure:nil];
+    operation.queuePriority = NSOperationQueuePriorityHigh; // don't let a heartbeat wait behind bulk sends
+    [self enqueueSocketOperation:operation];
+}
+
+- (void)heartbeatSchedulerDidMissIncomingHeartbeat:(RBKStompHeartbeatScheduler *)scheduler {
+    NSString *description = [NSString stringWithFormat:@"No heart-beat received from the server within %.0fms", scheduler.incomingInterval * scheduler.incomingTolerance * 1000];
+    NSError *error = [NSError errorWithDomain:RBKSocketNetworkingErrorDomain code:NSURLErrorTimedOut userInfo:@{NSLocalizedDescriptionKey: description}];
+
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (self.failureBlock) {
+            self.failureBlock(error);
+        }
+        [self.socket closeSocket]; // start the closing handshake without waiting for it, unlike -closeSocket which spins the run loop
+    });
+}
+
+#pragma mark - RBKSocketFrameDelegate
+
+- (BOOL)webSocket:(RoboSocket *)webSocket isUnsolicitedFrame:(id)message {
+    return [self.publisher isReceiptForUnconfirmedFrame:message];
+}
+
+#pragma mark - RBKSocketControlDelegate
+
+- (void)webSocket:(RoboSocket *)webSocket didCloseWithCode:(NSInteger)code reason:(NSString *)reason wasClean:(BOOL)wasClean {
+    [self.heartbeatScheduler stop];
+    [self.publisher failAllWithError:[NSError errorWithDomain:RBKSocketNetworkingErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:nil]];
+    [self.creditLock lock];
+    [self.subscriptionCredits removeAllObjects];
+    self.readingPaused = NO;
+    [self.creditLock unlock];
+
+    [super webSocket:webSocket didCloseWithCode:code reason:reason wasClean:wasClean];
 }
 
 
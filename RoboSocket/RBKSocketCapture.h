@@ -0,0 +1,94 @@
+//
+//  RBKSocketCapture.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+typedef NS_ENUM(uint8_t, RBKSocketCaptureDirection) {
+    RBKSocketCaptureDirectionInbound = 0,   // server to client
+    RBKSocketCaptureDirectionOutbound = 1,  // client to server
+};
+
+/**
+ The WebSocket opcode a message travelled as.
+ */
+typedef NS_ENUM(uint8_t, RBKSocketCaptureOpcode) {
+    RBKSocketCaptureOpcodeText = 0x1,
+    RBKSocketCaptureOpcodeBinary = 0x2,
+    RBKSocketCaptureOpcodePing = 0x9,
+    RBKSocketCaptureOpcodePong = 0xA,
+};
+
+/**
+ A captured message. `bytes` points into the reader's mapping of the file and is only valid while the reader is alive.
+ */
+typedef struct {
+    uint64_t timestamp; // nanoseconds since the capture started
+    RBKSocketCaptureDirection direction;
+    RBKSocketCaptureOpcode opcode;
+    const void *bytes;
+    NSUInteger length;
+} RBKSocketCaptureRecord;
+
+/**
+ Records every message a socket sends and receives into an append-only, memory-mapped capture file, for replay with `RBKSocketReplay`. Assign an instance to `-[RBKWebSocket capture]` to capture a socket; while it is `nil` nothing is recorded.
+
+ The file at `URL` holds the records back to back, each a 16 byte header followed by its payload; a file next to it with an `index` extension holds the offset of each record, 8 bytes apiece, for random access. Both files grow by doubling their mappings. Recording is safe from any thread, and a record is only counted in the file's header once it is fully written, so a capture cut short by a crash still reads back to its last whole record.
+ */
+@interface RBKSocketCapture : NSObject
+
+@property (readonly, nonatomic, strong) NSURL *URL;
+@property (readonly, nonatomic, assign) NSUInteger numberOfRecords;
+
+/**
+ Creates the capture file, replacing any file already at `url`.
+ */
+- (instancetype)initWithURL:(NSURL *)url error:(NSError *__autoreleasing *)error;
+
+/**
+ Records a text frame for an `NSString` and a binary frame for `NSData`.
+ */
+- (void)recordMessage:(id)message direction:(RBKSocketCaptureDirection)direction;
+- (void)recordBytes:(const void *)bytes length:(NSUInteger)length opcode:(RBKSocketCaptureOpcode)opcode direction:(RBKSocketCaptureDirection)direction;
+
+/**
+ Trims both files to what has been written and unmaps them. Later records are ignored.
+ */
+- (void)close;
+
+@end
+
+/**
+ Maps a capture file read-only. Uses the index file when it is present and agrees with the capture, and scans the records otherwise.
+ */
+@interface RBKSocketCaptureReader : NSObject
+
+@property (readonly, nonatomic, strong) NSURL *URL;
+@property (readonly, nonatomic, assign) NSUInteger numberOfRecords;
+
+/**
+ The wall clock time the capture started.
+ */
+@property (readonly, nonatomic, strong) NSDate *startDate;
+
+- (instancetype)initWithURL:(NSURL *)url error:(NSError *__autoreleasing *)error;
+
+/**
+ A record whose index entry points outside the capture, as in a corrupt file, comes back empty: no opcode, no bytes and a length of 0.
+ */
+- (RBKSocketCaptureRecord)recordAtIndex:(NSUInteger)index;
+
+/**
+ The index of the first record at or after `timestamp`, or `numberOfRecords` if there is none.
+ */
+- (NSUInteger)indexOfRecordAtTimestamp:(uint64_t)timestamp;
+
+/**
+ A copy of the record's payload as it was sent: an `NSString` for text frames and `NSData` otherwise.
+ */
+- (id)messageForRecord:(RBKSocketCaptureRecord)record;
+
+@end
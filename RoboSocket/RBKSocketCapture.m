@@ -0,0 +1,417 @@
+//
+//  RBKSocketCapture.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKSocketCapture.h"
+#import "RBKSocketMetrics.h"
+
+#include <libkern/OSAtomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char RBKSocketCaptureMagic[8] = {'R', 'B', 'K', 'C', 'A', 'P', 'T', '\0'};
+static const uint32_t RBKSocketCaptureVersion = 1;
+static const size_t RBKSocketCaptureInitialLength = 1024 * 1024;
+static const size_t RBKSocketCaptureInitialIndexLength = 64 * 1024;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerLength;      // where the first record starts
+    uint64_t startTime;         // wall clock, nanoseconds since 1970
+    volatile uint64_t dataLength;   // the header and every complete record; the file may be longer while it is being written
+    volatile uint64_t recordCount;
+} RBKSocketCaptureFileHeader;
+
+typedef struct {
+    uint64_t timestamp;
+    uint32_t length;
+    uint8_t opcode;
+    uint8_t direction;
+    uint16_t reserved;
+} RBKSocketCaptureRecordHeader;
+
+typedef struct {
+    int fd;
+    uint8_t *bytes;
+    size_t capacity;
+} RBKSocketCaptureMapping;
+
+static inline size_t RBKSocketCaptureRecordLength(size_t payloadLength) {
+    // keep every record header 8 byte aligned
+    return (sizeof(RBKSocketCaptureRecordHeader) + payloadLength + 7) & ~(size_t)7;
+}
+
+static NSURL *RBKSocketCaptureIndexURL(NSURL *url) {
+    return [url URLByAppendingPathExtension:@"index"];
+}
+
+static NSError *RBKSocketCaptureErrorWithCode(NSInteger code, NSURL *url) {
+    return [NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:@{NSURLErrorKey: url}];
+}
+
+// on failure the old mapping is left in place
+static BOOL RBKSocketCaptureMappingResize(RBKSocketCaptureMapping *mapping, size_t capacity) {
+    if (ftruncate(mapping->fd, (off_t)capacity) != 0) {
+        return NO;
+    }
+    void *bytes = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, mapping->fd, 0);
+    if (bytes == MAP_FAILED) {
+        return NO;
+    }
+    if (mapping->bytes) {
+        munmap(mapping->bytes, mapping->capacity);
+    }
+    mapping->bytes = bytes;
+    mapping->capacity = capacity;
+    return YES;
+}
+
+// unmaps and trims the file to `length`
+static void RBKSocketCaptureMappingClose(RBKSocketCaptureMapping *mapping, size_t length) {
+    if (mapping->bytes) {
+        munmap(mapping->bytes, mapping->capacity);
+        mapping->bytes = NULL;
+    }
+    if (mapping->fd >= 0) {
+        ftruncate(mapping->fd, (off_t)length);
+        close(mapping->fd);
+        mapping->fd = -1;
+    }
+}
+
+#pragma mark - RBKSocketCapture
+
+@interface RBKSocketCapture ()
+
+@property (readwrite, nonatomic, strong) NSURL *URL;
+
+@end
+
+@implementation RBKSocketCapture {
+    NSLock *_lock; // guards both mappings, which move when they grow; held across the syscalls that grow them, so it must block rather than spin
+    RBKSocketCaptureMapping _data;
+    RBKSocketCaptureMapping _index;
+    uint64_t _startTime;
+    BOOL _closed;
+}
+
+- (instancetype)init {
+    @throw [NSException exceptionWithName:NSInternalInconsistencyException reason:[NSString stringWithFormat:@"%@ Failed to call designated initializer. Invoke `initWithURL:error:` instead.", NSStringFromClass([self class])] userInfo:nil];
+}
+
+- (instancetype)initWithURL:(NSURL *)url error:(NSError *__autoreleasing *)error {
+    NSParameterAssert([url isFileURL]);
+
+    self = [super init];
+    if (self) {
+        _URL = url;
+        _lock = [[NSLock alloc] init];
+        _data.fd = open([[url path] fileSystemRepresentation], O_RDWR | O_CREAT | O_TRUNC, 0644);
+        _index.fd = open([[RBKSocketCaptureIndexURL(url) path] fileSystemRepresentation], O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (_data.fd < 0 || _index.fd < 0 || !RBKSocketCaptureMappingResize(&_data, RBKSocketCaptureInitialLength) || !RBKSocketCaptureMappingResize(&_index, RBKSocketCaptureInitialIndexLength)) {
+            if (error) {
+                *error = RBKSocketCaptureErrorWithCode(errno, url);
+            }
+            [self close];
+            return nil;
+        }
+
+        RBKSocketCaptureFileHeader *header = (RBKSocketCaptureFileHeader *)_data.bytes;
+        memcpy(header->magic, RBKSocketCaptureMagic, sizeof(RBKSocketCaptureMagic));
+        header->version = RBKSocketCaptureVersion;
+        header->headerLength = sizeof(RBKSocketCaptureFileHeader);
+        header->startTime = (uint64_t)([[NSDate date] timeIntervalSince1970] * NSEC_PER_SEC);
+        header->dataLength = sizeof(RBKSocketCaptureFileHeader);
+        header->recordCount = 0;
+        _startTime = RBKMonotonicNanoseconds();
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self close];
+}
+
+- (NSUInteger)numberOfRecords {
+    [_lock lock];
+    NSUInteger count = _data.bytes ? (NSUInteger)((RBKSocketCaptureFileHeader *)_data.bytes)->recordCount : 0;
+    [_lock unlock];
+    return count;
+}
+
+- (void)recordMessage:(id)message direction:(RBKSocketCaptureDirection)direction {
+    if ([message isKindOfClass:[NSString class]]) {
+        NSString *string = message;
+        NSUInteger length = [string lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+        // encode straight into the mapping rather than through a temporary buffer
+        [self appendRecordWithLength:length opcode:RBKSocketCaptureOpcodeText direction:direction writer:^(uint8_t *payload) {
+            [string getBytes:payload maxLength:length usedLength:NULL encoding:NSUTF8StringEncoding options:0 range:NSMakeRange(0, [string length]) remainingRange:NULL];
+        }];
+    } else if ([message isKindOfClass:[NSData class]]) {
+        [self recordBytes:[message bytes] length:[message length] opcode:RBKSocketCaptureOpcodeBinary direction:direction];
+    }
+}
+
+- (void)recordBytes:(const void *)bytes length:(NSUInteger)length opcode:(RBKSocketCaptureOpcode)opcode direction:(RBKSocketCaptureDirection)direction {
+    [self appendRecordWithLength:length opcode:opcode direction:direction writer:^(uint8_t *payload) {
+        if (length > 0) {
+            memcpy(payload, bytes, length);
+        }
+    }];
+}
+
+- (void)close {
+    [_lock lock];
+    if (!_closed) {
+        _closed = YES;
+        RBKSocketCaptureFileHeader *header = (RBKSocketCaptureFileHeader *)_data.bytes;
+        size_t dataLength = header ? (size_t)header->dataLength : 0;
+        size_t indexLength = header ? (size_t)header->recordCount * sizeof(uint64_t) : 0;
+        RBKSocketCaptureMappingClose(&_data, dataLength);
+        RBKSocketCaptureMappingClose(&_index, indexLength);
+    }
+    [_lock unlock];
+}
+
+#pragma mark - Private
+
+- (void)appendRecordWithLength:(NSUInteger)length opcode:(RBKSocketCaptureOpcode)opcode direction:(RBKSocketCaptureDirection)direction writer:(void (^)(uint8_t *payload))writer {
+    if (length > UINT32_MAX) {
+        return;
+    }
+    size_t recordLength = RBKSocketCaptureRecordLength(length);
+
+    [_lock lock];
+    if (_closed || ![self reserveRecordWithLength:recordLength]) {
+        [_lock unlock];
+        return;
+    }
+    RBKSocketCaptureFileHeader *header = (RBKSocketCaptureFileHeader *)_data.bytes;
+    uint64_t offset = header->dataLength;
+    uint64_t count = header->recordCount;
+
+    // stamped under the lock, so timestamps never go backwards through the file
+    RBKSocketCaptureRecordHeader recordHeader = {RBKMonotonicNanoseconds() - _startTime, (uint32_t)length, opcode, direction, 0};
+    memcpy(_data.bytes + offset, &recordHeader, sizeof(recordHeader));
+    writer(_data.bytes + offset + sizeof(recordHeader));
+    ((uint64_t *)_index.bytes)[count] = offset;
+
+    // only count the record once it is all there
+    OSMemoryBarrier();
+    header->dataLength = offset + recordLength;
+    header->recordCount = count + 1;
+    [_lock unlock];
+}
+
+// call with the lock held
+- (BOOL)reserveRecordWithLength:(size_t)recordLength {
+    RBKSocketCaptureFileHeader *header = (RBKSocketCaptureFileHeader *)_data.bytes;
+    size_t dataLength = (size_t)header->dataLength + recordLength;
+    if (dataLength > _data.capacity) {
+        size_t capacity = _data.capacity;
+        while (capacity < dataLength) {
+            capacity *= 2;
+        }
+        if (!RBKSocketCaptureMappingResize(&_data, capacity)) {
+            return NO;
+        }
+        header = (RBKSocketCaptureFileHeader *)_data.bytes;
+    }
+    size_t indexLength = ((size_t)header->recordCount + 1) * sizeof(uint64_t);
+    if (indexLength > _index.capacity && !RBKSocketCaptureMappingResize(&_index, _index.capacity * 2)) {
+        return NO;
+    }
+    return YES;
+}
+
+@end
+
+#pragma mark - RBKSocketCaptureReader
+
+@interface RBKSocketCaptureReader ()
+
+@property (readwrite, nonatomic, strong) NSURL *URL;
+@property (readwrite, nonatomic, assign) NSUInteger numberOfRecords;
+@property (readwrite, nonatomic, strong) NSDate *startDate;
+
+@end
+
+@implementation RBKSocketCaptureReader {
+    const uint8_t *_bytes;
+    size_t _mappedLength;
+    size_t _length; // up to the end of the last complete record
+    const uint8_t *_indexBytes;
+    size_t _indexLength;
+    const uint64_t *_offsets;
+    uint64_t *_scannedOffsets;
+}
+
+- (instancetype)init {
+    @throw [NSException exceptionWithName:NSInternalInconsistencyException reason:[NSString stringWithFormat:@"%@ Failed to call designated initializer. Invoke `initWithURL:error:` instead.", NSStringFromClass([self class])] userInfo:nil];
+}
+
+- (instancetype)initWithURL:(NSURL *)url error:(NSError *__autoreleasing *)error {
+    NSParameterAssert([url isFileURL]);
+
+    self = [super init];
+    if (self) {
+        _URL = url;
+        _bytes = [self mapFileAtURL:url length:&_mappedLength];
+        _length = _mappedLength;
+        if (!_bytes) {
+            if (error) {
+                *error = RBKSocketCaptureErrorWithCode(errno, url);
+            }
+            return nil;
+        }
+
+        RBKSocketCaptureFileHeader header;
+        if (_length < sizeof(header)) {
+            if (error) {
+                *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:@{NSURLErrorKey: url}];
+            }
+            return nil;
+        }
+        memcpy(&header, _bytes, sizeof(header));
+        if (memcmp(header.magic, RBKSocketCaptureMagic, sizeof(RBKSocketCaptureMagic)) != 0 || header.version != RBKSocketCaptureVersion || header.headerLength < sizeof(header)) {
+            if (error) {
+                *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:@{NSURLErrorKey: url}];
+            }
+            return nil;
+        }
+        // a capture still being written, or cut short, is read up to its last complete record
+        _length = (size_t)MIN((uint64_t)_length, header.dataLength);
+        _startDate = [NSDate dateWithTimeIntervalSince1970:header.startTime / (double)NSEC_PER_SEC];
+
+        _indexBytes = [self mapFileAtURL:RBKSocketCaptureIndexURL(url) length:&_indexLength];
+        if ([self isIndexValidForRecordCount:header.recordCount headerLength:header.headerLength]) {
+            _offsets = (const uint64_t *)_indexBytes;
+            _numberOfRecords = (NSUInteger)header.recordCount;
+        } else {
+            [self scanRecordsFromOffset:header.headerLength];
+        }
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_bytes) {
+        munmap((void *)_bytes, _mappedLength);
+    }
+    if (_indexBytes) {
+        munmap((void *)_indexBytes, _indexLength);
+    }
+    free(_scannedOffsets);
+}
+
+- (RBKSocketCaptureRecord)recordAtIndex:(NSUInteger)index {
+    NSParameterAssert(index < self.numberOfRecords);
+
+    uint64_t offset = _offsets[index];
+    if (![self isRecordAtOffset:offset withinLength:_length]) {
+        // a corrupt index entry; reading it would run off the mapping
+        RBKSocketCaptureRecord emptyRecord = {0};
+        return emptyRecord;
+    }
+    RBKSocketCaptureRecordHeader recordHeader;
+    memcpy(&recordHeader, _bytes + offset, sizeof(recordHeader));
+
+    RBKSocketCaptureRecord record;
+    record.timestamp = recordHeader.timestamp;
+    record.direction = recordHeader.direction;
+    record.opcode = recordHeader.opcode;
+    record.bytes = _bytes + offset + sizeof(recordHeader);
+    record.length = recordHeader.length;
+    return record;
+}
+
+- (NSUInteger)indexOfRecordAtTimestamp:(uint64_t)timestamp {
+    NSUInteger low = 0;
+    NSUInteger high = self.numberOfRecords;
+    while (low < high) {
+        NSUInteger middle = low + (high - low) / 2;
+        if ([self recordAtIndex:middle].timestamp < timestamp) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+- (id)messageForRecord:(RBKSocketCaptureRecord)record {
+    if (record.opcode == RBKSocketCaptureOpcodeText) {
+        return [[NSString alloc] initWithBytes:record.bytes length:record.length encoding:NSUTF8StringEncoding];
+    }
+    return [NSData dataWithBytes:record.bytes length:record.length];
+}
+
+#pragma mark - Private
+
+- (const uint8_t *)mapFileAtURL:(NSURL *)url length:(size_t *)length {
+    int fd = open([[url path] fileSystemRepresentation], O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat status;
+    void *bytes = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && status.st_size > 0) {
+        bytes = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    int mapError = status.st_size > 0 ? errno : EINVAL;
+    close(fd); // the mapping outlives the descriptor
+    if (bytes == MAP_FAILED) {
+        errno = mapError;
+        return NULL;
+    }
+    *length = (size_t)status.st_size;
+    return bytes;
+}
+
+- (BOOL)isRecordAtOffset:(uint64_t)offset withinLength:(size_t)length {
+    if (offset > length || offset + sizeof(RBKSocketCaptureRecordHeader) > length) {
+        return NO;
+    }
+    RBKSocketCaptureRecordHeader recordHeader;
+    memcpy(&recordHeader, _bytes + offset, sizeof(recordHeader));
+    return offset + RBKSocketCaptureRecordLength(recordHeader.length) <= length;
+}
+
+- (BOOL)isIndexValidForRecordCount:(uint64_t)recordCount headerLength:(uint32_t)headerLength {
+    if (recordCount == 0) {
+        return YES;
+    }
+    if (!_indexBytes || _indexLength < recordCount * sizeof(uint64_t)) {
+        return NO;
+    }
+    // the index is written in the same breath as the records, so checking its ends is enough to catch a stale one; recordAtIndex: still checks every entry it reads
+    const uint64_t *offsets = (const uint64_t *)_indexBytes;
+    return offsets[0] == headerLength && [self isRecordAtOffset:offsets[recordCount - 1] withinLength:_length];
+}
+
+- (void)scanRecordsFromOffset:(uint64_t)offset {
+    NSUInteger capacity = 1024;
+    NSUInteger count = 0;
+    _scannedOffsets = malloc(capacity * sizeof(uint64_t));
+    while ([self isRecordAtOffset:offset withinLength:_length]) {
+        if (count == capacity) {
+            capacity *= 2;
+            _scannedOffsets = realloc(_scannedOffsets, capacity * sizeof(uint64_t));
+        }
+        _scannedOffsets[count++] = offset;
+
+        RBKSocketCaptureRecordHeader recordHeader;
+        memcpy(&recordHeader, _bytes + offset, sizeof(recordHeader));
+        offset += RBKSocketCaptureRecordLength(recordHeader.length);
+    }
+    _offsets = _scannedOffsets;
+    _numberOfRecords = count;
+}
+
+@end
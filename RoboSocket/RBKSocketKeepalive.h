@@ -0,0 +1,75 @@
+//
+//  RBKSocketKeepalive.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class RBKSocketKeepalive;
+
+@protocol RBKSocketKeepaliveDelegate <NSObject>
+
+/**
+ Nothing has been received for the current interval. Send a WebSocket ping carrying `payload` and hand the pong's payload back to `-pongReceivedWithPayload:`.
+ */
+- (void)keepalive:(RBKSocketKeepalive *)keepalive shouldSendPingWithPayload:(NSData *)payload;
+
+/**
+ `maximumMissedPongs` pings in a row went unanswered with nothing else received, so the connection is most likely half-open. The keepalive stops itself before calling this.
+ */
+- (void)keepaliveDidDetectDeadConnection:(RBKSocketKeepalive *)keepalive;
+
+@end
+
+/**
+ Detects dead connections with WebSocket pings. A ping is only sent once the connection has been idle for the current interval, which doubles from `minimumInterval` up to `maximumInterval` while pongs keep coming back and drops back to `minimumInterval` after a miss. Each ping carries a sequence number and its send time, so every pong is a round trip time sample.
+ */
+@interface RBKSocketKeepalive : NSObject
+
+@property (weak, nonatomic) id<RBKSocketKeepaliveDelegate> delegate;
+
+/**
+ In seconds. 5 and 30 by default.
+ */
+@property (assign, nonatomic) NSTimeInterval minimumInterval;
+@property (assign, nonatomic) NSTimeInterval maximumInterval;
+
+/**
+ The least time, in seconds, to wait for a pong. The wait grows with the measured round trip time and its variation, like a TCP retransmission timeout. 2 by default.
+ */
+@property (assign, nonatomic) NSTimeInterval minimumPongTimeout;
+
+/**
+ How many consecutive unanswered pings mean the connection is dead. 3 by default.
+ */
+@property (assign, nonatomic) NSUInteger maximumMissedPongs;
+
+@property (readonly, nonatomic, assign) NSTimeInterval currentInterval;
+
+/**
+ Smoothed round trip time and its mean deviation (jitter), in seconds, as in RFC 6298. 0 until the first pong arrives.
+ */
+@property (readonly, nonatomic, assign) NSTimeInterval smoothedRoundTripTime;
+@property (readonly, nonatomic, assign) NSTimeInterval roundTripTimeVariation;
+
+@property (readonly, nonatomic, assign) NSUInteger missedPongs;
+@property (readonly, nonatomic, assign) uint64_t pingsSent;
+@property (readonly, nonatomic, assign) uint64_t pongsReceived;
+
+/**
+ @param queue The queue the delegate is called on. Must be serial.
+ */
+- (instancetype)initWithQueue:(dispatch_queue_t)queue;
+
+- (void)start;
+- (void)stop;
+
+/**
+ Call for every frame received; any traffic proves the connection is alive and postpones the next ping.
+ */
+- (void)frameReceived;
+- (void)pongReceivedWithPayload:(NSData *)payload;
+
+@end
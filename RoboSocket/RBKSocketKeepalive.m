@@ -0,0 +1,217 @@
+//
+//  RBKSocketKeepalive.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKSocketKeepalive.h"
+#import "RBKSocketMetrics.h"
+
+#include <libkern/OSAtomic.h>
+
+static const NSUInteger RBKSocketKeepalivePayloadLength = 16; // sequence and send time, big endian
+
+static inline void RBKAtomicStore64(volatile int64_t *target, int64_t value) {
+    int64_t current;
+    do {
+        current = *target;
+    } while (!OSAtomicCompareAndSwap64Barrier(current, value, target));
+}
+
+@interface RBKSocketKeepalive ()
+
+@property (readwrite, nonatomic, assign) NSTimeInterval currentInterval;
+@property (readwrite, nonatomic, assign) NSTimeInterval smoothedRoundTripTime;
+@property (readwrite, nonatomic, assign) NSTimeInterval roundTripTimeVariation;
+@property (readwrite, nonatomic, assign) NSUInteger missedPongs;
+@property (readwrite, nonatomic, assign) uint64_t pingsSent;
+@property (readwrite, nonatomic, assign) uint64_t pongsReceived;
+
+@property (strong, nonatomic) dispatch_queue_t queue;
+@property (strong, nonatomic) dispatch_source_t timer;
+@property (assign, nonatomic, getter = isRunning) BOOL running;
+@property (assign, nonatomic) uint64_t idleSince;
+@property (assign, nonatomic) uint64_t sequence;
+@property (assign, nonatomic) uint64_t outstandingSequence; // 0 when no ping is waiting for its pong
+@property (assign, nonatomic) uint64_t outstandingSendTime;
+
+@end
+
+@implementation RBKSocketKeepalive {
+    volatile int64_t _lastReceivedTime;
+}
+
+- (instancetype)init {
+    return [self initWithQueue:dispatch_queue_create("com.robotsandpencils.networking.keepalive", DISPATCH_QUEUE_SERIAL)];
+}
+
+- (instancetype)initWithQueue:(dispatch_queue_t)queue {
+    NSParameterAssert(queue);
+
+    self = [super init];
+    if (self) {
+        _queue = queue;
+        _minimumInterval = 5;
+        _maximumInterval = 30;
+        _minimumPongTimeout = 2;
+        _maximumMissedPongs = 3;
+        _currentInterval = _minimumInterval;
+
+        _timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, queue);
+        dispatch_source_set_timer(_timer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        __weak typeof(self)weakSelf = self;
+        dispatch_source_set_event_handler(_timer, ^{
+            [weakSelf timerFired];
+        });
+        dispatch_resume(_timer);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    dispatch_source_cancel(_timer);
+}
+
+#pragma mark - Public
+
+- (void)start {
+    dispatch_async(self.queue, ^{
+        self.running = YES;
+        self.currentInterval = self.minimumInterval;
+        self.missedPongs = 0;
+        self.outstandingSequence = 0;
+        self.idleSince = RBKMonotonicNanoseconds();
+        [self rearmTimer];
+    });
+}
+
+- (void)stop {
+    dispatch_async(self.queue, ^{
+        self.running = NO;
+        self.outstandingSequence = 0;
+        [self rearmTimer];
+    });
+}
+
+- (void)frameReceived {
+    RBKAtomicStore64(&_lastReceivedTime, (int64_t)RBKMonotonicNanoseconds());
+}
+
+- (void)pongReceivedWithPayload:(NSData *)payload {
+    uint64_t receivedTime = RBKMonotonicNanoseconds();
+    RBKAtomicStore64(&_lastReceivedTime, (int64_t)receivedTime);
+    if ([payload length] != RBKSocketKeepalivePayloadLength) {
+        return; // an unsolicited pong, or an answer to someone else's ping
+    }
+
+    uint64_t fields[2];
+    [payload getBytes:fields length:sizeof(fields)];
+    uint64_t sequence = CFSwapInt64BigToHost(fields[0]);
+    uint64_t sendTime = CFSwapInt64BigToHost(fields[1]);
+
+    dispatch_async(self.queue, ^{
+        if (!self.isRunning || sequence == 0 || sequence > self.sequence || sendTime > receivedTime) {
+            return;
+        }
+        self.pongsReceived += 1;
+        [self addRoundTripTimeSample:(receivedTime - sendTime) / (double)NSEC_PER_SEC];
+
+        if (sequence >= self.outstandingSequence && self.outstandingSequence != 0) {
+            // the link is healthy, so check it less often
+            self.outstandingSequence = 0;
+            self.missedPongs = 0;
+            self.currentInterval = MIN(self.currentInterval * 2, self.maximumInterval);
+            self.idleSince = receivedTime;
+            [self rearmTimer];
+        }
+    });
+}
+
+#pragma mark - Private
+
+- (void)addRoundTripTimeSample:(NSTimeInterval)roundTripTime {
+    if (self.smoothedRoundTripTime == 0) {
+        self.smoothedRoundTripTime = roundTripTime;
+        self.roundTripTimeVariation = roundTripTime / 2;
+        return;
+    }
+    self.roundTripTimeVariation = 0.75 * self.roundTripTimeVariation + 0.25 * fabs(self.smoothedRoundTripTime - roundTripTime);
+    self.smoothedRoundTripTime = 0.875 * self.smoothedRoundTripTime + 0.125 * roundTripTime;
+}
+
+- (NSTimeInterval)pongTimeout {
+    return MAX(self.minimumPongTimeout, self.smoothedRoundTripTime + 4 * self.roundTripTimeVariation);
+}
+
+- (uint64_t)lastReceivedTime {
+    return (uint64_t)_lastReceivedTime;
+}
+
+- (uint64_t)nextDeadline {
+    if (self.outstandingSequence) {
+        return self.outstandingSendTime + (uint64_t)([self pongTimeout] * NSEC_PER_SEC);
+    }
+    return MAX(self.lastReceivedTime, self.idleSince) + (uint64_t)(self.currentInterval * NSEC_PER_SEC);
+}
+
+- (void)rearmTimer {
+    if (!self.isRunning) {
+        dispatch_source_set_timer(self.timer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        return;
+    }
+
+    uint64_t deadline = [self nextDeadline];
+    uint64_t now = RBKMonotonicNanoseconds();
+    int64_t delay = deadline > now ? (int64_t)(deadline - now) : 0;
+    // use 5% leeway
+    uint64_t leeway = self.minimumInterval / 20.0 * NSEC_PER_SEC;
+    dispatch_source_set_timer(self.timer, dispatch_time(DISPATCH_TIME_NOW, delay), DISPATCH_TIME_FOREVER, leeway);
+}
+
+- (void)timerFired {
+    if (!self.isRunning) {
+        return;
+    }
+
+    uint64_t now = RBKMonotonicNanoseconds();
+    if (now < [self nextDeadline]) {
+        [self rearmTimer]; // traffic arrived since the timer was armed
+        return;
+    }
+
+    if (self.outstandingSequence) {
+        self.outstandingSequence = 0;
+        if (self.lastReceivedTime > self.outstandingSendTime) {
+            // the pong went missing but other frames made it, so the connection is alive
+            self.missedPongs = 0;
+            [self rearmTimer];
+            return;
+        } else {
+            self.missedPongs += 1;
+            self.currentInterval = self.minimumInterval;
+            if (self.missedPongs >= self.maximumMissedPongs) {
+                self.running = NO;
+                [self rearmTimer];
+                [self.delegate keepaliveDidDetectDeadConnection:self];
+                return;
+            }
+        }
+    }
+
+    [self sendPing];
+    [self rearmTimer];
+}
+
+- (void)sendPing {
+    self.sequence += 1;
+    self.outstandingSequence = self.sequence;
+    self.outstandingSendTime = RBKMonotonicNanoseconds();
+    self.pingsSent += 1;
+
+    uint64_t fields[2] = {CFSwapInt64HostToBig(self.sequence), CFSwapInt64HostToBig(self.outstandingSendTime)};
+    NSData *payload = [NSData dataWithBytes:fields length:sizeof(fields)];
+    [self.delegate keepalive:self shouldSendPingWithPayload:payload];
+}
+
+@end
@@ -0,0 +1,115 @@
+//
+//  RBKSocketMetrics.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ Monotonic time in nanoseconds. Unlike `NSDate` it does not jump when the wall clock is changed.
+ */
+extern uint64_t RBKMonotonicNanoseconds(void);
+
+/**
+ Keys in the dictionary returned by `-[RBKSocketMetrics snapshot]`.
+ */
+extern NSString * const RBKSocketMetricsFramesSentKey;
+extern NSString * const RBKSocketMetricsFramesReceivedKey;
+extern NSString * const RBKSocketMetricsBytesSentKey;
+extern NSString * const RBKSocketMetricsBytesReceivedKey;
+extern NSString * const RBKSocketMetricsOpcodesSentKey; // dictionary of opcode name to count
+extern NSString * const RBKSocketMetricsOpcodesReceivedKey;
+extern NSString * const RBKSocketMetricsOpensKey;
+extern NSString * const RBKSocketMetricsReconnectsKey; // opens that follow a close or failure recorded by the same metrics
+extern NSString * const RBKSocketMetricsClosesKey;
+extern NSString * const RBKSocketMetricsFailuresKey;
+extern NSString * const RBKSocketMetricsOperationsStartedKey; // operations counts and latency only cover operations that expect a response
+extern NSString * const RBKSocketMetricsOperationsCompletedKey;
+extern NSString * const RBKSocketMetricsOperationsFailedKey;
+extern NSString * const RBKSocketMetricsOperationLatencyKey; // dictionary from -[RBKLatencyHistogram dictionaryRepresentation]
+extern NSString * const RBKSocketMetricsSubscriptionsKey; // dictionary of subscription ID to messages, messages_per_sec, conflated, filtered and duplicates
+extern NSString * const RBKSocketMetricsGaugesKey; // dictionary of gauge name to current value
+
+extern NSString * const RBKSocketMetricsOpcodeText;
+extern NSString * const RBKSocketMetricsOpcodeBinary;
+extern NSString * const RBKSocketMetricsOpcodePing;
+extern NSString * const RBKSocketMetricsOpcodePong;
+extern NSString * const RBKSocketMetricsOpcodeClose;
+
+/**
+ A log-linear latency histogram in the style of HdrHistogram. Values are bucketed with roughly 3% relative precision from 1ns up to the full `uint64_t` range, in constant memory. Recording is lock free and safe from any thread.
+ */
+@interface RBKLatencyHistogram : NSObject
+
+@property (readonly, nonatomic, assign) uint64_t count;
+@property (readonly, nonatomic, assign) uint64_t maximum;
+@property (readonly, nonatomic, assign) double mean;
+
+- (void)recordValue:(uint64_t)nanoseconds;
+
+/**
+ @param percentile A value between 0 and 100.
+ @return The highest value equivalent to the bucket containing the percentile, or 0 if nothing has been recorded.
+ */
+- (uint64_t)valueAtPercentile:(double)percentile;
+
+- (void)reset;
+
+/**
+ count, mean_ns, p50_ns, p90_ns, p99_ns, p999_ns and max_ns.
+ */
+- (NSDictionary *)dictionaryRepresentation;
+
+@end
+
+
+/**
+ Counters, latency histograms and gauges for a single socket. Assign an instance to `-[RBKWebSocket metrics]` to start collecting; while it is `nil` the socket skips all bookkeeping. Counters are updated atomically from whichever thread observes the event, and `snapshot` can be polled from any thread.
+
+ A socket only opens once, so to count reconnects hand the same instance to each socket that replaces a dropped one.
+ */
+@interface RBKSocketMetrics : NSObject
+
+@property (readonly, nonatomic, strong) RBKLatencyHistogram *operationLatency;
+
+- (void)recordSentFrame:(id)frame;
+- (void)recordReceivedFrame:(id)frame;
+/**
+ Pings, pongs and closes only show up in the opcode counts; the frame and byte totals cover messages.
+ */
+- (void)recordSentControlFrameWithOpcode:(NSString *)opcode;
+- (void)recordReceivedControlFrameWithOpcode:(NSString *)opcode;
+
+- (void)recordSocketOpened;
+- (void)recordSocketClosed;
+- (void)recordSocketFailed;
+
+- (void)recordOperationStarted;
+- (void)recordOperationCompletedWithLatency:(uint64_t)nanoseconds;
+- (void)recordOperationFailed;
+
+- (void)recordMessageForSubscriptionID:(NSString *)subscriptionID;
+/**
+ A message for a conflating subscription was replaced by a newer one before its handler ran.
+ */
+- (void)recordConflatedMessageForSubscriptionID:(NSString *)subscriptionID;
+/**
+ A message was dropped by its subscription's header filter before it was parsed.
+ */
+- (void)recordFilteredMessageForSubscriptionID:(NSString *)subscriptionID;
+/**
+ A message was dropped as one its subscription had already seen, before it was parsed.
+ */
+- (void)recordDuplicateMessageForSubscriptionID:(NSString *)subscriptionID;
+- (void)removeSubscriptionID:(NSString *)subscriptionID;
+
+/**
+ Gauges are sampled when a snapshot is taken rather than maintained as events happen, so they cost nothing in between polls. Registering a gauge with an existing name replaces it.
+ */
+- (void)setGaugeWithName:(NSString *)name valueBlock:(NSNumber *(^)(void))valueBlock;
+
+- (NSDictionary *)snapshot;
+
+@end
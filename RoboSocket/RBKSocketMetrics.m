@@ -0,0 +1,415 @@
+//
+//  RBKSocketMetrics.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKSocketMetrics.h"
+
+#include <libkern/OSAtomic.h>
+#include <mach/mach_time.h>
+
+NSString * const RBKSocketMetricsFramesSentKey = @"frames_sent";
+NSString * const RBKSocketMetricsFramesReceivedKey = @"frames_received";
+NSString * const RBKSocketMetricsBytesSentKey = @"bytes_sent";
+NSString * const RBKSocketMetricsBytesReceivedKey = @"bytes_received";
+NSString * const RBKSocketMetricsOpcodesSentKey = @"opcodes_sent";
+NSString * const RBKSocketMetricsOpcodesReceivedKey = @"opcodes_received";
+NSString * const RBKSocketMetricsOpensKey = @"opens";
+NSString * const RBKSocketMetricsReconnectsKey = @"reconnects";
+NSString * const RBKSocketMetricsClosesKey = @"closes";
+NSString * const RBKSocketMetricsFailuresKey = @"failures";
+NSString * const RBKSocketMetricsOperationsStartedKey = @"operations_started";
+NSString * const RBKSocketMetricsOperationsCompletedKey = @"operations_completed";
+NSString * const RBKSocketMetricsOperationsFailedKey = @"operations_failed";
+NSString * const RBKSocketMetricsOperationLatencyKey = @"operation_latency";
+NSString * const RBKSocketMetricsSubscriptionsKey = @"subscriptions";
+NSString * const RBKSocketMetricsGaugesKey = @"gauges";
+
+NSString * const RBKSocketMetricsOpcodeText = @"text";
+NSString * const RBKSocketMetricsOpcodeBinary = @"binary";
+NSString * const RBKSocketMetricsOpcodePing = @"ping";
+NSString * const RBKSocketMetricsOpcodePong = @"pong";
+NSString * const RBKSocketMetricsOpcodeClose = @"close";
+
+uint64_t RBKMonotonicNanoseconds(void) {
+    static mach_timebase_info_data_t timebase;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        mach_timebase_info(&timebase);
+    });
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+}
+
+#pragma mark - RBKLatencyHistogram
+
+// Values below RBKHistogramSubBucketCount get a bucket each. Above that, every power of two is split into
+// RBKHistogramSubBucketHalfCount linear buckets, which bounds the relative error at 1/32.
+enum {
+    RBKHistogramSubBucketBits = 6,
+    RBKHistogramSubBucketCount = 1 << RBKHistogramSubBucketBits,
+    RBKHistogramSubBucketHalfCount = RBKHistogramSubBucketCount / 2,
+    RBKHistogramBucketCount = RBKHistogramSubBucketCount + (64 - RBKHistogramSubBucketBits) * RBKHistogramSubBucketHalfCount,
+};
+
+static inline NSUInteger RBKHistogramIndexForValue(uint64_t value) {
+    if (value < RBKHistogramSubBucketCount) {
+        return (NSUInteger)value;
+    }
+    unsigned int exponent = (63 - __builtin_clzll(value)) - (RBKHistogramSubBucketBits - 1);
+    uint64_t mantissa = value >> exponent;
+    return RBKHistogramSubBucketCount + (exponent - 1) * RBKHistogramSubBucketHalfCount + (NSUInteger)(mantissa - RBKHistogramSubBucketHalfCount);
+}
+
+static inline uint64_t RBKHistogramHighestValueForIndex(NSUInteger index) {
+    if (index < RBKHistogramSubBucketCount) {
+        return index;
+    }
+    unsigned int exponent = (unsigned int)((index - RBKHistogramSubBucketCount) / RBKHistogramSubBucketHalfCount) + 1;
+    uint64_t mantissa = (index - RBKHistogramSubBucketCount) % RBKHistogramSubBucketHalfCount + RBKHistogramSubBucketHalfCount;
+    return (mantissa << exponent) + ((1ULL << exponent) - 1);
+}
+
+@implementation RBKLatencyHistogram {
+    volatile int64_t _counts[RBKHistogramBucketCount];
+    volatile int64_t _count;
+    volatile int64_t _sum;
+    volatile int64_t _maximum;
+}
+
+- (void)recordValue:(uint64_t)nanoseconds {
+    OSAtomicIncrement64(&_counts[RBKHistogramIndexForValue(nanoseconds)]);
+    OSAtomicIncrement64(&_count);
+    OSAtomicAdd64((int64_t)nanoseconds, &_sum);
+
+    int64_t maximum = _maximum;
+    while ((int64_t)nanoseconds > maximum && !OSAtomicCompareAndSwap64(maximum, (int64_t)nanoseconds, &_maximum)) {
+        maximum = _maximum;
+    }
+}
+
+- (uint64_t)count {
+    return (uint64_t)_count;
+}
+
+- (uint64_t)maximum {
+    return (uint64_t)_maximum;
+}
+
+- (double)mean {
+    int64_t count = _count;
+    return count > 0 ? _sum / (double)count : 0;
+}
+
+- (uint64_t)valueAtPercentile:(double)percentile {
+    int64_t count = _count;
+    if (count == 0) {
+        return 0;
+    }
+
+    int64_t target = (int64_t)ceil(MIN(MAX(percentile, 0), 100) / 100.0 * count);
+    target = MAX(target, 1);
+
+    int64_t cumulative = 0;
+    for (NSUInteger idx = 0; idx < RBKHistogramBucketCount; idx++) {
+        cumulative += _counts[idx];
+        if (cumulative >= target) {
+            return MIN(RBKHistogramHighestValueForIndex(idx), (uint64_t)_maximum);
+        }
+    }
+    return (uint64_t)_maximum;
+}
+
+- (void)reset {
+    for (NSUInteger idx = 0; idx < RBKHistogramBucketCount; idx++) {
+        _counts[idx] = 0;
+    }
+    _count = 0;
+    _sum = 0;
+    _maximum = 0;
+    OSMemoryBarrier();
+}
+
+- (NSDictionary *)dictionaryRepresentation {
+    return @{@"count": @(self.count),
+             @"mean_ns": @(self.mean),
+             @"p50_ns": @([self valueAtPercentile:50]),
+             @"p90_ns": @([self valueAtPercentile:90]),
+             @"p99_ns": @([self valueAtPercentile:99]),
+             @"p999_ns": @([self valueAtPercentile:99.9]),
+             @"max_ns": @(self.maximum)};
+}
+
+@end
+
+#pragma mark - RBKSubscriptionMetrics
+
+@interface RBKSubscriptionMetrics : NSObject {
+@public
+    volatile int64_t _messages;
+    volatile int64_t _conflatedMessages;
+    volatile int64_t _filteredMessages;
+    volatile int64_t _duplicateMessages;
+    volatile int64_t _firstMessageTime;
+    volatile int64_t _lastMessageTime;
+}
+
+@end
+
+@implementation RBKSubscriptionMetrics
+
+- (NSDictionary *)dictionaryRepresentation {
+    int64_t messages = _messages;
+    int64_t elapsed = _lastMessageTime - _firstMessageTime;
+    double messagesPerSecond = (messages > 1 && elapsed > 0) ? (messages - 1) / (elapsed / (double)NSEC_PER_SEC) : 0;
+    return @{@"messages": @(messages), @"messages_per_sec": @(messagesPerSecond), @"conflated": @(_conflatedMessages), @"filtered": @(_filteredMessages), @"duplicates": @(_duplicateMessages)};
+}
+
+@end
+
+#pragma mark - RBKSocketMetrics
+
+static inline volatile int64_t *RBKControlFrameCounter(NSString *opcode, volatile int64_t *ping, volatile int64_t *pong, volatile int64_t *close) {
+    if ([opcode isEqualToString:RBKSocketMetricsOpcodePing]) {
+        return ping;
+    } else if ([opcode isEqualToString:RBKSocketMetricsOpcodePong]) {
+        return pong;
+    } else if ([opcode isEqualToString:RBKSocketMetricsOpcodeClose]) {
+        return close;
+    }
+    return NULL;
+}
+
+@interface RBKSocketMetrics ()
+
+@property (readwrite, nonatomic, strong) RBKLatencyHistogram *operationLatency;
+@property (strong, nonatomic) NSMutableDictionary *subscriptions;
+@property (strong, nonatomic) NSMutableDictionary *gauges;
+
+@end
+
+@implementation RBKSocketMetrics {
+    volatile int64_t _textFramesSent;
+    volatile int64_t _binaryFramesSent;
+    volatile int64_t _bytesSent;
+    volatile int64_t _textFramesReceived;
+    volatile int64_t _binaryFramesReceived;
+    volatile int64_t _bytesReceived;
+    volatile int64_t _pingsSent;
+    volatile int64_t _pongsSent;
+    volatile int64_t _closesSent;
+    volatile int64_t _pingsReceived;
+    volatile int64_t _pongsReceived;
+    volatile int64_t _closesReceived;
+    volatile int64_t _opens;
+    volatile int64_t _reconnects;
+    volatile int32_t _disconnected; // 1 after a close or failure, until the next open
+    volatile int64_t _closes;
+    volatile int64_t _failures;
+    volatile int64_t _operationsStarted;
+    volatile int64_t _operationsCompleted;
+    volatile int64_t _operationsFailed;
+    OSSpinLock _lock; // guards subscriptions and gauges
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _operationLatency = [[RBKLatencyHistogram alloc] init];
+        _subscriptions = [NSMutableDictionary dictionary];
+        _gauges = [NSMutableDictionary dictionary];
+        _lock = OS_SPINLOCK_INIT;
+    }
+    return self;
+}
+
+#pragma mark - Frames
+
+- (void)recordSentFrame:(id)frame {
+    if ([frame isKindOfClass:[NSString class]]) {
+        OSAtomicIncrement64(&_textFramesSent);
+        OSAtomicAdd64((int64_t)[frame lengthOfBytesUsingEncoding:NSUTF8StringEncoding], &_bytesSent);
+    } else if ([frame isKindOfClass:[NSData class]]) {
+        OSAtomicIncrement64(&_binaryFramesSent);
+        OSAtomicAdd64((int64_t)[frame length], &_bytesSent);
+    }
+}
+
+- (void)recordReceivedFrame:(id)frame {
+    if ([frame isKindOfClass:[NSString class]]) {
+        OSAtomicIncrement64(&_textFramesReceived);
+        OSAtomicAdd64((int64_t)[frame lengthOfBytesUsingEncoding:NSUTF8StringEncoding], &_bytesReceived);
+    } else if ([frame isKindOfClass:[NSData class]]) {
+        OSAtomicIncrement64(&_binaryFramesReceived);
+        OSAtomicAdd64((int64_t)[frame length], &_bytesReceived);
+    }
+}
+
+- (void)recordSentControlFrameWithOpcode:(NSString *)opcode {
+    volatile int64_t *counter = RBKControlFrameCounter(opcode, &_pingsSent, &_pongsSent, &_closesSent);
+    if (counter) {
+        OSAtomicIncrement64(counter);
+    }
+}
+
+- (void)recordReceivedControlFrameWithOpcode:(NSString *)opcode {
+    volatile int64_t *counter = RBKControlFrameCounter(opcode, &_pingsReceived, &_pongsReceived, &_closesReceived);
+    if (counter) {
+        OSAtomicIncrement64(counter);
+    }
+}
+
+#pragma mark - Connection
+
+- (void)recordSocketOpened {
+    OSAtomicIncrement64(&_opens);
+    if (OSAtomicCompareAndSwap32(1, 0, &_disconnected)) {
+        OSAtomicIncrement64(&_reconnects);
+    }
+}
+
+- (void)recordSocketClosed {
+    OSAtomicIncrement64(&_closes);
+    _disconnected = 1;
+    OSMemoryBarrier();
+}
+
+- (void)recordSocketFailed {
+    OSAtomicIncrement64(&_failures);
+    _disconnected = 1;
+    OSMemoryBarrier();
+}
+
+#pragma mark - Operations
+
+- (void)recordOperationStarted {
+    OSAtomicIncrement64(&_operationsStarted);
+}
+
+- (void)recordOperationCompletedWithLatency:(uint64_t)nanoseconds {
+    OSAtomicIncrement64(&_operationsCompleted);
+    [self.operationLatency recordValue:nanoseconds];
+}
+
+- (void)recordOperationFailed {
+    OSAtomicIncrement64(&_operationsFailed);
+}
+
+#pragma mark - Subscriptions
+
+- (RBKSubscriptionMetrics *)subscriptionMetricsForID:(NSString *)subscriptionID now:(int64_t)now {
+    OSSpinLockLock(&_lock);
+    RBKSubscriptionMetrics *subscription = self.subscriptions[subscriptionID];
+    if (!subscription) {
+        subscription = [[RBKSubscriptionMetrics alloc] init];
+        subscription->_firstMessageTime = now;
+        self.subscriptions[subscriptionID] = subscription;
+    }
+    OSSpinLockUnlock(&_lock);
+    return subscription;
+}
+
+- (void)recordMessageForSubscriptionID:(NSString *)subscriptionID {
+    if (!subscriptionID) {
+        return;
+    }
+
+    int64_t now = (int64_t)RBKMonotonicNanoseconds();
+    RBKSubscriptionMetrics *subscription = [self subscriptionMetricsForID:subscriptionID now:now];
+    OSAtomicIncrement64(&subscription->_messages);
+    subscription->_lastMessageTime = now;
+}
+
+- (void)recordConflatedMessageForSubscriptionID:(NSString *)subscriptionID {
+    if (!subscriptionID) {
+        return;
+    }
+
+    RBKSubscriptionMetrics *subscription = [self subscriptionMetricsForID:subscriptionID now:(int64_t)RBKMonotonicNanoseconds()];
+    OSAtomicIncrement64(&subscription->_conflatedMessages);
+}
+
+- (void)recordFilteredMessageForSubscriptionID:(NSString *)subscriptionID {
+    if (!subscriptionID) {
+        return;
+    }
+
+    RBKSubscriptionMetrics *subscription = [self subscriptionMetricsForID:subscriptionID now:(int64_t)RBKMonotonicNanoseconds()];
+    OSAtomicIncrement64(&subscription->_filteredMessages);
+}
+
+- (void)recordDuplicateMessageForSubscriptionID:(NSString *)subscriptionID {
+    if (!subscriptionID) {
+        return;
+    }
+
+    RBKSubscriptionMetrics *subscription = [self subscriptionMetricsForID:subscriptionID now:(int64_t)RBKMonotonicNanoseconds()];
+    OSAtomicIncrement64(&subscription->_duplicateMessages);
+}
+
+- (void)removeSubscriptionID:(NSString *)subscriptionID {
+    if (!subscriptionID) {
+        return;
+    }
+
+    OSSpinLockLock(&_lock);
+    [self.subscriptions removeObjectForKey:subscriptionID];
+    OSSpinLockUnlock(&_lock);
+}
+
+#pragma mark - Gauges
+
+- (void)setGaugeWithName:(NSString *)name valueBlock:(NSNumber *(^)(void))valueBlock {
+    NSParameterAssert(name);
+
+    OSSpinLockLock(&_lock);
+    if (valueBlock) {
+        self.gauges[name] = [valueBlock copy];
+    } else {
+        [self.gauges removeObjectForKey:name];
+    }
+    OSSpinLockUnlock(&_lock);
+}
+
+#pragma mark - Snapshot
+
+- (NSDictionary *)snapshot {
+    OSSpinLockLock(&_lock);
+    NSDictionary *subscriptions = [self.subscriptions copy];
+    NSDictionary *gauges = [self.gauges copy];
+    OSSpinLockUnlock(&_lock);
+
+    NSMutableDictionary *subscriptionSnapshot = [NSMutableDictionary dictionary];
+    [subscriptions enumerateKeysAndObjectsUsingBlock:^(NSString *subscriptionID, RBKSubscriptionMetrics *subscription, BOOL *stop) {
+        subscriptionSnapshot[subscriptionID] = [subscription dictionaryRepresentation];
+    }];
+
+    // gauge blocks run outside the lock since they may call back into the socket
+    NSMutableDictionary *gaugeSnapshot = [NSMutableDictionary dictionary];
+    [gauges enumerateKeysAndObjectsUsingBlock:^(NSString *name, NSNumber *(^valueBlock)(void), BOOL *stop) {
+        NSNumber *value = valueBlock();
+        if (value) {
+            gaugeSnapshot[name] = value;
+        }
+    }];
+
+    return @{RBKSocketMetricsFramesSentKey: @(_textFramesSent + _binaryFramesSent),
+             RBKSocketMetricsFramesReceivedKey: @(_textFramesReceived + _binaryFramesReceived),
+             RBKSocketMetricsBytesSentKey: @(_bytesSent),
+             RBKSocketMetricsBytesReceivedKey: @(_bytesReceived),
+             RBKSocketMetricsOpcodesSentKey: @{RBKSocketMetricsOpcodeText: @(_textFramesSent), RBKSocketMetricsOpcodeBinary: @(_binaryFramesSent), RBKSocketMetricsOpcodePing: @(_pingsSent), RBKSocketMetricsOpcodePong: @(_pongsSent), RBKSocketMetricsOpcodeClose: @(_closesSent)},
+             RBKSocketMetricsOpcodesReceivedKey: @{RBKSocketMetricsOpcodeText: @(_textFramesReceived), RBKSocketMetricsOpcodeBinary: @(_binaryFramesReceived), RBKSocketMetricsOpcodePing: @(_pingsReceived), RBKSocketMetricsOpcodePong: @(_pongsReceived), RBKSocketMetricsOpcodeClose: @(_closesReceived)},
+             RBKSocketMetricsOpensKey: @(_opens),
+             RBKSocketMetricsReconnectsKey: @(_reconnects),
+             RBKSocketMetricsClosesKey: @(_closes),
+             RBKSocketMetricsFailuresKey: @(_failures),
+             RBKSocketMetricsOperationsStartedKey: @(_operationsStarted),
+             RBKSocketMetricsOperationsCompletedKey: @(_operationsCompleted),
+             RBKSocketMetricsOperationsFailedKey: @(_operationsFailed),
+             RBKSocketMetricsOperationLatencyKey: [self.operationLatency dictionaryRepresentation],
+             RBKSocketMetricsSubscriptionsKey: subscriptionSnapshot,
+             RBKSocketMetricsGaugesKey: gaugeSnapshot};
+}
+
+@end
@@ -10,6 +10,7 @@
 
 #import "RBKSocketResponseSerialization.h"
 #import "RoboSocket.h"
+#import "RBKTimingWheel.h"
 
 extern NSString * const RBKSocketNetworkingErrorDomain;
 
@@ -98,6 +99,22 @@ extern NSString * const RBKSocketOperationDidFinishNotification;
 
 @property (nonatomic, strong) RoboSocket *socket;
 
+/**
+ When both are set the operation stamps its network thread, receive, parse, dispatch and callback stages into the tracer.
+ */
+@property (nonatomic, strong) RBKSocketTracer *tracer;
+@property (nonatomic, assign) uint64_t traceIdentifier;
+
+/**
+ How long, in seconds, an operation that expects a response waits for it once its frame is sent. When it runs out the operation fails with `NSURLErrorTimedOut` in `RBKSocketNetworkingErrorDomain` and gives up the socket's response slot. 0 (the default) waits forever.
+ */
+@property (nonatomic, assign) NSTimeInterval timeoutInterval;
+
+/**
+ The wheel that tracks `timeoutInterval`, normally shared by every operation on the connection. Without one the operation never times out.
+ */
+@property (nonatomic, strong) RBKTimingWheel *timingWheel;
+
 - (instancetype)initWithRequestFrame:(id)frame expectResponse:(BOOL)expectResponse;
 - (instancetype)initWithRequestFrame:(id)frame; // assumes that a response is expected
 
@@ -106,7 +106,10 @@ static inline BOOL RBKSocketStateTransitionIsValid(RBKSocketOperationState fromS
 @property (readwrite, nonatomic, copy) NSString *responseString; // deprecate?
 
 @property (readwrite, nonatomic, strong) NSError *responseSerializationError;
+@property (assign, nonatomic, getter = isResponseSerialized) BOOL responseSerialized;
 @property (readwrite, nonatomic, strong) NSRecursiveLock *lock;
+@property (assign, nonatomic) uint64_t sendTime;
+@property (strong, nonatomic) RBKTimingWheelTimeout *timeout;
 
 @end
 
@@ -165,7 +168,9 @@ static inline BOOL RBKSocketStateTransitionIsValid(RBKSocketOperationState fromS
 
 - (id)responseObject {
     [self.lock lock];
-    if (!_responseObject && [self isFinished] && !self.error) {
+    // only once: serializing a frame has side effects such as acknowledging it, and nil is a result too, e.g. for a MESSAGE a filter dropped
+    if (!self.isResponseSerialized && [self isFinished] && !self.error) {
+        self.responseSerialized = YES;
         NSError *error = nil;
         self.responseObject = [self.responseSerializer responseObjectForResponseFrame:self.responseFrame error:&error];
         if (error) {
@@ -195,6 +200,23 @@ static inline BOOL RBKSocketStateTransitionIsValid(RBKSocketOperationState fromS
 }
 
 
+- (void)setCompletionBlock:(void (^)(void))block {
+    [self.lock lock];
+    if (!block) {
+        [super setCompletionBlock:nil];
+    } else {
+        // nil out the completion block once it has run to break the retain cycle it has with the operation
+        __weak __typeof(self)weakSelf = self;
+        [super setCompletionBlock:^ {
+            __strong __typeof(weakSelf)strongSelf = weakSelf;
+            block();
+            [strongSelf setCompletionBlock:nil];
+        }];
+    }
+    [self.lock unlock];
+}
+
+
 #pragma mark - RBKSocketOperation
 
 - (void)setCompletionBlockWithSuccess:(void (^)(RBKSocketOperation *operation, id responseObject))success
@@ -212,21 +234,28 @@ static inline BOOL RBKSocketStateTransitionIsValid(RBKSocketOperationState fromS
         dispatch_async(socket_operation_processing_queue(), ^{
             if (self.error) {
                 if (failure) {
+                    [self recordTraceStage:RBKSocketTraceStageDispatch];
                     dispatch_group_async(self.completionGroup ?: socket_operation_completion_group(), self.completionQueue ?: dispatch_get_main_queue(), ^{
+                        [self recordTraceStage:RBKSocketTraceStageCallback];
                         failure(self, self.error);
                     });
                 }
             } else {
                 id responseObject = self.responseObject;
+                [self recordTraceStage:RBKSocketTraceStageParse];
                 if (self.error) {
                     if (failure) {
+                        [self recordTraceStage:RBKSocketTraceStageDispatch];
                         dispatch_group_async(self.completionGroup ?: socket_operation_completion_group(), self.completionQueue ?: dispatch_get_main_queue(), ^{
+                            [self recordTraceStage:RBKSocketTraceStageCallback];
                             failure(self, self.error);
                         });
                     }
                 } else {
                     if (success) {
+                        [self recordTraceStage:RBKSocketTraceStageDispatch];
                         dispatch_group_async(self.completionGroup ?: socket_operation_completion_group(), self.completionQueue ?: dispatch_get_main_queue(), ^{
+                            [self recordTraceStage:RBKSocketTraceStageCallback];
                             success(self, responseObject);
                         });
                     }
@@ -242,6 +271,14 @@ static inline BOOL RBKSocketStateTransitionIsValid(RBKSocketOperationState fromS
 }
 
 
+#pragma mark - Tracing
+
+- (void)recordTraceStage:(RBKSocketTraceStage)stage {
+    if (self.traceIdentifier) {
+        [self.tracer recordStage:stage traceIdentifier:self.traceIdentifier];
+    }
+}
+
 #pragma mark - NSOperation
 
 - (BOOL)isReady {
@@ -277,7 +314,19 @@ static inline BOOL RBKSocketStateTransitionIsValid(RBKSocketOperationState fromS
         // NSLog(@"start socket operation");
         
         self.socket.responseFrameDelegate = self;
-        [self.socket sendFrame:self.requestFrame];
+        [self recordTraceStage:RBKSocketTraceStageNetworkThread];
+        if (self.socket.metrics && self.isResponseExpected) {
+            [self.socket.metrics recordOperationStarted];
+            self.sendTime = RBKMonotonicNanoseconds();
+        }
+        if (self.isResponseExpected && self.timeoutInterval > 0) {
+            __weak __typeof(self)weakSelf = self;
+            self.timeout = [self.timingWheel scheduleTimeoutWithInterval:self.timeoutInterval handler:^{
+                __strong __typeof(weakSelf)strongSelf = weakSelf;
+                [strongSelf performSelector:@selector(timeoutConnection) onThread:[[strongSelf class] networkRequestThread] withObject:nil waitUntilDone:NO modes:[strongSelf.runLoopModes allObjects]];
+            }];
+        }
+        [self.socket sendFrame:self.requestFrame highPriority:self.queuePriority > NSOperationQueuePriorityNormal];
         
     }
     [self.lock unlock];
@@ -287,7 +336,7 @@ static inline BOOL RBKSocketStateTransitionIsValid(RBKSocketOperationState fromS
     });
     
     if ([self isCancelled]) {
-        [self finish];
+        [self cancelConnection];
     }
     if (!self.isResponseExpected) {
         [self finish];
@@ -295,10 +344,22 @@ static inline BOOL RBKSocketStateTransitionIsValid(RBKSocketOperationState fromS
 }
 
 - (void)finish {
+    [self.lock lock];
+    if ([self isFinished]) {
+        [self.lock unlock];
+        return;
+    }
     self.state = RBKSocketOperationFinishedState;
     
-    self.socket.responseFrameDelegate = nil;
+    [self.timeout cancel];
+    self.timeout = nil;
+    
+    // a later operation may already own the response slot
+    if (self.socket.responseFrameDelegate == self) {
+        self.socket.responseFrameDelegate = nil;
+    }
     self.socket = nil;
+    [self.lock unlock];
     
     dispatch_async(dispatch_get_main_queue(), ^{
         [[NSNotificationCenter defaultCenter] postNotificationName:RBKSocketOperationDidFinishNotification object:self];
@@ -320,19 +381,27 @@ static inline BOOL RBKSocketStateTransitionIsValid(RBKSocketOperationState fromS
 }
 
 - (void)cancelConnection {
-    NSDictionary *userInfo = nil;
-    
-    // instead of a request, we have a frame
-    
-    if (0 /*[self.request URL]*/) {
-        userInfo = [NSDictionary dictionaryWithObject:@"our-socket?" /*[self.request URL]*/ forKey:NSURLErrorFailingURLErrorKey];
-    }
-    // NSError *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:userInfo];
-    
-    if (![self isFinished] /*&& self.connection*/) {
-        // [self.connection cancel];
-        // [self performSelector:@selector(connection:didFailWithError:) withObject:self.connection withObject:error];
+    // instead of a request, we have a frame, so there is no connection to cancel; just stop waiting for the response
+    NSError *error = [NSError errorWithDomain:RBKSocketNetworkingErrorDomain code:NSURLErrorCancelled userInfo:nil];
+    [self failWithError:error];
+}
+
+- (void)timeoutConnection {
+    NSDictionary *userInfo = @{NSLocalizedDescriptionKey: [NSString stringWithFormat:@"No response within %.3gs", self.timeoutInterval]};
+    NSError *error = [NSError errorWithDomain:RBKSocketNetworkingErrorDomain code:NSURLErrorTimedOut userInfo:userInfo];
+    [self failWithError:error];
+}
+
+- (void)failWithError:(NSError *)error {
+    [self.lock lock];
+    if (![self isFinished]) {
+        if (self.sendTime) {
+            [self.socket.metrics recordOperationFailed];
+        }
+        self.error = error;
+        [self finish];
     }
+    [self.lock unlock];
 }
 
 #pragma mark - RBKSocketFrameDelegate
@@ -341,6 +410,13 @@ static inline BOOL RBKSocketStateTransitionIsValid(RBKSocketOperationState fromS
 // or NSData if the server is using binary.
 - (void)webSocket:(RoboSocket *)webSocket didReceiveFrame:(id)frame {
     // NSLog(@"received Frame");
+    if ([self isFinished]) {
+        return; // it arrived after the operation timed out or was cancelled
+    }
+    [self recordTraceStage:RBKSocketTraceStageReceive];
+    if (self.sendTime) {
+        [self.socket.metrics recordOperationCompletedWithLatency:RBKMonotonicNanoseconds() - self.sendTime];
+    }
     self.responseFrame = frame;
     
     [self finish];
@@ -349,6 +425,9 @@ static inline BOOL RBKSocketStateTransitionIsValid(RBKSocketOperationState fromS
 - (void)webSocket:(RoboSocket *)webSocket didFailWithError:(NSError *)error {
     NSLog(@"websocket failed with error %@", [error localizedDescription]);
     
+    if (self.sendTime) {
+        [self.socket.metrics recordOperationFailed];
+    }
     self.error = error;
     
     [self finish];
@@ -0,0 +1,53 @@
+//
+//  RBKSocketReplay.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class RBKWebSocket;
+@class RBKSocketCaptureReader;
+
+/**
+ Plays the server's side of a capture back to a `RBKWebSocket` or `RBKSTOMPSocket`, with no broker involved. The replay is the server end of an in-memory loopback connection: every inbound text and binary message in the capture is sent to the socket in order, and whatever the socket sends is counted and discarded.
+ */
+@interface RBKSocketReplay : NSObject
+
+@property (readonly, nonatomic, strong) RBKSocketCaptureReader *reader;
+
+/**
+ Send each message at the offset from the first one it was captured at. YES by default; NO sends them as fast as the socket reads them.
+ */
+@property (assign, nonatomic) BOOL preservesTiming;
+
+/**
+ How much faster than captured a timed replay runs. 1 by default.
+ */
+@property (assign, nonatomic) double speed;
+
+/**
+ Messages sent to the socket and received from it so far.
+ */
+@property (readonly, nonatomic, assign) NSUInteger numberOfReplayedMessages;
+@property (readonly, nonatomic, assign) NSUInteger numberOfReceivedMessages;
+
+- (instancetype)initWithReader:(RBKSocketCaptureReader *)reader;
+
+/**
+ Points `socket` at the replay instead of its URL. Call right after creating the socket, before it opens on the main queue's next turn.
+ */
+- (void)connectSocket:(RBKWebSocket *)socket;
+
+/**
+ Starts sending once the socket has connected. `completion` is called on the main queue after the last message has been handed to the connection.
+ */
+- (void)startWithCompletion:(dispatch_block_t)completion;
+
+/**
+ Stops sending and closes the connection.
+ */
+- (void)stop;
+
+@end
@@ -0,0 +1,160 @@
+//
+//  RBKSocketReplay.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKSocketReplay.h"
+#import "RBKSocketCapture.h"
+#import "RBKSocketMetrics.h"
+#import "RBKWebSocket.h"
+
+#import <SocketRocket/SRServerSocket.h>
+#import <SocketRocket/SRWebSocket.h>
+
+// an untimed replay waits for the connection to drain below this before sending more
+static const NSUInteger RBKSocketReplayMaximumBufferedBytes = 1024 * 1024;
+static const int64_t RBKSocketReplayDrainInterval = NSEC_PER_MSEC;
+
+@interface RBKSocketReplay () <SRWebSocketDelegate>
+
+@property (readwrite, nonatomic, strong) RBKSocketCaptureReader *reader;
+@property (readwrite, nonatomic, assign) NSUInteger numberOfReplayedMessages;
+@property (readwrite, nonatomic, assign) NSUInteger numberOfReceivedMessages;
+@property (strong, nonatomic) SRServerSocket *serverSocket;
+@property (strong, nonatomic) dispatch_queue_t replayQueue;
+@property (copy, nonatomic) dispatch_block_t completion;
+@property (assign, nonatomic, getter = isServerOpen) BOOL serverOpen;
+@property (assign, nonatomic, getter = isStarted) BOOL started;
+@property (assign, nonatomic, getter = isStopped) BOOL stopped;
+@property (assign, nonatomic) NSUInteger nextIndex;
+@property (assign, nonatomic, getter = isTimelineStarted) BOOL timelineStarted;
+@property (assign, nonatomic) uint64_t firstTimestamp; // capture time of the first replayed message
+@property (assign, nonatomic) uint64_t startTime;      // when it was replayed
+
+@end
+
+@implementation RBKSocketReplay
+
+- (instancetype)init {
+    @throw [NSException exceptionWithName:NSInternalInconsistencyException reason:[NSString stringWithFormat:@"%@ Failed to call designated initializer. Invoke `initWithReader:` instead.", NSStringFromClass([self class])] userInfo:nil];
+}
+
+- (instancetype)initWithReader:(RBKSocketCaptureReader *)reader {
+    NSParameterAssert(reader);
+
+    self = [super init];
+    if (self) {
+        _reader = reader;
+        _preservesTiming = YES;
+        _speed = 1.0;
+        _replayQueue = dispatch_queue_create("com.robotsandpencils.networking.replay", DISPATCH_QUEUE_SERIAL);
+        _serverSocket = [[SRServerSocket alloc] initWithURL:[NSURL URLWithString:@"ws://localhost"]];
+        [_serverSocket setDelegateDispatchQueue:_replayQueue];
+        _serverSocket.delegate = self;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    _serverSocket.delegate = nil;
+    [_serverSocket close];
+}
+
+- (void)connectSocket:(RBKWebSocket *)socket {
+    [socket connectToLoopbackServer:self.serverSocket];
+}
+
+- (void)startWithCompletion:(dispatch_block_t)completion {
+    dispatch_async(self.replayQueue, ^{
+        self.completion = completion;
+        self.started = YES;
+        if (self.isServerOpen) {
+            [self replayDueMessages];
+        }
+    });
+}
+
+- (void)stop {
+    dispatch_sync(self.replayQueue, ^{
+        self.stopped = YES;
+        self.completion = nil;
+    });
+    [self.serverSocket close];
+}
+
+#pragma mark - Private
+
+// runs on the replay queue until it runs out of messages or has to wait for one
+- (void)replayDueMessages {
+    if (self.isStopped) {
+        return;
+    }
+    RBKSocketCaptureReader *reader = self.reader;
+    NSUInteger count = reader.numberOfRecords;
+    __weak typeof(self)weakSelf = self;
+
+    while (self.nextIndex < count) {
+        RBKSocketCaptureRecord record = [reader recordAtIndex:self.nextIndex];
+        if (record.direction != RBKSocketCaptureDirectionInbound || (record.opcode != RBKSocketCaptureOpcodeText && record.opcode != RBKSocketCaptureOpcodeBinary)) {
+            // the socket sends its own frames, and the server answers pings by itself
+            self.nextIndex += 1;
+            continue;
+        }
+
+        uint64_t now = RBKMonotonicNanoseconds();
+        if (!self.isTimelineStarted) {
+            self.timelineStarted = YES;
+            self.firstTimestamp = record.timestamp;
+            self.startTime = now;
+        }
+        if (self.preservesTiming) {
+            uint64_t dueTime = self.startTime + (uint64_t)((record.timestamp - self.firstTimestamp) / MAX(self.speed, DBL_MIN));
+            if (dueTime > now) {
+                dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(dueTime - now)), self.replayQueue, ^{
+                    [weakSelf replayDueMessages];
+                });
+                return;
+            }
+        } else if ([self.serverSocket bufferedAmount] >= RBKSocketReplayMaximumBufferedBytes) {
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, RBKSocketReplayDrainInterval), self.replayQueue, ^{
+                [weakSelf replayDueMessages];
+            });
+            return;
+        }
+
+        [self.serverSocket send:[reader messageForRecord:record]];
+        self.nextIndex += 1;
+        self.numberOfReplayedMessages += 1;
+    }
+
+    dispatch_block_t completion = self.completion;
+    self.completion = nil;
+    if (completion) {
+        dispatch_async(dispatch_get_main_queue(), completion);
+    }
+}
+
+#pragma mark - SRWebSocketDelegate
+
+- (void)webSocketDidOpen:(SRWebSocket *)webSocket {
+    self.serverOpen = YES;
+    if (self.isStarted) {
+        [self replayDueMessages];
+    }
+}
+
+- (void)webSocket:(SRWebSocket *)webSocket didReceiveMessage:(id)message {
+    self.numberOfReceivedMessages += 1;
+}
+
+- (void)webSocket:(SRWebSocket *)webSocket didFailWithError:(NSError *)error {
+    self.stopped = YES;
+}
+
+- (void)webSocket:(SRWebSocket *)webSocket didCloseWithCode:(NSInteger)code reason:(NSString *)reason wasClean:(BOOL)wasClean {
+    self.stopped = YES;
+}
+
+@end
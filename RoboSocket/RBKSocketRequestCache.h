@@ -0,0 +1,76 @@
+//
+//  RBKSocketRequestCache.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "RBKClock.h"
+
+@class RBKSocketOperation;
+
+/**
+ Returns the key a serialized request frame is answered under, or nil to always send it.
+ */
+typedef id<NSCopying> (^RBKSocketRequestCacheKeyBlock)(id requestFrame);
+
+/**
+ Returns a new operation that expects a response, for the same request, to send on behalf of everyone waiting on it.
+ */
+typedef RBKSocketOperation *(^RBKSocketRequestCacheFlightBlock)(void);
+
+/**
+ Answers identical requests with one round trip. A request whose key matches one in flight waits for that operation's response instead of sending its own, and a response stays cached for `timeToLive` seconds so later requests with the key are answered without sending anything. At most `capacity` responses are kept; the least recently used goes first. Failures are passed to every waiting request but not cached. Each caller gets an operation of its own, so one cancelling doesn't cancel the request for the rest.
+
+ Only suits request/reply protocols, where a request's only reply is its response and sending it twice gets the same answer. Everyone answered by an operation shares its response object. Safe to use from any thread.
+ */
+@interface RBKSocketRequestCache : NSObject
+
+@property (readonly, nonatomic, assign) NSUInteger capacity;
+
+/**
+ How long, in seconds, a response is served from the cache. 0 only shares operations in flight.
+ */
+@property (readonly, nonatomic, assign) NSTimeInterval timeToLive;
+
+/**
+ Where `timeToLive` is measured. `RBKSystemClock` by default.
+ */
+@property (strong, nonatomic) id<RBKClock> clock;
+
+/**
+ Picks the key of a request from its serialized frame, for instance an identifier inside it. By default, a frame serialized to a string or data is its own key and any other frame is always sent.
+ */
+@property (copy, nonatomic) RBKSocketRequestCacheKeyBlock keyBlock;
+
+@property (readonly, nonatomic, assign) NSUInteger numberOfResponses;
+
+/**
+ Requests answered from the cache, and requests that waited for an operation already in flight.
+ */
+@property (readonly, nonatomic, assign) uint64_t numberOfHits;
+@property (readonly, nonatomic, assign) uint64_t numberOfCoalescedRequests;
+
++ (instancetype)cacheWithCapacity:(NSUInteger)capacity timeToLive:(NSTimeInterval)timeToLive;
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity timeToLive:(NSTimeInterval)timeToLive;
+
+/**
+ Answers the request of `operation`, a new operation that expects a response and hasn't been sent. A request with a cached response, or with the key of one in flight, is answered from it and nil returned. Otherwise returns the operation to send: `operation` itself if the request has no key, or else a new one from `flightBlock`, which then answers every request with its key until it finishes.
+
+ A request with a key is answered on `operation`, which is the caller's own handle and is never sent: `success` or `failure` is called with it on its `completionQueue`, or the main queue. Cancelling it only stops this caller waiting, with `NSURLErrorCancelled`; the request goes on for everyone else.
+ */
+- (RBKSocketOperation *)flightOperationForOperation:(RBKSocketOperation *)operation
+                                            success:(void (^)(RBKSocketOperation *operation, id responseObject))success
+                                            failure:(void (^)(RBKSocketOperation *operation, NSError *error))failure
+                                        flightBlock:(RBKSocketRequestCacheFlightBlock)flightBlock;
+
+/**
+ Forgets cached responses. Operations in flight still answer the requests already waiting on them.
+ */
+- (void)removeResponseForKey:(id<NSCopying>)key;
+- (void)removeAllResponses;
+
+@end
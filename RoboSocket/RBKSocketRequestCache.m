@@ -0,0 +1,262 @@
+//
+//  RBKSocketRequestCache.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKSocketRequestCache.h"
+#import "RBKSocketOperation.h"
+
+typedef void (^RBKSocketRequestCacheWaiterBlock)(id responseObject, NSError *error);
+
+static id<NSCopying> RBKSocketRequestCacheDefaultKey(id requestFrame) {
+    if ([requestFrame isKindOfClass:[NSString class]] || [requestFrame isKindOfClass:[NSData class]]) {
+        return [requestFrame copy];
+    }
+    return nil;
+}
+
+/**
+ A cached response, linked into the recency list. The cache's dictionary owns the entries; the links are weak, so a long list is never released recursively.
+ */
+@interface RBKSocketRequestCacheEntry : NSObject
+
+@property (strong, nonatomic) id<NSCopying> key;
+@property (strong, nonatomic) id responseObject;
+@property (assign, nonatomic) uint64_t expirationTime;
+@property (weak, nonatomic) RBKSocketRequestCacheEntry *previous; // more recently used
+@property (weak, nonatomic) RBKSocketRequestCacheEntry *next; // less recently used
+
+@end
+
+@implementation RBKSocketRequestCacheEntry
+@end
+
+/**
+ Everyone waiting on the response of an operation in flight.
+ */
+@interface RBKSocketRequestCacheFlight : NSObject
+
+@property (strong, nonatomic) NSMutableArray *waiters;
+
+@end
+
+@implementation RBKSocketRequestCacheFlight
+@end
+
+@interface RBKSocketRequestCache ()
+
+@property (readwrite, nonatomic, assign) NSUInteger capacity;
+@property (readwrite, nonatomic, assign) NSTimeInterval timeToLive;
+@property (strong, nonatomic) NSLock *lock;
+@property (strong, nonatomic) NSMutableDictionary *entries;
+@property (strong, nonatomic) NSMutableDictionary *flights;
+@property (weak, nonatomic) RBKSocketRequestCacheEntry *mostRecentlyUsedEntry;
+@property (weak, nonatomic) RBKSocketRequestCacheEntry *leastRecentlyUsedEntry;
+
+@end
+
+@implementation RBKSocketRequestCache {
+    uint64_t _timeToLiveNanoseconds;
+    uint64_t _hitCount;
+    uint64_t _coalescedCount;
+}
+
++ (instancetype)cacheWithCapacity:(NSUInteger)capacity timeToLive:(NSTimeInterval)timeToLive {
+    return [[self alloc] initWithCapacity:capacity timeToLive:timeToLive];
+}
+
+- (instancetype)init {
+    @throw [NSException exceptionWithName:NSInternalInconsistencyException reason:[NSString stringWithFormat:@"%@ Failed to call designated initializer. Invoke `initWithCapacity:timeToLive:` instead.", NSStringFromClass([self class])] userInfo:nil];
+}
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity timeToLive:(NSTimeInterval)timeToLive {
+    self = [super init];
+    if (self) {
+        _capacity = capacity;
+        _timeToLive = MAX(timeToLive, 0);
+        _timeToLiveNanoseconds = (uint64_t)(_timeToLive * NSEC_PER_SEC);
+        _clock = [RBKSystemClock sharedClock];
+        _lock = [[NSLock alloc] init];
+        _entries = [NSMutableDictionary dictionary];
+        _flights = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (NSUInteger)numberOfResponses {
+    [self.lock lock];
+    NSUInteger count = [self.entries count];
+    [self.lock unlock];
+    return count;
+}
+
+- (uint64_t)numberOfHits {
+    [self.lock lock];
+    uint64_t count = _hitCount;
+    [self.lock unlock];
+    return count;
+}
+
+- (uint64_t)numberOfCoalescedRequests {
+    [self.lock lock];
+    uint64_t count = _coalescedCount;
+    [self.lock unlock];
+    return count;
+}
+
+#pragma mark - Public
+
+- (RBKSocketOperation *)flightOperationForOperation:(RBKSocketOperation *)operation
+                                            success:(void (^)(RBKSocketOperation *operation, id responseObject))success
+                                            failure:(void (^)(RBKSocketOperation *operation, NSError *error))failure
+                                        flightBlock:(RBKSocketRequestCacheFlightBlock)flightBlock {
+    RBKSocketRequestCacheKeyBlock keyBlock = self.keyBlock;
+    id<NSCopying> key = keyBlock ? keyBlock(operation.requestFrame) : RBKSocketRequestCacheDefaultKey(operation.requestFrame);
+    if (!key) {
+        return operation;
+    }
+
+    // the caller's operation is only its handle, so cancelling it stops this caller waiting and nobody else
+    RBKSocketRequestCacheWaiterBlock waiter = ^(id responseObject, NSError *error) {
+        if ([operation isCancelled]) {
+            return; // its own completion block reports the cancellation
+        }
+        [operation setCompletionBlock:nil]; // never runs now, so break its retain cycle here
+        if (error) {
+            if (failure) {
+                failure(operation, error);
+            }
+        } else if (success) {
+            success(operation, responseObject);
+        }
+    };
+
+    uint64_t now = _timeToLiveNanoseconds > 0 ? [self.clock now] : 0;
+    [self.lock lock];
+    RBKSocketRequestCacheEntry *entry = self.entries[key];
+    if (entry && entry.expirationTime <= now) {
+        [self removeEntry:entry];
+        entry = nil;
+    }
+    if (entry) {
+        [self removeEntry:entry];
+        [self insertEntry:entry];
+        _hitCount += 1;
+        [self.lock unlock];
+
+        id responseObject = entry.responseObject;
+        dispatch_async(operation.completionQueue ?: dispatch_get_main_queue(), ^{
+            waiter(responseObject, nil);
+        });
+        return nil;
+    }
+
+    RBKSocketRequestCacheFlight *flight = self.flights[key];
+    if (flight) {
+        [flight.waiters addObject:waiter];
+        _coalescedCount += 1;
+        [self.lock unlock];
+        return nil;
+    }
+
+    flight = [[RBKSocketRequestCacheFlight alloc] init];
+    flight.waiters = [NSMutableArray arrayWithObject:waiter];
+    self.flights[key] = flight;
+    [self.lock unlock];
+
+    // the operation holds on to the cache until it finishes, so nobody is left waiting
+    RBKSocketOperation *flightOperation = flightBlock();
+    if (!flightOperation) {
+        [self finishFlightWithKey:key responseObject:nil error:[NSError errorWithDomain:RBKSocketNetworkingErrorDomain code:-1 userInfo:nil]];
+        return nil;
+    }
+    flightOperation.completionQueue = operation.completionQueue;
+    [flightOperation setCompletionBlockWithSuccess:^(RBKSocketOperation *answeringOperation, id responseObject) {
+        [self finishFlightWithKey:key responseObject:responseObject error:nil];
+    } failure:^(RBKSocketOperation *answeringOperation, NSError *error) {
+        [self finishFlightWithKey:key responseObject:nil error:error];
+    }];
+    return flightOperation;
+}
+
+- (void)removeResponseForKey:(id<NSCopying>)key {
+    [self.lock lock];
+    RBKSocketRequestCacheEntry *entry = self.entries[key];
+    if (entry) {
+        [self removeEntry:entry];
+    }
+    [self.lock unlock];
+}
+
+- (void)removeAllResponses {
+    [self.lock lock];
+    [self.entries removeAllObjects];
+    self.mostRecentlyUsedEntry = nil;
+    self.leastRecentlyUsedEntry = nil;
+    [self.lock unlock];
+}
+
+#pragma mark - Private
+
+- (void)finishFlightWithKey:(id<NSCopying>)key responseObject:(id)responseObject error:(NSError *)error {
+    uint64_t now = _timeToLiveNanoseconds > 0 ? [self.clock now] : 0;
+    [self.lock lock];
+    RBKSocketRequestCacheFlight *flight = self.flights[key];
+    [self.flights removeObjectForKey:key];
+    if (!error && self.capacity > 0 && _timeToLiveNanoseconds > 0) {
+        RBKSocketRequestCacheEntry *entry = self.entries[key];
+        if (entry) {
+            [self removeEntry:entry];
+        }
+        entry = [[RBKSocketRequestCacheEntry alloc] init];
+        entry.key = key;
+        entry.responseObject = responseObject;
+        entry.expirationTime = now + _timeToLiveNanoseconds;
+        [self insertEntry:entry];
+
+        while ([self.entries count] > self.capacity) {
+            [self removeEntry:self.leastRecentlyUsedEntry];
+        }
+    }
+    [self.lock unlock];
+
+    // already on the completion queue
+    for (RBKSocketRequestCacheWaiterBlock waiter in flight.waiters) {
+        waiter(responseObject, error);
+    }
+}
+
+#pragma mark Recency list
+
+- (void)insertEntry:(RBKSocketRequestCacheEntry *)entry {
+    self.entries[entry.key] = entry;
+    entry.previous = nil;
+    entry.next = self.mostRecentlyUsedEntry;
+    self.mostRecentlyUsedEntry.previous = entry;
+    self.mostRecentlyUsedEntry = entry;
+    if (!self.leastRecentlyUsedEntry) {
+        self.leastRecentlyUsedEntry = entry;
+    }
+}
+
+- (void)removeEntry:(RBKSocketRequestCacheEntry *)entry {
+    RBKSocketRequestCacheEntry *previous = entry.previous;
+    RBKSocketRequestCacheEntry *next = entry.next;
+    if (previous) {
+        previous.next = next;
+    } else {
+        self.mostRecentlyUsedEntry = next;
+    }
+    if (next) {
+        next.previous = previous;
+    } else {
+        self.leastRecentlyUsedEntry = previous;
+    }
+    entry.previous = nil;
+    entry.next = nil;
+    [self.entries removeObjectForKey:entry.key];
+}
+
+@end
@@ -376,6 +376,23 @@ extern NSTimeInterval const kRBKUploadStream3GSuggestedDelay;
 - (void)unsubscribedFromDestination:(NSString *)destination subscriptionID:(NSString *)subscriptionID;
 - (void)heartbeatSent;
 
+@optional
+
+/**
+ Called when a CONNECT or STOMP frame is serialized, with the heart-beat it asks for, so the outcome can be negotiated once CONNECTED arrives.
+ */
+- (void)connectingWithHeartbeat:(RBKStompHeartbeat)heartbeat;
+
+/**
+ Called after `subscribedToDestination:subscriptionID:acknowledgeMode:messageHandler:` for a SUBSCRIBE frame with a prefetch count.
+ */
+- (void)subscriptionID:(NSString *)subscriptionID limitedToPrefetchCount:(NSUInteger)prefetchCount;
+
+/**
+ Called when a NACK frame is serialized, with the `id` of the message it rejects.
+ */
+- (void)nackingMessageWithAckIdentifier:(NSString *)ackIdentifier;
+
 @end
 
 @interface RBKSocketStompRequestSerializer : RBKSocketRequestSerializer
@@ -1243,6 +1243,9 @@ typedef enum {
         }// otherwise pass our acknowledgeMode on, where nil is the same as auto
         
         [self.delegate subscribedToDestination:destination subscriptionID:subscriptionID acknowledgeMode:acknowledgeMode messageHandler:frameHandler];
+        if (stompFrame.prefetchCount > 0 && [self.delegate respondsToSelector:@selector(subscriptionID:limitedToPrefetchCount:)]) {
+            [self.delegate subscriptionID:subscriptionID limitedToPrefetchCount:stompFrame.prefetchCount];
+        }
     }
     // if this is an UNSUBSCRIBE frame then we need to tell our delegate so it can remove our response frame handler
     else if ([stompFrame.command isEqualToString:RBKStompCommandUnsubscribe]) {
@@ -1251,6 +1254,23 @@ typedef enum {
         NSString *subscriptionID = [stompFrame headerValueForKey:RBKStompHeaderID];
         [self.delegate unsubscribedFromDestination:destination subscriptionID:subscriptionID];
     }
+    // if this is a NACK frame, or a transaction batch that may carry some, then our delegate may be holding credit for the messages they reject
+    else if ([stompFrame.command isEqualToString:RBKStompCommandNack] || [stompFrame batchedFrames]) {
+        for (RBKStompFrame *frame in [stompFrame batchedFrames] ?: @[stompFrame]) {
+            NSString *ackIdentifier = [frame.command isEqualToString:RBKStompCommandNack] ? [frame headerValueForKey:RBKStompHeaderID] : nil;
+            if (ackIdentifier && [self.delegate respondsToSelector:@selector(nackingMessageWithAckIdentifier:)]) {
+                [self.delegate nackingMessageWithAckIdentifier:ackIdentifier];
+            }
+        }
+    }
+    // if this is a CONNECT frame then our delegate needs to know the heart-beat we asked for
+    else if ([stompFrame.command isEqualToString:RBKStompCommandConnect] || [stompFrame.command isEqualToString:RBKStompCommandStompConnect]) {
+        if ([self.delegate respondsToSelector:@selector(connectingWithHeartbeat:)]) {
+            NSString *heartbeatString = [stompFrame headerValueForKey:RBKStompHeaderHeartBeat];
+            RBKStompHeartbeat heartbeat = heartbeatString ? RBKStompHeartbeatFromString(heartbeatString) : RBKStompHeartbeatZero;
+            [self.delegate connectingWithHeartbeat:heartbeat];
+        }
+    }
     
     NSData *frameAsData = [stompFrame frameData];
     return [[RBKSocketOperation alloc] initWithRequestFrame:frameAsData expectResponse:expectResponse];
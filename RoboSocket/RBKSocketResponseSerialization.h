@@ -216,6 +216,28 @@
 - (void)heartbeatReceived;
 - (void)sendHeartbeatWithInterval:(NSTimeInterval)interval;
 
+@optional
+
+/**
+ Called when CONNECTED arrives with the heart-beat the server offers and asks for.
+ */
+- (void)connectedWithHeartbeat:(RBKStompHeartbeat)heartbeat;
+
+/**
+ Called for a RECEIPT frame, and for an ERROR frame that names the receipt of the frame it rejects.
+ */
+- (void)receiptReceivedWithResponseFrame:(RBKStompFrame *)responseFrame;
+
+/**
+ Asked for each MESSAGE before it is parsed. Return NO to drop it, e.g. because its headers fail a subscription's filter; it is then never parsed or handed to `messageForDestination:responseFrame:`.
+ */
+- (BOOL)shouldParseMessageWithFrameData:(NSData *)frameData;
+
+/**
+ Called with each MESSAGE as it arrived, next to its parsed frame, just before it is handed to `messageForDestination:responseFrame:`.
+ */
+- (void)receivedMessageWithFrameData:(NSData *)frameData responseFrame:(RBKStompFrame *)responseFrame;
+
 @end
 
 /**
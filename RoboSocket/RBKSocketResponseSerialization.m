@@ -593,6 +593,15 @@ extern NSString * const RBKSocketNetworkingOperationFailingURLResponseErrorKey;
         return nil;
     }
     
+    // let the delegate throw a MESSAGE away on its headers alone, before paying to parse it
+    static const char messageCommand[] = "MESSAGE";
+    if ([self.delegate respondsToSelector:@selector(shouldParseMessageWithFrameData:)] && RBKStompFrameDataHasCommand(responseFrame, messageCommand, sizeof(messageCommand) - 1)) {
+        if (![self.delegate shouldParseMessageWithFrameData:responseFrame]) {
+            [self.delegate heartbeatReceived];
+            return nil;
+        }
+    }
+    
     RBKStompFrame *stompFrame = [RBKStompFrame responseFrameFromData:responseFrame];
     
     [self.delegate heartbeatReceived]; // any time we receive a frame, consider it a heartbeat
@@ -600,6 +609,9 @@ extern NSString * const RBKSocketNetworkingOperationFailingURLResponseErrorKey;
     if ([stompFrame.command isEqualToString:RBKStompCommandMessage]) {
         
         NSString *destination = [stompFrame headerValueForKey:RBKStompHeaderDestination];
+        if ([self.delegate respondsToSelector:@selector(receivedMessageWithFrameData:responseFrame:)]) {
+            [self.delegate receivedMessageWithFrameData:responseFrame responseFrame:stompFrame];
+        }
         [self.delegate messageForDestination:destination responseFrame:stompFrame];
         
         // if we need to acknowledge it, then do so
@@ -617,12 +629,18 @@ extern NSString * const RBKSocketNetworkingOperationFailingURLResponseErrorKey;
     } else if ([stompFrame.command isEqualToString:RBKStompCommandConnected]) {
         // check our connected frame to see if we need to support a heartbeat
         NSString *heartbeatString = [stompFrame headerValueForKey:RBKStompHeaderHeartBeat];
-        RBKStompHeartbeat heartbeat = RBKStompHeartbeatFromString(heartbeatString);
-        if (heartbeat.desiredReceptionIntervalMinimum > 0) { // assume that we can support the desired interval
+        RBKStompHeartbeat heartbeat = heartbeatString ? RBKStompHeartbeatFromString(heartbeatString) : RBKStompHeartbeatZero;
+        if ([self.delegate respondsToSelector:@selector(connectedWithHeartbeat:)]) {
+            [self.delegate connectedWithHeartbeat:heartbeat];
+        } else if (heartbeat.desiredReceptionIntervalMinimum > 0) { // assume that we can support the desired interval
             // desiredReceptionIntervalMinimum is in milliseconds, but we'll deal in seconds
             // tell our delegate that we need to send a heartbeat every interval
             [self.delegate sendHeartbeatWithInterval:heartbeat.desiredReceptionIntervalMinimum / 1000.0];
         }
+    } else if ([stompFrame.command isEqualToString:RBKStompCommandReceipt] || ([stompFrame.command isEqualToString:RBKStompCommandError] && [stompFrame headerValueForKey:RBKStompHeaderReceiptID])) {
+        if ([self.delegate respondsToSelector:@selector(receiptReceivedWithResponseFrame:)]) {
+            [self.delegate receiptReceivedWithResponseFrame:stompFrame];
+        }
     }
     
     return stompFrame;
@@ -0,0 +1,61 @@
+//
+//  RBKSocketTracer.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+typedef NS_ENUM(uint32_t, RBKSocketTraceStage) {
+    // stamped per operation
+    RBKSocketTraceStageEnqueue = 0,     // -sendSocketOperationWithFrame: was called
+    RBKSocketTraceStageSerialize,       // the request serializer produced the operation
+    RBKSocketTraceStageNetworkThread,   // the operation started on the network thread and handed its frame to the socket
+    RBKSocketTraceStageReceive,         // the response frame was delivered to the operation
+    RBKSocketTraceStageParse,           // the response serializer produced the response object
+    RBKSocketTraceStageDispatch,        // the completion block was dispatched to the completion queue
+    RBKSocketTraceStageCallback,        // the success or failure block started running
+    // stamped per frame on the socket's work queue, not tied to an operation
+    RBKSocketTraceStageEncode,
+    RBKSocketTraceStageWrite,
+    RBKSocketTraceStageRead,
+    RBKSocketTraceStageDecode,
+};
+
+extern NSString *NSStringFromSocketTraceStage(RBKSocketTraceStage stage);
+
+/**
+ Records timestamped trace events into a fixed size ring buffer, overwriting the oldest events once it is full. Recording is lock free and safe from any thread. Assign an instance to `-[RBKWebSocket tracer]` to trace a socket; while it is `nil` no events are recorded.
+ */
+@interface RBKSocketTracer : NSObject
+
+@property (readonly, nonatomic, assign) NSUInteger capacity;
+
+/**
+ @param capacity The number of events kept, rounded up to a power of two.
+ */
+- (instancetype)initWithCapacity:(NSUInteger)capacity;
+
+/**
+ Returns a new identifier to correlate the stages of one operation. Never 0, which is used for events that do not belong to an operation.
+ */
+- (uint64_t)nextTraceIdentifier;
+
+- (void)recordStage:(RBKSocketTraceStage)stage traceIdentifier:(uint64_t)traceIdentifier;
+- (void)recordStage:(RBKSocketTraceStage)stage traceIdentifier:(uint64_t)traceIdentifier length:(NSUInteger)length;
+
+/**
+ The events currently in the buffer, oldest first, as dictionaries with `stage`, `trace_id`, `timestamp_ns`, `thread` and `length` keys.
+ */
+- (NSArray *)events;
+
+/**
+ The buffered events in the Chrome trace event format, for chrome://tracing or Perfetto. Each operation is an async span with a nested span per stage transition; frame level events are thread instant events.
+ */
+- (NSData *)chromeTraceData;
+- (BOOL)writeChromeTraceToURL:(NSURL *)url error:(NSError *__autoreleasing *)error;
+
+- (void)reset;
+
+@end
@@ -0,0 +1,212 @@
+//
+//  RBKSocketTracer.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKSocketTracer.h"
+#import "RBKSocketMetrics.h"
+
+#include <libkern/OSAtomic.h>
+#include <pthread.h>
+
+NSString *NSStringFromSocketTraceStage(RBKSocketTraceStage stage) {
+    switch (stage) {
+        case RBKSocketTraceStageEnqueue:
+            return @"enqueue";
+        case RBKSocketTraceStageSerialize:
+            return @"serialize";
+        case RBKSocketTraceStageNetworkThread:
+            return @"network-thread";
+        case RBKSocketTraceStageReceive:
+            return @"receive";
+        case RBKSocketTraceStageParse:
+            return @"parse";
+        case RBKSocketTraceStageDispatch:
+            return @"dispatch";
+        case RBKSocketTraceStageCallback:
+            return @"callback";
+        case RBKSocketTraceStageEncode:
+            return @"encode";
+        case RBKSocketTraceStageWrite:
+            return @"write";
+        case RBKSocketTraceStageRead:
+            return @"read";
+        case RBKSocketTraceStageDecode:
+            return @"decode";
+    }
+    return @"unknown";
+}
+
+typedef struct {
+    volatile int64_t sequence; // index of the event in the slot, or -1 while it is being written
+    uint64_t timestamp;
+    uint64_t traceIdentifier;
+    uint64_t length;
+    uint32_t stage;
+    uint32_t thread;
+} RBKSocketTraceSlot;
+
+@interface RBKSocketTracer ()
+
+@property (readwrite, nonatomic, assign) NSUInteger capacity;
+
+@end
+
+@implementation RBKSocketTracer {
+    RBKSocketTraceSlot *_slots;
+    NSUInteger _mask;
+    volatile int64_t _head;
+    volatile int64_t _traceIdentifier;
+}
+
+- (instancetype)init {
+    return [self initWithCapacity:16384];
+}
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity {
+    self = [super init];
+    if (self) {
+        NSUInteger roundedCapacity = 1;
+        while (roundedCapacity < MAX(capacity, 2u)) {
+            roundedCapacity <<= 1;
+        }
+        _capacity = roundedCapacity;
+        _mask = roundedCapacity - 1;
+        _slots = calloc(roundedCapacity, sizeof(RBKSocketTraceSlot));
+        [self reset];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    free(_slots);
+}
+
+- (uint64_t)nextTraceIdentifier {
+    return (uint64_t)OSAtomicIncrement64(&_traceIdentifier);
+}
+
+- (void)recordStage:(RBKSocketTraceStage)stage traceIdentifier:(uint64_t)traceIdentifier {
+    [self recordStage:stage traceIdentifier:traceIdentifier length:0];
+}
+
+- (void)recordStage:(RBKSocketTraceStage)stage traceIdentifier:(uint64_t)traceIdentifier length:(NSUInteger)length {
+    uint64_t timestamp = RBKMonotonicNanoseconds();
+    int64_t index = OSAtomicIncrement64(&_head) - 1;
+    RBKSocketTraceSlot *slot = &_slots[index & _mask];
+
+    slot->sequence = -1;
+    OSMemoryBarrier();
+    slot->timestamp = timestamp;
+    slot->traceIdentifier = traceIdentifier;
+    slot->length = length;
+    slot->stage = stage;
+    slot->thread = pthread_mach_thread_np(pthread_self());
+    OSMemoryBarrier();
+    slot->sequence = index;
+}
+
+- (NSArray *)events {
+    int64_t head = _head;
+    int64_t tail = MAX(head - (int64_t)self.capacity, 0);
+
+    NSMutableArray *events = [NSMutableArray arrayWithCapacity:(NSUInteger)(head - tail)];
+    for (int64_t index = tail; index < head; index++) {
+        RBKSocketTraceSlot *slot = &_slots[index & _mask];
+        if (slot->sequence != index) {
+            continue; // still being written, or already overwritten
+        }
+        RBKSocketTraceSlot copy = *slot;
+        OSMemoryBarrier();
+        if (slot->sequence != index) {
+            continue;
+        }
+        [events addObject:@{@"stage": @(copy.stage),
+                            @"trace_id": @(copy.traceIdentifier),
+                            @"timestamp_ns": @(copy.timestamp),
+                            @"thread": @(copy.thread),
+                            @"length": @(copy.length)}];
+    }
+
+    // slots are claimed before they are stamped, so claim order and time order can differ slightly
+    return [events sortedArrayUsingDescriptors:@[[NSSortDescriptor sortDescriptorWithKey:@"timestamp_ns" ascending:YES]]];
+}
+
+- (void)reset {
+    for (NSUInteger idx = 0; idx < self.capacity; idx++) {
+        _slots[idx].sequence = -1;
+    }
+    _head = 0;
+    OSMemoryBarrier();
+}
+
+#pragma mark - Chrome trace
+
+- (NSData *)chromeTraceData {
+    NSArray *events = [self events];
+    uint64_t origin = [[events firstObject][@"timestamp_ns"] unsignedLongLongValue];
+
+    NSMutableArray *traceEvents = [NSMutableArray array];
+    NSMutableDictionary *operations = [NSMutableDictionary dictionary];
+    for (NSDictionary *event in events) {
+        uint64_t traceIdentifier = [event[@"trace_id"] unsignedLongLongValue];
+        if (traceIdentifier == 0) {
+            [traceEvents addObject:@{@"name": NSStringFromSocketTraceStage([event[@"stage"] unsignedIntValue]),
+                                     @"cat": @"frame",
+                                     @"ph": @"i",
+                                     @"s": @"t",
+                                     @"ts": @([self microsecondsForEvent:event origin:origin]),
+                                     @"pid": @1,
+                                     @"tid": event[@"thread"],
+                                     @"args": @{@"bytes": event[@"length"]}}];
+            continue;
+        }
+        NSMutableArray *stages = operations[event[@"trace_id"]];
+        if (!stages) {
+            stages = [NSMutableArray array];
+            operations[event[@"trace_id"]] = stages;
+        }
+        [stages addObject:event];
+    }
+
+    [operations enumerateKeysAndObjectsUsingBlock:^(NSNumber *traceIdentifier, NSArray *stages, BOOL *stop) {
+        NSDictionary *first = [stages firstObject];
+        NSDictionary *last = [stages lastObject];
+        NSString *identifier = [NSString stringWithFormat:@"0x%llx", [traceIdentifier unsignedLongLongValue]];
+
+        [traceEvents addObject:[self asyncEventWithName:@"operation" phase:@"b" identifier:identifier event:first origin:origin]];
+        for (NSUInteger idx = 1; idx < [stages count]; idx++) {
+            NSDictionary *from = stages[idx - 1];
+            NSDictionary *to = stages[idx];
+            NSString *name = [NSString stringWithFormat:@"%@ -> %@", NSStringFromSocketTraceStage([from[@"stage"] unsignedIntValue]), NSStringFromSocketTraceStage([to[@"stage"] unsignedIntValue])];
+            [traceEvents addObject:[self asyncEventWithName:name phase:@"b" identifier:identifier event:from origin:origin]];
+            [traceEvents addObject:[self asyncEventWithName:name phase:@"e" identifier:identifier event:to origin:origin]];
+        }
+        [traceEvents addObject:[self asyncEventWithName:@"operation" phase:@"e" identifier:identifier event:last origin:origin]];
+    }];
+
+    NSDictionary *trace = @{@"traceEvents": traceEvents, @"displayTimeUnit": @"ns"};
+    return [NSJSONSerialization dataWithJSONObject:trace options:0 error:nil];
+}
+
+- (BOOL)writeChromeTraceToURL:(NSURL *)url error:(NSError *__autoreleasing *)error {
+    return [[self chromeTraceData] writeToURL:url options:NSDataWritingAtomic error:error];
+}
+
+- (double)microsecondsForEvent:(NSDictionary *)event origin:(uint64_t)origin {
+    return ([event[@"timestamp_ns"] unsignedLongLongValue] - origin) / (double)NSEC_PER_USEC;
+}
+
+- (NSDictionary *)asyncEventWithName:(NSString *)name phase:(NSString *)phase identifier:(NSString *)identifier event:(NSDictionary *)event origin:(uint64_t)origin {
+    return @{@"name": name,
+             @"cat": @"operation",
+             @"ph": phase,
+             @"id": identifier,
+             @"ts": @([self microsecondsForEvent:event origin:origin]),
+             @"pid": @1,
+             @"tid": event[@"thread"]};
+}
+
+@end
@@ -0,0 +1,51 @@
+//
+//  RBKStompDuplicateWindow.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "RBKClock.h"
+
+/**
+ Remembers the `message-id`s a subscription has seen lately, so a message the broker sends again can be recognized. It holds at most `capacity` ids and, if `timeInterval` is set, forgets each one that much later; the oldest go first.
+
+ Ids are remembered by a 64-bit hash, in a table with a counting Bloom filter in front of it, so a new id is usually told apart by a few counters alone and nothing is allocated per message. Two ids that share a hash are taken for the same one. Safe to use from any thread.
+ */
+@interface RBKStompDuplicateWindow : NSObject
+
+@property (readonly, nonatomic, assign) NSUInteger capacity;
+
+/**
+ How long, in seconds, an id is remembered. 0 remembers it until `capacity` newer ones push it out.
+ */
+@property (readonly, nonatomic, assign) NSTimeInterval timeInterval;
+
+/**
+ Where `timeInterval` is measured. `RBKSystemClock` by default.
+ */
+@property (strong, nonatomic) id<RBKClock> clock;
+
+@property (readonly, nonatomic, assign) NSUInteger numberOfMessageIDs;
+@property (readonly, nonatomic, assign) uint64_t numberOfDuplicates;
+
++ (instancetype)windowWithCapacity:(NSUInteger)capacity;
++ (instancetype)windowWithCapacity:(NSUInteger)capacity timeInterval:(NSTimeInterval)timeInterval;
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity timeInterval:(NSTimeInterval)timeInterval;
+
+/**
+ Remembers the `message-id` of the raw frame `data`, read without parsing the frame. Returns YES if it was remembered already. A frame without a `message-id` is never a duplicate.
+ */
+- (BOOL)isDuplicateFrameData:(NSData *)data;
+
+- (BOOL)isDuplicateMessageID:(NSString *)messageID;
+
+/**
+ Whether the `message-id` of the raw frame `data` is remembered, without remembering a new one. A hit counts as a duplicate.
+ */
+- (BOOL)containsMessageIDOfFrameData:(NSData *)data;
+
+@end
@@ -0,0 +1,265 @@
+//
+//  RBKStompDuplicateWindow.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKStompDuplicateWindow.h"
+#import "RBKStompFrame.h"
+
+#include <libkern/OSAtomic.h>
+
+// about a 3% false positive rate with 3 hashes, before the table has the last word
+static const NSUInteger RBKStompDuplicateWindowCountersPerID = 8;
+static const NSUInteger RBKStompDuplicateWindowHashCount = 3;
+static const uint8_t RBKStompDuplicateWindowCounterMaximum = UINT8_MAX; // a saturated counter is never decremented
+
+static inline NSUInteger RBKStompDuplicateWindowPowerOfTwo(NSUInteger minimum) {
+    NSUInteger size = 1;
+    while (size < minimum) {
+        size <<= 1;
+    }
+    return size;
+}
+
+static inline uint64_t RBKStompDuplicateWindowHash(const uint8_t *bytes, size_t length) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t idx = 0; idx < length; idx++) {
+        hash = (hash ^ bytes[idx]) * 1099511628211ull;
+    }
+    return hash ? hash : 1; // 0 marks an empty slot of the table
+}
+
+@interface RBKStompDuplicateWindow ()
+
+@property (readwrite, nonatomic, assign) NSUInteger capacity;
+@property (readwrite, nonatomic, assign) NSTimeInterval timeInterval;
+
+@end
+
+@implementation RBKStompDuplicateWindow {
+    OSSpinLock _lock;
+    uint64_t _timeIntervalNanoseconds;
+    uint64_t _duplicateCount;
+
+    // the remembered hashes in arrival order, oldest at _head
+    uint64_t *_hashes;
+    uint64_t *_times;
+    NSUInteger _head;
+    NSUInteger _count;
+
+    // open addressing with linear probing, at most half full
+    uint64_t *_table;
+    NSUInteger _tableMask;
+
+    uint8_t *_counters;
+    NSUInteger _counterMask;
+}
+
++ (instancetype)windowWithCapacity:(NSUInteger)capacity {
+    return [[self alloc] initWithCapacity:capacity timeInterval:0];
+}
+
++ (instancetype)windowWithCapacity:(NSUInteger)capacity timeInterval:(NSTimeInterval)timeInterval {
+    return [[self alloc] initWithCapacity:capacity timeInterval:timeInterval];
+}
+
+- (instancetype)init {
+    @throw [NSException exceptionWithName:NSInternalInconsistencyException reason:[NSString stringWithFormat:@"%@ Failed to call designated initializer. Invoke `initWithCapacity:timeInterval:` instead.", NSStringFromClass([self class])] userInfo:nil];
+}
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity timeInterval:(NSTimeInterval)timeInterval {
+    NSParameterAssert(capacity > 0);
+
+    self = [super init];
+    if (self) {
+        _capacity = capacity;
+        _timeInterval = MAX(timeInterval, 0);
+        _timeIntervalNanoseconds = (uint64_t)(_timeInterval * NSEC_PER_SEC);
+        _clock = [RBKSystemClock sharedClock];
+        _lock = OS_SPINLOCK_INIT;
+
+        NSUInteger tableSize = RBKStompDuplicateWindowPowerOfTwo(capacity * 2);
+        NSUInteger counterCount = RBKStompDuplicateWindowPowerOfTwo(capacity * RBKStompDuplicateWindowCountersPerID);
+        _hashes = calloc(capacity, sizeof(uint64_t));
+        _times = calloc(capacity, sizeof(uint64_t));
+        _table = calloc(tableSize, sizeof(uint64_t));
+        _tableMask = tableSize - 1;
+        _counters = calloc(counterCount, sizeof(uint8_t));
+        _counterMask = counterCount - 1;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    free(_hashes);
+    free(_times);
+    free(_table);
+    free(_counters);
+}
+
+- (NSUInteger)numberOfMessageIDs {
+    OSSpinLockLock(&_lock);
+    NSUInteger count = _count;
+    OSSpinLockUnlock(&_lock);
+    return count;
+}
+
+- (uint64_t)numberOfDuplicates {
+    OSSpinLockLock(&_lock);
+    uint64_t count = _duplicateCount;
+    OSSpinLockUnlock(&_lock);
+    return count;
+}
+
+#pragma mark - Public
+
+- (BOOL)isDuplicateFrameData:(NSData *)data {
+    const char *key = [RBKStompHeaderMessageID UTF8String];
+    NSRange range = RBKStompHeaderValueRangeInFrameData(data, key, strlen(key));
+    if (range.location == NSNotFound) {
+        return NO;
+    }
+    return [self isDuplicateHash:RBKStompDuplicateWindowHash((const uint8_t *)[data bytes] + range.location, range.length)];
+}
+
+- (BOOL)isDuplicateMessageID:(NSString *)messageID {
+    if (!messageID) {
+        return NO;
+    }
+    const char *bytes = [messageID UTF8String];
+    return [self isDuplicateHash:RBKStompDuplicateWindowHash((const uint8_t *)bytes, strlen(bytes))];
+}
+
+- (BOOL)containsMessageIDOfFrameData:(NSData *)data {
+    const char *key = [RBKStompHeaderMessageID UTF8String];
+    NSRange range = RBKStompHeaderValueRangeInFrameData(data, key, strlen(key));
+    if (range.location == NSNotFound) {
+        return NO;
+    }
+    return [self isDuplicateHash:RBKStompDuplicateWindowHash((const uint8_t *)[data bytes] + range.location, range.length) remembers:NO];
+}
+
+#pragma mark - Private
+
+- (BOOL)isDuplicateHash:(uint64_t)hash {
+    return [self isDuplicateHash:hash remembers:YES];
+}
+
+- (BOOL)isDuplicateHash:(uint64_t)hash remembers:(BOOL)remembers {
+    uint64_t now = _timeIntervalNanoseconds > 0 ? [self.clock now] : 0;
+
+    OSSpinLockLock(&_lock);
+    while (_count > 0 && _timeIntervalNanoseconds > 0 && now - _times[_head] >= _timeIntervalNanoseconds) {
+        [self forgetOldest];
+    }
+
+    // the counters rule most new ids out without touching the table
+    BOOL isDuplicate = [self countersMayContainHash:hash] && [self tableIndexOfHash:hash] != NSNotFound;
+    if (isDuplicate) {
+        _duplicateCount += 1;
+    } else if (remembers) {
+        if (_count == _capacity) {
+            [self forgetOldest];
+        }
+        NSUInteger tail = (_head + _count) % _capacity;
+        _hashes[tail] = hash;
+        _times[tail] = now;
+        _count += 1;
+        [self insertHashInTable:hash];
+        [self adjustCountersForHash:hash by:1];
+    }
+    OSSpinLockUnlock(&_lock);
+    return isDuplicate;
+}
+
+- (void)forgetOldest {
+    uint64_t hash = _hashes[_head];
+    _head = (_head + 1) % _capacity;
+    _count -= 1;
+    [self removeHashFromTable:hash];
+    [self adjustCountersForHash:hash by:-1];
+}
+
+#pragma mark Counting Bloom filter
+
+static inline NSUInteger RBKStompDuplicateWindowCounterIndex(uint64_t hash, NSUInteger idx, NSUInteger mask) {
+    // double hashing over the two halves of the hash
+    uint32_t first = (uint32_t)hash;
+    uint32_t second = (uint32_t)(hash >> 32) | 1;
+    return (first + idx * second) & mask;
+}
+
+- (BOOL)countersMayContainHash:(uint64_t)hash {
+    for (NSUInteger idx = 0; idx < RBKStompDuplicateWindowHashCount; idx++) {
+        if (_counters[RBKStompDuplicateWindowCounterIndex(hash, idx, _counterMask)] == 0) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+- (void)adjustCountersForHash:(uint64_t)hash by:(int)delta {
+    for (NSUInteger idx = 0; idx < RBKStompDuplicateWindowHashCount; idx++) {
+        uint8_t *counter = &_counters[RBKStompDuplicateWindowCounterIndex(hash, idx, _counterMask)];
+        if (*counter == RBKStompDuplicateWindowCounterMaximum) {
+            continue;
+        }
+        if (delta > 0 || *counter > 0) {
+            *counter += delta;
+        }
+    }
+}
+
+#pragma mark Table
+
+static inline NSUInteger RBKStompDuplicateWindowHomeIndex(uint64_t hash, NSUInteger mask) {
+    return (NSUInteger)(hash ^ (hash >> 32)) & mask;
+}
+
+- (NSUInteger)tableIndexOfHash:(uint64_t)hash {
+    NSUInteger idx = RBKStompDuplicateWindowHomeIndex(hash, _tableMask);
+    while (_table[idx] != 0) {
+        if (_table[idx] == hash) {
+            return idx;
+        }
+        idx = (idx + 1) & _tableMask;
+    }
+    return NSNotFound;
+}
+
+- (void)insertHashInTable:(uint64_t)hash {
+    NSUInteger idx = RBKStompDuplicateWindowHomeIndex(hash, _tableMask);
+    while (_table[idx] != 0) {
+        idx = (idx + 1) & _tableMask;
+    }
+    _table[idx] = hash;
+}
+
+- (void)removeHashFromTable:(uint64_t)hash {
+    NSUInteger hole = [self tableIndexOfHash:hash];
+    if (hole == NSNotFound) {
+        return;
+    }
+    _table[hole] = 0;
+
+    // shift later entries of the run back into the hole, so lookups never stop short of them
+    NSUInteger idx = hole;
+    while (YES) {
+        idx = (idx + 1) & _tableMask;
+        if (_table[idx] == 0) {
+            break;
+        }
+        NSUInteger home = RBKStompDuplicateWindowHomeIndex(_table[idx], _tableMask);
+        BOOL homeBetween = hole <= idx ? (home > hole && home <= idx) : (home > hole || home <= idx);
+        if (!homeBetween) {
+            _table[hole] = _table[idx];
+            _table[idx] = 0;
+            hole = idx;
+        }
+    }
+}
+
+@end
@@ -65,6 +65,17 @@ extern const RBKStompHeartbeat RBKStompHeartbeatZero;
 NSString *NSStringFromStompHeartbeat(RBKStompHeartbeat heartbeat);
 RBKStompHeartbeat RBKStompHeartbeatFromString(NSString *heartbeatString);
 
+/**
+ Finds the value of the header `key` in a raw frame without parsing the frame. The first occurrence wins, as in STOMP 1.2, and the value is left escaped.
+ @return The range of the value within `data`, or `{NSNotFound, 0}` if the frame has no such header.
+ */
+NSRange RBKStompHeaderValueRangeInFrameData(NSData *data, const char *key, size_t keyLength);
+
+/**
+ Whether the raw frame `data` starts with `command`, skipping any heart-beat EOLs in front of it.
+ */
+BOOL RBKStompFrameDataHasCommand(NSData *data, const char *command, size_t commandLength);
+
 @class RBKStompFrame;
 
 typedef void (^RBKStompFrameHandler)(RBKStompFrame *responseFrame);
@@ -80,10 +91,25 @@ typedef void (^RBKStompFrameHandler)(RBKStompFrame *responseFrame);
 
 @property (strong, nonatomic, readonly) RBKStompSubscription *subscription;
 @property (strong, nonatomic, readonly) NSString *command;
+@property (strong, nonatomic, readonly) NSDictionary *headers;
 @property (strong, nonatomic, readonly) RBKStompFrameHandler responseFrameHandler;
+/**
+ For a SUBSCRIBE frame, how many messages its handler may have in progress at once. 0 means no limit.
+ */
+@property (assign, nonatomic, readonly) NSUInteger prefetchCount;
 
 + (instancetype)responseFrameFromData:(NSData *)data;
 
+/**
+ Splits `data` holding several NUL terminated frames, as written by a frame batch, and parses each of them.
+ */
++ (NSArray *)responseFramesFromData:(NSData *)data;
+
+/**
+ The value of the header `key` in the raw frame `data`, decoded without parsing the rest of the frame.
+ */
++ (NSString *)headerValueForKey:(NSString *)key inFrameData:(NSData *)data;
+
 #pragma mark - Connect
 
 + (instancetype)connectFrameWithLogin:(NSString *)login passcode:(NSString *)passcode host:(NSString *)host;
@@ -97,6 +123,10 @@ typedef void (^RBKStompFrameHandler)(RBKStompFrame *responseFrame);
 #pragma mark - Subscription
 
 + (instancetype)subscribeFrameWithDestination:(NSString *)destination headers:(NSDictionary *)headers messageHandler:(RBKStompFrameHandler)messageHandler;
+/**
+ A subscription whose handler is given at most `prefetchCount` messages it hasn't completed with `-[RBKSTOMPSocket completeMessage:]`; later messages wait. With `client` or `client-individual` acks, each message is acknowledged when it is completed rather than when it is handed over.
+ */
++ (instancetype)subscribeFrameWithDestination:(NSString *)destination headers:(NSDictionary *)headers prefetchCount:(NSUInteger)prefetchCount messageHandler:(RBKStompFrameHandler)messageHandler;
 
 #pragma mark - Subscription
 
@@ -113,10 +143,38 @@ typedef void (^RBKStompFrameHandler)(RBKStompFrame *responseFrame);
 #pragma mark - Ack
 
 + (instancetype)ackFrameWithIdentifier:(NSString *)identifier;
++ (instancetype)ackFrameWithIdentifier:(NSString *)identifier transaction:(NSString *)transaction;
 
 #pragma mark - Nack
 
 + (instancetype)nackFrameWithIdentifier:(NSString *)identifier;
++ (instancetype)nackFrameWithIdentifier:(NSString *)identifier transaction:(NSString *)transaction;
+
+#pragma mark - Transaction
+
++ (instancetype)beginFrameWithTransaction:(NSString *)transaction headers:(NSDictionary *)headers;
++ (instancetype)commitFrameWithTransaction:(NSString *)transaction headers:(NSDictionary *)headers;
++ (instancetype)abortFrameWithTransaction:(NSString *)transaction headers:(NSDictionary *)headers;
+
+#pragma mark - Batch
+
+/**
+ A frame whose data is the data of each of `frames` back to back, so they go out as a single WebSocket message. It has no command of its own.
+ */
++ (instancetype)batchFrameWithFrames:(NSArray *)frames;
+
+/**
+ A frame that writes `frameData` exactly as given, e.g. frames read back from an `RBKOutboundJournal`. Like a batch, it has no command of its own.
+ */
++ (instancetype)frameWithFrameData:(NSData *)frameData;
+
+#pragma mark - Receipt
+
++ (instancetype)receiptFrameWithReceiptID:(NSString *)receiptID;
+
+#pragma mark - Error
+
++ (instancetype)errorFrameWithMessage:(NSString *)message headers:(NSDictionary *)headers body:(NSString *)body;
 
 #pragma mark - Heartbeat
 
@@ -129,6 +187,21 @@ typedef void (^RBKStompFrameHandler)(RBKStompFrame *responseFrame);
 - (NSString *)headerValueForKey:(NSString *)key;
 - (NSString *)bodyValue;
 
+/**
+ The frames a batch frame carries, in order, or nil if this isn't a batch.
+ */
+- (NSArray *)batchedFrames;
+
+/**
+ Whether the frame, or any frame batched in it, belongs to a transaction.
+ */
+- (BOOL)isTransactional;
+
+/**
+ A copy of the frame without the headers `keys`.
+ */
+- (instancetype)frameByRemovingHeadersForKeys:(NSArray *)keys;
+
 
 
 @end
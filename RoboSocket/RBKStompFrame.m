@@ -81,6 +81,56 @@ RBKStompHeartbeat RBKStompHeartbeatFromString(NSString *heartbeatString) {
     return heartbeat;
 }
 
+static NSUInteger RBKStompFrameDataCommandOffset(const char *bytes, NSUInteger length) {
+    NSUInteger idx = 0;
+    while (idx < length && (bytes[idx] == '\n' || bytes[idx] == '\r')) {
+        idx++;
+    }
+    return idx;
+}
+
+BOOL RBKStompFrameDataHasCommand(NSData *data, const char *command, size_t commandLength) {
+    const char *bytes = [data bytes];
+    NSUInteger length = [data length];
+    NSUInteger idx = RBKStompFrameDataCommandOffset(bytes, length);
+    if (length - idx <= commandLength || memcmp(bytes + idx, command, commandLength) != 0) {
+        return NO;
+    }
+    return bytes[idx + commandLength] == '\n' || bytes[idx + commandLength] == '\r';
+}
+
+NSRange RBKStompHeaderValueRangeInFrameData(NSData *data, const char *key, size_t keyLength) {
+    const char *bytes = [data bytes];
+    NSUInteger length = [data length];
+
+    // skip the command line
+    NSUInteger idx = RBKStompFrameDataCommandOffset(bytes, length);
+    const char *lineEnd = idx < length ? memchr(bytes + idx, '\n', length - idx) : NULL;
+    if (!lineEnd) {
+        return NSMakeRange(NSNotFound, 0);
+    }
+    idx = lineEnd - bytes + 1;
+
+    while (idx < length) {
+        lineEnd = memchr(bytes + idx, '\n', length - idx);
+        NSUInteger lineLength = (lineEnd ? (NSUInteger)(lineEnd - bytes) : length) - idx;
+        if (lineLength > 0 && bytes[idx + lineLength - 1] == '\r') {
+            lineLength--;
+        }
+        if (lineLength == 0) {
+            break; // the blank line before the body
+        }
+        if (lineLength > keyLength && bytes[idx + keyLength] == ':' && memcmp(bytes + idx, key, keyLength) == 0) {
+            return NSMakeRange(idx + keyLength + 1, lineLength - keyLength - 1);
+        }
+        if (!lineEnd) {
+            break;
+        }
+        idx = lineEnd - bytes + 1;
+    }
+    return NSMakeRange(NSNotFound, 0);
+}
+
 
 @interface RBKStompSubscription ()
 
@@ -118,6 +168,9 @@ RBKStompHeartbeat RBKStompHeartbeatFromString(NSString *heartbeatString) {
 
 @property (strong, nonatomic, readwrite) RBKStompSubscription *subscription;
 @property (strong, nonatomic) RBKStompFrameHandler responseFrameHandler;
+@property (assign, nonatomic, readwrite) NSUInteger prefetchCount;
+@property (strong, nonatomic) NSArray *batchedFrames;
+@property (strong, nonatomic) NSData *rawFrameData;
 
 @end
 
@@ -132,14 +185,19 @@ static NSUInteger messageIdentifier;
     // NSLog(@"<<<\n%@", frameAsString);
     
     NSMutableArray *contents = [[frameAsString componentsSeparatedByString:RBKStompLineFeed] mutableCopy];
-    // skip initial if its an empty string
-    if ([[contents firstObject] isEqualToString:@""]) {
-        [contents removeObject:[contents firstObject]];
+    // skip the heart-beat EOLs in front of the command
+    while ([contents count] > 1 && ([[contents firstObject] isEqualToString:@""] || [[contents firstObject] isEqualToString:@"\r"])) {
+        [contents removeObjectAtIndex:0];
     }
     // get our command
     NSString *command = [[contents firstObject] copy];
-    [contents removeObject:[contents firstObject]];
-    if (!command && [contents count] == 0) { // don't have a command or other body, then this is just a heartbeat
+    if ([command hasSuffix:@"\r"]) {
+        command = [command substringToIndex:[command length] - 1];
+    }
+    if ([contents count] > 0) {
+        [contents removeObjectAtIndex:0];
+    }
+    if ([command length] == 0 && [contents count] == 0) { // don't have a command or other body, then this is just a heartbeat
         command = RBKStompCommandHeartbeat;
     }
     
@@ -159,10 +217,12 @@ static NSUInteger messageIdentifier;
                 }
             }
         } else {
-            if ([line isEqualToString:@""]) {
+            // STOMP 1.2 allows CRLF line endings
+            NSString *headerLine = [line hasSuffix:@"\r"] ? [line substringToIndex:[line length] - 1] : line;
+            if ([headerLine isEqualToString:@""]) {
                 haveParsedHeaders = YES;
             } else {
-                NSMutableArray *headerEntry = [NSMutableArray arrayWithArray:[line componentsSeparatedByString:RBKStompHeaderSeparator]];
+                NSMutableArray *headerEntry = [NSMutableArray arrayWithArray:[headerLine componentsSeparatedByString:RBKStompHeaderSeparator]];
 				// key ist the first part
 				NSString *key = headerEntry[0];
                 [headerEntry removeObjectAtIndex:0];
@@ -174,6 +234,34 @@ static NSUInteger messageIdentifier;
     return [[RBKStompFrame alloc] initFrameWithCommand:command headers:headers body:body];
 }
 
++ (NSArray *)responseFramesFromData:(NSData *)data {
+
+    NSMutableArray *frames = [NSMutableArray array];
+    const char *bytes = [data bytes];
+    NSUInteger length = [data length];
+    NSUInteger start = 0;
+    for (NSUInteger idx = 0; idx < length; idx++) {
+        if (bytes[idx] == '\0') {
+            [frames addObject:[self responseFrameFromData:[data subdataWithRange:NSMakeRange(start, idx + 1 - start)]]];
+            start = idx + 1;
+        }
+    }
+    // without a NUL this is a heartbeat; anything after the last NUL is EOLs between frames
+    if ([frames count] == 0) {
+        [frames addObject:[self responseFrameFromData:data]];
+    }
+    return frames;
+}
+
++ (NSString *)headerValueForKey:(NSString *)key inFrameData:(NSData *)data {
+    const char *keyBytes = [key UTF8String];
+    NSRange valueRange = RBKStompHeaderValueRangeInFrameData(data, keyBytes, strlen(keyBytes));
+    if (valueRange.location == NSNotFound) {
+        return nil;
+    }
+    return [[NSString alloc] initWithBytes:(const char *)[data bytes] + valueRange.location length:valueRange.length encoding:NSUTF8StringEncoding];
+}
+
 - (instancetype)initFrameWithCommand:(NSString *)command headers:(NSDictionary *)headers body:(NSString *)body {
     self = [super init];
     if (self) {
@@ -261,6 +349,12 @@ static NSUInteger messageIdentifier;
     return [[RBKStompFrame alloc] initSubscribeMessageWithDestination:destination headers:headers messageHandler:messageHandler];
 }
 
++ (instancetype)subscribeFrameWithDestination:(NSString *)destination headers:(NSDictionary *)headers prefetchCount:(NSUInteger)prefetchCount messageHandler:(RBKStompFrameHandler)messageHandler {
+    RBKStompFrame *frame = [[RBKStompFrame alloc] initSubscribeMessageWithDestination:destination headers:headers messageHandler:messageHandler];
+    frame.prefetchCount = prefetchCount;
+    return frame;
+}
+
 - (instancetype)initSubscribeMessageWithDestination:(NSString *)destination headers:(NSDictionary *)headers messageHandler:(RBKStompFrameHandler)messageHandler {
 
     static dispatch_once_t onceToken;
@@ -361,10 +455,21 @@ static NSUInteger messageIdentifier;
     return [[RBKStompFrame alloc] initAckFrameWithIdentifier:identifier];
 }
 
++ (instancetype)ackFrameWithIdentifier:(NSString *)identifier transaction:(NSString *)transaction {
+    return [[RBKStompFrame alloc] initAckFrameWithIdentifier:identifier transaction:transaction];
+}
+
 - (instancetype)initAckFrameWithIdentifier:(NSString *)identifier {
+    return [self initAckFrameWithIdentifier:identifier transaction:nil];
+}
+
+- (instancetype)initAckFrameWithIdentifier:(NSString *)identifier transaction:(NSString *)transaction {
     
     NSMutableDictionary *mutableHeaders = [NSMutableDictionary dictionary];
     mutableHeaders[RBKStompHeaderID] = identifier;
+    if (transaction) {
+        mutableHeaders[RBKStompHeaderTransaction] = transaction;
+    }
     
     self = [self initFrameWithCommand:RBKStompCommandAck headers:mutableHeaders body:nil];
     
@@ -377,16 +482,116 @@ static NSUInteger messageIdentifier;
     return [[RBKStompFrame alloc] initNackFrameWithIdentifier:identifier];
 }
 
++ (instancetype)nackFrameWithIdentifier:(NSString *)identifier transaction:(NSString *)transaction {
+    return [[RBKStompFrame alloc] initNackFrameWithIdentifier:identifier transaction:transaction];
+}
+
 - (instancetype)initNackFrameWithIdentifier:(NSString *)identifier {
+    return [self initNackFrameWithIdentifier:identifier transaction:nil];
+}
+
+- (instancetype)initNackFrameWithIdentifier:(NSString *)identifier transaction:(NSString *)transaction {
     
     NSMutableDictionary *mutableHeaders = [NSMutableDictionary dictionary];
     mutableHeaders[RBKStompHeaderID] = identifier;
+    if (transaction) {
+        mutableHeaders[RBKStompHeaderTransaction] = transaction;
+    }
     
     self = [self initFrameWithCommand:RBKStompCommandNack headers:mutableHeaders body:nil];
     
     return self;
 }
 
+#pragma mark - Transaction
+
++ (instancetype)beginFrameWithTransaction:(NSString *)transaction headers:(NSDictionary *)headers {
+    return [[RBKStompFrame alloc] initTransactionFrameWithCommand:RBKStompCommandBegin transaction:transaction headers:headers];
+}
+
++ (instancetype)commitFrameWithTransaction:(NSString *)transaction headers:(NSDictionary *)headers {
+    return [[RBKStompFrame alloc] initTransactionFrameWithCommand:RBKStompCommandCommit transaction:transaction headers:headers];
+}
+
++ (instancetype)abortFrameWithTransaction:(NSString *)transaction headers:(NSDictionary *)headers {
+    return [[RBKStompFrame alloc] initTransactionFrameWithCommand:RBKStompCommandAbort transaction:transaction headers:headers];
+}
+
+- (instancetype)initTransactionFrameWithCommand:(NSString *)command transaction:(NSString *)transaction headers:(NSDictionary *)headers {
+    NSParameterAssert(transaction);
+    
+    NSMutableDictionary *mutableHeaders = [[NSMutableDictionary alloc] initWithDictionary:headers];
+    mutableHeaders[RBKStompHeaderTransaction] = transaction;
+    
+    self = [self initFrameWithCommand:command headers:mutableHeaders body:nil];
+    
+    return self;
+}
+
+#pragma mark - Batch
+
++ (instancetype)batchFrameWithFrames:(NSArray *)frames {
+    return [[RBKStompFrame alloc] initBatchFrameWithFrames:frames];
+}
+
+- (instancetype)initBatchFrameWithFrames:(NSArray *)frames {
+    
+    self = [self initFrameWithCommand:nil headers:nil body:nil];
+    if (self) {
+        _batchedFrames = [frames copy];
+    }
+    
+    return self;
+}
+
++ (instancetype)frameWithFrameData:(NSData *)frameData {
+    return [[RBKStompFrame alloc] initFrameWithFrameData:frameData];
+}
+
+- (instancetype)initFrameWithFrameData:(NSData *)frameData {
+    
+    self = [self initFrameWithCommand:nil headers:nil body:nil];
+    if (self) {
+        _rawFrameData = [frameData copy];
+    }
+    
+    return self;
+}
+
+#pragma mark - Receipt
+
++ (instancetype)receiptFrameWithReceiptID:(NSString *)receiptID {
+    return [[RBKStompFrame alloc] initReceiptFrameWithReceiptID:receiptID];
+}
+
+- (instancetype)initReceiptFrameWithReceiptID:(NSString *)receiptID {
+    
+    NSMutableDictionary *mutableHeaders = [NSMutableDictionary dictionary];
+    mutableHeaders[RBKStompHeaderReceiptID] = receiptID;
+    
+    self = [self initFrameWithCommand:RBKStompCommandReceipt headers:mutableHeaders body:nil];
+    
+    return self;
+}
+
+#pragma mark - Error
+
++ (instancetype)errorFrameWithMessage:(NSString *)message headers:(NSDictionary *)headers body:(NSString *)body {
+    return [[RBKStompFrame alloc] initErrorFrameWithMessage:message headers:headers body:body];
+}
+
+- (instancetype)initErrorFrameWithMessage:(NSString *)message headers:(NSDictionary *)headers body:(NSString *)body {
+    
+    NSMutableDictionary *mutableHeaders = [[NSMutableDictionary alloc] initWithDictionary:headers];
+    if (message) {
+        mutableHeaders[RBKStompHeaderMessage] = message;
+    }
+    
+    self = [self initFrameWithCommand:RBKStompCommandError headers:mutableHeaders body:body];
+    
+    return self;
+}
+
 #pragma mark - Heartbeat
 
 + (instancetype)heartbeatFrame {
@@ -405,6 +610,18 @@ static NSUInteger messageIdentifier;
 
 - (NSString *)frameString {
     
+    if (self.rawFrameData) {
+        return [[NSString alloc] initWithData:self.rawFrameData encoding:NSUTF8StringEncoding];
+    }
+    
+    if (self.batchedFrames) {
+        NSMutableString *frameString = [NSMutableString string];
+        for (RBKStompFrame *frame in self.batchedFrames) {
+            [frameString appendString:[frame frameString]];
+        }
+        return frameString;
+    }
+    
     // if this is a heartbeat, then just print HEARTBEAT
     if ([self.command isEqualToString:RBKStompCommandHeartbeat]) {
         return RBKStompCommandHeartbeat;
@@ -442,6 +659,19 @@ static NSUInteger messageIdentifier;
 
 - (NSData *)frameData {
     
+    if (self.rawFrameData) {
+        return self.rawFrameData;
+    }
+    
+    // encode the whole batch into one buffer so it is written as one message
+    if (self.batchedFrames) {
+        NSMutableData *frameData = [NSMutableData data];
+        for (RBKStompFrame *frame in self.batchedFrames) {
+            [frameData appendData:[frame frameData]];
+        }
+        return frameData;
+    }
+    
     // if this is a heartbeat, then just return EOL
     if ([self.command isEqualToString:RBKStompCommandHeartbeat]) {
         return [RBKStompLineFeed dataUsingEncoding:NSUTF8StringEncoding];
@@ -454,11 +684,26 @@ static NSUInteger messageIdentifier;
     return self.headers[key];
 }
 
+- (BOOL)isTransactional {
+    for (RBKStompFrame *frame in self.batchedFrames) {
+        if ([frame isTransactional]) {
+            return YES;
+        }
+    }
+    return [self headerValueForKey:RBKStompHeaderTransaction] != nil;
+}
+
 - (NSString *)bodyValue {
     // should only return a string if our content-type is a string
     return self.body;
 }
 
+- (instancetype)frameByRemovingHeadersForKeys:(NSArray *)keys {
+    NSMutableDictionary *headers = [self.headers mutableCopy];
+    [headers removeObjectsForKeys:keys];
+    return [[RBKStompFrame alloc] initFrameWithCommand:self.command headers:headers body:self.body];
+}
+
 #pragma mark - Private
 
 -(BOOL)commandPermitsBody:(NSString *)command {
@@ -0,0 +1,28 @@
+//
+//  RBKStompHeaderFilter.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ A predicate over a frame's headers that is evaluated against the raw frame, before it is parsed and without decoding its body. Header names and values are converted to UTF-8 once, when the filter is made, and compared byte for byte with the escaped values on the wire. A frame without the header a filter tests never matches it.
+ */
+@interface RBKStompHeaderFilter : NSObject
+
++ (instancetype)filterWithHeader:(NSString *)header equalTo:(NSString *)value;
++ (instancetype)filterWithHeader:(NSString *)header prefix:(NSString *)prefix;
+
+/**
+ Matches a header whose value is a number between `minimum` and `maximum`, inclusive.
+ */
++ (instancetype)filterWithHeader:(NSString *)header minimum:(double)minimum maximum:(double)maximum;
+
++ (instancetype)filterMatchingAllOf:(NSArray *)filters;
++ (instancetype)filterMatchingAnyOf:(NSArray *)filters;
+
+- (BOOL)matchesFrameData:(NSData *)data;
+
+@end
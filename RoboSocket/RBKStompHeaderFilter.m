@@ -0,0 +1,129 @@
+//
+//  RBKStompHeaderFilter.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKStompHeaderFilter.h"
+#import "RBKStompFrame.h"
+
+typedef NS_ENUM(NSInteger, RBKStompHeaderFilterKind) {
+    RBKStompHeaderFilterEqualKind = 0,
+    RBKStompHeaderFilterPrefixKind,
+    RBKStompHeaderFilterRangeKind,
+    RBKStompHeaderFilterAllKind,
+    RBKStompHeaderFilterAnyKind,
+};
+
+static const NSUInteger RBKStompHeaderFilterMaximumNumberLength = 63;
+
+@interface RBKStompHeaderFilter ()
+
+@property (assign, nonatomic) RBKStompHeaderFilterKind kind;
+@property (strong, nonatomic) NSData *header; // UTF-8, without a terminator
+@property (strong, nonatomic) NSData *value;
+@property (assign, nonatomic) double minimum;
+@property (assign, nonatomic) double maximum;
+@property (copy, nonatomic) NSArray *filters;
+
+@end
+
+@implementation RBKStompHeaderFilter
+
++ (instancetype)filterWithHeader:(NSString *)header equalTo:(NSString *)value {
+    NSParameterAssert(value);
+
+    RBKStompHeaderFilter *filter = [[self alloc] initWithKind:RBKStompHeaderFilterEqualKind header:header];
+    filter.value = [value dataUsingEncoding:NSUTF8StringEncoding];
+    return filter;
+}
+
++ (instancetype)filterWithHeader:(NSString *)header prefix:(NSString *)prefix {
+    NSParameterAssert(prefix);
+
+    RBKStompHeaderFilter *filter = [[self alloc] initWithKind:RBKStompHeaderFilterPrefixKind header:header];
+    filter.value = [prefix dataUsingEncoding:NSUTF8StringEncoding];
+    return filter;
+}
+
++ (instancetype)filterWithHeader:(NSString *)header minimum:(double)minimum maximum:(double)maximum {
+    RBKStompHeaderFilter *filter = [[self alloc] initWithKind:RBKStompHeaderFilterRangeKind header:header];
+    filter.minimum = minimum;
+    filter.maximum = maximum;
+    return filter;
+}
+
++ (instancetype)filterMatchingAllOf:(NSArray *)filters {
+    RBKStompHeaderFilter *filter = [[self alloc] initWithKind:RBKStompHeaderFilterAllKind header:nil];
+    filter.filters = filters;
+    return filter;
+}
+
++ (instancetype)filterMatchingAnyOf:(NSArray *)filters {
+    RBKStompHeaderFilter *filter = [[self alloc] initWithKind:RBKStompHeaderFilterAnyKind header:nil];
+    filter.filters = filters;
+    return filter;
+}
+
+- (instancetype)initWithKind:(RBKStompHeaderFilterKind)kind header:(NSString *)header {
+    self = [super init];
+    if (self) {
+        _kind = kind;
+        _header = [header dataUsingEncoding:NSUTF8StringEncoding];
+    }
+    return self;
+}
+
+- (BOOL)matchesFrameData:(NSData *)data {
+    switch (self.kind) {
+        case RBKStompHeaderFilterAllKind:
+            for (RBKStompHeaderFilter *filter in self.filters) {
+                if (![filter matchesFrameData:data]) {
+                    return NO;
+                }
+            }
+            return YES;
+        case RBKStompHeaderFilterAnyKind:
+            for (RBKStompHeaderFilter *filter in self.filters) {
+                if ([filter matchesFrameData:data]) {
+                    return YES;
+                }
+            }
+            return NO;
+        default:
+            break;
+    }
+
+    NSRange valueRange = RBKStompHeaderValueRangeInFrameData(data, [self.header bytes], [self.header length]);
+    if (valueRange.location == NSNotFound) {
+        return NO;
+    }
+    const char *value = (const char *)[data bytes] + valueRange.location;
+
+    switch (self.kind) {
+        case RBKStompHeaderFilterEqualKind:
+            return valueRange.length == [self.value length] && memcmp(value, [self.value bytes], valueRange.length) == 0;
+        case RBKStompHeaderFilterPrefixKind:
+            return valueRange.length >= [self.value length] && memcmp(value, [self.value bytes], [self.value length]) == 0;
+        case RBKStompHeaderFilterRangeKind: {
+            if (valueRange.length == 0 || valueRange.length > RBKStompHeaderFilterMaximumNumberLength) {
+                return NO;
+            }
+            // strtod needs a terminated string, so copy the value to the stack
+            char number[RBKStompHeaderFilterMaximumNumberLength + 1];
+            memcpy(number, value, valueRange.length);
+            number[valueRange.length] = '\0';
+            char *end = NULL;
+            double parsed = strtod(number, &end);
+            if (end != number + valueRange.length) {
+                return NO;
+            }
+            return parsed >= self.minimum && parsed <= self.maximum;
+        }
+        default:
+            return NO;
+    }
+}
+
+@end
@@ -0,0 +1,79 @@
+//
+//  RBKStompHeartbeatScheduler.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "RBKClock.h"
+
+@class RBKStompHeartbeatScheduler;
+
+@protocol RBKStompHeartbeatSchedulerDelegate <NSObject>
+
+/**
+ Nothing has been sent for the outgoing interval, so a heartbeat frame should be sent now.
+ */
+- (void)heartbeatSchedulerShouldSendHeartbeat:(RBKStompHeartbeatScheduler *)scheduler;
+
+/**
+ Nothing has been received for the incoming interval multiplied by the tolerance. The scheduler stops itself before calling this.
+ */
+- (void)heartbeatSchedulerDidMissIncomingHeartbeat:(RBKStompHeartbeatScheduler *)scheduler;
+
+@end
+
+/**
+ Sends and checks STOMP heartbeats for one connection with a single long-lived timer. Recording traffic only stores a monotonic timestamp; the timer re-arms itself for the next deadline, so it only acts when the link has actually been idle.
+ */
+@interface RBKStompHeartbeatScheduler : NSObject
+
+@property (weak, nonatomic) id<RBKStompHeartbeatSchedulerDelegate> delegate;
+
+/**
+ In seconds. 0 turns the direction off.
+ */
+@property (readonly, nonatomic, assign) NSTimeInterval outgoingInterval;
+@property (readonly, nonatomic, assign) NSTimeInterval incomingInterval;
+
+/**
+ How many incoming intervals may pass without traffic before the peer is considered dead, to allow for network delay. 2 by default.
+ */
+@property (assign, nonatomic) double incomingTolerance;
+
+@property (readonly, nonatomic, strong) id<RBKClock> clock;
+
+/**
+ Timestamps on `clock`, in nanoseconds, of the most recent traffic in each direction. 0 if there has been none.
+ */
+@property (readonly, nonatomic, assign) uint64_t lastSentTime;
+@property (readonly, nonatomic, assign) uint64_t lastReceivedTime;
+
+/**
+ @param queue The queue the delegate is called on. Must be serial.
+ */
+- (instancetype)initWithQueue:(dispatch_queue_t)queue;
+
+/**
+ @param clock Where deadlines are measured and timed; `RBKSystemClock` for the other initializers.
+ */
+- (instancetype)initWithQueue:(dispatch_queue_t)queue clock:(id<RBKClock>)clock;
+
+/**
+ Starts the timer, or changes the intervals of a running one. Both idle periods are measured from now.
+ */
+- (void)startWithOutgoingInterval:(NSTimeInterval)outgoingInterval incomingInterval:(NSTimeInterval)incomingInterval;
+- (void)stop;
+
+/**
+ Stops and restarts checking for incoming traffic, for while the socket isn't reading and nothing can arrive. Heartbeats are still sent. After resuming, the incoming idle period is measured from then.
+ */
+- (void)suspendIncoming;
+- (void)resumeIncoming;
+
+- (void)frameSent;
+- (void)frameReceived;
+
+@end
@@ -0,0 +1,181 @@
+//
+//  RBKStompHeartbeatScheduler.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKStompHeartbeatScheduler.h"
+#import "RBKSocketMetrics.h"
+#import "RBKClock.h"
+
+#include <libkern/OSAtomic.h>
+
+static inline void RBKAtomicStore64(volatile int64_t *target, int64_t value) {
+    int64_t current;
+    do {
+        current = *target;
+    } while (!OSAtomicCompareAndSwap64Barrier(current, value, target));
+}
+
+@interface RBKStompHeartbeatScheduler ()
+
+@property (readwrite, nonatomic, assign) NSTimeInterval outgoingInterval;
+@property (readwrite, nonatomic, assign) NSTimeInterval incomingInterval;
+@property (strong, nonatomic) dispatch_queue_t queue;
+@property (readwrite, strong, nonatomic) id<RBKClock> clock;
+@property (strong, nonatomic) id<RBKClockTimer> timer;
+@property (assign, nonatomic, getter = isRunning) BOOL running;
+@property (assign, nonatomic) uint64_t startTime;
+@property (assign, nonatomic, getter = isIncomingSuspended) BOOL incomingSuspended;
+@property (assign, nonatomic) uint64_t incomingResumeTime;
+
+@end
+
+@implementation RBKStompHeartbeatScheduler {
+    volatile int64_t _lastSentTime;
+    volatile int64_t _lastReceivedTime;
+}
+
+- (instancetype)init {
+    return [self initWithQueue:dispatch_queue_create("com.robotsandpencils.stomp.heartbeat", DISPATCH_QUEUE_SERIAL)];
+}
+
+- (instancetype)initWithQueue:(dispatch_queue_t)queue {
+    return [self initWithQueue:queue clock:[RBKSystemClock sharedClock]];
+}
+
+- (instancetype)initWithQueue:(dispatch_queue_t)queue clock:(id<RBKClock>)clock {
+    NSParameterAssert(queue);
+    NSParameterAssert(clock);
+
+    self = [super init];
+    if (self) {
+        _queue = queue;
+        _clock = clock;
+        _incomingTolerance = 2.0;
+
+        // the one timer this scheduler uses; it is re-armed rather than recreated
+        __weak typeof(self)weakSelf = self;
+        _timer = [clock timerWithQueue:queue handler:^{
+            [weakSelf timerFired];
+        }];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [_timer cancel];
+}
+
+- (uint64_t)lastSentTime {
+    return (uint64_t)_lastSentTime;
+}
+
+- (uint64_t)lastReceivedTime {
+    return (uint64_t)_lastReceivedTime;
+}
+
+#pragma mark - Public
+
+- (void)startWithOutgoingInterval:(NSTimeInterval)outgoingInterval incomingInterval:(NSTimeInterval)incomingInterval {
+    dispatch_async(self.queue, ^{
+        self.outgoingInterval = MAX(outgoingInterval, 0);
+        self.incomingInterval = MAX(incomingInterval, 0);
+        self.startTime = [self.clock now];
+        self.running = (self.outgoingInterval > 0 || self.incomingInterval > 0);
+        [self rearmTimer];
+    });
+}
+
+- (void)stop {
+    dispatch_async(self.queue, ^{
+        self.running = NO;
+        [self rearmTimer];
+    });
+}
+
+- (void)suspendIncoming {
+    dispatch_async(self.queue, ^{
+        self.incomingSuspended = YES;
+        [self rearmTimer];
+    });
+}
+
+- (void)resumeIncoming {
+    dispatch_async(self.queue, ^{
+        self.incomingSuspended = NO;
+        self.incomingResumeTime = [self.clock now];
+        [self rearmTimer];
+    });
+}
+
+- (void)frameSent {
+    RBKAtomicStore64(&_lastSentTime, (int64_t)[self.clock now]);
+}
+
+- (void)frameReceived {
+    RBKAtomicStore64(&_lastReceivedTime, (int64_t)[self.clock now]);
+}
+
+#pragma mark - Private
+
+- (uint64_t)sendDeadline {
+    return MAX(self.lastSentTime, self.startTime) + (uint64_t)(self.outgoingInterval * NSEC_PER_SEC);
+}
+
+- (BOOL)isCheckingIncoming {
+    return self.incomingInterval > 0 && !self.isIncomingSuspended;
+}
+
+- (uint64_t)receiveDeadline {
+    return MAX(MAX(self.lastReceivedTime, self.startTime), self.incomingResumeTime) + (uint64_t)(self.incomingInterval * self.incomingTolerance * NSEC_PER_SEC);
+}
+
+- (void)rearmTimer {
+    if (!self.isRunning) {
+        [self.timer fireAtTime:RBKClockDistantFuture leeway:0];
+        return;
+    }
+
+    uint64_t deadline = UINT64_MAX;
+    NSTimeInterval shortestInterval = DBL_MAX;
+    if (self.outgoingInterval > 0) {
+        deadline = MIN(deadline, [self sendDeadline]);
+        shortestInterval = MIN(shortestInterval, self.outgoingInterval);
+    }
+    if ([self isCheckingIncoming]) {
+        deadline = MIN(deadline, [self receiveDeadline]);
+        shortestInterval = MIN(shortestInterval, self.incomingInterval);
+    }
+    if (deadline == UINT64_MAX) {
+        [self.timer fireAtTime:RBKClockDistantFuture leeway:0]; // only checking incoming, and that is suspended
+        return;
+    }
+
+    // use 5% leeway
+    uint64_t leeway = shortestInterval / 20.0 * NSEC_PER_SEC;
+    [self.timer fireAtTime:deadline leeway:leeway];
+}
+
+- (void)timerFired {
+    if (!self.isRunning) {
+        return;
+    }
+
+    uint64_t now = [self.clock now];
+    if ([self isCheckingIncoming] && now >= [self receiveDeadline]) {
+        self.running = NO;
+        [self rearmTimer];
+        [self.delegate heartbeatSchedulerDidMissIncomingHeartbeat:self];
+        return;
+    }
+
+    if (self.outgoingInterval > 0 && now >= [self sendDeadline]) {
+        [self frameSent]; // so the timer is not re-armed for a deadline that has already passed
+        [self.delegate heartbeatSchedulerShouldSendHeartbeat:self];
+    }
+    [self rearmTimer];
+}
+
+@end
@@ -0,0 +1,48 @@
+//
+//  RBKStompLastValueCache.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class RBKStompFrame;
+
+/**
+ Keeps the newest MESSAGE frame of each destination and key in a memory-mapped file, so the next launch can show them before the broker has sent anything. Assign one to `-[RBKSTOMPSocket lastValueCache]`.
+
+ Frames are stored as they arrived and only parsed when asked for. The file is appended to; once superseded frames take up more of it than current ones, it is rewritten with the current ones only. Writes reach the file as soon as they are copied into the mapping, so they survive the app being killed, though not necessarily the device losing power. The records of the file are only read on first use. Safe to use from any thread.
+ */
+@interface RBKStompLastValueCache : NSObject
+
+@property (readonly, nonatomic, strong) NSURL *URL;
+
+/**
+ How many frames are cached, across all destinations.
+ */
+@property (readonly, nonatomic, assign) NSUInteger numberOfMessages;
+
+/**
+ Opens the cache at `url`, creating the file if need be.
+ */
+- (instancetype)initWithURL:(NSURL *)url error:(NSError *__autoreleasing *)error;
+
+/**
+ Caches the raw MESSAGE frame `frameData` as the newest of `destination` under `key`, replacing the one there.
+ */
+- (void)storeFrameData:(NSData *)frameData destination:(NSString *)destination key:(NSString *)key;
+
+/**
+ The frames cached for `destination`, parsed, oldest first.
+ */
+- (NSArray *)messageFramesForDestination:(NSString *)destination;
+
+- (void)removeMessagesForDestination:(NSString *)destination;
+
+/**
+ Unmaps the file. Later stores are ignored and lookups find nothing.
+ */
+- (void)close;
+
+@end
@@ -0,0 +1,417 @@
+//
+//  RBKStompLastValueCache.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKStompLastValueCache.h"
+#import "RBKStompFrame.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char RBKStompLastValueCacheMagic[8] = {'R', 'B', 'K', 'L', 'V', 'C', '\0', '\0'};
+static const uint32_t RBKStompLastValueCacheVersion = 1;
+static const size_t RBKStompLastValueCacheInitialLength = 256 * 1024;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerLength;      // where the first record starts
+} RBKStompLastValueCacheFileHeader;
+
+typedef struct {
+    uint32_t checksum;          // of the other fields, the destination, the key and the frame
+    uint32_t destinationLength; // 0 past the last record, where the file is still zeroed
+    uint32_t keyLength;
+    uint32_t frameLength;
+} RBKStompLastValueCacheRecordHeader;
+
+static inline size_t RBKStompLastValueCacheRecordLength(RBKStompLastValueCacheRecordHeader header) {
+    // keep every record header 8 byte aligned
+    return (sizeof(RBKStompLastValueCacheRecordHeader) + (size_t)header.destinationLength + header.keyLength + header.frameLength + 7) & ~(size_t)7;
+}
+
+static uint32_t RBKStompLastValueCacheChecksum(RBKStompLastValueCacheRecordHeader header, const uint8_t *payload) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    uint32_t lengths[3] = {header.destinationLength, header.keyLength, header.frameLength};
+    const uint8_t *lengthBytes = (const uint8_t *)lengths;
+    for (size_t idx = 0; idx < sizeof(lengths); idx++) {
+        hash = (hash ^ lengthBytes[idx]) * 16777619u;
+    }
+    size_t payloadLength = (size_t)header.destinationLength + header.keyLength + header.frameLength;
+    for (size_t idx = 0; idx < payloadLength; idx++) {
+        hash = (hash ^ payload[idx]) * 16777619u;
+    }
+    return hash;
+}
+
+typedef struct {
+    int fd;
+    uint8_t *bytes;
+    size_t capacity;
+} RBKStompLastValueCacheMapping;
+
+// creates, or empties, the file at `path` with room for `capacity` bytes
+static BOOL RBKStompLastValueCacheMappingCreate(RBKStompLastValueCacheMapping *mapping, const char *path, size_t capacity) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return NO;
+    }
+    void *bytes = MAP_FAILED;
+    if (ftruncate(fd, (off_t)capacity) == 0) {
+        bytes = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (bytes == MAP_FAILED) {
+        int savedErrno = errno;
+        close(fd);
+        errno = savedErrno;
+        return NO;
+    }
+
+    RBKStompLastValueCacheFileHeader header;
+    memcpy(header.magic, RBKStompLastValueCacheMagic, sizeof(header.magic));
+    header.version = RBKStompLastValueCacheVersion;
+    header.headerLength = sizeof(RBKStompLastValueCacheFileHeader);
+    memcpy(bytes, &header, sizeof(header));
+
+    mapping->fd = fd;
+    mapping->bytes = bytes;
+    mapping->capacity = capacity;
+    return YES;
+}
+
+// on failure the old mapping is left in place
+static BOOL RBKStompLastValueCacheMappingResize(RBKStompLastValueCacheMapping *mapping, size_t capacity) {
+    if (ftruncate(mapping->fd, (off_t)capacity) != 0) {
+        return NO;
+    }
+    void *bytes = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, mapping->fd, 0);
+    if (bytes == MAP_FAILED) {
+        return NO;
+    }
+    munmap(mapping->bytes, mapping->capacity);
+    mapping->bytes = bytes;
+    mapping->capacity = capacity;
+    return YES;
+}
+
+static void RBKStompLastValueCacheMappingClose(RBKStompLastValueCacheMapping *mapping) {
+    if (mapping->bytes) {
+        munmap(mapping->bytes, mapping->capacity);
+        mapping->bytes = NULL;
+    }
+    if (mapping->fd >= 0) {
+        close(mapping->fd);
+        mapping->fd = -1;
+    }
+}
+
+@interface RBKStompLastValueCache ()
+
+@property (readwrite, nonatomic, strong) NSURL *URL;
+@property (strong, nonatomic) NSLock *lock;
+
+@end
+
+@implementation RBKStompLastValueCache {
+    RBKStompLastValueCacheMapping _mapping;
+    size_t _length;                 // the header and every record; known once the index is loaded
+    size_t _liveLength;             // the records the index points at
+    NSMutableDictionary *_index;    // destination -> key -> record offset; nil until first used
+    NSUInteger _messageCount;
+}
+
+- (instancetype)init {
+    @throw [NSException exceptionWithName:NSInternalInconsistencyException reason:[NSString stringWithFormat:@"%@ Failed to call designated initializer. Invoke `initWithURL:error:` instead.", NSStringFromClass([self class])] userInfo:nil];
+}
+
+- (instancetype)initWithURL:(NSURL *)url error:(NSError *__autoreleasing *)error {
+    NSParameterAssert(url);
+
+    self = [super init];
+    if (self) {
+        _URL = url;
+        _lock = [[NSLock alloc] init];
+        _mapping.fd = -1;
+
+        if (![self openMapping]) {
+            if (error) {
+                *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSURLErrorKey: url}];
+            }
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self closeMapping];
+}
+
+- (NSUInteger)numberOfMessages {
+    [self.lock lock];
+    [self loadIndexIfNeeded];
+    NSUInteger count = _messageCount;
+    [self.lock unlock];
+    return count;
+}
+
+#pragma mark - Public
+
+- (void)storeFrameData:(NSData *)frameData destination:(NSString *)destination key:(NSString *)key {
+    NSParameterAssert(frameData);
+    NSParameterAssert(destination);
+    NSParameterAssert(key);
+
+    NSData *destinationData = [destination dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *keyData = [key dataUsingEncoding:NSUTF8StringEncoding];
+    if ([destinationData length] == 0) {
+        return;
+    }
+    RBKStompLastValueCacheRecordHeader header;
+    header.destinationLength = (uint32_t)[destinationData length];
+    header.keyLength = (uint32_t)[keyData length];
+    header.frameLength = (uint32_t)[frameData length];
+    size_t recordLength = RBKStompLastValueCacheRecordLength(header);
+
+    [self.lock lock];
+    [self loadIndexIfNeeded];
+    if (!_mapping.bytes || ![self reserveLength:recordLength]) {
+        [self.lock unlock];
+        return;
+    }
+
+    // the header goes last, so a record cut short by a crash fails its checksum
+    uint8_t *record = _mapping.bytes + _length;
+    uint8_t *payload = record + sizeof(header);
+    memcpy(payload, [destinationData bytes], header.destinationLength);
+    memcpy(payload + header.destinationLength, [keyData bytes], header.keyLength);
+    memcpy(payload + header.destinationLength + header.keyLength, [frameData bytes], header.frameLength);
+    header.checksum = RBKStompLastValueCacheChecksum(header, payload);
+    memcpy(record, &header, sizeof(header));
+
+    [self indexRecordAtOffset:_length destination:destination key:key];
+    _length += recordLength;
+    [self.lock unlock];
+}
+
+- (NSArray *)messageFramesForDestination:(NSString *)destination {
+    NSParameterAssert(destination);
+
+    NSMutableArray *frameDatas = [NSMutableArray array];
+    [self.lock lock];
+    [self loadIndexIfNeeded];
+    NSArray *offsets = [[_index[destination] allValues] sortedArrayUsingSelector:@selector(compare:)];
+    for (NSNumber *offset in offsets) {
+        RBKStompLastValueCacheRecordHeader header = [self recordHeaderAtOffset:[offset unsignedLongLongValue]];
+        const uint8_t *frameBytes = _mapping.bytes + [offset unsignedLongLongValue] + sizeof(header) + header.destinationLength + header.keyLength;
+        [frameDatas addObject:[NSData dataWithBytes:frameBytes length:header.frameLength]];
+    }
+    [self.lock unlock];
+
+    // parse outside the lock, so storing doesn't wait on it
+    NSMutableArray *frames = [NSMutableArray arrayWithCapacity:[frameDatas count]];
+    for (NSData *frameData in frameDatas) {
+        [frames addObject:[RBKStompFrame responseFrameFromData:frameData]];
+    }
+    return frames;
+}
+
+- (void)removeMessagesForDestination:(NSString *)destination {
+    NSParameterAssert(destination);
+
+    [self.lock lock];
+    [self loadIndexIfNeeded];
+    NSDictionary *keys = _index[destination];
+    if (keys) {
+        for (NSNumber *offset in [keys allValues]) {
+            _liveLength -= RBKStompLastValueCacheRecordLength([self recordHeaderAtOffset:[offset unsignedLongLongValue]]);
+        }
+        _messageCount -= [keys count];
+        [_index removeObjectForKey:destination];
+        // a removal isn't recorded, so it only lasts once the file no longer holds the frames
+        [self compactWithReservedLength:0];
+    }
+    [self.lock unlock];
+}
+
+- (void)close {
+    [self.lock lock];
+    [self closeMapping];
+    [self.lock unlock];
+}
+
+#pragma mark - Private
+
+- (BOOL)openMapping {
+    const char *path = [[self.URL path] fileSystemRepresentation];
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return NO;
+    }
+    struct stat status;
+    if (fstat(fd, &status) == 0 && (size_t)status.st_size >= sizeof(RBKStompLastValueCacheFileHeader)) {
+        void *bytes = mmap(NULL, (size_t)status.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (bytes != MAP_FAILED) {
+            RBKStompLastValueCacheFileHeader header;
+            memcpy(&header, bytes, sizeof(header));
+            if (memcmp(header.magic, RBKStompLastValueCacheMagic, sizeof(header.magic)) == 0 && header.version == RBKStompLastValueCacheVersion && header.headerLength <= (size_t)status.st_size) {
+                _mapping.fd = fd;
+                _mapping.bytes = bytes;
+                _mapping.capacity = (size_t)status.st_size;
+                return YES;
+            }
+            munmap(bytes, (size_t)status.st_size);
+        }
+    }
+    close(fd);
+
+    // anything else is started over; it is only a cache
+    return RBKStompLastValueCacheMappingCreate(&_mapping, path, RBKStompLastValueCacheInitialLength);
+}
+
+- (void)closeMapping {
+    if (!_mapping.bytes) {
+        return;
+    }
+    msync(_mapping.bytes, _mapping.capacity, MS_ASYNC);
+    if (_index) {
+        ftruncate(_mapping.fd, (off_t)_length);
+    }
+    RBKStompLastValueCacheMappingClose(&_mapping);
+    _index = [NSMutableDictionary dictionary];
+    _messageCount = 0;
+}
+
+- (RBKStompLastValueCacheRecordHeader)recordHeaderAtOffset:(size_t)offset {
+    RBKStompLastValueCacheRecordHeader header;
+    memcpy(&header, _mapping.bytes + offset, sizeof(header));
+    return header;
+}
+
+// call with the lock held
+- (void)indexRecordAtOffset:(size_t)offset destination:(NSString *)destination key:(NSString *)key {
+    NSMutableDictionary *keys = _index[destination];
+    if (!keys) {
+        keys = [NSMutableDictionary dictionary];
+        _index[destination] = keys;
+    }
+    NSNumber *replacedOffset = keys[key];
+    if (replacedOffset) {
+        _liveLength -= RBKStompLastValueCacheRecordLength([self recordHeaderAtOffset:[replacedOffset unsignedLongLongValue]]);
+    } else {
+        _messageCount += 1;
+    }
+    keys[key] = @(offset);
+    _liveLength += RBKStompLastValueCacheRecordLength([self recordHeaderAtOffset:offset]);
+}
+
+// reads the records on first use rather than when the cache is opened; call with the lock held
+- (void)loadIndexIfNeeded {
+    if (_index) {
+        return;
+    }
+    _index = [NSMutableDictionary dictionary];
+
+    const uint8_t *bytes = _mapping.bytes;
+    size_t capacity = _mapping.capacity;
+    RBKStompLastValueCacheFileHeader fileHeader;
+    memcpy(&fileHeader, bytes, sizeof(fileHeader));
+    size_t offset = fileHeader.headerLength;
+    while (capacity - offset >= sizeof(RBKStompLastValueCacheRecordHeader)) {
+        RBKStompLastValueCacheRecordHeader header = [self recordHeaderAtOffset:offset];
+        if (header.destinationLength == 0 || header.destinationLength > capacity || header.keyLength > capacity || header.frameLength > capacity) {
+            break;
+        }
+        size_t recordLength = RBKStompLastValueCacheRecordLength(header);
+        if (recordLength > capacity - offset) {
+            break;
+        }
+        const uint8_t *payload = bytes + offset + sizeof(header);
+        if (RBKStompLastValueCacheChecksum(header, payload) != header.checksum) {
+            break;
+        }
+        NSString *destination = [[NSString alloc] initWithBytes:payload length:header.destinationLength encoding:NSUTF8StringEncoding];
+        NSString *key = [[NSString alloc] initWithBytes:payload + header.destinationLength length:header.keyLength encoding:NSUTF8StringEncoding];
+        if (!destination || !key) {
+            break;
+        }
+        [self indexRecordAtOffset:offset destination:destination key:key];
+        offset += recordLength;
+    }
+    _length = offset;
+}
+
+// makes room for a record of `recordLength` at the end; call with the lock held
+- (BOOL)reserveLength:(size_t)recordLength {
+    if (_length + recordLength <= _mapping.capacity) {
+        return YES;
+    }
+    // rewrite rather than grow while most of the file is superseded frames
+    if (_liveLength < _length / 2 && [self compactWithReservedLength:recordLength]) {
+        return YES;
+    }
+    size_t capacity = MAX(_mapping.capacity, RBKStompLastValueCacheInitialLength);
+    while (_length + recordLength > capacity) {
+        capacity *= 2;
+    }
+    return RBKStompLastValueCacheMappingResize(&_mapping, capacity);
+}
+
+// writes the current records to a new file and swaps it in; call with the lock held
+- (BOOL)compactWithReservedLength:(size_t)reservedLength {
+    size_t length = sizeof(RBKStompLastValueCacheFileHeader) + _liveLength;
+    size_t capacity = RBKStompLastValueCacheInitialLength;
+    while (length + reservedLength > capacity / 2) {
+        capacity *= 2;
+    }
+
+    NSString *compactedPath = [[self.URL path] stringByAppendingPathExtension:@"compacting"];
+    RBKStompLastValueCacheMapping compacted = {-1, NULL, 0};
+    if (!RBKStompLastValueCacheMappingCreate(&compacted, [compactedPath fileSystemRepresentation], capacity)) {
+        return NO;
+    }
+
+    // oldest first, so the order frames are handed out in stays the same
+    NSMutableArray *records = [NSMutableArray arrayWithCapacity:_messageCount];
+    [_index enumerateKeysAndObjectsUsingBlock:^(NSString *destination, NSMutableDictionary *keys, BOOL *stop) {
+        [keys enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSNumber *offset, BOOL *stop) {
+            [records addObject:@[offset, destination, key]];
+        }];
+    }];
+    [records sortUsingComparator:^NSComparisonResult(NSArray *record1, NSArray *record2) {
+        return [record1[0] compare:record2[0]];
+    }];
+
+    NSMutableArray *compactedOffsets = [NSMutableArray arrayWithCapacity:[records count]];
+    size_t compactedLength = sizeof(RBKStompLastValueCacheFileHeader);
+    for (NSArray *record in records) {
+        size_t offset = [record[0] unsignedLongLongValue];
+        size_t recordLength = RBKStompLastValueCacheRecordLength([self recordHeaderAtOffset:offset]);
+        memcpy(compacted.bytes + compactedLength, _mapping.bytes + offset, recordLength);
+        [compactedOffsets addObject:@(compactedLength)];
+        compactedLength += recordLength;
+    }
+
+    msync(compacted.bytes, compactedLength, MS_SYNC);
+    if (rename([compactedPath fileSystemRepresentation], [[self.URL path] fileSystemRepresentation]) != 0) {
+        RBKStompLastValueCacheMappingClose(&compacted);
+        unlink([compactedPath fileSystemRepresentation]);
+        return NO;
+    }
+    NSMutableDictionary *index = _index;
+    [records enumerateObjectsUsingBlock:^(NSArray *record, NSUInteger idx, BOOL *stop) {
+        index[record[1]][record[2]] = compactedOffsets[idx];
+    }];
+    RBKStompLastValueCacheMappingClose(&_mapping);
+    _mapping = compacted;
+    _length = compactedLength;
+    return YES;
+}
+
+@end
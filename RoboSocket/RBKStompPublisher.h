@@ -0,0 +1,82 @@
+//
+//  RBKStompPublisher.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class RBKSTOMPSocket;
+@class RBKStompFrame;
+@class RBKOutboundJournal;
+
+typedef void (^RBKStompPublishSuccessBlock)(RBKStompFrame *receiptFrame);
+typedef void (^RBKStompPublishFailureBlock)(NSError *error);
+
+/**
+ Publishes SEND frames with confirmed delivery. Every frame asks for a receipt, and up to `maximumUnconfirmedFrames` of them are on the wire at once; the rest wait their turn. A publish succeeds when its RECEIPT arrives, in whatever order the server sends them, and fails on an ERROR carrying its receipt id, on timeout or when the socket closes.
+
+ Callbacks are called on the main queue.
+ */
+@interface RBKStompPublisher : NSObject
+
+@property (weak, nonatomic, readonly) RBKSTOMPSocket *socket;
+
+/**
+ How many published frames may be waiting for a receipt at once. 32 by default.
+ */
+@property (assign, nonatomic) NSUInteger maximumUnconfirmedFrames;
+
+/**
+ How long, in seconds, a frame waits for its receipt once sent. Until set, it is the socket's `operationTimeoutInterval` at the time; 0 waits forever.
+ */
+@property (assign, nonatomic) NSTimeInterval receiptTimeoutInterval;
+
+/**
+ Where frames are recorded before they are sent, so they outlive the process. A frame is retired when its RECEIPT or ERROR arrives; one that times out or is cut off by the connection closing stays in the journal, and is sent again without callbacks once a socket using the journal connects. Delivery becomes at least once, and replayed frames may arrive after newer ones. A frame that can't be journaled fails instead of being sent. Frames in a transaction aren't journaled: replayed on a new connection, their ACKs would name the old connection's messages. Set it before publishing.
+ */
+@property (strong, nonatomic) RBKOutboundJournal *journal;
+
+@property (readonly, nonatomic, assign) NSUInteger numberOfUnconfirmedFrames;
+@property (readonly, nonatomic, assign) NSUInteger numberOfQueuedFrames;
+
+- (instancetype)initWithSocket:(RBKSTOMPSocket *)socket;
+
+- (void)publishToDestination:(NSString *)destination
+                     headers:(NSDictionary *)headers
+                        body:(NSString *)body
+                     success:(RBKStompPublishSuccessBlock)success
+                     failure:(RBKStompPublishFailureBlock)failure;
+
+/**
+ Publishes a frame that already asks for the receipt `receiptID`, e.g. a transaction batch whose COMMIT carries it. Get the id from `-nextReceiptID`.
+ */
+- (void)publishFrame:(RBKStompFrame *)frame
+           receiptID:(NSString *)receiptID
+             success:(RBKStompPublishSuccessBlock)success
+             failure:(RBKStompPublishFailureBlock)failure;
+
+- (NSString *)nextReceiptID;
+
+/**
+ Whether `frame` is a RECEIPT, or an ERROR, for a frame this publisher is waiting on. Cheap for other frames.
+ */
+- (BOOL)isReceiptForUnconfirmedFrame:(id)frame;
+
+/**
+ Completes the publish `responseFrame` answers. Returns NO if it answers none of them.
+ */
+- (BOOL)handleReceiptFrame:(RBKStompFrame *)responseFrame;
+
+/**
+ Publishes the frames left unretired in `journal`, other than those already in flight. The socket calls this when it receives CONNECTED.
+ */
+- (void)resendJournaledFrames;
+
+/**
+ Fails every unconfirmed and queued publish, e.g. because the connection closed.
+ */
+- (void)failAllWithError:(NSError *)error;
+
+@end
@@ -0,0 +1,323 @@
+//
+//  RBKStompPublisher.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKStompPublisher.h"
+#import "RBKSTOMPSocket.h"
+#import "RBKStompFrame.h"
+#import "RBKOutboundJournal.h"
+#import "RBKSocketOperation.h"
+
+@interface RBKStompPublication : NSObject
+
+@property (strong, nonatomic) RBKStompFrame *frame;
+@property (copy, nonatomic) NSString *receiptID;
+@property (copy, nonatomic) RBKStompPublishSuccessBlock success;
+@property (copy, nonatomic) RBKStompPublishFailureBlock failure;
+@property (strong, nonatomic) RBKTimingWheelTimeout *timeout;
+@property (assign, nonatomic, getter = isJournaled) BOOL journaled;
+
+@end
+
+@implementation RBKStompPublication
+
+@end
+
+@interface RBKStompPublisher ()
+
+@property (weak, nonatomic, readwrite) RBKSTOMPSocket *socket;
+@property (strong, nonatomic) NSLock *lock;
+@property (strong, nonatomic) NSMutableDictionary *unconfirmedPublications; // receipt id -> publication
+@property (strong, nonatomic) NSMutableArray *queuedPublications;
+@property (copy, nonatomic) NSString *receiptPrefix;
+@property (assign, nonatomic) NSUInteger receiptCounter;
+
+@end
+
+@implementation RBKStompPublisher
+
+- (instancetype)initWithSocket:(RBKSTOMPSocket *)socket {
+    self = [super init];
+    if (self) {
+        _socket = socket;
+        _lock = [[NSLock alloc] init];
+        _unconfirmedPublications = [NSMutableDictionary dictionary];
+        _queuedPublications = [NSMutableArray array];
+        _maximumUnconfirmedFrames = 32;
+        _receiptTimeoutInterval = -1; // the socket's, read when a frame is sent
+        // journaled receipt ids outlive the process, so they must not repeat across launches
+        _receiptPrefix = [NSString stringWithFormat:@"pub-%@-", [[NSUUID UUID] UUIDString]];
+    }
+    return self;
+}
+
+- (NSUInteger)numberOfUnconfirmedFrames {
+    [self.lock lock];
+    NSUInteger count = [self.unconfirmedPublications count];
+    [self.lock unlock];
+    return count;
+}
+
+- (NSUInteger)numberOfQueuedFrames {
+    [self.lock lock];
+    NSUInteger count = [self.queuedPublications count];
+    [self.lock unlock];
+    return count;
+}
+
+- (NSTimeInterval)receiptTimeoutInterval {
+    return _receiptTimeoutInterval >= 0 ? _receiptTimeoutInterval : self.socket.operationTimeoutInterval;
+}
+
+#pragma mark - Public
+
+- (void)publishToDestination:(NSString *)destination headers:(NSDictionary *)headers body:(NSString *)body success:(RBKStompPublishSuccessBlock)success failure:(RBKStompPublishFailureBlock)failure {
+    NSParameterAssert(destination);
+
+    NSString *receiptID = [self nextReceiptID];
+    NSMutableDictionary *mutableHeaders = [NSMutableDictionary dictionaryWithDictionary:headers];
+    mutableHeaders[RBKStompHeaderReceipt] = receiptID;
+    RBKStompFrame *frame = [RBKStompFrame sendFrameWithDestination:destination headers:mutableHeaders body:body];
+
+    [self publishFrame:frame receiptID:receiptID success:success failure:failure];
+}
+
+- (void)publishFrame:(RBKStompFrame *)frame receiptID:(NSString *)receiptID success:(RBKStompPublishSuccessBlock)success failure:(RBKStompPublishFailureBlock)failure {
+    NSParameterAssert(frame);
+    NSParameterAssert(receiptID);
+
+    RBKStompPublication *publication = [[RBKStompPublication alloc] init];
+    publication.frame = frame;
+    publication.receiptID = receiptID;
+    publication.success = success;
+    publication.failure = failure;
+
+    [self.lock lock];
+    [self.queuedPublications addObject:publication];
+    NSArray *sendable = [self dequeueSendablePublications];
+    [self.lock unlock];
+
+    [self sendPublications:sendable];
+}
+
+- (NSString *)nextReceiptID {
+    [self.lock lock];
+    NSString *receiptID = [self.receiptPrefix stringByAppendingFormat:@"%lu", (unsigned long)++self.receiptCounter];
+    [self.lock unlock];
+    return receiptID;
+}
+
+- (BOOL)isReceiptForUnconfirmedFrame:(id)frame {
+    if ([self numberOfUnconfirmedFrames] == 0) {
+        return NO;
+    }
+
+    // skip parsing anything that can't be a receipt
+    NSData *data = [frame isKindOfClass:[NSString class]] ? [frame dataUsingEncoding:NSUTF8StringEncoding] : frame;
+    if (![data isKindOfClass:[NSData class]]) {
+        return NO;
+    }
+    static const char receipt[] = "RECEIPT";
+    static const char error[] = "ERROR";
+    if (!RBKStompFrameDataHasCommand(data, receipt, sizeof(receipt) - 1) && !RBKStompFrameDataHasCommand(data, error, sizeof(error) - 1)) {
+        return NO;
+    }
+
+    NSString *receiptID = [RBKStompFrame headerValueForKey:RBKStompHeaderReceiptID inFrameData:data];
+    if (!receiptID) {
+        return NO;
+    }
+    [self.lock lock];
+    BOOL isTracked = self.unconfirmedPublications[receiptID] != nil;
+    [self.lock unlock];
+    return isTracked;
+}
+
+- (BOOL)handleReceiptFrame:(RBKStompFrame *)responseFrame {
+    NSString *receiptID = [responseFrame headerValueForKey:RBKStompHeaderReceiptID];
+    if (!receiptID) {
+        return NO;
+    }
+
+    [self.lock lock];
+    RBKStompPublication *publication = self.unconfirmedPublications[receiptID];
+    if (publication) {
+        [self.unconfirmedPublications removeObjectForKey:receiptID];
+    }
+    NSArray *sendable = [self dequeueSendablePublications];
+    [self.lock unlock];
+
+    if (!publication) {
+        return NO;
+    }
+
+    // an ERROR won't go any better the next time
+    if (publication.isJournaled) {
+        [self.journal retireEntryWithKey:receiptID];
+    }
+    [publication.timeout cancel];
+    if ([responseFrame.command isEqualToString:RBKStompCommandError]) {
+        NSString *message = [responseFrame headerValueForKey:RBKStompHeaderMessage] ?: @"The server rejected the frame";
+        NSError *error = [NSError errorWithDomain:RBKSocketNetworkingErrorDomain code:NSURLErrorBadServerResponse userInfo:@{NSLocalizedDescriptionKey: message}];
+        [self completePublication:publication receiptFrame:nil error:error];
+    } else {
+        [self completePublication:publication receiptFrame:responseFrame error:nil];
+    }
+
+    [self sendPublications:sendable];
+    return YES;
+}
+
+- (void)resendJournaledFrames {
+    NSArray *entries = [self.journal unretiredEntries];
+    if ([entries count] == 0) {
+        return;
+    }
+
+    [self.lock lock];
+    NSMutableSet *trackedReceiptIDs = [NSMutableSet setWithArray:[self.unconfirmedPublications allKeys]];
+    for (RBKStompPublication *publication in self.queuedPublications) {
+        [trackedReceiptIDs addObject:publication.receiptID];
+    }
+    for (RBKOutboundJournalEntry *entry in entries) {
+        if ([trackedReceiptIDs containsObject:entry.key]) {
+            continue;
+        }
+        RBKStompPublication *publication = [[RBKStompPublication alloc] init];
+        publication.frame = [RBKStompFrame frameWithFrameData:entry.data];
+        publication.receiptID = entry.key;
+        publication.journaled = YES;
+        [self.queuedPublications addObject:publication];
+    }
+    NSArray *sendable = [self dequeueSendablePublications];
+    [self.lock unlock];
+
+    [self sendPublications:sendable];
+}
+
+- (void)failAllWithError:(NSError *)error {
+    [self.lock lock];
+    NSMutableArray *publications = [NSMutableArray arrayWithArray:[self.unconfirmedPublications allValues]];
+    [publications addObjectsFromArray:self.queuedPublications];
+    [self.unconfirmedPublications removeAllObjects];
+    [self.queuedPublications removeAllObjects];
+    [self.lock unlock];
+
+    for (RBKStompPublication *publication in publications) {
+        [publication.timeout cancel];
+        [self completePublication:publication receiptFrame:nil error:error];
+    }
+}
+
+#pragma mark - Private
+
+// call with the lock held; marks the returned publications unconfirmed, so they must be sent
+- (NSArray *)dequeueSendablePublications {
+    NSMutableArray *sendable = [NSMutableArray array];
+    while ([self.queuedPublications count] > 0 && [self.unconfirmedPublications count] < MAX(self.maximumUnconfirmedFrames, 1u)) {
+        RBKStompPublication *publication = self.queuedPublications[0];
+        [self.queuedPublications removeObjectAtIndex:0];
+        self.unconfirmedPublications[publication.receiptID] = publication;
+        [sendable addObject:publication];
+    }
+    return sendable;
+}
+
+- (void)sendPublications:(NSArray *)publications {
+    RBKOutboundJournal *journal = self.journal;
+    for (RBKStompPublication *publication in publications) {
+        // a transaction can't be replayed on another connection, outside its BEGIN and COMMIT
+        if (!journal || publication.isJournaled || [publication.frame isTransactional]) {
+            [self transmitPublication:publication];
+            continue;
+        }
+        // recorded before it is sent, so it is never on the wire without being on disk
+        publication.journaled = YES;
+        __weak typeof(self)weakSelf = self;
+        [journal appendEntryWithKey:publication.receiptID data:[publication.frame frameData] completion:^(NSError *error) {
+            if (error) {
+                [weakSelf journalingFailedForPublication:publication error:error];
+            } else {
+                [weakSelf transmitPublication:publication];
+            }
+        }];
+    }
+}
+
+- (void)journalingFailedForPublication:(RBKStompPublication *)publication error:(NSError *)error {
+    NSString *receiptID = publication.receiptID;
+    [self.lock lock];
+    BOOL isUnconfirmed = self.unconfirmedPublications[receiptID] == publication;
+    if (isUnconfirmed) {
+        [self.unconfirmedPublications removeObjectForKey:receiptID];
+    }
+    NSArray *sendable = [self dequeueSendablePublications];
+    [self.lock unlock];
+
+    // whatever part of it was written must not be sent later
+    [self.journal retireEntryWithKey:receiptID];
+    if (isUnconfirmed) {
+        [self completePublication:publication receiptFrame:nil error:error];
+    }
+    [self sendPublications:sendable];
+}
+
+- (void)transmitPublication:(RBKStompPublication *)publication {
+    NSString *receiptID = publication.receiptID;
+    if (publication.isJournaled) {
+        // the socket may have closed while it was being journaled
+        [self.lock lock];
+        BOOL isUnconfirmed = self.unconfirmedPublications[receiptID] == publication;
+        [self.lock unlock];
+        if (!isUnconfirmed) {
+            return;
+        }
+    }
+
+    RBKSTOMPSocket *socket = self.socket;
+    NSTimeInterval receiptTimeoutInterval = self.receiptTimeoutInterval;
+    if (receiptTimeoutInterval > 0) {
+        __weak typeof(self)weakSelf = self;
+        publication.timeout = [socket.timingWheel scheduleTimeoutWithInterval:receiptTimeoutInterval handler:^{
+            [weakSelf receiptTimedOut:receiptID];
+        }];
+    }
+    // no response expected, so the frame doesn't hold the socket's response slot while it waits for its receipt
+    [socket sendSocketOperationWithFrame:publication.frame];
+}
+
+- (void)receiptTimedOut:(NSString *)receiptID {
+    [self.lock lock];
+    RBKStompPublication *publication = self.unconfirmedPublications[receiptID];
+    [self.unconfirmedPublications removeObjectForKey:receiptID];
+    NSArray *sendable = [self dequeueSendablePublications];
+    [self.lock unlock];
+
+    if (publication) {
+        NSDictionary *userInfo = @{NSLocalizedDescriptionKey: [NSString stringWithFormat:@"No receipt within %.3gs", self.receiptTimeoutInterval]};
+        [self completePublication:publication receiptFrame:nil error:[NSError errorWithDomain:RBKSocketNetworkingErrorDomain code:NSURLErrorTimedOut userInfo:userInfo]];
+    }
+    [self sendPublications:sendable];
+}
+
+- (void)completePublication:(RBKStompPublication *)publication receiptFrame:(RBKStompFrame *)receiptFrame error:(NSError *)error {
+    RBKStompPublishSuccessBlock success = publication.success;
+    RBKStompPublishFailureBlock failure = publication.failure;
+    publication.success = nil;
+    publication.failure = nil;
+
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (error) {
+            if (failure) {
+                failure(error);
+            }
+        } else if (success) {
+            success(receiptFrame);
+        }
+    });
+}
+
+@end
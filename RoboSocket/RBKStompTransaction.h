@@ -0,0 +1,41 @@
+//
+//  RBKStompTransaction.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class RBKStompFrame;
+
+/**
+ Collects the SEND, ACK and NACK frames of a STOMP transaction. Nothing is sent until the transaction is committed with `-[RBKSTOMPSocket commitTransaction:success:failure:]`, which writes BEGIN, every collected frame and COMMIT as a single WebSocket message and waits for one receipt on the COMMIT.
+ */
+@interface RBKStompTransaction : NSObject
+
+@property (readonly, nonatomic, copy) NSString *identifier;
+@property (readonly, nonatomic, assign) NSUInteger numberOfFrames;
+
+/**
+ YES once the transaction has been committed or aborted; it can't collect any more frames.
+ */
+@property (readonly, nonatomic, assign, getter = isFinished) BOOL finished;
+
+- (instancetype)initWithIdentifier:(NSString *)identifier;
+
+- (void)sendToDestination:(NSString *)destination headers:(NSDictionary *)headers body:(NSString *)body;
+- (void)acknowledgeMessageWithIdentifier:(NSString *)identifier;
+- (void)nackMessageWithIdentifier:(NSString *)identifier;
+
+/**
+ Finishes the transaction and returns BEGIN, the collected frames and COMMIT, in that order, as one batch frame. `commitHeaders` are added to the COMMIT frame, e.g. its receipt.
+ */
+- (RBKStompFrame *)finishWithCommitHeaders:(NSDictionary *)commitHeaders;
+
+/**
+ Finishes the transaction and discards the collected frames.
+ */
+- (void)abort;
+
+@end
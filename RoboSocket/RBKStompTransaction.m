@@ -0,0 +1,79 @@
+//
+//  RBKStompTransaction.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKStompTransaction.h"
+#import "RBKStompFrame.h"
+
+@interface RBKStompTransaction ()
+
+@property (readwrite, nonatomic, copy) NSString *identifier;
+@property (readwrite, nonatomic, assign, getter = isFinished) BOOL finished;
+@property (strong, nonatomic) NSMutableArray *frames;
+
+@end
+
+@implementation RBKStompTransaction
+
+- (instancetype)initWithIdentifier:(NSString *)identifier {
+    NSParameterAssert(identifier);
+
+    self = [super init];
+    if (self) {
+        _identifier = [identifier copy];
+        _frames = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (NSUInteger)numberOfFrames {
+    return [self.frames count];
+}
+
+- (void)sendToDestination:(NSString *)destination headers:(NSDictionary *)headers body:(NSString *)body {
+    NSParameterAssert(destination);
+
+    NSMutableDictionary *mutableHeaders = [NSMutableDictionary dictionaryWithDictionary:headers];
+    mutableHeaders[RBKStompHeaderTransaction] = self.identifier;
+    [self addFrame:[RBKStompFrame sendFrameWithDestination:destination headers:mutableHeaders body:body]];
+}
+
+- (void)acknowledgeMessageWithIdentifier:(NSString *)identifier {
+    NSParameterAssert(identifier);
+    [self addFrame:[RBKStompFrame ackFrameWithIdentifier:identifier transaction:self.identifier]];
+}
+
+- (void)nackMessageWithIdentifier:(NSString *)identifier {
+    NSParameterAssert(identifier);
+    [self addFrame:[RBKStompFrame nackFrameWithIdentifier:identifier transaction:self.identifier]];
+}
+
+- (RBKStompFrame *)finishWithCommitHeaders:(NSDictionary *)commitHeaders {
+    NSAssert(!self.isFinished, @"Transaction %@ is already finished", self.identifier);
+    self.finished = YES;
+
+    NSMutableArray *frames = [NSMutableArray arrayWithCapacity:[self.frames count] + 2];
+    [frames addObject:[RBKStompFrame beginFrameWithTransaction:self.identifier headers:nil]];
+    [frames addObjectsFromArray:self.frames];
+    [frames addObject:[RBKStompFrame commitFrameWithTransaction:self.identifier headers:commitHeaders]];
+    [self.frames removeAllObjects];
+
+    return [RBKStompFrame batchFrameWithFrames:frames];
+}
+
+- (void)abort {
+    self.finished = YES;
+    [self.frames removeAllObjects];
+}
+
+#pragma mark - Private
+
+- (void)addFrame:(RBKStompFrame *)frame {
+    NSAssert(!self.isFinished, @"Transaction %@ is already finished", self.identifier);
+    [self.frames addObject:frame];
+}
+
+@end
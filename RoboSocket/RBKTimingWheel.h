@@ -0,0 +1,61 @@
+//
+//  RBKTimingWheel.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "RBKClock.h"
+
+/**
+ A pending timeout in a `RBKTimingWheel`.
+ */
+@interface RBKTimingWheelTimeout : NSObject
+
+@property (readonly, nonatomic, assign, getter = isCancelled) BOOL cancelled;
+@property (readonly, nonatomic, assign, getter = isExpired) BOOL expired;
+
+/**
+ Removes the timeout from its wheel and releases its handler. Safe from any thread; does nothing if the timeout already expired.
+ */
+- (void)cancel;
+
+@end
+
+/**
+ A hashed timing wheel: timeouts are dropped into one of `slotCount` slots by their deadline and a single timer advances one slot per tick, so scheduling and cancelling are constant time no matter how many timeouts are pending. A timeout fires up to a tick late, never early. The timer only runs while there are pending timeouts.
+ */
+@interface RBKTimingWheel : NSObject
+
+@property (readonly, nonatomic, assign) NSTimeInterval tickDuration;
+@property (readonly, nonatomic, assign) NSUInteger slotCount;
+
+/**
+ Where the ticks are timed. `RBKSystemClock` unless given another clock.
+ */
+@property (readonly, nonatomic, strong) id<RBKClock> clock;
+
+/**
+ The number of timeouts that have neither expired nor been cancelled.
+ */
+@property (readonly, nonatomic, assign) NSUInteger count;
+
+/**
+ @param tickDuration The resolution of the wheel, in seconds.
+ @param slotCount The number of slots, rounded up to a power of two. Timeouts longer than one revolution wait out extra revolutions in their slot.
+ */
+- (instancetype)initWithTickDuration:(NSTimeInterval)tickDuration slotCount:(NSUInteger)slotCount;
+
+/**
+ Ticks on `clock`, e.g. a `RBKVirtualClock`, so timeouts run as fast as a simulation does.
+ */
+- (instancetype)initWithTickDuration:(NSTimeInterval)tickDuration slotCount:(NSUInteger)slotCount clock:(id<RBKClock>)clock;
+
+/**
+ @param handler Called on the wheel's private queue once `interval` has passed, unless the timeout is cancelled first.
+ */
+- (RBKTimingWheelTimeout *)scheduleTimeoutWithInterval:(NSTimeInterval)interval handler:(dispatch_block_t)handler;
+
+@end
@@ -0,0 +1,228 @@
+//
+//  RBKTimingWheel.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKTimingWheel.h"
+
+#include <libkern/OSAtomic.h>
+
+typedef NS_ENUM(int32_t, RBKTimingWheelTimeoutState) {
+    RBKTimingWheelTimeoutPendingState = 0,
+    RBKTimingWheelTimeoutCancelledState,
+    RBKTimingWheelTimeoutExpiredState,
+};
+
+@interface RBKTimingWheelTimeout () {
+    @package
+    volatile int32_t _state;
+}
+
+@property (weak, nonatomic) RBKTimingWheel *wheel;
+@property (copy, nonatomic) dispatch_block_t handler;
+@property (assign, nonatomic) NSUInteger slot;
+@property (assign, nonatomic) NSUInteger remainingRounds;
+
+- (BOOL)expire;
+
+@end
+
+@interface RBKTimingWheel ()
+
+@property (readwrite, nonatomic, assign) NSTimeInterval tickDuration;
+@property (readwrite, nonatomic, assign) NSUInteger slotCount;
+@property (readwrite, nonatomic, strong) id<RBKClock> clock;
+@property (strong, nonatomic) dispatch_queue_t queue;
+@property (strong, nonatomic) id<RBKClockTimer> timer;
+@property (strong, nonatomic) NSArray *slots;
+@property (assign, nonatomic) NSUInteger cursor;
+@property (assign, nonatomic) NSUInteger scheduledCount; // entries still sitting in a slot, only touched on the queue
+@property (assign, nonatomic, getter = isTicking) BOOL ticking;
+@property (assign, nonatomic) uint64_t nextTickTime;
+
+- (void)removeTimeout:(RBKTimingWheelTimeout *)timeout;
+- (void)timeoutDidFinish;
+
+@end
+
+@implementation RBKTimingWheelTimeout
+
+- (BOOL)isCancelled {
+    return _state == RBKTimingWheelTimeoutCancelledState;
+}
+
+- (BOOL)isExpired {
+    return _state == RBKTimingWheelTimeoutExpiredState;
+}
+
+- (void)cancel {
+    if (!OSAtomicCompareAndSwap32Barrier(RBKTimingWheelTimeoutPendingState, RBKTimingWheelTimeoutCancelledState, &_state)) {
+        return; // already expired or cancelled
+    }
+    RBKTimingWheel *wheel = self.wheel;
+    [wheel timeoutDidFinish];
+    [wheel removeTimeout:self];
+}
+
+- (BOOL)expire {
+    return OSAtomicCompareAndSwap32Barrier(RBKTimingWheelTimeoutPendingState, RBKTimingWheelTimeoutExpiredState, &_state);
+}
+
+@end
+
+@implementation RBKTimingWheel {
+    volatile int64_t _count;
+}
+
+- (instancetype)init {
+    return [self initWithTickDuration:0.1 slotCount:512];
+}
+
+- (instancetype)initWithTickDuration:(NSTimeInterval)tickDuration slotCount:(NSUInteger)slotCount {
+    return [self initWithTickDuration:tickDuration slotCount:slotCount clock:[RBKSystemClock sharedClock]];
+}
+
+- (instancetype)initWithTickDuration:(NSTimeInterval)tickDuration slotCount:(NSUInteger)slotCount clock:(id<RBKClock>)clock {
+    NSParameterAssert(tickDuration > 0);
+    NSParameterAssert(clock);
+
+    self = [super init];
+    if (self) {
+        NSUInteger roundedSlotCount = 1;
+        while (roundedSlotCount < MAX(slotCount, 2u)) {
+            roundedSlotCount <<= 1;
+        }
+        _tickDuration = tickDuration;
+        _slotCount = roundedSlotCount;
+        _clock = clock;
+
+        NSMutableArray *slots = [NSMutableArray arrayWithCapacity:roundedSlotCount];
+        for (NSUInteger idx = 0; idx < roundedSlotCount; idx++) {
+            [slots addObject:[NSMutableSet set]];
+        }
+        _slots = slots;
+
+        _queue = dispatch_queue_create("com.robotsandpencils.networking.timingwheel", DISPATCH_QUEUE_SERIAL);
+        __weak typeof(self)weakSelf = self;
+        _timer = [clock timerWithQueue:_queue handler:^{
+            [weakSelf tick];
+        }];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [_timer cancel];
+}
+
+- (NSUInteger)count {
+    return (NSUInteger)_count;
+}
+
+- (RBKTimingWheelTimeout *)scheduleTimeoutWithInterval:(NSTimeInterval)interval handler:(dispatch_block_t)handler {
+    NSParameterAssert(handler);
+
+    RBKTimingWheelTimeout *timeout = [[RBKTimingWheelTimeout alloc] init];
+    timeout.wheel = self;
+    timeout.handler = handler;
+    OSAtomicIncrement64(&_count);
+
+    NSUInteger intervalTicks = MAX((NSUInteger)ceil(interval / self.tickDuration), 1u);
+    dispatch_async(self.queue, ^{
+        if (timeout.isCancelled) {
+            return;
+        }
+        // a running wheel is partway through the current tick, which must not count towards the interval
+        NSUInteger ticks = self.isTicking ? intervalTicks + 1 : intervalTicks;
+        timeout.slot = (self.cursor + ticks) & (self.slotCount - 1);
+        timeout.remainingRounds = (ticks - 1) / self.slotCount;
+        [self.slots[timeout.slot] addObject:timeout];
+        self.scheduledCount += 1;
+        [self startTicking];
+    });
+    return timeout;
+}
+
+#pragma mark - Private
+
+- (void)timeoutDidFinish {
+    OSAtomicDecrement64(&_count);
+}
+
+- (void)removeTimeout:(RBKTimingWheelTimeout *)timeout {
+    dispatch_async(self.queue, ^{
+        NSMutableSet *slot = self.slots[timeout.slot];
+        if ([slot containsObject:timeout]) {
+            [slot removeObject:timeout];
+            self.scheduledCount -= 1;
+        }
+        timeout.handler = nil;
+        [self stopTickingIfIdle];
+    });
+}
+
+- (void)startTicking {
+    if (self.isTicking) {
+        return;
+    }
+    self.ticking = YES;
+    self.nextTickTime = [self.clock now];
+    [self scheduleNextTick];
+}
+
+// ticks keep to their schedule, so a late tick is made up rather than pushing every later deadline back
+- (void)scheduleNextTick {
+    uint64_t tick = self.tickDuration * NSEC_PER_SEC;
+    self.nextTickTime += tick;
+    [self.timer fireAtTime:self.nextTickTime leeway:tick / 10];
+}
+
+- (void)stopTickingIfIdle {
+    if (!self.isTicking || self.scheduledCount > 0) {
+        return;
+    }
+    self.ticking = NO;
+    [self.timer fireAtTime:RBKClockDistantFuture leeway:0];
+}
+
+- (void)tick {
+    if (!self.isTicking) {
+        return; // stopped after the timer was already on its way
+    }
+    self.cursor = (self.cursor + 1) & (self.slotCount - 1);
+    NSMutableSet *slot = self.slots[self.cursor];
+    if ([slot count] == 0) {
+        [self scheduleNextTick];
+        return;
+    }
+
+    NSMutableArray *expired = [NSMutableArray array];
+    for (RBKTimingWheelTimeout *timeout in slot) {
+        if (timeout.remainingRounds > 0) {
+            timeout.remainingRounds -= 1;
+        } else {
+            [expired addObject:timeout];
+        }
+    }
+
+    for (RBKTimingWheelTimeout *timeout in expired) {
+        [slot removeObject:timeout];
+        self.scheduledCount -= 1;
+
+        dispatch_block_t handler = timeout.handler;
+        timeout.handler = nil;
+        if ([timeout expire]) {
+            [self timeoutDidFinish];
+            handler();
+        }
+    }
+    if (self.scheduledCount > 0) {
+        [self scheduleNextTick];
+    } else {
+        [self stopTickingIfIdle];
+    }
+}
+
+@end
@@ -6,6 +6,13 @@
 #import <Foundation/Foundation.h>
 #import "RBKSocketRequestSerialization.h"
 #import "RBKSocketResponseSerialization.h"
+#import "RBKSocketMetrics.h"
+#import "RBKSocketTracer.h"
+#import "RBKSocketCapture.h"
+#import "RBKTimingWheel.h"
+#import "RBKSocketRequestCache.h"
+
+@class SRServerSocket;
 
 typedef void (^RBKSocketFailureBlock)(NSError *error);
 
@@ -25,8 +32,49 @@ typedef void (^RBKSocketFailureBlock)(NSError *error);
 @property (nonatomic, strong) RBKSocketResponseSerializer <RBKSocketResponseSerialization> * responseSerializer;
 @property (assign, nonatomic, getter = socketIsOpen) BOOL socketOpen;
 @property (nonatomic, copy) RBKSocketFailureBlock failureBlock;
+/**
+ How long, in seconds, an operation that expects a response waits for it before failing with `NSURLErrorTimedOut` in `RBKSocketNetworkingErrorDomain`. Applies to operations created after it is set. 0 (the default) waits forever.
+ */
+@property (nonatomic, assign) NSTimeInterval operationTimeoutInterval;
+/**
+ Tracks the deadlines of everything waiting on a reply over this connection. Replace it, e.g. with one ticking on a `RBKVirtualClock`, before sending operations.
 
+ @warning `timingWheel` must not be `nil`.
+ */
+@property (nonatomic, strong) RBKTimingWheel *timingWheel;
+/**
+ Set to collect frame, byte, operation latency and queue depth metrics for this socket. `nil` by default, which turns collection off.
+ */
+@property (nonatomic, strong) RBKSocketMetrics *metrics;
+/**
+ Set to record timestamps for each stage an operation and its frames pass through. `nil` by default, which turns tracing off. Assign it before sending frames.
+ */
+@property (nonatomic, strong) RBKSocketTracer *tracer;
+/**
+ Set to record every message sent and received, with its timestamp, to a capture file that `RBKSocketReplay` can play back. `nil` by default, which turns capture off. Assign it before the socket opens to capture the whole session.
+ */
+@property (nonatomic, strong) RBKSocketCapture *capture;
+/**
+ Set to detect half-open connections with WebSocket pings; a dead connection is reported through `failureBlock`, with `NSURLErrorTimedOut` in `RBKSocketNetworkingErrorDomain`, fails any operation waiting on a response, and closes the socket. `nil` by default.
+ */
+@property (nonatomic, strong) RBKSocketKeepalive *keepalive;
+/**
+ Set to have the socket's streams deliver events on its own queue rather than on a shared network thread, saving a thread hop for every read and write. NO by default. The socket opens on the main queue's next turn after init, so set it right after creating the socket.
+ */
+@property (nonatomic, assign) BOOL schedulesStreamsOnWorkQueue;
+/**
+ Set to answer identical requests with one round trip: operations sent with a success or failure block share a matching operation in flight or a cached response instead of sending their frame. Each caller still gets an operation of its own to cancel. `nil` by default. Only for protocols where each request gets exactly one reply.
+ */
+@property (nonatomic, strong) RBKSocketRequestCache *requestCache;
+
+/**
+ The socket opens on the main queue's next turn rather than right away, so the transport can still be configured on it, e.g. with `schedulesStreamsOnWorkQueue` or `connectToLoopbackServer:`. Operations sent before it is open wait until it is, then go out in the order they were sent, each once the one before it has finished. Closing it before then means it never opens.
+ */
 - (instancetype)initWithSocketURL:(NSURL *)socketURL;
+/**
+ Connects to `server` through in-memory streams instead of TCP, so benchmarks and tests measure the library rather than the kernel's loopback. Call right after init, before the socket opens on the main queue's next turn.
+ */
+- (void)connectToLoopbackServer:(SRServerSocket *)server;
 /**
  Inclusion of success and/or failure block indicates that this operation expects a response as part of the operation
  */
@@ -34,7 +82,7 @@ typedef void (^RBKSocketFailureBlock)(NSError *error);
                                          success:(void (^)(RBKSocketOperation *operation, id responseObject))success
                                          failure:(void (^)(RBKSocketOperation *operation, NSError *error))failure;
 /**
- Inclusion of success and/or failure block indicates that this operation expects a response as part of the operation
+ Inclusion of success and/or failure block indicates that this operation expects a response as part of the operation. With a `requestCache`, returns the caller's own operation even when another one answers the request; cancelling it only stops this caller waiting.
  */
 - (RBKSocketOperation *)sendSocketOperationWithFrame:(id)frame
                                              success:(void (^)(RBKSocketOperation *operation, id responseObject))success
@@ -43,6 +91,15 @@ typedef void (^RBKSocketFailureBlock)(NSError *error);
  Lack of success and/or failure block indicates that this operation does not expect a response as part of the operation. Responses may come outside the operation
  */
 - (RBKSocketOperation *)sendSocketOperationWithFrame:(id)frame;
+/**
+ Sends an operation made with `socketOperationWithFrame:success:failure:`, e.g. after adjusting its `queuePriority`. Operations with a priority above normal have their frame written ahead of frames already waiting to be sent.
+ */
+- (void)enqueueSocketOperation:(RBKSocketOperation *)operation;
 - (void)closeSocket;
+/**
+ Stop and restart reading frames from the network. Frames already read are still delivered.
+ */
+- (void)pauseReading;
+- (void)resumeReading;
 
 @end
@@ -13,6 +13,7 @@
 @property (strong, nonatomic) NSOperationQueue *operationQueue;
 @property (strong, nonatomic) RoboSocket *socket;
 @property (strong, nonatomic) NSMutableArray *pendingOperations;
+@property (assign, nonatomic, getter = isOpenPending) BOOL openPending;
 @end
 
 @implementation RBKWebSocket {
@@ -28,10 +29,17 @@
         
         _operationQueue = [[NSOperationQueue alloc] init];
         _pendingOperations = [NSMutableArray array];
+        _timingWheel = [[RBKTimingWheel alloc] init];
         _socketOpen = NO;
         _requestSerializer = [RBKSocketStringRequestSerializer serializer];
         _responseSerializer = [RBKSocketStringResponseSerializer serializer];
-        [self openSocket];
+        
+        // open on the next turn of the main queue, so the transport can still be configured after init
+        _openPending = YES;
+        __weak typeof(self)weakSelf = self;
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [weakSelf openSocket];
+        });
     }
     return self;
 }
@@ -48,6 +56,51 @@
     _responseSerializer = responseSerializer;
 }
 
+- (void)setTimingWheel:(RBKTimingWheel *)timingWheel {
+    NSParameterAssert(timingWheel);
+
+    _timingWheel = timingWheel;
+}
+
+- (void)setMetrics:(RBKSocketMetrics *)metrics {
+    _metrics = metrics;
+    self.socket.metrics = metrics;
+
+    __weak typeof(self)weakSelf = self;
+    [metrics setGaugeWithName:@"pending_operations" valueBlock:^NSNumber *{
+        return @([weakSelf.pendingOperations count]);
+    }];
+    [metrics setGaugeWithName:@"queued_operations" valueBlock:^NSNumber *{
+        return @([weakSelf.operationQueue operationCount]);
+    }];
+    [metrics setGaugeWithName:@"output_buffer_bytes" valueBlock:^NSNumber *{
+        return @([weakSelf.socket bufferedAmount]);
+    }];
+}
+
+- (void)setTracer:(RBKSocketTracer *)tracer {
+    _tracer = tracer;
+    self.socket.tracer = tracer;
+}
+
+- (void)setCapture:(RBKSocketCapture *)capture {
+    _capture = capture;
+    self.socket.capture = capture;
+}
+
+- (void)setKeepalive:(RBKSocketKeepalive *)keepalive {
+    _keepalive = keepalive;
+    self.socket.keepalive = keepalive;
+}
+
+- (BOOL)schedulesStreamsOnWorkQueue {
+    return self.socket.schedulesStreamsOnWorkQueue;
+}
+
+- (void)setSchedulesStreamsOnWorkQueue:(BOOL)schedulesStreamsOnWorkQueue {
+    self.socket.schedulesStreamsOnWorkQueue = schedulesStreamsOnWorkQueue;
+}
+
 - (RBKSocketOperation *)socketOperationWithFrame:(id)frame
                                          success:(void (^)(RBKSocketOperation *operation, id responseObject))success
                                          failure:(void (^)(RBKSocketOperation *operation, NSError *error))failure {
@@ -57,6 +110,16 @@
         expectResponse = YES;
     }
 
+    RBKSocketOperation *operation = [self socketOperationWithFrame:frame expectResponse:expectResponse];
+    if (expectResponse) {
+        [operation setCompletionBlockWithSuccess:success failure:failure];
+    }
+
+    return operation;
+}
+
+- (RBKSocketOperation *)socketOperationWithFrame:(id)frame expectResponse:(BOOL)expectResponse {
+
     RBKSocketOperation *operation = [self.requestSerializer requestOperationWithFrame:frame expectResponse:expectResponse];
 
     operation.responseSerializer = self.responseSerializer;
@@ -66,9 +129,9 @@
 
     // give the operation the socket to use?
     operation.socket = self.socket;
-    if (expectResponse) {
-        [operation setCompletionBlockWithSuccess:success failure:failure];
-    }
+    operation.tracer = self.tracer;
+    operation.timingWheel = self.timingWheel;
+    operation.timeoutInterval = self.operationTimeoutInterval;
 
     return operation;
 }
@@ -76,6 +139,9 @@
 - (RBKSocketOperation *)sendSocketOperationWithFrame:(id)frame
                                              success:(void (^)(RBKSocketOperation *operation, id responseObject))success
                                              failure:(void (^)(RBKSocketOperation *operation, NSError *error))failure {
+    uint64_t traceIdentifier = [self.tracer nextTraceIdentifier];
+    [self.tracer recordStage:RBKSocketTraceStageEnqueue traceIdentifier:traceIdentifier];
+
     RBKSocketOperation *operation = [self socketOperationWithFrame:frame success:success failure:failure];
 
     if (!operation) {
@@ -87,12 +153,35 @@
         return nil;
     }
 
+    if (traceIdentifier) {
+        operation.traceIdentifier = traceIdentifier;
+        [self.tracer recordStage:RBKSocketTraceStageSerialize traceIdentifier:traceIdentifier];
+    }
+
+    RBKSocketRequestCache *requestCache = self.requestCache;
+    if (requestCache && (success || failure)) {
+        __weak typeof(self)weakSelf = self;
+        RBKSocketOperation *flightOperation = [requestCache flightOperationForOperation:operation success:success failure:failure flightBlock:^RBKSocketOperation *{
+            RBKSocketOperation *requestOperation = [weakSelf socketOperationWithFrame:frame expectResponse:YES];
+            requestOperation.traceIdentifier = traceIdentifier;
+            return requestOperation;
+        }];
+        if (flightOperation) {
+            [self enqueueSocketOperation:flightOperation];
+        }
+        return operation; // the caller's own, even when it only waits on another
+    }
+
+    [self enqueueSocketOperation:operation];
+    return operation;
+}
+
+- (void)enqueueSocketOperation:(RBKSocketOperation *)operation {
     if (self.socketIsOpen) {
         [self.operationQueue addOperation:operation]; // can't send until the socket is opened
     } else {
         [self.pendingOperations addObject:operation];
     }
-    return operation;
 }
 
 - (RBKSocketOperation *)sendSocketOperationWithFrame:(id)frame {
@@ -100,22 +189,52 @@
 }
 
 - (void)openSocket {
+    if (!self.isOpenPending) {
+        return; // closed before it got to open
+    }
+    self.openPending = NO;
     [self.socket openSocket];
 }
 
+- (void)connectToLoopbackServer:(SRServerSocket *)server {
+    [self.socket connectToLoopbackServer:server];
+}
+
 - (void)closeSocket {
+    if (self.isOpenPending) {
+        self.openPending = NO;
+        return;
+    }
     [self.socket closeSocket];
 
     while (self.socketOpen && [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.1]]); // don't advance until the socket has closed completely
     // NSLog(@"Socket Closed");
 }
 
+- (void)pauseReading {
+    [self.socket pauseReading];
+}
+
+- (void)resumeReading {
+    [self.socket resumeReading];
+}
+
 #pragma mark - RBKSocketControlDelegate
 
 - (void)webSocketDidOpen:(RoboSocket *)webSocket {
 
+    // now that the socket is open, send them all in the order they were sent; each waits for the one before it to finish, so e.g. a STOMP CONNECT is answered before anything follows it
+    RBKSocketOperation *previousOperation = nil;
     for (RBKSocketOperation *operation in self.pendingOperations) {
-        [self.operationQueue addOperation:operation]; // now that the socket is open, send them all
+        // a cancelled operation finishes without being sent, and a queue won't take a finished one
+        if ([operation isCancelled] || [operation isFinished]) {
+            continue;
+        }
+        if (previousOperation) {
+            [operation addDependency:previousOperation];
+        }
+        [self.operationQueue addOperation:operation];
+        previousOperation = operation;
     }
     [self.pendingOperations removeAllObjects];
 
@@ -139,6 +258,10 @@
         NSLog(@"Serializer error: %@", [error localizedDescription]);
     }
 }
+- (BOOL)webSocket:(RoboSocket *)webSocket isUnsolicitedFrame:(id)message {
+    return NO;
+}
+
 - (void)webSocket:(RoboSocket *)webSocket didFailWithError:(NSError *)error {
     if (self.failureBlock) {
         self.failureBlock(error);
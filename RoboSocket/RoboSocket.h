@@ -8,9 +8,15 @@
 
 #import <Foundation/Foundation.h>
 
+#import "RBKSocketMetrics.h"
+#import "RBKSocketTracer.h"
+#import "RBKSocketKeepalive.h"
+#import "RBKSocketCapture.h"
+
 #pragma mark - SRWebSocketDelegate
 
 @class RoboSocket;
+@class SRServerSocket;
 
 @protocol RBKSocketFrameDelegate <NSObject>
 
@@ -22,6 +28,11 @@
 
 - (void)webSocket:(RoboSocket *)webSocket didFailWithError:(NSError *)error;
 
+/**
+ Asked of the default frame delegate while a response is awaited. Return YES for frames that answer something else, such as receipts, so they reach the default delegate instead of the operation waiting for its response.
+ */
+- (BOOL)webSocket:(RoboSocket *)webSocket isUnsolicitedFrame:(id)message;
+
 @end
 
 
@@ -38,10 +49,35 @@
 @property (weak, nonatomic) id<RBKSocketFrameDelegate> responseFrameDelegate;
 @property (weak, nonatomic) id<RBKSocketFrameDelegate> defaultFrameDelegate;
 @property (weak, nonatomic) id<RBKSocketControlDelegate> controlDelegate;
+@property (strong, nonatomic) RBKSocketMetrics *metrics;
+@property (strong, nonatomic) RBKSocketTracer *tracer;
+@property (strong, nonatomic) RBKSocketCapture *capture;
+/**
+ Set to ping the server whenever the connection goes idle and fail the socket once pongs stop coming back. `nil` by default.
+ */
+@property (strong, nonatomic) RBKSocketKeepalive *keepalive;
+/**
+ Deliver stream events straight on the socket's own serial queue instead of through a shared network run loop thread. NO by default. Set before `openSocket`.
+ */
+@property (assign, nonatomic) BOOL schedulesStreamsOnWorkQueue;
 
 - (instancetype)initWithSocketURL:(NSURL *)socketURL;
 - (void)openSocket;
+/**
+ Connects to `server` through in-memory streams rather than a TCP socket, running the same handshake and framing without the kernel in the way. Call before `openSocket`.
+ */
+- (void)connectToLoopbackServer:(SRServerSocket *)server;
 - (void)closeSocket;
 - (void)sendFrame:(id)frame;
+/**
+ A high priority frame is written ahead of frames already waiting to be sent, though never in the middle of a large frame that is already going out in fragments.
+ */
+- (void)sendFrame:(id)frame highPriority:(BOOL)highPriority;
+- (NSUInteger)bufferedAmount;
+/**
+ Stop and restart reading from the network, so a slow consumer holds the server back through TCP flow control instead of piling up frames in memory. The keepalive stops while reading is paused, since no pong could be read, and starts over when reading resumes.
+ */
+- (void)pauseReading;
+- (void)resumeReading;
 
 @end
@@ -7,15 +7,36 @@
 //
 
 #import "RoboSocket.h"
+#import "RBKSocketOperation.h"
 
 #import <SocketRocket/SRWebSocket.h>
+#import <SocketRocket/SRServerSocket.h>
 
-@interface RoboSocket () <SRWebSocketDelegate>
+@interface RoboSocket () <SRWebSocketDelegate, RBKSocketKeepaliveDelegate>
 
 @property (strong, nonatomic) SRWebSocket *socket;
+@property (assign, nonatomic, getter = isReadingPaused) BOOL readingPaused;
+@property (strong, nonatomic) NSError *deadConnectionError;
 
 @end
 
+static const NSInteger RBKSocketAbnormalClosureCode = 1006; // closed without a close frame
+
+
+static inline RBKSocketTraceStage RBKSocketTraceStageFromTraceEvent(SRTraceEvent event) {
+    switch (event) {
+        case SRTraceEventFrameEncoded:
+            return RBKSocketTraceStageEncode;
+        case SRTraceEventStreamWrite:
+            return RBKSocketTraceStageWrite;
+        case SRTraceEventStreamRead:
+            return RBKSocketTraceStageRead;
+        case SRTraceEventFrameDecoded:
+            return RBKSocketTraceStageDecode;
+    }
+    return RBKSocketTraceStageDecode;
+}
+
 
 @implementation RoboSocket
 
@@ -36,6 +57,37 @@
     self.socket.delegate = nil;
 }
 
+- (void)setTracer:(RBKSocketTracer *)tracer {
+    _tracer = tracer;
+
+    if (!tracer) {
+        self.socket.traceHandler = nil;
+        return;
+    }
+    __weak RBKSocketTracer *weakTracer = tracer;
+    self.socket.traceHandler = ^(SRTraceEvent event, NSUInteger length) {
+        [weakTracer recordStage:RBKSocketTraceStageFromTraceEvent(event) traceIdentifier:0 length:length];
+    };
+}
+
+- (void)setKeepalive:(RBKSocketKeepalive *)keepalive {
+    [_keepalive stop];
+    _keepalive = keepalive;
+    keepalive.delegate = self;
+
+    if (self.socket.readyState == SR_OPEN && !self.isReadingPaused) {
+        [keepalive start];
+    }
+}
+
+- (BOOL)schedulesStreamsOnWorkQueue {
+    return self.socket.schedulesStreamsOnWorkQueue;
+}
+
+- (void)setSchedulesStreamsOnWorkQueue:(BOOL)schedulesStreamsOnWorkQueue {
+    self.socket.schedulesStreamsOnWorkQueue = schedulesStreamsOnWorkQueue;
+}
+
 - (void)openSocket {
     [self.socket open];
 }
@@ -44,8 +96,37 @@
     [self.socket close];
 }
 
+- (void)connectToLoopbackServer:(SRServerSocket *)server {
+    [self.socket connectToLoopbackServer:server];
+}
+
 - (void)sendFrame:(id)frame {
-    [self.socket send:frame];
+    [self sendFrame:frame highPriority:NO];
+}
+
+- (void)sendFrame:(id)frame highPriority:(BOOL)highPriority {
+    [self.metrics recordSentFrame:frame];
+    [self.capture recordMessage:frame direction:RBKSocketCaptureDirectionOutbound];
+    [self.socket send:frame priority:highPriority ? SRMessagePriorityHigh : SRMessagePriorityNormal];
+}
+
+- (NSUInteger)bufferedAmount {
+    return [self.socket bufferedAmount];
+}
+
+// pongs can't be read while paused, so the keepalive would take the silence for a dead connection
+- (void)pauseReading {
+    self.readingPaused = YES;
+    [self.keepalive stop];
+    [self.socket pauseReading];
+}
+
+- (void)resumeReading {
+    self.readingPaused = NO;
+    [self.socket resumeReading];
+    if (self.socket.readyState == SR_OPEN) {
+        [self.keepalive start];
+    }
 }
 
 #pragma mark - SRWebSocketDelegate
@@ -53,8 +134,17 @@
 // RoboSocket needs two delegates - one for messages and one for control
 - (void)webSocket:(SRWebSocket *)webSocket didReceiveMessage:(id)frame {
     // NSLog(@"received frame %@", frame);
+    [self.metrics recordReceivedFrame:frame];
+    [self.capture recordMessage:frame direction:RBKSocketCaptureDirectionInbound];
+    [self.keepalive frameReceived];
+    
+    id<RBKSocketFrameDelegate> defaultFrameDelegate = self.defaultFrameDelegate;
+    BOOL isUnsolicited = NO;
+    if (self.responseFrameDelegate && [defaultFrameDelegate respondsToSelector:@selector(webSocket:isUnsolicitedFrame:)]) {
+        isUnsolicited = [defaultFrameDelegate webSocket:self isUnsolicitedFrame:frame];
+    }
     
-    if (self.responseFrameDelegate) { // this is an expected response
+    if (self.responseFrameDelegate && !isUnsolicited) { // this is an expected response
         [self.responseFrameDelegate webSocket:self didReceiveFrame:frame];
     } else { // this is not an expected response
         [self.defaultFrameDelegate webSocket:self didReceiveFrame:frame];
@@ -63,23 +153,74 @@
 
 - (void)webSocketDidOpen:(SRWebSocket *)webSocket {
     // NSLog(@"socket opened");
+    [self.metrics recordSocketOpened];
+    if (!self.isReadingPaused) {
+        [self.keepalive start];
+    }
     [self.controlDelegate webSocketDidOpen:self];
 }
 
 - (void)webSocket:(SRWebSocket *)webSocket didFailWithError:(NSError *)error {
     // NSLog(@"socket failed");
+    [self.metrics recordSocketFailed];
+    [self.keepalive stop];
+    BOOL isDeadConnection = self.deadConnectionError && error == self.deadConnectionError;
+    self.deadConnectionError = nil;
     if (self.responseFrameDelegate) {
         [self.responseFrameDelegate webSocket:self didFailWithError:error];
-    } else {
+    }
+    // a dead connection is reported to the owner even when an operation was waiting on it
+    if (!self.responseFrameDelegate || isDeadConnection) {
         [self.defaultFrameDelegate webSocket:self didFailWithError:error];
     }
+    if (isDeadConnection) {
+        // SocketRocket reports no close after a failure, so the owner would go on sending on the dead socket
+        [self.controlDelegate webSocket:self didCloseWithCode:RBKSocketAbnormalClosureCode reason:[error localizedDescription] wasClean:NO];
+    }
 }
 
 - (void)webSocket:(SRWebSocket *)webSocket didCloseWithCode:(NSInteger)code reason:(NSString *)reason wasClean:(BOOL)wasClean {
     // NSLog(@"socket closed");
+    [self.metrics recordSocketClosed];
+    [self.keepalive stop];
     [self.controlDelegate webSocket:self didCloseWithCode:code reason:reason wasClean:wasClean];
 
 }
 
+- (void)webSocket:(SRWebSocket *)webSocket didReceivePing:(NSData *)pingPayload {
+    [self.metrics recordReceivedControlFrameWithOpcode:RBKSocketMetricsOpcodePing];
+    [self.metrics recordSentControlFrameWithOpcode:RBKSocketMetricsOpcodePong]; // SocketRocket answers it
+}
+
+- (void)webSocket:(SRWebSocket *)webSocket didSendCloseWithCode:(NSInteger)code {
+    [self.metrics recordSentControlFrameWithOpcode:RBKSocketMetricsOpcodeClose];
+}
+
+- (void)webSocket:(SRWebSocket *)webSocket didReceiveCloseWithCode:(NSInteger)code reason:(NSString *)reason {
+    [self.metrics recordReceivedControlFrameWithOpcode:RBKSocketMetricsOpcodeClose];
+}
+
+- (void)webSocket:(SRWebSocket *)webSocket didReceivePong:(NSData *)pongPayload {
+    [self.metrics recordReceivedControlFrameWithOpcode:RBKSocketMetricsOpcodePong];
+    [self.capture recordBytes:[pongPayload bytes] length:[pongPayload length] opcode:RBKSocketCaptureOpcodePong direction:RBKSocketCaptureDirectionInbound];
+    [self.keepalive pongReceivedWithPayload:pongPayload];
+}
+
+#pragma mark - RBKSocketKeepaliveDelegate
+
+- (void)keepalive:(RBKSocketKeepalive *)keepalive shouldSendPingWithPayload:(NSData *)payload {
+    [self.metrics recordSentControlFrameWithOpcode:RBKSocketMetricsOpcodePing];
+    [self.capture recordBytes:[payload bytes] length:[payload length] opcode:RBKSocketCaptureOpcodePing direction:RBKSocketCaptureDirectionOutbound];
+    [self.socket sendPing:payload];
+}
+
+- (void)keepaliveDidDetectDeadConnection:(RBKSocketKeepalive *)keepalive {
+    // don't wait for a closing handshake the peer will never answer; the failure also closes the socket for our delegates
+    NSString *description = [NSString stringWithFormat:@"No pong received for %lu pings", (unsigned long)keepalive.maximumMissedPongs];
+    NSError *error = [NSError errorWithDomain:RBKSocketNetworkingErrorDomain code:NSURLErrorTimedOut userInfo:@{NSLocalizedDescriptionKey: description}];
+    self.deadConnectionError = error;
+    [self.socket failWithError:error];
+}
+
 
 @end
@@ -0,0 +1,79 @@
+//
+//  RBKBenchmarkReport.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ Benchmarks only run when the `RBK_RUN_BENCHMARKS` environment variable is set, so they stay out of the regular test pass. Reports are written as JSON to the directory named by `RBK_BENCHMARK_OUTPUT_DIR`, or the temporary directory if it is not set.
+ */
+extern NSString * const RBKBenchmarkEnabledEnvironmentKey;
+extern NSString * const RBKBenchmarkOutputDirectoryEnvironmentKey;
+
+/**
+ Heap allocations made by the calling thread between `RBKBenchmarkBeginCountingAllocations` and `RBKBenchmarkEndCountingAllocations`. Allocations on other threads are ignored, and counting is not reentrant.
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t bytes;
+} RBKBenchmarkAllocations;
+
+extern void RBKBenchmarkBeginCountingAllocations(void);
+extern RBKBenchmarkAllocations RBKBenchmarkEndCountingAllocations(void);
+
+/**
+ A set of latency samples for one benchmark configuration.
+ */
+@interface RBKBenchmarkSeries : NSObject
+
+@property (readonly, nonatomic, strong) NSString *name;
+@property (readonly, nonatomic, strong) NSDictionary *parameters;
+@property (readonly, nonatomic, assign) NSUInteger sampleCount;
+
+/**
+ Wall clock time for the whole series and the number of operations completed within it, used for the messages/sec figure.
+ */
+@property (assign, nonatomic) uint64_t elapsedNanoseconds;
+@property (assign, nonatomic) NSUInteger completedOperations;
+@property (assign, nonatomic, getter = didTimeOut) BOOL timedOut;
+
+/**
+ Additional named values to include in the report, such as allocation counts.
+ */
+@property (readonly, nonatomic, strong) NSMutableDictionary *metrics;
+
+- (instancetype)initWithName:(NSString *)name parameters:(NSDictionary *)parameters;
+
+- (void)addSample:(uint64_t)nanoseconds;
+
+/**
+ @param percentile A value between 0 and 100.
+ */
+- (uint64_t)sampleAtPercentile:(double)percentile;
+- (double)operationsPerSecond;
+
+- (NSDictionary *)dictionaryRepresentation;
+
+@end
+
+
+@interface RBKBenchmarkReport : NSObject
+
+@property (readonly, nonatomic, strong) NSString *suiteName;
+@property (readonly, nonatomic, strong) NSArray *series;
+
++ (BOOL)benchmarksEnabled;
+
+- (instancetype)initWithSuiteName:(NSString *)suiteName;
+
+- (void)addSeries:(RBKBenchmarkSeries *)series;
+
+/**
+ Writes `<suiteName>.json` into the configured output directory and returns its URL, or `nil` on failure.
+ */
+- (NSURL *)writeReport:(NSError *__autoreleasing *)error;
+
+@end
@@ -0,0 +1,190 @@
+//
+//  RBKBenchmarkReport.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKBenchmarkReport.h"
+
+#include <pthread.h>
+
+// libmalloc calls this for every allocation and free; it is what malloc stack logging is built on
+typedef void (RBKMallocLogger)(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t numberOfHotFramesToSkip);
+extern RBKMallocLogger *malloc_logger;
+
+static const uint32_t RBKMallocLogTypeAllocate = 2;
+static const uint32_t RBKMallocLogTypeDeallocate = 4;
+
+NSString * const RBKBenchmarkEnabledEnvironmentKey = @"RBK_RUN_BENCHMARKS";
+NSString * const RBKBenchmarkOutputDirectoryEnvironmentKey = @"RBK_BENCHMARK_OUTPUT_DIR";
+
+static pthread_t RBKBenchmarkCountingThread;
+static RBKBenchmarkAllocations RBKBenchmarkCountedAllocations;
+static RBKMallocLogger *RBKBenchmarkPreviousMallocLogger;
+
+static void RBKBenchmarkMallocLogger(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t numberOfHotFramesToSkip) {
+    if (RBKBenchmarkPreviousMallocLogger) {
+        RBKBenchmarkPreviousMallocLogger(type, arg1, arg2, arg3, result, numberOfHotFramesToSkip);
+    }
+    if (!(type & RBKMallocLogTypeAllocate) || !pthread_equal(pthread_self(), RBKBenchmarkCountingThread)) {
+        return;
+    }
+    RBKBenchmarkCountedAllocations.count += 1;
+    // realloc is logged as an allocate and deallocate, with the new size in arg3
+    RBKBenchmarkCountedAllocations.bytes += (type & RBKMallocLogTypeDeallocate) ? arg3 : arg2;
+}
+
+void RBKBenchmarkBeginCountingAllocations(void) {
+    RBKBenchmarkCountingThread = pthread_self();
+    RBKBenchmarkCountedAllocations = (RBKBenchmarkAllocations){0, 0};
+    RBKBenchmarkPreviousMallocLogger = malloc_logger;
+    malloc_logger = RBKBenchmarkMallocLogger;
+}
+
+RBKBenchmarkAllocations RBKBenchmarkEndCountingAllocations(void) {
+    malloc_logger = RBKBenchmarkPreviousMallocLogger;
+    RBKBenchmarkPreviousMallocLogger = NULL;
+    return RBKBenchmarkCountedAllocations;
+}
+
+static int RBKBenchmarkCompareSamples(const void *a, const void *b) {
+    uint64_t lhs = *(const uint64_t *)a;
+    uint64_t rhs = *(const uint64_t *)b;
+    return lhs < rhs ? -1 : (lhs > rhs ? 1 : 0);
+}
+
+
+@interface RBKBenchmarkSeries ()
+
+@property (readwrite, nonatomic, strong) NSString *name;
+@property (readwrite, nonatomic, strong) NSDictionary *parameters;
+@property (readwrite, nonatomic, strong) NSMutableDictionary *metrics;
+@property (strong, nonatomic) NSMutableData *samples; // uint64_t nanoseconds, kept flat so recording stays cheap
+@property (assign, nonatomic, getter = isSorted) BOOL sorted;
+
+@end
+
+@implementation RBKBenchmarkSeries
+
+- (instancetype)initWithName:(NSString *)name parameters:(NSDictionary *)parameters {
+    self = [super init];
+    if (self) {
+        _name = name;
+        _parameters = parameters ?: @{};
+        _metrics = [NSMutableDictionary dictionary];
+        _samples = [NSMutableData data];
+    }
+    return self;
+}
+
+- (NSUInteger)sampleCount {
+    return [self.samples length] / sizeof(uint64_t);
+}
+
+- (void)addSample:(uint64_t)nanoseconds {
+    [self.samples appendBytes:&nanoseconds length:sizeof(nanoseconds)];
+    self.sorted = NO;
+}
+
+- (uint64_t)sampleAtPercentile:(double)percentile {
+    NSUInteger count = self.sampleCount;
+    if (count == 0) {
+        return 0;
+    }
+    if (!self.isSorted) {
+        qsort([self.samples mutableBytes], count, sizeof(uint64_t), RBKBenchmarkCompareSamples);
+        self.sorted = YES;
+    }
+    // nearest-rank
+    NSUInteger rank = (NSUInteger)ceil(percentile / 100.0 * count);
+    rank = MAX(rank, 1);
+    rank = MIN(rank, count);
+    return ((const uint64_t *)[self.samples bytes])[rank - 1];
+}
+
+- (double)operationsPerSecond {
+    if (self.elapsedNanoseconds == 0) {
+        return 0;
+    }
+    return self.completedOperations / (self.elapsedNanoseconds / (double)NSEC_PER_SEC);
+}
+
+- (NSDictionary *)dictionaryRepresentation {
+    NSMutableDictionary *dictionary = [NSMutableDictionary dictionary];
+    dictionary[@"name"] = self.name;
+    dictionary[@"parameters"] = self.parameters;
+    dictionary[@"samples"] = @(self.sampleCount);
+    dictionary[@"operations"] = @(self.completedOperations);
+    dictionary[@"elapsed_ns"] = @(self.elapsedNanoseconds);
+    dictionary[@"ops_per_sec"] = @([self operationsPerSecond]);
+    dictionary[@"p50_ns"] = @([self sampleAtPercentile:50]);
+    dictionary[@"p99_ns"] = @([self sampleAtPercentile:99]);
+    dictionary[@"p999_ns"] = @([self sampleAtPercentile:99.9]);
+    dictionary[@"max_ns"] = @([self sampleAtPercentile:100]);
+    dictionary[@"timed_out"] = @(self.didTimeOut);
+    if ([self.metrics count] > 0) {
+        dictionary[@"metrics"] = self.metrics;
+    }
+    return dictionary;
+}
+
+@end
+
+
+@interface RBKBenchmarkReport ()
+
+@property (readwrite, nonatomic, strong) NSString *suiteName;
+@property (strong, nonatomic) NSMutableArray *mutableSeries;
+
+@end
+
+@implementation RBKBenchmarkReport
+
++ (BOOL)benchmarksEnabled {
+    return [[[NSProcessInfo processInfo] environment][RBKBenchmarkEnabledEnvironmentKey] boolValue];
+}
+
+- (instancetype)initWithSuiteName:(NSString *)suiteName {
+    self = [super init];
+    if (self) {
+        _suiteName = suiteName;
+        _mutableSeries = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (NSArray *)series {
+    return [self.mutableSeries copy];
+}
+
+- (void)addSeries:(RBKBenchmarkSeries *)series {
+    [self.mutableSeries addObject:series];
+}
+
+- (NSURL *)writeReport:(NSError *__autoreleasing *)error {
+    NSString *directory = [[NSProcessInfo processInfo] environment][RBKBenchmarkOutputDirectoryEnvironmentKey] ?: NSTemporaryDirectory();
+    NSURL *url = [[NSURL fileURLWithPath:directory isDirectory:YES] URLByAppendingPathComponent:[self.suiteName stringByAppendingPathExtension:@"json"]];
+
+    NSMutableArray *series = [NSMutableArray array];
+    for (RBKBenchmarkSeries *aSeries in self.mutableSeries) {
+        [series addObject:[aSeries dictionaryRepresentation]];
+    }
+
+    NSProcessInfo *processInfo = [NSProcessInfo processInfo];
+    NSDictionary *report = @{@"suite": self.suiteName,
+                             @"timestamp": @([[NSDate date] timeIntervalSince1970]),
+                             @"host": [processInfo hostName] ?: @"",
+                             @"os": [processInfo operatingSystemVersionString] ?: @"",
+                             @"processors": @([processInfo activeProcessorCount]),
+                             @"series": series};
+
+    NSData *data = [NSJSONSerialization dataWithJSONObject:report options:NSJSONWritingPrettyPrinted error:error];
+    if (!data || ![data writeToURL:url options:NSDataWritingAtomic error:error]) {
+        return nil;
+    }
+    NSLog(@"Benchmark report written to %@", [url path]);
+    return url;
+}
+
+@end
@@ -0,0 +1,224 @@
+//
+//  RBKCodecBenchmarkTests.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "RBKSTOMPSocket.h"
+#import "RBKSocketMetrics.h"
+#import "RBKBenchmarkReport.h"
+
+#import <SocketRocket/SRWebSocket.h>
+
+static NSUInteger const RBKCodecBenchmarkWarmUpIterations = 100;
+static NSUInteger const RBKCodecBenchmarkAllocationIterations = 100;
+static const uint8_t RBKCodecBenchmarkMaskKey[4] = {0x37, 0xfa, 0x21, 0x3d};
+
+@interface RBKCodecBenchmarkTests : XCTestCase
+
+@property (strong, nonatomic) RBKBenchmarkReport *report;
+
+@end
+
+@implementation RBKCodecBenchmarkTests
+
+- (void)setUp {
+    [super setUp];
+
+    self.report = [[RBKBenchmarkReport alloc] initWithSuiteName:[NSString stringWithFormat:@"codec-%@", NSStringFromSelector(self.invocation.selector)]];
+}
+
+- (void)tearDown {
+    if ([self.report.series count] > 0) {
+        NSError *error = nil;
+        if (![self.report writeReport:&error]) {
+            NSLog(@"Failed to write benchmark report: %@", [error localizedDescription]);
+        }
+    }
+
+    [super tearDown];
+}
+
+#pragma mark - Corpus
+
+// Frames as a broker sends them, so the corpus stays fixed between runs
++ (NSDictionary *)stompFrameCorpus {
+    static NSDictionary *corpus = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSString *jsonBody = [self JSONBodyWithNumberOfRecords:40];
+        corpus = @{@"heartbeat": [@"\n" dataUsingEncoding:NSUTF8StringEncoding],
+                   @"connected": [@"CONNECTED\nversion:1.2\nheart-beat:10000,10000\nserver:RabbitMQ/3.2.4\nsession:session-Lw3YHfZqsVVbfT0s4p6mQA\n\n\0" dataUsingEncoding:NSUTF8StringEncoding],
+                   @"receipt": [@"RECEIPT\nreceipt-id:receipt-42\n\n\0" dataUsingEncoding:NSUTF8StringEncoding],
+                   @"message-small": [@"MESSAGE\nsubscription:sub-0\ndestination:/topic/quotes.AAPL\nmessage-id:T_sub-0@@session-Lw3YHfZqsVVbfT0s4p6mQA@@1\ncontent-type:text/plain\ncontent-length:6\n\n531.24\0" dataUsingEncoding:NSUTF8StringEncoding],
+                   @"message-json": [[NSString stringWithFormat:@"MESSAGE\nsubscription:sub-1\ndestination:/queue/orders\nmessage-id:T_sub-1@@session-Lw3YHfZqsVVbfT0s4p6mQA@@2\nack:ack-2\ncontent-type:application/json\ncontent-length:%lu\n\n%@\0", (unsigned long)[jsonBody lengthOfBytesUsingEncoding:NSUTF8StringEncoding], jsonBody] dataUsingEncoding:NSUTF8StringEncoding]};
+    });
+    return corpus;
+}
+
++ (NSString *)JSONBodyWithNumberOfRecords:(NSUInteger)numberOfRecords {
+    NSMutableArray *records = [NSMutableArray array];
+    for (NSUInteger idx = 0; idx < numberOfRecords; idx++) {
+        [records addObject:@{@"id": @(idx), @"symbol": @"AAPL", @"side": (idx % 2) ? @"buy" : @"sell", @"quantity": @(idx * 100), @"price": @(531.24 + idx), @"note": @"filled à la marché"}];
+    }
+    NSData *data = [NSJSONSerialization dataWithJSONObject:@{@"orders": records} options:0 error:nil];
+    return [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+}
+
++ (NSData *)payloadOfLength:(NSUInteger)length multibyte:(BOOL)multibyte {
+    // "é" is two bytes, so multibyte payloads exercise the slow path of UTF-8 validation
+    NSString *pattern = multibyte ? @"café " : @"cafe ";
+    NSString *string = [@"" stringByPaddingToLength:length withString:pattern startingAtIndex:0];
+    NSData *data = [string dataUsingEncoding:NSUTF8StringEncoding];
+    return [data subdataWithRange:NSMakeRange(0, MIN(length, [data length]))];
+}
+
+#pragma mark - Benchmarks
+
+- (void)testStompFrameParsing {
+    if (![RBKBenchmarkReport benchmarksEnabled]) {
+        return;
+    }
+
+    [[[self class] stompFrameCorpus] enumerateKeysAndObjectsUsingBlock:^(NSString *name, NSData *frameData, BOOL *stop) {
+        [self measureSeriesNamed:@"stomp.responseFrameFromData" parameters:@{@"frame": name, @"bytes": @([frameData length])} iterations:10000 block:^{
+            [RBKStompFrame responseFrameFromData:frameData];
+        }];
+    }];
+}
+
+- (void)testStompFrameEncoding {
+    if (![RBKBenchmarkReport benchmarksEnabled]) {
+        return;
+    }
+
+    NSDictionary *frames = @{@"send-small": [RBKStompFrame sendFrameWithDestination:@"/topic/quotes.AAPL" headers:@{@"content-type": @"text/plain"} body:@"531.24"],
+                             @"send-json": [RBKStompFrame sendFrameWithDestination:@"/queue/orders" headers:@{@"content-type": @"application/json"} body:[[self class] JSONBodyWithNumberOfRecords:40]],
+                             @"subscribe": [RBKStompFrame subscribeFrameWithDestination:@"/topic/quotes.*" headers:nil messageHandler:nil],
+                             @"ack": [RBKStompFrame ackFrameWithIdentifier:@"ack-2"]};
+
+    [frames enumerateKeysAndObjectsUsingBlock:^(NSString *name, RBKStompFrame *frame, BOOL *stop) {
+        [self measureSeriesNamed:@"stomp.frameData" parameters:@{@"frame": name} iterations:10000 block:^{
+            [frame frameData];
+        }];
+    }];
+}
+
+- (void)testJSONResponseSerialization {
+    if (![RBKBenchmarkReport benchmarksEnabled]) {
+        return;
+    }
+
+    RBKSocketJSONResponseSerializer *serializer = [RBKSocketJSONResponseSerializer serializer];
+    NSArray *recordCounts = @[@1, @40, @1000];
+    for (NSNumber *recordCount in recordCounts) {
+        NSString *body = [[self class] JSONBodyWithNumberOfRecords:[recordCount unsignedIntegerValue]];
+        NSUInteger iterations = MAX(100u, 40000 / [recordCount unsignedIntegerValue]);
+        [self measureSeriesNamed:@"json.responseObjectForResponseFrame" parameters:@{@"bytes": @([body lengthOfBytesUsingEncoding:NSUTF8StringEncoding])} iterations:iterations block:^{
+            NSError *error = nil;
+            [serializer responseObjectForResponseFrame:body error:&error];
+        }];
+    }
+}
+
+- (void)testWebSocketMasking {
+    if (![RBKBenchmarkReport benchmarksEnabled]) {
+        return;
+    }
+
+    NSArray *lengths = @[@16, @4096, @65536, @1048576];
+    for (NSNumber *length in lengths) {
+        NSData *payload = [[self class] payloadOfLength:[length unsignedIntegerValue] multibyte:NO];
+        NSMutableData *output = [NSMutableData dataWithLength:[payload length]];
+        NSUInteger iterations = MAX(100u, (64u * 1024 * 1024) / [length unsignedIntegerValue]);
+        iterations = MIN(iterations, 100000u);
+
+        RBKBenchmarkSeries *series = [self measureSeriesNamed:@"websocket.mask" parameters:@{@"bytes": length} iterations:iterations block:^{
+            SRMaskBytes([output mutableBytes], [payload bytes], [payload length], RBKCodecBenchmarkMaskKey, 0);
+        }];
+        [self addThroughputForSeries:series bytesPerOperation:[payload length]];
+    }
+}
+
+- (void)testUTF8Validation {
+    if (![RBKBenchmarkReport benchmarksEnabled]) {
+        return;
+    }
+
+    NSArray *lengths = @[@16, @4096, @65536];
+    for (NSNumber *length in lengths) {
+        for (NSNumber *multibyte in @[@NO, @YES]) {
+            NSData *payload = [[self class] payloadOfLength:[length unsignedIntegerValue] multibyte:[multibyte boolValue]];
+            NSUInteger iterations = MIN(MAX(100u, (16u * 1024 * 1024) / [length unsignedIntegerValue]), 100000u);
+
+            RBKBenchmarkSeries *series = [self measureSeriesNamed:@"websocket.validateUTF8" parameters:@{@"bytes": length, @"multibyte": multibyte} iterations:iterations block:^{
+                SRValidUTF8PrefixLength(payload);
+            }];
+            [self addThroughputForSeries:series bytesPerOperation:[payload length]];
+        }
+    }
+}
+
+- (void)testSocketOperationLifecycle {
+    if (![RBKBenchmarkReport benchmarksEnabled]) {
+        return;
+    }
+
+    RBKSocketStringRequestSerializer *requestSerializer = [RBKSocketStringRequestSerializer serializer];
+    RBKSocketStringResponseSerializer *responseSerializer = [RBKSocketStringResponseSerializer serializer];
+    [self measureSeriesNamed:@"operation.lifecycle" parameters:nil iterations:10000 block:^{
+        RBKSocketOperation *operation = [requestSerializer requestOperationWithFrame:@"ping" expectResponse:YES];
+        operation.responseSerializer = responseSerializer;
+        [operation setCompletionBlockWithSuccess:^(RBKSocketOperation *completedOperation, id responseObject) {
+        } failure:^(RBKSocketOperation *completedOperation, NSError *error) {
+        }];
+    }];
+}
+
+#pragma mark - Measurement
+
+// Times each operation individually, then repeats a shorter pass with allocation counting on so the hook does not skew the timings
+- (RBKBenchmarkSeries *)measureSeriesNamed:(NSString *)name parameters:(NSDictionary *)parameters iterations:(NSUInteger)iterations block:(void (^)(void))block {
+    RBKBenchmarkSeries *series = [[RBKBenchmarkSeries alloc] initWithName:name parameters:parameters];
+
+    for (NSUInteger idx = 0; idx < RBKCodecBenchmarkWarmUpIterations; idx++) {
+        @autoreleasepool {
+            block();
+        }
+    }
+
+    uint64_t start = RBKMonotonicNanoseconds();
+    for (NSUInteger idx = 0; idx < iterations; idx++) {
+        @autoreleasepool {
+            uint64_t operationStart = RBKMonotonicNanoseconds();
+            block();
+            [series addSample:RBKMonotonicNanoseconds() - operationStart];
+        }
+    }
+    series.elapsedNanoseconds = RBKMonotonicNanoseconds() - start;
+    series.completedOperations = iterations;
+
+    RBKBenchmarkBeginCountingAllocations();
+    for (NSUInteger idx = 0; idx < RBKCodecBenchmarkAllocationIterations; idx++) {
+        @autoreleasepool {
+            block();
+        }
+    }
+    RBKBenchmarkAllocations allocations = RBKBenchmarkEndCountingAllocations();
+
+    series.metrics[@"ns_per_op"] = @(series.elapsedNanoseconds / (double)iterations);
+    series.metrics[@"allocations_per_op"] = @(allocations.count / (double)RBKCodecBenchmarkAllocationIterations);
+    series.metrics[@"bytes_allocated_per_op"] = @(allocations.bytes / (double)RBKCodecBenchmarkAllocationIterations);
+
+    [self.report addSeries:series];
+    return series;
+}
+
+- (void)addThroughputForSeries:(RBKBenchmarkSeries *)series bytesPerOperation:(NSUInteger)bytesPerOperation {
+    series.metrics[@"bytes_per_sec"] = @([series operationsPerSecond] * bytesPerOperation);
+}
+
+@end
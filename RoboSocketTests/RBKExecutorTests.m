@@ -0,0 +1,102 @@
+//
+//  RBKExecutorTests.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#define EXP_SHORTHAND YES
+#import <Expecta/Expecta.h>
+
+#import "RBKExecutor.h"
+
+#include <libkern/OSAtomic.h>
+
+@interface RBKExecutorTests : XCTestCase
+
+@end
+
+@implementation RBKExecutorTests
+
+- (void)setUp {
+    [super setUp];
+
+    [Expecta setAsynchronousTestTimeout:5.0];
+}
+
+- (void)testSerialQueueExecutorRunsOnQueue {
+    dispatch_queue_t queue = dispatch_queue_create("com.robotsandpencils.networking.tests.executor", DISPATCH_QUEUE_SERIAL);
+    static void *RBKExecutorTestsQueueKey = &RBKExecutorTestsQueueKey;
+    dispatch_queue_set_specific(queue, RBKExecutorTestsQueueKey, RBKExecutorTestsQueueKey, NULL);
+
+    RBKSerialQueueExecutor *executor = [RBKSerialQueueExecutor executorWithQueue:queue];
+    __block BOOL ranOnQueue = NO;
+    [executor executeBlock:^{
+        ranOnQueue = dispatch_get_specific(RBKExecutorTestsQueueKey) == RBKExecutorTestsQueueKey;
+    }];
+
+    expect(ranOnQueue).will.beTruthy();
+}
+
+- (void)testWorkerPoolKeepsEachMailboxInOrder {
+    RBKWorkerPool *pool = [[RBKWorkerPool alloc] initWithMaximumConcurrency:4];
+    pool.throughput = 2;
+
+    NSUInteger const mailboxCount = 8;
+    NSUInteger const blockCount = 200;
+    NSMutableArray *mailboxes = [NSMutableArray array];
+    NSMutableArray *results = [NSMutableArray array];
+    for (NSUInteger idx = 0; idx < mailboxCount; idx++) {
+        [mailboxes addObject:[pool mailbox]];
+        [results addObject:[NSMutableArray array]];
+    }
+
+    __block int32_t running = 0;
+    __block int32_t maximumRunning = 0;
+    __block int32_t finished = 0;
+    for (NSUInteger blockIdx = 0; blockIdx < blockCount; blockIdx++) {
+        for (NSUInteger idx = 0; idx < mailboxCount; idx++) {
+            NSMutableArray *result = results[idx]; // only touched by its own mailbox
+            [mailboxes[idx] executeBlock:^{
+                int32_t nowRunning = OSAtomicIncrement32Barrier(&running);
+                int32_t previousMaximum;
+                while (nowRunning > (previousMaximum = maximumRunning) && !OSAtomicCompareAndSwap32Barrier(previousMaximum, nowRunning, &maximumRunning));
+                [result addObject:@(blockIdx)];
+                OSAtomicDecrement32Barrier(&running);
+                OSAtomicIncrement32Barrier(&finished);
+            }];
+        }
+    }
+
+    expect(finished).will.equal(mailboxCount * blockCount);
+    expect(maximumRunning).to.beLessThanOrEqualTo(4);
+    for (NSArray *result in results) {
+        NSMutableArray *expected = [NSMutableArray array];
+        for (NSUInteger blockIdx = 0; blockIdx < blockCount; blockIdx++) {
+            [expected addObject:@(blockIdx)];
+        }
+        expect(result).to.equal(expected);
+    }
+}
+
+- (void)testBusyMailboxDoesNotBlockOthers {
+    RBKWorkerPool *pool = [[RBKWorkerPool alloc] initWithMaximumConcurrency:2];
+    id<RBKOrderedExecutor> busyMailbox = [pool mailbox];
+    id<RBKOrderedExecutor> quietMailbox = [pool mailbox];
+
+    dispatch_semaphore_t release = dispatch_semaphore_create(0);
+    [busyMailbox executeBlock:^{
+        dispatch_semaphore_wait(release, dispatch_time(DISPATCH_TIME_NOW, 5 * NSEC_PER_SEC));
+    }];
+    __block BOOL quietRan = NO;
+    [quietMailbox executeBlock:^{
+        quietRan = YES;
+    }];
+
+    expect(quietRan).will.beTruthy();
+    dispatch_semaphore_signal(release);
+}
+
+@end
@@ -0,0 +1,94 @@
+//
+//  RBKNetworkSimulator.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "RBKClock.h"
+
+@class RBKBenchmarkSeries;
+
+/**
+ How one direction of a simulated link treats the messages crossing it.
+ */
+@interface RBKNetworkConditions : NSObject
+
+/**
+ One-way delay added to every message, in seconds.
+ */
+@property (assign, nonatomic) NSTimeInterval latency;
+
+/**
+ Up to this much, in seconds, is added to or taken from the latency of each message. Messages never overtake one another.
+ */
+@property (assign, nonatomic) NSTimeInterval jitter;
+
+/**
+ In bytes per second. A message is held until the ones before it, and itself, have been transmitted. 0 (default) is unlimited.
+ */
+@property (assign, nonatomic) NSUInteger bandwidth;
+
++ (instancetype)conditionsWithLatency:(NSTimeInterval)latency jitter:(NSTimeInterval)jitter bandwidth:(NSUInteger)bandwidth;
+
+@end
+
+/**
+ `RBKNetworkSimulator` sits between a client and a WebSocket server, such as a `RBKStompBroker`, and relays each message after the delay its direction's conditions call for. Delivery is timed on a `RBKVirtualClock`, so share the clock with the client and the server and an hour of heart-beats runs in seconds.
+
+ Each call to `connectionURL` relays a single client. Run the simulation from the main thread with `runForInterval:`; nothing is delivered late while the clock stands still.
+ */
+@interface RBKNetworkSimulator : NSObject
+
+@property (readonly, nonatomic, strong) RBKVirtualClock *clock;
+
+/**
+ Client to server. No delay by default.
+ */
+@property (strong, atomic) RBKNetworkConditions *upstreamConditions;
+
+/**
+ Server to client. No delay by default.
+ */
+@property (strong, atomic) RBKNetworkConditions *downstreamConditions;
+
+/**
+ Real time, in seconds, the main run loop is given after each step of the clock, so sockets can read, write and call back before time moves on. 0.005 by default.
+ */
+@property (assign, nonatomic) NSTimeInterval settleInterval;
+
+/**
+ One-way delay of every relayed message, in virtual nanoseconds, and counts under `metrics`: `upstream.messages`, `upstream.bytes`, `downstream.messages`, `downstream.bytes` and `dropped`. Read it between runs.
+ */
+@property (readonly, nonatomic, strong) RBKBenchmarkSeries *series;
+
+- (instancetype)initWithServerURL:(NSURL *)serverURL clock:(RBKVirtualClock *)clock;
+
+/**
+ Opens a relay to the server and returns the URL a client should connect to.
+ */
+- (NSURL *)connectionURL;
+
+/**
+ Holds back everything, in both directions, for `interval` seconds from now, then releases it in order.
+ */
+- (void)stallForInterval:(NSTimeInterval)interval;
+
+/**
+ Fails both ends of every relay as though the network had gone away. Messages still in flight are dropped.
+ */
+- (void)dropConnection;
+
+/**
+ Advances the clock by `interval` seconds, one timer deadline at a time, settling the main run loop after each.
+ */
+- (void)runForInterval:(NSTimeInterval)interval;
+
+/**
+ Closes every relay.
+ */
+- (void)close;
+
+@end
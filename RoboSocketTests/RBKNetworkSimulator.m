@@ -0,0 +1,325 @@
+//
+//  RBKNetworkSimulator.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKNetworkSimulator.h"
+#import "RBKBenchmarkReport.h"
+
+#import <SocketRocket/SRServerSocket.h>
+#import <SocketRocket/SRWebSocket.h>
+
+@implementation RBKNetworkConditions
+
++ (instancetype)conditionsWithLatency:(NSTimeInterval)latency jitter:(NSTimeInterval)jitter bandwidth:(NSUInteger)bandwidth {
+    RBKNetworkConditions *conditions = [[self alloc] init];
+    conditions.latency = latency;
+    conditions.jitter = jitter;
+    conditions.bandwidth = bandwidth;
+    return conditions;
+}
+
+@end
+
+#pragma mark - RBKNetworkSimulatorPacket
+
+@interface RBKNetworkSimulatorPacket : NSObject
+
+@property (strong, nonatomic) id message;
+@property (assign, nonatomic) NSUInteger length;
+@property (assign, nonatomic) uint64_t sentTime;
+@property (assign, nonatomic) uint64_t deliveryTime;
+
+@end
+
+@implementation RBKNetworkSimulatorPacket
+
+@end
+
+#pragma mark - RBKNetworkSimulatorLink
+
+// one direction of a relay; only touched on the simulator queue
+@interface RBKNetworkSimulatorLink : NSObject
+
+@property (assign, nonatomic, getter = isUpstream) BOOL upstream;
+@property (weak, nonatomic) SRBaseSocket *sink;
+@property (strong, nonatomic) NSMutableArray *packets; // in delivery order
+@property (strong, nonatomic) id<RBKClockTimer> timer;
+@property (assign, nonatomic) uint64_t busyUntil; // when the last queued message is done transmitting
+@property (assign, nonatomic) uint64_t lastDeliveryTime;
+
+@end
+
+@implementation RBKNetworkSimulatorLink
+
+@end
+
+#pragma mark - RBKNetworkSimulatorRelay
+
+@class RBKNetworkSimulator;
+
+@interface RBKNetworkSimulatorRelay : NSObject <SRWebSocketDelegate>
+
+@property (weak, nonatomic) RBKNetworkSimulator *simulator;
+@property (strong, nonatomic) SRServerSocket *clientSocket;
+@property (strong, nonatomic) SRWebSocket *serverSocket;
+@property (strong, nonatomic) RBKNetworkSimulatorLink *upstream;
+@property (strong, nonatomic) RBKNetworkSimulatorLink *downstream;
+@property (assign, nonatomic, getter = isClosed) BOOL closed;
+
+@end
+
+@interface RBKNetworkSimulator ()
+
+@property (readwrite, nonatomic, strong) RBKVirtualClock *clock;
+@property (readwrite, nonatomic, strong) RBKBenchmarkSeries *series;
+@property (strong, nonatomic) NSURL *serverURL;
+@property (strong, nonatomic) NSURL *hostURL; // the server URL without its port, for the endpoints clients connect to
+@property (strong, nonatomic) dispatch_queue_t simulatorQueue;
+@property (strong, nonatomic) NSMutableArray *relays;
+@property (assign, nonatomic) uint64_t stallUntil;
+
+- (void)link:(RBKNetworkSimulatorLink *)link didReceiveMessage:(id)message;
+- (void)deliverDuePacketsOnLink:(RBKNetworkSimulatorLink *)link;
+- (void)closeRelay:(RBKNetworkSimulatorRelay *)relay error:(NSError *)error;
+
+@end
+
+@implementation RBKNetworkSimulatorRelay
+
+- (void)webSocket:(SRWebSocket *)webSocket didReceiveMessage:(id)message {
+    [self.simulator link:(webSocket == (id)self.clientSocket ? self.upstream : self.downstream) didReceiveMessage:message];
+}
+
+- (void)webSocketDidOpen:(SRWebSocket *)webSocket {
+    // either end may have been spoken to before it was up
+    [self.simulator deliverDuePacketsOnLink:(webSocket == (id)self.clientSocket ? self.downstream : self.upstream)];
+}
+
+- (void)webSocket:(SRWebSocket *)webSocket didFailWithError:(NSError *)error {
+    [self.simulator closeRelay:self error:error];
+}
+
+- (void)webSocket:(SRWebSocket *)webSocket didCloseWithCode:(NSInteger)code reason:(NSString *)reason wasClean:(BOOL)wasClean {
+    [self.simulator closeRelay:self error:nil];
+}
+
+@end
+
+#pragma mark - RBKNetworkSimulator
+
+@implementation RBKNetworkSimulator
+
+- (instancetype)init {
+    @throw [NSException exceptionWithName:NSInternalInconsistencyException reason:[NSString stringWithFormat:@"%@ Failed to call designated initializer. Invoke `initWithServerURL:clock:` instead.", NSStringFromClass([self class])] userInfo:nil];
+}
+
+- (instancetype)initWithServerURL:(NSURL *)serverURL clock:(RBKVirtualClock *)clock {
+    NSParameterAssert(serverURL);
+    NSParameterAssert(clock);
+
+    self = [super init];
+    if (self) {
+        _serverURL = serverURL;
+        _hostURL = [NSURL URLWithString:[NSString stringWithFormat:@"%@://%@", [serverURL scheme], [serverURL host]]];
+        _clock = clock;
+        _simulatorQueue = dispatch_queue_create("com.robotsandpencils.networking.simulator", DISPATCH_QUEUE_SERIAL);
+        _relays = [NSMutableArray array];
+        _upstreamConditions = [[RBKNetworkConditions alloc] init];
+        _downstreamConditions = [[RBKNetworkConditions alloc] init];
+        _settleInterval = 0.005;
+        _series = [[RBKBenchmarkSeries alloc] initWithName:@"network-simulator" parameters:nil];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    for (RBKNetworkSimulatorRelay *relay in _relays) {
+        [relay.clientSocket close];
+        [relay.serverSocket close];
+    }
+}
+
+- (NSURL *)connectionURL {
+    RBKNetworkSimulatorRelay *relay = [[RBKNetworkSimulatorRelay alloc] init];
+    relay.simulator = self;
+    relay.clientSocket = [[SRServerSocket alloc] initWithURL:self.hostURL];
+    relay.serverSocket = [[SRWebSocket alloc] initWithURL:self.serverURL];
+    relay.upstream = [self linkWithSink:relay.serverSocket upstream:YES];
+    relay.downstream = [self linkWithSink:relay.clientSocket upstream:NO];
+
+    for (SRBaseSocket *socket in @[relay.clientSocket, relay.serverSocket]) {
+        [socket setDelegateDispatchQueue:self.simulatorQueue];
+        socket.delegate = relay;
+    }
+
+    dispatch_sync(self.simulatorQueue, ^{
+        [self.relays addObject:relay];
+    });
+    [relay.serverSocket open];
+
+    NSString *hostWithPort = [NSString stringWithFormat:@"%@:%lu", [self.hostURL absoluteString], (unsigned long)[relay.clientSocket serverSocketPort]];
+    return [NSURL URLWithString:hostWithPort];
+}
+
+- (void)stallForInterval:(NSTimeInterval)interval {
+    uint64_t stallUntil = [self.clock now] + (uint64_t)(MAX(interval, 0) * NSEC_PER_SEC);
+    dispatch_sync(self.simulatorQueue, ^{
+        self.stallUntil = MAX(self.stallUntil, stallUntil);
+        for (RBKNetworkSimulatorRelay *relay in self.relays) {
+            for (RBKNetworkSimulatorLink *link in @[relay.upstream, relay.downstream]) {
+                for (RBKNetworkSimulatorPacket *packet in link.packets) {
+                    packet.deliveryTime = MAX(packet.deliveryTime, stallUntil);
+                }
+                link.lastDeliveryTime = MAX(link.lastDeliveryTime, stallUntil);
+                [self deliverDuePacketsOnLink:link];
+            }
+        }
+    });
+}
+
+- (void)dropConnection {
+    NSError *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:@{NSLocalizedDescriptionKey: @"The simulated network dropped the connection"}];
+    dispatch_sync(self.simulatorQueue, ^{
+        for (RBKNetworkSimulatorRelay *relay in [self.relays copy]) {
+            [self closeRelay:relay error:error];
+        }
+    });
+}
+
+- (void)runForInterval:(NSTimeInterval)interval {
+    NSAssert([NSThread isMainThread], @"The simulation runs on the main thread");
+
+    uint64_t end = [self.clock now] + (uint64_t)(MAX(interval, 0) * NSEC_PER_SEC);
+    [self settle];
+    while (YES) {
+        // step one deadline at a time, so whatever a timer sets off reaches the sockets before the next timer looks
+        uint64_t next = MIN([self.clock nextDeadline], end);
+        [self.clock advanceToTime:next];
+        [self settle];
+        if (next >= end) {
+            break;
+        }
+    }
+}
+
+- (void)close {
+    dispatch_sync(self.simulatorQueue, ^{
+        for (RBKNetworkSimulatorRelay *relay in [self.relays copy]) {
+            [self closeRelay:relay error:nil];
+        }
+    });
+}
+
+// give the main run loop real time to let the sockets catch up with the clock
+- (void)settle {
+    NSDate *settleDate = [NSDate dateWithTimeIntervalSinceNow:self.settleInterval];
+    while ([settleDate timeIntervalSinceNow] > 0 && [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:settleDate]);
+}
+
+#pragma mark - Links
+
+- (RBKNetworkSimulatorLink *)linkWithSink:(SRBaseSocket *)sink upstream:(BOOL)upstream {
+    RBKNetworkSimulatorLink *link = [[RBKNetworkSimulatorLink alloc] init];
+    link.upstream = upstream;
+    link.sink = sink;
+    link.packets = [NSMutableArray array];
+
+    __weak typeof(self)weakSelf = self;
+    __weak RBKNetworkSimulatorLink *weakLink = link;
+    link.timer = [self.clock timerWithQueue:self.simulatorQueue handler:^{
+        [weakSelf deliverDuePacketsOnLink:weakLink];
+    }];
+    return link;
+}
+
+- (void)link:(RBKNetworkSimulatorLink *)link didReceiveMessage:(id)message {
+    RBKNetworkConditions *conditions = link.isUpstream ? self.upstreamConditions : self.downstreamConditions;
+    uint64_t now = [self.clock now];
+
+    RBKNetworkSimulatorPacket *packet = [[RBKNetworkSimulatorPacket alloc] init];
+    packet.message = message;
+    packet.length = [message isKindOfClass:[NSString class]] ? [message lengthOfBytesUsingEncoding:NSUTF8StringEncoding] : [message length];
+    packet.sentTime = now;
+
+    // the message goes out once the link is done with the ones ahead of it, then spends the latency in flight
+    uint64_t transmitTime = conditions.bandwidth > 0 ? (uint64_t)((double)packet.length / conditions.bandwidth * NSEC_PER_SEC) : 0;
+    link.busyUntil = MAX(now, link.busyUntil) + transmitTime;
+    NSTimeInterval latency = conditions.latency;
+    if (conditions.jitter > 0) {
+        latency += (arc4random_uniform(UINT32_MAX) / (double)UINT32_MAX * 2.0 - 1.0) * conditions.jitter;
+    }
+    uint64_t deliveryTime = link.busyUntil + (uint64_t)(MAX(latency, 0) * NSEC_PER_SEC);
+    packet.deliveryTime = MAX(MAX(deliveryTime, link.lastDeliveryTime), self.stallUntil);
+    link.lastDeliveryTime = packet.deliveryTime;
+
+    [link.packets addObject:packet];
+    [self deliverDuePacketsOnLink:link];
+}
+
+- (void)deliverDuePacketsOnLink:(RBKNetworkSimulatorLink *)link {
+    if (!link) {
+        return;
+    }
+    uint64_t now = [self.clock now];
+    SRBaseSocket *sink = link.sink;
+    NSString *direction = link.isUpstream ? @"upstream" : @"downstream";
+
+    while ([link.packets count] > 0) {
+        RBKNetworkSimulatorPacket *packet = link.packets[0];
+        if (packet.deliveryTime > now) {
+            break;
+        }
+        if (sink.readyState == SR_CONNECTING) {
+            // picked up again when the sink opens; arming the timer for a past deadline would spin the clock
+            [link.timer fireAtTime:RBKClockDistantFuture leeway:0];
+            return;
+        }
+        [link.packets removeObjectAtIndex:0];
+        if (sink.readyState != SR_OPEN) {
+            [self incrementMetric:@"dropped" by:1];
+            continue;
+        }
+        [sink send:packet.message];
+        [self.series addSample:packet.deliveryTime - packet.sentTime];
+        [self incrementMetric:[direction stringByAppendingString:@".messages"] by:1];
+        [self incrementMetric:[direction stringByAppendingString:@".bytes"] by:packet.length];
+    }
+
+    RBKNetworkSimulatorPacket *nextPacket = [link.packets firstObject];
+    [link.timer fireAtTime:(nextPacket ? nextPacket.deliveryTime : RBKClockDistantFuture) leeway:0];
+}
+
+- (void)closeRelay:(RBKNetworkSimulatorRelay *)relay error:(NSError *)error {
+    if (relay.isClosed) {
+        return;
+    }
+    relay.closed = YES;
+    [self.relays removeObjectIdenticalTo:relay];
+
+    for (RBKNetworkSimulatorLink *link in @[relay.upstream, relay.downstream]) {
+        [self incrementMetric:@"dropped" by:[link.packets count]];
+        [link.packets removeAllObjects];
+        [link.timer cancel];
+    }
+
+    // whatever happened to one end happens to the other
+    for (SRBaseSocket *socket in @[relay.clientSocket, relay.serverSocket]) {
+        if (socket.readyState == SR_CLOSING || socket.readyState == SR_CLOSED) {
+            continue;
+        }
+        if (error) {
+            [socket failWithError:error];
+        } else {
+            [socket close];
+        }
+    }
+}
+
+- (void)incrementMetric:(NSString *)key by:(NSUInteger)amount {
+    self.series.metrics[key] = @([self.series.metrics[key] unsignedIntegerValue] + amount);
+}
+
+@end
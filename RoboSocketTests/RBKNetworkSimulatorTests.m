@@ -0,0 +1,259 @@
+//
+//  RBKNetworkSimulatorTests.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#define EXP_SHORTHAND YES
+#import <Expecta/Expecta.h>
+
+#import "RBKSTOMPSocket.h"
+#import "RBKStompBroker.h"
+#import "RBKNetworkSimulator.h"
+#import "RBKBenchmarkReport.h"
+
+@interface RBKNetworkSimulatorTests : XCTestCase
+
+@property (strong, nonatomic) RBKVirtualClock *clock;
+@property (strong, nonatomic) RBKStompBroker *broker;
+@property (strong, nonatomic) RBKNetworkSimulator *simulator;
+@property (strong, nonatomic) RBKSTOMPSocket *stompSocket;
+
+@end
+
+@implementation RBKNetworkSimulatorTests
+
+- (void)setUp {
+    [super setUp];
+
+    [Expecta setAsynchronousTestTimeout:5.0];
+
+    self.clock = [[RBKVirtualClock alloc] init];
+    self.broker = [[RBKStompBroker alloc] initWithHostURL:[NSURL URLWithString:@"ws://localhost"]];
+    self.broker.clock = self.clock;
+    self.simulator = [[RBKNetworkSimulator alloc] initWithServerURL:[self.broker connectionURL] clock:self.clock];
+    self.stompSocket = [self stompSocketWithURL:[self.simulator connectionURL]];
+}
+
+- (void)tearDown {
+    [self.stompSocket closeSocket];
+    [self.simulator close];
+    [self.broker close];
+
+    [super tearDown];
+}
+
+- (RBKSTOMPSocket *)stompSocketWithURL:(NSURL *)socketURL {
+    RBKSTOMPSocket *stompSocket = [RBKStompBroker stompSocketWithURL:socketURL];
+    stompSocket.clock = self.clock;
+    return stompSocket;
+}
+
+- (void)connectWithOutgoingHeartbeat:(NSUInteger)outgoingHeartbeat incomingHeartbeat:(NSUInteger)incomingHeartbeat {
+    RBKStompFrame *connectFrame = [RBKStompFrame connectFrameWithLogin:@"username" passcode:@"passcode" host:@"localhost" supportedOutgoingHeartbeat:outgoingHeartbeat desiredIncomingHeartbeat:incomingHeartbeat];
+
+    __block BOOL connected = NO;
+    [self.stompSocket sendSocketOperationWithFrame:connectFrame success:^(RBKSocketOperation *operation, RBKStompFrame *responseObject) {
+        connected = [responseObject.command isEqualToString:RBKStompCommandConnected];
+    } failure:nil];
+    for (NSUInteger step = 0; !connected && step < 100; step++) {
+        [self.simulator runForInterval:0.05];
+    }
+    expect(connected).to.beTruthy();
+}
+
+- (void)testHourOfClientHeartbeats {
+    RBKStompHeartbeat heartbeat = {0, 10000};
+    self.broker.heartbeat = heartbeat;
+    self.simulator.upstreamConditions = [RBKNetworkConditions conditionsWithLatency:0.05 jitter:0.02 bandwidth:0];
+
+    [self connectWithOutgoingHeartbeat:10000 incomingHeartbeat:0];
+    [self.simulator runForInterval:60 * 60];
+
+    // one every 10s, and the broker, which gives up after 20s of silence, heard every one of them
+    expect([self.stompSocket numberOfSentHeartbeats]).to.beInTheRangeOf(355, 361);
+    expect([self.simulator.series.metrics[@"upstream.messages"] unsignedIntegerValue]).to.beGreaterThanOrEqualTo(355);
+    expect(self.stompSocket.socketOpen).to.beTruthy();
+}
+
+- (void)testStallMissesServerHeartbeats {
+    RBKStompHeartbeat heartbeat = {1000, 0};
+    self.broker.heartbeat = heartbeat;
+
+    __block NSError *heartbeatError = nil;
+    self.stompSocket.failureBlock = ^(NSError *error) {
+        heartbeatError = error;
+    };
+
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:1000];
+    [self.simulator runForInterval:10];
+    expect([self.stompSocket numberOfReceivedHeartbeats]).to.beGreaterThanOrEqualTo(8);
+    expect(heartbeatError).to.beNil();
+
+    // longer than the client's two intervals of tolerance
+    [self.simulator stallForInterval:5];
+    [self.simulator runForInterval:5];
+    expect(heartbeatError.code).will.equal(NSURLErrorTimedOut);
+}
+
+- (void)testUpstreamLatencyDelaysReceipt {
+    self.simulator.upstreamConditions = [RBKNetworkConditions conditionsWithLatency:0.25 jitter:0 bandwidth:0];
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:0];
+
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/foo/bar" headers:@{RBKStompHeaderReceipt: @"receipt-1"} messageHandler:nil];
+    RBKVirtualClock *clock = self.clock;
+    uint64_t sentTime = [clock now];
+    __block uint64_t receiptTime = 0;
+    [self.stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        receiptTime = [clock now];
+    } failure:nil];
+
+    [self.simulator runForInterval:1];
+    expect(receiptTime).will.beGreaterThan(0);
+    expect(receiptTime - sentTime).to.beGreaterThanOrEqualTo(250 * NSEC_PER_MSEC);
+}
+
+- (void)testDownstreamBandwidthDelaysMessage {
+    self.simulator.downstreamConditions = [RBKNetworkConditions conditionsWithLatency:0 jitter:0 bandwidth:1000];
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:0];
+
+    RBKVirtualClock *clock = self.clock;
+    __block uint64_t receivedTime = 0;
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/foo/bar" headers:@{RBKStompHeaderReceipt: @"receipt-1"} messageHandler:^(RBKStompFrame *responseFrame) {
+        receivedTime = [clock now];
+    }];
+    __block BOOL subscribed = NO;
+    [self.stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        subscribed = YES;
+    } failure:nil];
+    for (NSUInteger step = 0; !subscribed && step < 100; step++) {
+        [self.simulator runForInterval:0.05];
+    }
+    expect(subscribed).to.beTruthy();
+
+    // 2KB at 1KB/s
+    uint64_t publishedTime = [clock now];
+    [self.broker publishMessageWithDestination:@"/foo/bar" headers:nil body:[@"" stringByPaddingToLength:2048 withString:@"x" startingAtIndex:0]];
+    [self.simulator runForInterval:5];
+    expect(receivedTime).will.beGreaterThan(0);
+    expect(receivedTime - publishedTime).to.beGreaterThanOrEqualTo(2 * NSEC_PER_SEC);
+}
+
+- (void)testDropConnectionClosesSocket {
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:0];
+    expect(self.stompSocket.socketOpen).to.beTruthy();
+
+    [self.simulator dropConnection];
+    [self.simulator runForInterval:0.1];
+    expect(self.stompSocket.socketOpen).will.beFalsy();
+}
+
+- (void)testReconnectAfterDropSendsPendingOperations {
+    RBKNetworkConditions *conditions = [RBKNetworkConditions conditionsWithLatency:0.1 jitter:0.05 bandwidth:0];
+    self.simulator.upstreamConditions = conditions;
+    self.simulator.downstreamConditions = conditions;
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:0];
+
+    [self.simulator dropConnection];
+    [self.simulator runForInterval:0.1];
+    expect(self.stompSocket.socketOpen).will.beFalsy();
+
+    // a broker endpoint takes one client, so the replacement connection gets its own endpoint and relay
+    RBKNetworkSimulator *simulator = [[RBKNetworkSimulator alloc] initWithServerURL:[self.broker connectionURL] clock:self.clock];
+    simulator.upstreamConditions = conditions;
+    simulator.downstreamConditions = conditions;
+    RBKSTOMPSocket *stompSocket = [self stompSocketWithURL:[simulator connectionURL]];
+    RBKSocketMetrics *metrics = [[RBKSocketMetrics alloc] init];
+    stompSocket.metrics = metrics;
+
+    // everything is sent before the replacement has opened, so it all waits as pending operations
+    __block BOOL connected = NO;
+    [stompSocket sendSocketOperationWithFrame:[RBKStompFrame connectFrameWithLogin:@"username" passcode:@"passcode" host:@"localhost"] success:^(RBKSocketOperation *operation, RBKStompFrame *responseObject) {
+        connected = YES;
+    } failure:nil];
+    NSMutableArray *bodies = [NSMutableArray array];
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/quotes" headers:@{RBKStompHeaderReceipt: @"receipt-1"} messageHandler:^(RBKStompFrame *responseFrame) {
+        [bodies addObject:[responseFrame bodyValue]];
+    }];
+    __block BOOL subscribed = NO;
+    [stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        subscribed = YES;
+    } failure:nil];
+    for (NSUInteger idx = 1; idx <= 3; idx++) {
+        [stompSocket sendSocketOperationWithFrame:[RBKStompFrame sendFrameWithDestination:@"/quotes" headers:nil body:[NSString stringWithFormat:@"GOOG %lu", (unsigned long)idx]]];
+    }
+    expect([metrics snapshot][RBKSocketMetricsGaugesKey][@"pending_operations"]).to.equal(5);
+
+    for (NSUInteger step = 0; [bodies count] < 3 && step < 100; step++) {
+        [simulator runForInterval:0.05];
+    }
+    expect(connected).to.beTruthy();
+    expect(subscribed).to.beTruthy();
+    expect(bodies).to.equal(@[@"GOOG 1", @"GOOG 2", @"GOOG 3"]);
+    expect([metrics snapshot][RBKSocketMetricsGaugesKey][@"pending_operations"]).to.equal(0);
+
+    [stompSocket closeSocket];
+    [simulator close];
+}
+
+- (void)testClientAckRedeliveryUnderStall {
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:0];
+
+    // the prefetch count holds the ACK back, so the message can be NACKed instead
+    RBKVirtualClock *clock = self.clock;
+    NSMutableArray *receivedFrames = [NSMutableArray array];
+    NSMutableArray *receivedTimes = [NSMutableArray array];
+    NSDictionary *headers = @{RBKStompHeaderReceipt: @"receipt-1", RBKStompHeaderAck: RBKStompAckClientIndividual};
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/quotes" headers:headers prefetchCount:1 messageHandler:^(RBKStompFrame *responseFrame) {
+        [receivedFrames addObject:responseFrame];
+        [receivedTimes addObject:@([clock now])];
+    }];
+    __block BOOL subscribed = NO;
+    [self.stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        subscribed = YES;
+    } failure:nil];
+    for (NSUInteger step = 0; !subscribed && step < 100; step++) {
+        [self.simulator runForInterval:0.05];
+    }
+    expect(subscribed).to.beTruthy();
+
+    [self.broker publishMessageWithDestination:@"/quotes" headers:nil body:@"GOOG 1"];
+    for (NSUInteger step = 0; [receivedFrames count] < 1 && step < 100; step++) {
+        [self.simulator runForInterval:0.05];
+    }
+    expect([receivedFrames count]).to.equal(1);
+
+    // the NACK and the redelivery are held up far longer than a receipt is waited for
+    uint64_t stallTime = [clock now];
+    [self.simulator stallForInterval:5];
+    [self.stompSocket sendSocketOperationWithFrame:[RBKStompFrame nackFrameWithIdentifier:[receivedFrames[0] headerValueForKey:RBKStompHeaderAck]]];
+    self.stompSocket.publisher.receiptTimeoutInterval = 1;
+    __block NSError *publishError = nil;
+    __block uint64_t publishFailedTime = 0;
+    [self.stompSocket.publisher publishToDestination:@"/trades" headers:nil body:@"BUY GOOG" success:nil failure:^(NSError *error) {
+        publishError = error;
+        publishFailedTime = [clock now];
+    }];
+
+    [self.simulator runForInterval:2];
+    expect(publishError.code).will.equal(NSURLErrorTimedOut);
+    expect(publishFailedTime - stallTime).to.beInTheRangeOf(1 * NSEC_PER_SEC, 2 * NSEC_PER_SEC);
+    expect([receivedFrames count]).to.equal(1);
+
+    [self.simulator runForInterval:4];
+    expect([receivedFrames count]).will.equal(2);
+    expect([receivedTimes[1] unsignedLongLongValue] - stallTime).to.beGreaterThanOrEqualTo(5 * NSEC_PER_SEC);
+    expect(self.broker.numberOfRedeliveredMessages).to.equal(1);
+    expect([receivedFrames[1] bodyValue]).to.equal(@"GOOG 1");
+
+    [self.stompSocket completeMessage:receivedFrames[1]];
+    [self.simulator runForInterval:0.5];
+    expect(self.broker.numberOfAcknowledgedMessages).will.equal(1);
+    expect(self.broker.numberOfRedeliveredMessages).to.equal(1);
+    expect(self.stompSocket.socketOpen).to.beTruthy();
+}
+
+@end
@@ -0,0 +1,227 @@
+//
+//  RBKOutboundJournalTests.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#define EXP_SHORTHAND YES
+#import <Expecta/Expecta.h>
+
+#import "RBKOutboundJournal.h"
+#import "RBKSTOMPSocket.h"
+#import "RBKStompBroker.h"
+
+@interface RBKOutboundJournalTests : XCTestCase
+
+@property (strong, nonatomic) NSURL *directoryURL;
+
+@end
+
+@implementation RBKOutboundJournalTests
+
+- (void)setUp {
+    [super setUp];
+
+    [Expecta setAsynchronousTestTimeout:5.0];
+
+    NSString *directoryName = [NSString stringWithFormat:@"journal-%@", [[NSUUID UUID] UUIDString]];
+    self.directoryURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:directoryName]];
+}
+
+- (void)tearDown {
+    [[NSFileManager defaultManager] removeItemAtURL:self.directoryURL error:nil];
+
+    [super tearDown];
+}
+
+- (NSData *)dataWithString:(NSString *)string {
+    return [string dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+- (void)testUnretiredEntriesSurviveReopening {
+    NSError *error = nil;
+    RBKOutboundJournal *journal = [[RBKOutboundJournal alloc] initWithDirectoryURL:self.directoryURL error:&error];
+    expect(error).to.beNil();
+
+    __block NSUInteger durableCount = 0;
+    for (NSString *key in @[@"a", @"b", @"c"]) {
+        [journal appendEntryWithKey:key data:[self dataWithString:[key uppercaseString]] completion:^(NSError *error) {
+            durableCount += error ? 0 : 1;
+        }];
+    }
+    [journal retireEntryWithKey:@"b"];
+    [journal sync];
+    expect(durableCount).will.equal(3);
+    expect(journal.numberOfEntries).to.equal(2);
+    [journal close];
+
+    RBKOutboundJournal *reopened = [[RBKOutboundJournal alloc] initWithDirectoryURL:self.directoryURL error:&error];
+    expect(error).to.beNil();
+    NSArray *entries = [reopened unretiredEntries];
+    expect([entries valueForKey:@"key"]).to.equal((@[@"a", @"c"]));
+    expect([entries[1] data]).to.equal([self dataWithString:@"C"]);
+    [reopened close];
+}
+
+- (void)testRecoveryStopsAtATornRecord {
+    RBKOutboundJournal *journal = [[RBKOutboundJournal alloc] initWithDirectoryURL:self.directoryURL error:nil];
+    [journal appendEntryWithKey:@"whole" data:[self dataWithString:@"whole"] completion:nil];
+    [journal appendEntryWithKey:@"torn" data:[self dataWithString:@"torn"] completion:nil];
+    [journal close];
+
+    // flip the last byte of the last record's data
+    NSArray *segmentURLs = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:self.directoryURL includingPropertiesForKeys:nil options:0 error:nil];
+    expect(segmentURLs).to.haveCountOf(1);
+    NSMutableData *segment = [NSMutableData dataWithContentsOfURL:segmentURLs[0]];
+    uint8_t *bytes = [segment mutableBytes];
+    NSUInteger idx = [segment length] - 1;
+    while (bytes[idx] == 0) {
+        idx -= 1; // skip the padding
+    }
+    bytes[idx] ^= 0xFF;
+    [segment writeToURL:segmentURLs[0] atomically:YES];
+
+    RBKOutboundJournal *reopened = [[RBKOutboundJournal alloc] initWithDirectoryURL:self.directoryURL error:nil];
+    expect([[reopened unretiredEntries] valueForKey:@"key"]).to.equal((@[@"whole"]));
+    [reopened close];
+}
+
+- (void)testAppendsShareCommits {
+    RBKOutboundJournal *journal = [[RBKOutboundJournal alloc] initWithDirectoryURL:self.directoryURL error:nil];
+
+    NSUInteger const appendCount = 200;
+    __block NSUInteger durableCount = 0;
+    for (NSUInteger idx = 0; idx < appendCount; idx++) {
+        [journal appendEntryWithKey:[NSString stringWithFormat:@"%lu", (unsigned long)idx] data:[self dataWithString:@"frame"] completion:^(NSError *error) {
+            durableCount += error ? 0 : 1;
+        }];
+    }
+    expect(durableCount).will.equal(appendCount);
+    expect(journal.numberOfCommits).to.beLessThan(appendCount);
+    [journal close];
+}
+
+- (void)testRotationCompactsRetiredEntries {
+    RBKOutboundJournal *journal = [[RBKOutboundJournal alloc] initWithDirectoryURL:self.directoryURL error:nil];
+    journal.segmentSize = 4096;
+
+    // about 40 segments' worth, nearly all of it retired
+    NSData *data = [[@"" stringByPaddingToLength:200 withString:@"x" startingAtIndex:0] dataUsingEncoding:NSUTF8StringEncoding];
+    NSUInteger const appendCount = 800;
+    for (NSUInteger idx = 0; idx < appendCount; idx++) {
+        NSString *key = [NSString stringWithFormat:@"%lu", (unsigned long)idx];
+        [journal appendEntryWithKey:key data:data completion:nil];
+        if (idx % 100 != 0) {
+            [journal retireEntryWithKey:key];
+        }
+    }
+    [journal sync];
+    expect(journal.numberOfEntries).to.equal(8);
+    expect(journal.numberOfSegments).to.beLessThanOrEqualTo(2);
+    [journal close];
+
+    RBKOutboundJournal *reopened = [[RBKOutboundJournal alloc] initWithDirectoryURL:self.directoryURL error:nil];
+    NSArray *entries = [reopened unretiredEntries];
+    expect([entries valueForKey:@"key"]).to.equal((@[@"0", @"100", @"200", @"300", @"400", @"500", @"600", @"700"]));
+    expect([entries[7] data]).to.equal(data);
+    [reopened close];
+}
+
+- (void)testAppendAfterCloseFails {
+    RBKOutboundJournal *journal = [[RBKOutboundJournal alloc] initWithDirectoryURL:self.directoryURL error:nil];
+    [journal close];
+
+    __block NSError *appendError = nil;
+    [journal appendEntryWithKey:@"late" data:[self dataWithString:@"late"] completion:^(NSError *error) {
+        appendError = error;
+    }];
+    expect(appendError.code).will.equal(EBADF);
+    expect(journal.numberOfEntries).to.equal(0);
+}
+
+#pragma mark - Publisher
+
+- (RBKSTOMPSocket *)stompSocketWithBroker:(RBKStompBroker *)broker journal:(RBKOutboundJournal *)journal {
+    RBKSTOMPSocket *stompSocket = [broker stompSocket];
+    stompSocket.publisher.journal = journal;
+
+    __block BOOL connected = NO;
+    [stompSocket sendSocketOperationWithFrame:[RBKStompFrame connectFrameWithLogin:@"username" passcode:@"passcode" host:@"localhost"] success:^(RBKSocketOperation *operation, RBKStompFrame *responseObject) {
+        connected = [responseObject.command isEqualToString:RBKStompCommandConnected];
+    } failure:nil];
+    expect(connected).will.beTruthy();
+    return stompSocket;
+}
+
+- (void)testPublisherRetiresConfirmedFrames {
+    RBKStompBroker *broker = [[RBKStompBroker alloc] initWithHostURL:[NSURL URLWithString:@"ws://localhost"]];
+    RBKOutboundJournal *journal = [[RBKOutboundJournal alloc] initWithDirectoryURL:self.directoryURL error:nil];
+    RBKSTOMPSocket *stompSocket = [self stompSocketWithBroker:broker journal:journal];
+
+    __block NSUInteger confirmed = 0;
+    for (NSUInteger idx = 0; idx < 10; idx++) {
+        [stompSocket.publisher publishToDestination:@"/foo/bar" headers:nil body:@"journaled" success:^(RBKStompFrame *receiptFrame) {
+            confirmed += 1;
+        } failure:nil];
+    }
+    expect(confirmed).will.equal(10);
+    expect(broker.numberOfReceivedMessages).to.equal(10);
+    expect(journal.numberOfEntries).will.equal(0);
+
+    [stompSocket closeSocket];
+    [broker close];
+    [journal close];
+}
+
+- (void)testPublisherResendsUnretiredFramesOnConnect {
+    // left over from an earlier launch that never got its receipt
+    RBKOutboundJournal *earlierJournal = [[RBKOutboundJournal alloc] initWithDirectoryURL:self.directoryURL error:nil];
+    RBKStompFrame *frame = [RBKStompFrame sendFrameWithDestination:@"/foo/bar" headers:@{RBKStompHeaderReceipt: @"earlier-launch-1"} body:@"unconfirmed"];
+    [earlierJournal appendEntryWithKey:@"earlier-launch-1" data:[frame frameData] completion:nil];
+    [earlierJournal close];
+
+    RBKStompBroker *broker = [[RBKStompBroker alloc] initWithHostURL:[NSURL URLWithString:@"ws://localhost"]];
+    RBKOutboundJournal *journal = [[RBKOutboundJournal alloc] initWithDirectoryURL:self.directoryURL error:nil];
+    expect(journal.numberOfEntries).to.equal(1);
+
+    RBKSTOMPSocket *stompSocket = [self stompSocketWithBroker:broker journal:journal];
+    expect(broker.numberOfReceivedMessages).will.equal(1);
+    expect(journal.numberOfEntries).will.equal(0);
+    expect(stompSocket.publisher.numberOfUnconfirmedFrames).to.equal(0);
+
+    [stompSocket closeSocket];
+    [broker close];
+    [journal close];
+}
+
+- (void)testPublisherFailsFramesItCannotJournal {
+    RBKStompBroker *broker = [[RBKStompBroker alloc] initWithHostURL:[NSURL URLWithString:@"ws://localhost"]];
+    RBKOutboundJournal *journal = [[RBKOutboundJournal alloc] initWithDirectoryURL:self.directoryURL error:nil];
+    RBKSTOMPSocket *stompSocket = [self stompSocketWithBroker:broker journal:journal];
+    [journal close];
+
+    __block NSError *publishError = nil;
+    [stompSocket.publisher publishToDestination:@"/foo/bar" headers:nil body:@"unjournaled" success:nil failure:^(NSError *error) {
+        publishError = error;
+    }];
+    expect(publishError).willNot.beNil();
+    expect(stompSocket.publisher.numberOfUnconfirmedFrames).to.equal(0);
+
+    // transactions skip the journal, so they still go out
+    RBKStompTransaction *transaction = [stompSocket beginTransaction];
+    [transaction sendToDestination:@"/foo/bar" headers:nil body:@"transactional"];
+    __block BOOL committed = NO;
+    [stompSocket commitTransaction:transaction success:^(RBKStompFrame *receiptFrame) {
+        committed = YES;
+    } failure:nil];
+    expect(committed).will.beTruthy();
+    expect(broker.numberOfReceivedMessages).to.equal(1);
+
+    [stompSocket closeSocket];
+    [broker close];
+}
+
+@end
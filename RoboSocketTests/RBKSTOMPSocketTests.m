@@ -136,6 +136,8 @@ NSString * const hostURL = @"ws://localhost";
     };
     
     expect([self.stompSocket timeIntervalBetweenPreviousHeartbeats]).will.beCloseToWithin(expectedInterval(), 0.1);
+    // the stub goes quiet after one heart-beat, so the socket closes itself two intervals later; this runs well before then
+    expect(self.stompSocket.socketOpen).to.beTruthy();
 }
 
 - (void)testSocketSTOMPConnectClientHeartbeat {
@@ -167,10 +169,37 @@ NSString * const hostURL = @"ws://localhost";
     expect(self.isCurrentScenarioSuccessful).will.beTruthy(); // indicates that the client heartbeat was received
 }
 
+- (void)testSocketSTOMPMissedServerHeartbeat {
+    
+    self.currentScenario = RBKTestScenarioStompConnectServerHeartbeat; // the stub sends a single heartbeat and then goes quiet
+    
+    self.stompSocket.requestSerializer = [RBKSocketStompRequestSerializer serializer];
+    RBKSocketStompRequestSerializer *requestSerializer = (id)self.stompSocket.requestSerializer;
+    requestSerializer.delegate = self.stompSocket;
+    self.stompSocket.responseSerializer = [RBKSocketStompResponseSerializer serializer];
+    RBKSocketStompResponseSerializer *responseSerializer = (id)self.stompSocket.responseSerializer;
+    responseSerializer.delegate = self.stompSocket;
+    
+    __block NSError *heartbeatError = nil;
+    self.stompSocket.failureBlock = ^(NSError *error) {
+        heartbeatError = error;
+    };
+    
+    RBKStompFrame *connectMessage = [RBKStompFrame connectFrameWithLogin:@"username" passcode:@"passcode" host:[[NSURL URLWithString:hostURL] host] supportedOutgoingHeartbeat:0 desiredIncomingHeartbeat:200];
+    
+    __block BOOL success = NO;
+    [self.stompSocket sendSocketOperationWithFrame:connectMessage success:^(RBKSocketOperation *operation, id responseObject) {
+        success = YES;
+    }                                      failure:nil];
+    expect(success).will.beTruthy();
+    expect([self.stompSocket numberOfReceivedHeartbeats]).will.beGreaterThanOrEqualTo(2);
+    expect(heartbeatError.code).will.equal(NSURLErrorTimedOut);
+    expect(self.stompSocket.socketOpen).will.beFalsy();
+}
 
 // Connection:
 // client heartbeat is not tested
-// unreceived client/server heartbeat is not tested
+// unreceived client heartbeat is not tested
 // negotiation error is not tested
 
 - (void)testSocketSTOMPSubscribe {
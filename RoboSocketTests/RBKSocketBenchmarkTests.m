@@ -0,0 +1,322 @@
+//
+//  RBKSocketBenchmarkTests.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "RBKSTOMPSocket.h"
+#import "RBKStompBroker.h"
+#import "RBKSocketMetrics.h"
+#import "RBKBenchmarkReport.h"
+
+#import <SocketRocket/SRServerSocket.h>
+#import <SocketRocket/SRWebSocket.h>
+
+static NSString * const RBKBenchmarkHostURL = @"ws://localhost";
+static NSTimeInterval const RBKBenchmarkSeriesTimeout = 60.0;
+
+// 16B to 16MB
+static NSUInteger const RBKBenchmarkPayloadSizes[] = {16, 256, 4096, 65536, 1048576, 16777216};
+static NSUInteger const RBKBenchmarkConcurrencyLevels[] = {1, 4, 16};
+
+#pragma mark - RBKBenchmarkRun
+
+// The state shared by every client taking part in one series
+@interface RBKBenchmarkRun : NSObject
+
+@property (strong, nonatomic) RBKBenchmarkSeries *series;
+@property (strong, nonatomic) id frame;
+@property (assign, nonatomic) NSUInteger iterations;
+@property (assign, nonatomic) NSUInteger issuedOperations;
+@property (assign, nonatomic) NSUInteger completedOperations;
+
+- (BOOL)isComplete;
+
+@end
+
+@implementation RBKBenchmarkRun
+
+- (BOOL)isComplete {
+    return self.completedOperations >= self.iterations;
+}
+
+@end
+
+#pragma mark - RBKSocketBenchmarkTests
+
+@interface RBKSocketBenchmarkTests : XCTestCase <SRWebSocketDelegate>
+
+@property (strong, nonatomic) RBKBenchmarkReport *report;
+@property (strong, nonatomic) NSMutableArray *echoSockets;
+
+@end
+
+@implementation RBKSocketBenchmarkTests
+
+- (void)setUp {
+    [super setUp];
+
+    self.report = [[RBKBenchmarkReport alloc] initWithSuiteName:[NSString stringWithFormat:@"roundtrip-%@", NSStringFromSelector(self.invocation.selector)]];
+    self.echoSockets = [NSMutableArray array];
+}
+
+- (void)tearDown {
+    if ([self.report.series count] > 0) {
+        NSError *error = nil;
+        if (![self.report writeReport:&error]) {
+            NSLog(@"Failed to write benchmark report: %@", [error localizedDescription]);
+        }
+    }
+    for (SRServerSocket *echoSocket in self.echoSockets) {
+        [echoSocket close];
+    }
+
+    [super tearDown];
+}
+
+#pragma mark - Benchmarks
+
+- (void)testWebSocketRoundTrip {
+    if (![RBKBenchmarkReport benchmarksEnabled]) {
+        return;
+    }
+
+    [self measureWebSocketSeriesOverLoopback:NO];
+}
+
+// the same series through in-memory streams, so the numbers are the library's own cost without the kernel's
+- (void)testWebSocketLoopbackRoundTrip {
+    if (![RBKBenchmarkReport benchmarksEnabled]) {
+        return;
+    }
+
+    [self measureWebSocketSeriesOverLoopback:YES];
+}
+
+- (void)testSTOMPRoundTrip {
+    if (![RBKBenchmarkReport benchmarksEnabled]) {
+        return;
+    }
+
+    for (NSUInteger sizeIndex = 0; sizeIndex < sizeof(RBKBenchmarkPayloadSizes) / sizeof(RBKBenchmarkPayloadSizes[0]); sizeIndex++) {
+        NSUInteger payloadSize = RBKBenchmarkPayloadSizes[sizeIndex];
+        for (NSUInteger concurrencyIndex = 0; concurrencyIndex < sizeof(RBKBenchmarkConcurrencyLevels) / sizeof(RBKBenchmarkConcurrencyLevels[0]); concurrencyIndex++) {
+            [self measureSTOMPSeriesWithPayloadSize:payloadSize concurrency:RBKBenchmarkConcurrencyLevels[concurrencyIndex]];
+        }
+    }
+}
+
+#pragma mark - Measurement
+
+- (void)measureWebSocketSeriesOverLoopback:(BOOL)loopback {
+    NSString *prefix = loopback ? @"loopback." : @"";
+
+    for (NSUInteger sizeIndex = 0; sizeIndex < sizeof(RBKBenchmarkPayloadSizes) / sizeof(RBKBenchmarkPayloadSizes[0]); sizeIndex++) {
+        NSUInteger payloadSize = RBKBenchmarkPayloadSizes[sizeIndex];
+        NSString *textPayload = [self payloadStringOfLength:payloadSize];
+        NSData *binaryPayload = [textPayload dataUsingEncoding:NSUTF8StringEncoding];
+
+        for (NSUInteger concurrencyIndex = 0; concurrencyIndex < sizeof(RBKBenchmarkConcurrencyLevels) / sizeof(RBKBenchmarkConcurrencyLevels[0]); concurrencyIndex++) {
+            NSUInteger concurrency = RBKBenchmarkConcurrencyLevels[concurrencyIndex];
+
+            [self measureWebSocketSeriesNamed:[prefix stringByAppendingString:@"websocket.text"] frame:textPayload payloadSize:payloadSize concurrency:concurrency loopback:loopback
+                            requestSerializer:[RBKSocketStringRequestSerializer serializer] responseSerializer:[RBKSocketStringResponseSerializer serializer]];
+
+            [self measureWebSocketSeriesNamed:[prefix stringByAppendingString:@"websocket.binary"] frame:binaryPayload payloadSize:payloadSize concurrency:concurrency loopback:loopback
+                            requestSerializer:[RBKSocketDataRequestSerializer serializer] responseSerializer:[RBKSocketDataResponseSerializer serializer]];
+
+            [self measureWebSocketSeriesNamed:[prefix stringByAppendingString:@"websocket.json"] frame:@{@"payload": textPayload} payloadSize:payloadSize concurrency:concurrency loopback:loopback
+                            requestSerializer:[RBKSocketJSONRequestSerializer serializer] responseSerializer:[RBKSocketJSONResponseSerializer serializer]];
+        }
+    }
+}
+
+// Each in-flight operation gets its own connection because a socket routes every reply to its single response delegate
+- (void)measureWebSocketSeriesNamed:(NSString *)name frame:(id)frame payloadSize:(NSUInteger)payloadSize concurrency:(NSUInteger)concurrency loopback:(BOOL)loopback
+                  requestSerializer:(RBKSocketRequestSerializer <RBKSocketRequestSerialization> *)requestSerializer
+                 responseSerializer:(RBKSocketResponseSerializer <RBKSocketResponseSerialization> *)responseSerializer {
+
+    RBKBenchmarkRun *run = [[RBKBenchmarkRun alloc] init];
+    run.series = [[RBKBenchmarkSeries alloc] initWithName:name parameters:@{@"payload_bytes": @(payloadSize), @"concurrency": @(concurrency)}];
+    run.frame = frame;
+    run.iterations = [self iterationsForPayloadSize:payloadSize];
+
+    NSMutableArray *clients = [NSMutableArray array];
+    for (NSUInteger idx = 0; idx < concurrency; idx++) {
+        RBKWebSocket *client = nil;
+        if (loopback) {
+            client = [[RBKWebSocket alloc] initWithSocketURL:[NSURL URLWithString:RBKBenchmarkHostURL]];
+            [client connectToLoopbackServer:[self echoSocket]];
+        } else {
+            client = [[RBKWebSocket alloc] initWithSocketURL:[self echoSocketURL]];
+        }
+        client.requestSerializer = requestSerializer;
+        client.responseSerializer = responseSerializer;
+        [clients addObject:client];
+    }
+    [self warmUpClients:clients frame:frame];
+
+    uint64_t start = RBKMonotonicNanoseconds();
+    for (RBKWebSocket *client in clients) {
+        [self sendNextFrameOnSocket:client run:run];
+    }
+    [self waitForRun:run];
+    run.series.elapsedNanoseconds = RBKMonotonicNanoseconds() - start;
+    run.series.completedOperations = run.completedOperations;
+
+    for (RBKWebSocket *client in clients) {
+        [client closeSocket];
+    }
+    [self.report addSeries:run.series];
+}
+
+- (void)sendNextFrameOnSocket:(RBKWebSocket *)socket run:(RBKBenchmarkRun *)run {
+    if (run.issuedOperations >= run.iterations) {
+        return;
+    }
+    run.issuedOperations += 1;
+
+    uint64_t sent = RBKMonotonicNanoseconds();
+    __weak typeof(self)weakSelf = self;
+    [socket sendSocketOperationWithFrame:run.frame success:^(RBKSocketOperation *operation, id responseObject) {
+        [run.series addSample:RBKMonotonicNanoseconds() - sent];
+        run.completedOperations += 1;
+        [weakSelf sendNextFrameOnSocket:socket run:run];
+    } failure:^(RBKSocketOperation *operation, NSError *error) {
+        run.completedOperations += 1;
+        [weakSelf sendNextFrameOnSocket:socket run:run];
+    }];
+}
+
+- (void)measureSTOMPSeriesWithPayloadSize:(NSUInteger)payloadSize concurrency:(NSUInteger)concurrency {
+    RBKStompBroker *broker = [[RBKStompBroker alloc] initWithHostURL:[NSURL URLWithString:RBKBenchmarkHostURL]];
+
+    RBKBenchmarkRun *run = [[RBKBenchmarkRun alloc] init];
+    run.series = [[RBKBenchmarkSeries alloc] initWithName:@"stomp.send-message" parameters:@{@"payload_bytes": @(payloadSize), @"concurrency": @(concurrency)}];
+    run.iterations = [self iterationsForPayloadSize:payloadSize];
+    NSString *body = [self payloadStringOfLength:payloadSize];
+
+    // every client subscribes to its own destination, so each SEND comes back to its sender as a MESSAGE
+    NSMutableArray *clients = [NSMutableArray array];
+    NSMutableArray *sendTimes = [NSMutableArray array];
+    for (NSUInteger idx = 0; idx < concurrency; idx++) {
+        RBKSTOMPSocket *client = [self connectedSTOMPSocketForBroker:broker];
+        NSString *destination = [NSString stringWithFormat:@"/benchmark/%lu", (unsigned long)idx];
+        NSMutableData *sendTime = [NSMutableData dataWithLength:sizeof(uint64_t)];
+        [sendTimes addObject:sendTime];
+
+        __weak RBKSTOMPSocket *weakClient = client;
+        __weak typeof(self)weakSelf = self;
+        RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:destination headers:nil messageHandler:^(RBKStompFrame *responseFrame) {
+            // handlers run on the thread reading the socket; the run is only touched on the main queue, where it is polled
+            uint64_t received = RBKMonotonicNanoseconds();
+            dispatch_async(dispatch_get_main_queue(), ^{
+                [run.series addSample:received - *(uint64_t *)[sendTime bytes]];
+                run.completedOperations += 1;
+                [weakSelf sendNextSTOMPFrameOnSocket:weakClient destination:destination body:body sendTime:sendTime run:run];
+            });
+        }];
+        [client sendSocketOperationWithFrame:subscribeFrame];
+        [clients addObject:client];
+    }
+
+    uint64_t start = RBKMonotonicNanoseconds();
+    for (NSUInteger idx = 0; idx < concurrency; idx++) {
+        NSString *destination = [NSString stringWithFormat:@"/benchmark/%lu", (unsigned long)idx];
+        [self sendNextSTOMPFrameOnSocket:clients[idx] destination:destination body:body sendTime:sendTimes[idx] run:run];
+    }
+    [self waitForRun:run];
+    run.series.elapsedNanoseconds = RBKMonotonicNanoseconds() - start;
+    run.series.completedOperations = run.completedOperations;
+
+    for (RBKSTOMPSocket *client in clients) {
+        [client closeSocket];
+    }
+    [broker close];
+    [self.report addSeries:run.series];
+}
+
+- (void)sendNextSTOMPFrameOnSocket:(RBKSTOMPSocket *)socket destination:(NSString *)destination body:(NSString *)body sendTime:(NSMutableData *)sendTime run:(RBKBenchmarkRun *)run {
+    if (run.issuedOperations >= run.iterations) {
+        return;
+    }
+    run.issuedOperations += 1;
+
+    *(uint64_t *)[sendTime mutableBytes] = RBKMonotonicNanoseconds();
+    [socket sendSocketOperationWithFrame:[RBKStompFrame sendFrameWithDestination:destination headers:nil body:body]];
+}
+
+#pragma mark - Helpers
+
+- (NSUInteger)iterationsForPayloadSize:(NSUInteger)payloadSize {
+    // keep each series to roughly 64MB of traffic, but never fewer than 8 round trips
+    NSUInteger iterations = (64 * 1024 * 1024) / payloadSize;
+    return MAX(MIN(iterations, 2000u), 8u);
+}
+
+- (NSString *)payloadStringOfLength:(NSUInteger)length {
+    return [@"" stringByPaddingToLength:length withString:@"x" startingAtIndex:0];
+}
+
+- (SRServerSocket *)echoSocket {
+    SRServerSocket *echoSocket = [[SRServerSocket alloc] initWithURL:[NSURL URLWithString:RBKBenchmarkHostURL]];
+    echoSocket.delegate = self;
+    [self.echoSockets addObject:echoSocket];
+    return echoSocket;
+}
+
+- (NSURL *)echoSocketURL {
+    SRServerSocket *echoSocket = [self echoSocket];
+    NSString *hostWithPort = [NSString stringWithFormat:@"%@:%lu", RBKBenchmarkHostURL, (unsigned long)[echoSocket serverSocketPort]];
+    return [NSURL URLWithString:hostWithPort];
+}
+
+// one round trip per client so that connection setup is not part of the measurement
+- (void)warmUpClients:(NSArray *)clients frame:(id)frame {
+    RBKBenchmarkRun *warmUp = [[RBKBenchmarkRun alloc] init];
+    warmUp.iterations = [clients count];
+    for (RBKWebSocket *client in clients) {
+        [client sendSocketOperationWithFrame:frame success:^(RBKSocketOperation *operation, id responseObject) {
+            warmUp.completedOperations += 1;
+        } failure:^(RBKSocketOperation *operation, NSError *error) {
+            warmUp.completedOperations += 1;
+        }];
+    }
+    [self waitForRun:warmUp];
+}
+
+- (RBKSTOMPSocket *)connectedSTOMPSocketForBroker:(RBKStompBroker *)broker {
+    RBKSTOMPSocket *socket = [broker stompSocket];
+
+    RBKBenchmarkRun *connect = [[RBKBenchmarkRun alloc] init];
+    connect.iterations = 1;
+    RBKStompFrame *connectFrame = [RBKStompFrame connectFrameWithLogin:@"benchmark" passcode:@"benchmark" host:@"localhost"];
+    [socket sendSocketOperationWithFrame:connectFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        connect.completedOperations += 1;
+    } failure:^(RBKSocketOperation *operation, NSError *error) {
+        connect.completedOperations += 1;
+    }];
+    [self waitForRun:connect];
+    return socket;
+}
+
+// completion blocks are delivered on the main queue, so keep the run loop turning until the run finishes
+- (void)waitForRun:(RBKBenchmarkRun *)run {
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:RBKBenchmarkSeriesTimeout];
+    while (![run isComplete] && [timeout timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    run.series.timedOut = ![run isComplete];
+}
+
+#pragma mark - SRWebSocketDelegate
+
+- (void)webSocket:(SRWebSocket *)webSocket didReceiveMessage:(id)message {
+    // echo
+    [webSocket send:message];
+}
+
+@end
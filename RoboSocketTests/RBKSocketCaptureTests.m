@@ -0,0 +1,213 @@
+//
+//  RBKSocketCaptureTests.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#define EXP_SHORTHAND YES
+#import <Expecta/Expecta.h>
+
+#import "RBKWebSocket.h"
+#import "RBKSocketCapture.h"
+#import "RBKSocketReplay.h"
+#import <SocketRocket/SRServerSocket.h>
+#import <SocketRocket/SRWebSocket.h>
+
+@interface RBKSocketCaptureTests : XCTestCase <SRWebSocketDelegate>
+
+@property (strong, nonatomic) NSURL *captureURL;
+
+@end
+
+@implementation RBKSocketCaptureTests
+
+- (void)setUp {
+    [super setUp];
+
+    [Expecta setAsynchronousTestTimeout:5.0];
+
+    NSString *fileName = [NSString stringWithFormat:@"capture-%@.rbkcap", [[NSUUID UUID] UUIDString]];
+    self.captureURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:fileName]];
+}
+
+- (void)tearDown {
+    [[NSFileManager defaultManager] removeItemAtURL:self.captureURL error:nil];
+    [[NSFileManager defaultManager] removeItemAtURL:[self.captureURL URLByAppendingPathExtension:@"index"] error:nil];
+
+    [super tearDown];
+}
+
+- (void)testCaptureReadsBack {
+    RBKSocketCapture *capture = [[RBKSocketCapture alloc] initWithURL:self.captureURL error:nil];
+    uint8_t pingBytes[] = {1, 2, 3};
+    [capture recordMessage:@"Hello, World!" direction:RBKSocketCaptureDirectionOutbound];
+    [capture recordMessage:[@"binary" dataUsingEncoding:NSUTF8StringEncoding] direction:RBKSocketCaptureDirectionInbound];
+    [capture recordBytes:pingBytes length:sizeof(pingBytes) opcode:RBKSocketCaptureOpcodePing direction:RBKSocketCaptureDirectionOutbound];
+    expect(capture.numberOfRecords).to.equal(3);
+    [capture close];
+
+    NSError *error = nil;
+    RBKSocketCaptureReader *reader = [[RBKSocketCaptureReader alloc] initWithURL:self.captureURL error:&error];
+    expect(error).to.beNil();
+    expect(reader.numberOfRecords).to.equal(3);
+    expect([reader.startDate timeIntervalSinceNow]).to.beCloseToWithin(0, 5);
+
+    RBKSocketCaptureRecord text = [reader recordAtIndex:0];
+    expect(text.direction).to.equal(RBKSocketCaptureDirectionOutbound);
+    expect(text.opcode).to.equal(RBKSocketCaptureOpcodeText);
+    expect([reader messageForRecord:text]).to.equal(@"Hello, World!");
+
+    RBKSocketCaptureRecord binary = [reader recordAtIndex:1];
+    expect(binary.direction).to.equal(RBKSocketCaptureDirectionInbound);
+    expect(binary.opcode).to.equal(RBKSocketCaptureOpcodeBinary);
+    expect([reader messageForRecord:binary]).to.equal([@"binary" dataUsingEncoding:NSUTF8StringEncoding]);
+    expect(binary.timestamp).to.beGreaterThanOrEqualTo(text.timestamp);
+
+    RBKSocketCaptureRecord ping = [reader recordAtIndex:2];
+    expect(ping.opcode).to.equal(RBKSocketCaptureOpcodePing);
+    expect(ping.length).to.equal(3);
+    expect(memcmp(ping.bytes, pingBytes, sizeof(pingBytes))).to.equal(0);
+
+    expect([reader indexOfRecordAtTimestamp:0]).to.equal(0);
+    expect([reader indexOfRecordAtTimestamp:ping.timestamp + 1]).to.equal(3);
+}
+
+- (void)testCaptureGrowsAndReadsWithoutIndex {
+    // past both the initial 1MB capture mapping and the 8192 records of the initial index mapping
+    NSUInteger const recordCount = 10000;
+    NSString *padding = [@"" stringByPaddingToLength:300 withString:@"x" startingAtIndex:0];
+    RBKSocketCapture *capture = [[RBKSocketCapture alloc] initWithURL:self.captureURL error:nil];
+    for (NSUInteger idx = 0; idx < recordCount; idx++) {
+        [capture recordMessage:[NSString stringWithFormat:@"%lu %@", (unsigned long)idx, padding] direction:RBKSocketCaptureDirectionInbound];
+    }
+    [capture close];
+
+    RBKSocketCaptureReader *reader = [[RBKSocketCaptureReader alloc] initWithURL:self.captureURL error:nil];
+    expect(reader.numberOfRecords).to.equal(recordCount);
+    expect([reader messageForRecord:[reader recordAtIndex:recordCount - 1]]).to.equal(([NSString stringWithFormat:@"%lu %@", (unsigned long)(recordCount - 1), padding]));
+
+    // the records find themselves without the index
+    [[NSFileManager defaultManager] removeItemAtURL:[self.captureURL URLByAppendingPathExtension:@"index"] error:nil];
+    RBKSocketCaptureReader *scanningReader = [[RBKSocketCaptureReader alloc] initWithURL:self.captureURL error:nil];
+    expect(scanningReader.numberOfRecords).to.equal(recordCount);
+    expect([scanningReader messageForRecord:[scanningReader recordAtIndex:5000]]).to.equal(([NSString stringWithFormat:@"5000 %@", padding]));
+}
+
+- (void)testCorruptIndexEntryReadsAsEmptyRecord {
+    RBKSocketCapture *capture = [[RBKSocketCapture alloc] initWithURL:self.captureURL error:nil];
+    for (NSUInteger idx = 0; idx < 3; idx++) {
+        [capture recordMessage:[NSString stringWithFormat:@"message %lu", (unsigned long)idx] direction:RBKSocketCaptureDirectionInbound];
+    }
+    [capture close];
+
+    // the index still has sound ends, so the reader trusts it
+    NSURL *indexURL = [self.captureURL URLByAppendingPathExtension:@"index"];
+    NSMutableData *index = [NSMutableData dataWithContentsOfURL:indexURL];
+    uint64_t corruptOffset = UINT64_MAX - 4;
+    [index replaceBytesInRange:NSMakeRange(sizeof(uint64_t), sizeof(uint64_t)) withBytes:&corruptOffset];
+    [index writeToURL:indexURL atomically:YES];
+
+    RBKSocketCaptureReader *reader = [[RBKSocketCaptureReader alloc] initWithURL:self.captureURL error:nil];
+    expect(reader.numberOfRecords).to.equal(3);
+    RBKSocketCaptureRecord corrupt = [reader recordAtIndex:1];
+    expect(corrupt.length).to.equal(0);
+    expect(corrupt.bytes == NULL).to.beTruthy();
+    expect([reader messageForRecord:[reader recordAtIndex:2]]).to.equal(@"message 2");
+}
+
+- (void)testReaderRejectsOtherFiles {
+    [[@"not a capture, but long enough to have a header" dataUsingEncoding:NSUTF8StringEncoding] writeToURL:self.captureURL atomically:YES];
+
+    NSError *error = nil;
+    RBKSocketCaptureReader *reader = [[RBKSocketCaptureReader alloc] initWithURL:self.captureURL error:&error];
+    expect(reader).to.beNil();
+    expect(error.code).to.equal(NSFileReadCorruptFileError);
+}
+
+- (void)testWebSocketCapturesBothDirections {
+    SRServerSocket *loopbackServer = [[SRServerSocket alloc] initWithURL:[NSURL URLWithString:@"ws://localhost"]];
+    loopbackServer.delegate = self;
+    RBKWebSocket *webSocket = [[RBKWebSocket alloc] initWithSocketURL:[NSURL URLWithString:@"ws://localhost"]];
+    [webSocket connectToLoopbackServer:loopbackServer];
+    RBKSocketCapture *capture = [[RBKSocketCapture alloc] initWithURL:self.captureURL error:nil];
+    webSocket.capture = capture;
+
+    __block NSString *responseMessage = nil;
+    [webSocket sendSocketOperationWithFrame:@"Hello, World!" success:^(RBKSocketOperation *operation, id responseObject) {
+        responseMessage = responseObject;
+    } failure:nil];
+    expect(responseMessage).will.equal(@"Hello, World!");
+
+    [loopbackServer close];
+    [webSocket closeSocket];
+    [capture close];
+
+    RBKSocketCaptureReader *reader = [[RBKSocketCaptureReader alloc] initWithURL:self.captureURL error:nil];
+    expect(reader.numberOfRecords).to.equal(2);
+    expect([reader recordAtIndex:0].direction).to.equal(RBKSocketCaptureDirectionOutbound);
+    expect([reader recordAtIndex:1].direction).to.equal(RBKSocketCaptureDirectionInbound);
+    expect([reader messageForRecord:[reader recordAtIndex:1]]).to.equal(@"Hello, World!");
+}
+
+- (void)testReplayAsFastAsPossible {
+    NSUInteger const inboundCount = 500;
+    RBKSocketCapture *capture = [[RBKSocketCapture alloc] initWithURL:self.captureURL error:nil];
+    for (NSUInteger idx = 0; idx < inboundCount; idx++) {
+        [capture recordMessage:@"SUBSCRIBE" direction:RBKSocketCaptureDirectionOutbound]; // not replayed, the socket sends its own
+        [capture recordMessage:[NSString stringWithFormat:@"message %lu", (unsigned long)idx] direction:RBKSocketCaptureDirectionInbound];
+    }
+    [capture close];
+
+    RBKSocketReplay *replay = [[RBKSocketReplay alloc] initWithReader:[[RBKSocketCaptureReader alloc] initWithURL:self.captureURL error:nil]];
+    replay.preservesTiming = NO;
+    RBKWebSocket *webSocket = [[RBKWebSocket alloc] initWithSocketURL:[NSURL URLWithString:@"ws://localhost"]];
+    webSocket.metrics = [[RBKSocketMetrics alloc] init];
+    [replay connectSocket:webSocket];
+
+    __block BOOL finished = NO;
+    [replay startWithCompletion:^{
+        finished = YES;
+    }];
+    expect(finished).will.beTruthy();
+    expect(replay.numberOfReplayedMessages).to.equal(inboundCount);
+    expect([webSocket.metrics snapshot][RBKSocketMetricsFramesReceivedKey]).will.equal(inboundCount);
+
+    [replay stop];
+    [webSocket closeSocket];
+}
+
+- (void)testReplayPreservesTiming {
+    RBKSocketCapture *capture = [[RBKSocketCapture alloc] initWithURL:self.captureURL error:nil];
+    [capture recordMessage:@"first" direction:RBKSocketCaptureDirectionInbound];
+    [NSThread sleepForTimeInterval:0.4];
+    [capture recordMessage:@"second" direction:RBKSocketCaptureDirectionInbound];
+    [capture close];
+
+    RBKSocketReplay *replay = [[RBKSocketReplay alloc] initWithReader:[[RBKSocketCaptureReader alloc] initWithURL:self.captureURL error:nil]];
+    replay.speed = 2.0;
+    RBKWebSocket *webSocket = [[RBKWebSocket alloc] initWithSocketURL:[NSURL URLWithString:@"ws://localhost"]];
+    [replay connectSocket:webSocket];
+
+    __block NSDate *finishedDate = nil;
+    NSDate *startDate = [NSDate date];
+    [replay startWithCompletion:^{
+        finishedDate = [NSDate date];
+    }];
+    expect(finishedDate).willNot.beNil();
+    expect([finishedDate timeIntervalSinceDate:startDate]).to.beGreaterThanOrEqualTo(0.2);
+
+    [replay stop];
+    [webSocket closeSocket];
+}
+
+#pragma mark - SRWebSocketDelegate
+
+- (void)webSocket:(SRWebSocket *)webSocket didReceiveMessage:(id)message {
+    // echo
+    [webSocket send:message];
+}
+
+@end
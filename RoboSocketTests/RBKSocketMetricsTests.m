@@ -0,0 +1,148 @@
+//
+//  RBKSocketMetricsTests.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#define EXP_SHORTHAND YES
+#import <Expecta/Expecta.h>
+
+#import "RBKWebSocket.h"
+#import "RBKSocketMetrics.h"
+#import <SocketRocket/SRServerSocket.h>
+#import <SocketRocket/SRWebSocket.h>
+
+@interface RBKSocketMetricsTests : XCTestCase <SRWebSocketDelegate>
+
+@property (strong, nonatomic) RBKWebSocket *webSocket;
+@property (strong, nonatomic) SRServerSocket *stubSocket;
+@property (strong, nonatomic) NSURL *socketURL;
+
+@end
+
+@implementation RBKSocketMetricsTests
+
+- (void)setUp {
+    [super setUp];
+
+    NSString * const hostURL = @"ws://localhost";
+
+    [Expecta setAsynchronousTestTimeout:5.0];
+
+    self.stubSocket = [[SRServerSocket alloc] initWithURL:[NSURL URLWithString:hostURL]];
+    self.stubSocket.delegate = self;
+
+    NSString *hostWithPort = [NSString stringWithFormat:@"%@:%lu", hostURL, (unsigned long)[self.stubSocket serverSocketPort]];
+    self.socketURL = [NSURL URLWithString:hostWithPort];
+    self.webSocket = [[RBKWebSocket alloc] initWithSocketURL:self.socketURL];
+}
+
+- (void)tearDown {
+    [self.stubSocket close];
+
+    while (self.webSocket.socketOpen && [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.1]]); // don't advance until the socket has closed completely
+
+    [super tearDown];
+}
+
+- (void)testHistogramPercentiles {
+    RBKLatencyHistogram *histogram = [[RBKLatencyHistogram alloc] init];
+    for (uint64_t value = 1; value <= 1000; value++) {
+        [histogram recordValue:value * NSEC_PER_USEC];
+    }
+
+    expect(histogram.count).to.equal(1000);
+    expect(histogram.maximum).to.equal(1000 * NSEC_PER_USEC);
+    // buckets are accurate to 1/32 of the value
+    expect((double)[histogram valueAtPercentile:50]).to.beCloseToWithin(500.0 * NSEC_PER_USEC, 500.0 * NSEC_PER_USEC / 32);
+    expect((double)[histogram valueAtPercentile:99]).to.beCloseToWithin(990.0 * NSEC_PER_USEC, 990.0 * NSEC_PER_USEC / 32);
+    expect([histogram valueAtPercentile:100]).to.equal(1000 * NSEC_PER_USEC);
+
+    [histogram reset];
+    expect(histogram.count).to.equal(0);
+    expect([histogram valueAtPercentile:50]).to.equal(0);
+}
+
+- (void)testHistogramSmallValuesAreExact {
+    RBKLatencyHistogram *histogram = [[RBKLatencyHistogram alloc] init];
+    [histogram recordValue:0];
+    [histogram recordValue:7];
+    [histogram recordValue:63];
+
+    expect([histogram valueAtPercentile:0]).to.equal(0);
+    expect([histogram valueAtPercentile:50]).to.equal(7);
+    expect([histogram valueAtPercentile:100]).to.equal(63);
+}
+
+- (void)testEchoMetrics {
+    expect(self.webSocket.socketOpen).to.beFalsy(); // opens on the next turn of the main queue, so the open is counted
+    RBKSocketMetrics *metrics = [[RBKSocketMetrics alloc] init];
+    self.webSocket.metrics = metrics;
+
+    __block BOOL success = NO;
+    [self.webSocket sendSocketOperationWithFrame:@"Hello, World!" success:^(RBKSocketOperation *operation, id responseObject) {
+        success = YES;
+    } failure:nil];
+    expect(success).will.beTruthy();
+
+    NSDictionary *snapshot = [metrics snapshot];
+    expect(snapshot[RBKSocketMetricsFramesSentKey]).to.equal(1);
+    expect(snapshot[RBKSocketMetricsFramesReceivedKey]).to.equal(1);
+    expect(snapshot[RBKSocketMetricsBytesSentKey]).to.equal(13);
+    expect(snapshot[RBKSocketMetricsBytesReceivedKey]).to.equal(13);
+    expect(snapshot[RBKSocketMetricsOpcodesSentKey][RBKSocketMetricsOpcodeText]).to.equal(1);
+    expect(snapshot[RBKSocketMetricsOpensKey]).to.equal(1);
+    expect(snapshot[RBKSocketMetricsReconnectsKey]).to.equal(0);
+    expect(snapshot[RBKSocketMetricsOperationsCompletedKey]).to.equal(1);
+    expect(snapshot[RBKSocketMetricsOperationLatencyKey][@"count"]).to.equal(1);
+    expect(snapshot[RBKSocketMetricsGaugesKey][@"pending_operations"]).to.equal(0);
+    expect(snapshot[RBKSocketMetricsGaugesKey][@"output_buffer_bytes"]).toNot.beNil();
+}
+
+- (void)testControlFramesAndReconnects {
+    RBKSocketMetrics *metrics = [[RBKSocketMetrics alloc] init];
+    self.webSocket.metrics = metrics;
+
+    __block BOOL success = NO;
+    [self.webSocket sendSocketOperationWithFrame:@"ping" success:^(RBKSocketOperation *operation, id responseObject) {
+        success = YES;
+    } failure:nil];
+    expect(success).will.beTruthy();
+    expect([metrics snapshot][RBKSocketMetricsOpcodesSentKey][RBKSocketMetricsOpcodePong]).will.equal(1);
+    expect([metrics snapshot][RBKSocketMetricsOpcodesReceivedKey][RBKSocketMetricsOpcodePing]).to.equal(1);
+
+    [self.webSocket closeSocket];
+    NSDictionary *snapshot = [metrics snapshot];
+    expect(snapshot[RBKSocketMetricsOpcodesSentKey][RBKSocketMetricsOpcodeClose]).to.equal(1);
+    expect(snapshot[RBKSocketMetricsOpcodesReceivedKey][RBKSocketMetricsOpcodeClose]).to.equal(1);
+    expect(snapshot[RBKSocketMetricsReconnectsKey]).to.equal(0);
+
+    // a replacement socket sharing the metrics counts as a reconnect
+    self.webSocket = [[RBKWebSocket alloc] initWithSocketURL:self.socketURL];
+    self.webSocket.metrics = metrics;
+    success = NO;
+    [self.webSocket sendSocketOperationWithFrame:@"Hello, World!" success:^(RBKSocketOperation *operation, id responseObject) {
+        success = YES;
+    } failure:nil];
+    expect(success).will.beTruthy();
+
+    snapshot = [metrics snapshot];
+    expect(snapshot[RBKSocketMetricsOpensKey]).to.equal(2);
+    expect(snapshot[RBKSocketMetricsReconnectsKey]).to.equal(1);
+    expect(snapshot[RBKSocketMetricsOpcodesSentKey][RBKSocketMetricsOpcodeText]).to.equal(2);
+}
+
+#pragma mark - SRWebSocketDelegate
+
+- (void)webSocket:(SRWebSocket *)webSocket didReceiveMessage:(id)message {
+    if ([message isEqual:@"ping"]) {
+        [webSocket sendPing:nil];
+    }
+    // echo
+    [webSocket send:message];
+}
+
+@end
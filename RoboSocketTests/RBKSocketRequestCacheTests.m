@@ -0,0 +1,192 @@
+//
+//  RBKSocketRequestCacheTests.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#define EXP_SHORTHAND YES
+#import <Expecta/Expecta.h>
+
+#import "RBKWebSocket.h"
+#import <SocketRocket/SRServerSocket.h>
+#import <SocketRocket/SRWebSocket.h>
+
+static NSString * const RBKSocketRequestCacheTestsUnansweredFrame = @"no reply";
+
+@interface RBKSocketRequestCacheTests : XCTestCase <SRWebSocketDelegate>
+
+@property (strong, nonatomic) SRServerSocket *loopbackServer;
+@property (strong, nonatomic) RBKWebSocket *webSocket;
+@property (assign) NSUInteger numberOfReceivedMessages;
+
+@end
+
+@implementation RBKSocketRequestCacheTests
+
+- (void)setUp {
+    [super setUp];
+
+    [Expecta setAsynchronousTestTimeout:5.0];
+
+    self.loopbackServer = [[SRServerSocket alloc] initWithURL:[NSURL URLWithString:@"ws://localhost"]];
+    self.loopbackServer.delegate = self;
+    self.webSocket = [[RBKWebSocket alloc] initWithSocketURL:[NSURL URLWithString:@"ws://localhost"]];
+    [self.webSocket connectToLoopbackServer:self.loopbackServer];
+}
+
+- (void)tearDown {
+    [self.loopbackServer close];
+    [self.webSocket closeSocket];
+
+    [super tearDown];
+}
+
+- (NSString *)responseToFrame:(NSString *)frame {
+    __block NSString *responseMessage = nil;
+    [self.webSocket sendSocketOperationWithFrame:frame success:^(RBKSocketOperation *operation, id responseObject) {
+        responseMessage = responseObject;
+    } failure:nil];
+    expect(responseMessage).will.equal(frame);
+    return responseMessage;
+}
+
+- (void)testConcurrentRequestsShareOneRoundTrip {
+    RBKSocketRequestCache *requestCache = [RBKSocketRequestCache cacheWithCapacity:10 timeToLive:0];
+    self.webSocket.requestCache = requestCache;
+
+    NSUInteger const requestCount = 10;
+    NSMutableArray *responses = [NSMutableArray array];
+    NSMutableSet *operations = [NSMutableSet set];
+    for (NSUInteger idx = 0; idx < requestCount; idx++) {
+        RBKSocketOperation *operation = [self.webSocket sendSocketOperationWithFrame:@"quote GOOG" success:^(RBKSocketOperation *operation, id responseObject) {
+            [responses addObject:responseObject];
+        } failure:nil];
+        [operations addObject:operation];
+    }
+    expect([responses count]).will.equal(requestCount);
+    expect([responses lastObject]).to.equal(@"quote GOOG");
+    expect(operations).to.haveCountOf(requestCount); // each caller has its own, though only one was sent
+    expect(self.numberOfReceivedMessages).to.equal(1);
+    expect(requestCache.numberOfCoalescedRequests).to.equal(requestCount - 1);
+
+    // nothing is cached without a time to live
+    [self responseToFrame:@"quote GOOG"];
+    expect(self.numberOfReceivedMessages).to.equal(2);
+    expect(requestCache.numberOfResponses).to.equal(0);
+}
+
+- (void)testResponsesExpire {
+    RBKVirtualClock *clock = [[RBKVirtualClock alloc] initWithTime:0];
+    RBKSocketRequestCache *requestCache = [RBKSocketRequestCache cacheWithCapacity:10 timeToLive:10];
+    requestCache.clock = clock;
+    self.webSocket.requestCache = requestCache;
+
+    [self responseToFrame:@"quote GOOG"];
+    [clock advanceByInterval:5];
+    [self responseToFrame:@"quote GOOG"];
+    expect(self.numberOfReceivedMessages).to.equal(1);
+    expect(requestCache.numberOfHits).to.equal(1);
+
+    [clock advanceByInterval:6];
+    [self responseToFrame:@"quote GOOG"];
+    expect(self.numberOfReceivedMessages).to.equal(2);
+}
+
+- (void)testLeastRecentlyUsedResponseIsEvicted {
+    RBKSocketRequestCache *requestCache = [RBKSocketRequestCache cacheWithCapacity:2 timeToLive:60];
+    self.webSocket.requestCache = requestCache;
+
+    [self responseToFrame:@"quote GOOG"];
+    [self responseToFrame:@"quote AAPL"];
+    [self responseToFrame:@"quote GOOG"];
+    [self responseToFrame:@"quote MSFT"];
+    expect(self.numberOfReceivedMessages).to.equal(3);
+    expect(requestCache.numberOfResponses).to.equal(2);
+
+    [self responseToFrame:@"quote GOOG"];
+    expect(self.numberOfReceivedMessages).to.equal(3);
+    [self responseToFrame:@"quote AAPL"];
+    expect(self.numberOfReceivedMessages).to.equal(4);
+}
+
+- (void)testFailuresAreSharedButNotCached {
+    RBKSocketRequestCache *requestCache = [RBKSocketRequestCache cacheWithCapacity:10 timeToLive:60];
+    self.webSocket.requestCache = requestCache;
+    self.webSocket.operationTimeoutInterval = 0.3;
+
+    __block NSUInteger failureCount = 0;
+    for (NSUInteger idx = 0; idx < 3; idx++) {
+        [self.webSocket sendSocketOperationWithFrame:RBKSocketRequestCacheTestsUnansweredFrame success:nil failure:^(RBKSocketOperation *operation, NSError *error) {
+            failureCount += error.code == NSURLErrorTimedOut ? 1 : 0;
+        }];
+    }
+    expect(failureCount).will.equal(3);
+    expect(self.numberOfReceivedMessages).to.equal(1);
+    expect(requestCache.numberOfResponses).to.equal(0);
+
+    __block BOOL failed = NO;
+    [self.webSocket sendSocketOperationWithFrame:RBKSocketRequestCacheTestsUnansweredFrame success:nil failure:^(RBKSocketOperation *operation, NSError *error) {
+        failed = YES;
+    }];
+    expect(failed).will.beTruthy();
+    expect(self.numberOfReceivedMessages).to.equal(2);
+}
+
+- (void)testCancellingOneCallerLeavesTheOthersWaiting {
+    RBKSocketRequestCache *requestCache = [RBKSocketRequestCache cacheWithCapacity:10 timeToLive:0];
+    self.webSocket.requestCache = requestCache;
+
+    NSMutableArray *responses = [NSMutableArray array];
+    __block NSUInteger cancelCount = 0;
+    void (^failure)(RBKSocketOperation *, NSError *) = ^(RBKSocketOperation *operation, NSError *error) {
+        cancelCount += error.code == NSURLErrorCancelled ? 1 : 0;
+    };
+    RBKSocketOperation *firstOperation = [self.webSocket sendSocketOperationWithFrame:@"quote GOOG" success:^(RBKSocketOperation *operation, id responseObject) {
+        [responses addObject:responseObject];
+    } failure:failure];
+    RBKSocketOperation *secondOperation = [self.webSocket sendSocketOperationWithFrame:@"quote GOOG" success:^(RBKSocketOperation *operation, id responseObject) {
+        [responses addObject:responseObject];
+    } failure:failure];
+    [self.webSocket sendSocketOperationWithFrame:@"quote GOOG" success:^(RBKSocketOperation *operation, id responseObject) {
+        [responses addObject:responseObject];
+    } failure:failure];
+
+    // both the caller whose request went out and one waiting on it
+    [firstOperation cancel];
+    [secondOperation cancel];
+    expect(cancelCount).will.equal(2);
+    expect(responses).will.equal(@[@"quote GOOG"]);
+    expect(self.numberOfReceivedMessages).to.equal(1);
+}
+
+- (void)testKeyBlockChoosesWhatIsShared {
+    RBKSocketRequestCache *requestCache = [RBKSocketRequestCache cacheWithCapacity:10 timeToLive:60];
+    requestCache.keyBlock = ^id<NSCopying>(id requestFrame) {
+        return [requestFrame hasPrefix:@"quote "] ? requestFrame : nil;
+    };
+    self.webSocket.requestCache = requestCache;
+
+    [self responseToFrame:@"order GOOG"];
+    [self responseToFrame:@"order GOOG"];
+    expect(self.numberOfReceivedMessages).to.equal(2);
+
+    [self responseToFrame:@"quote GOOG"];
+    [self responseToFrame:@"quote GOOG"];
+    expect(self.numberOfReceivedMessages).to.equal(3);
+}
+
+#pragma mark - SRWebSocketDelegate
+
+- (void)webSocket:(SRWebSocket *)webSocket didReceiveMessage:(id)message {
+    self.numberOfReceivedMessages += 1;
+    if ([message isEqual:RBKSocketRequestCacheTestsUnansweredFrame]) {
+        return;
+    }
+    // echo
+    [webSocket send:message];
+}
+
+@end
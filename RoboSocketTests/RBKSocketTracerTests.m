@@ -0,0 +1,95 @@
+//
+//  RBKSocketTracerTests.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#define EXP_SHORTHAND YES
+#import <Expecta/Expecta.h>
+
+#import "RBKWebSocket.h"
+#import "RBKSocketTracer.h"
+#import <SocketRocket/SRServerSocket.h>
+#import <SocketRocket/SRWebSocket.h>
+
+@interface RBKSocketTracerTests : XCTestCase <SRWebSocketDelegate>
+
+@property (strong, nonatomic) RBKWebSocket *webSocket;
+@property (strong, nonatomic) SRServerSocket *stubSocket;
+
+@end
+
+@implementation RBKSocketTracerTests
+
+- (void)setUp {
+    [super setUp];
+
+    NSString * const hostURL = @"ws://localhost";
+
+    [Expecta setAsynchronousTestTimeout:5.0];
+
+    self.stubSocket = [[SRServerSocket alloc] initWithURL:[NSURL URLWithString:hostURL]];
+    self.stubSocket.delegate = self;
+
+    NSString *hostWithPort = [NSString stringWithFormat:@"%@:%lu", hostURL, (unsigned long)[self.stubSocket serverSocketPort]];
+    self.webSocket = [[RBKWebSocket alloc] initWithSocketURL:[NSURL URLWithString:hostWithPort]];
+}
+
+- (void)tearDown {
+    [self.stubSocket close];
+
+    while (self.webSocket.socketOpen && [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.1]]); // don't advance until the socket has closed completely
+
+    [super tearDown];
+}
+
+- (void)testRingBufferKeepsNewestEvents {
+    RBKSocketTracer *tracer = [[RBKSocketTracer alloc] initWithCapacity:4];
+    for (uint64_t traceIdentifier = 1; traceIdentifier <= 6; traceIdentifier++) {
+        [tracer recordStage:RBKSocketTraceStageEnqueue traceIdentifier:traceIdentifier];
+    }
+
+    NSArray *events = [tracer events];
+    expect(events).to.haveCountOf(4);
+    expect([events firstObject][@"trace_id"]).to.equal(3);
+    expect([events lastObject][@"trace_id"]).to.equal(6);
+}
+
+- (void)testEchoOperationStages {
+    RBKSocketTracer *tracer = [[RBKSocketTracer alloc] init];
+    self.webSocket.tracer = tracer;
+
+    __block BOOL success = NO;
+    [self.webSocket sendSocketOperationWithFrame:@"Hello, World!" success:^(RBKSocketOperation *operation, id responseObject) {
+        success = YES;
+    } failure:nil];
+    expect(success).will.beTruthy();
+
+    NSMutableArray *operationStages = [NSMutableArray array];
+    NSMutableSet *frameStages = [NSMutableSet set];
+    for (NSDictionary *event in [tracer events]) {
+        if ([event[@"trace_id"] unsignedLongLongValue] == 0) {
+            [frameStages addObject:event[@"stage"]];
+        } else {
+            [operationStages addObject:event[@"stage"]];
+        }
+    }
+    expect(operationStages).to.equal(@[@(RBKSocketTraceStageEnqueue), @(RBKSocketTraceStageSerialize), @(RBKSocketTraceStageNetworkThread), @(RBKSocketTraceStageReceive), @(RBKSocketTraceStageParse), @(RBKSocketTraceStageDispatch), @(RBKSocketTraceStageCallback)]);
+    expect([frameStages containsObject:@(RBKSocketTraceStageWrite)]).to.beTruthy();
+    expect([frameStages containsObject:@(RBKSocketTraceStageDecode)]).to.beTruthy();
+
+    NSDictionary *chromeTrace = [NSJSONSerialization JSONObjectWithData:[tracer chromeTraceData] options:0 error:nil];
+    expect(chromeTrace[@"traceEvents"]).toNot.beEmpty();
+}
+
+#pragma mark - SRWebSocketDelegate
+
+- (void)webSocket:(SRWebSocket *)webSocket didReceiveMessage:(id)message {
+    // echo
+    [webSocket send:message];
+}
+
+@end
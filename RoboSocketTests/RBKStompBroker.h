@@ -0,0 +1,97 @@
+//
+//  RBKStompBroker.h
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "RBKStompFrame.h"
+#import "RBKClock.h"
+
+@class RBKSTOMPSocket;
+
+/**
+ `RBKStompBroker` is an in-process STOMP 1.2 broker built on `SRServerSocket`. It is intended as a stand-in for a real broker in integration tests and benchmarks.
+
+ Each call to `connectionURL` opens a new listening endpoint that accepts a single client. Messages sent by any client are fanned out to every matching subscription on every connection.
+
+ Supported:
+ - CONNECT/STOMP with heart-beat negotiation
+ - SUBSCRIBE/UNSUBSCRIBE, with `*` (one path segment) and `>` (remaining segments) wildcards on `/` or `.` separated destinations
+ - SEND fan-out
+ - ACK/NACK for `client` and `client-individual` subscriptions, with redelivery on NACK
+ - receipts on any client frame
+ - BEGIN/COMMIT/ABORT transactions covering SEND, ACK and NACK
+ */
+@interface RBKStompBroker : NSObject
+
+/**
+ The heart-beat the broker offers during CONNECT negotiation, in milliseconds. `RBKStompHeartbeatZero` by default.
+ */
+@property (assign, nonatomic) RBKStompHeartbeat heartbeat;
+
+/**
+ Times the broker's heart-beats, sent and expected. `RBKSystemClock` by default; share a `RBKVirtualClock` with the client to run heart-beat scenarios faster than real time. Message delivery pacing stays on real time.
+ */
+@property (strong, nonatomic) id<RBKClock> clock;
+
+/**
+ Extra time added before each MESSAGE is delivered, in seconds. `0` by default.
+ */
+@property (assign, nonatomic) NSTimeInterval deliveryLatency;
+
+/**
+ The maximum number of MESSAGE frames delivered per second across all connections. `0` (default) means unlimited.
+ */
+@property (assign, nonatomic) NSUInteger maximumDeliveryRate;
+
+/**
+ The number of times a NACK'd message is redelivered before it is dropped. `3` by default.
+ */
+@property (assign, nonatomic) NSUInteger maximumRedeliveries;
+
+/**
+ WebSocket messages received. A message may carry several frames, so this can be less than `numberOfReceivedFrames`.
+ */
+@property (readonly, nonatomic) NSUInteger numberOfReceivedMessages;
+@property (readonly, nonatomic) NSUInteger numberOfReceivedFrames;
+@property (readonly, nonatomic) NSUInteger numberOfDeliveredMessages;
+@property (readonly, nonatomic) NSUInteger numberOfRedeliveredMessages;
+/**
+ Messages taken off a subscription by an ACK, counting each message a cumulative `client` ACK covers.
+ */
+@property (readonly, nonatomic) NSUInteger numberOfAcknowledgedMessages;
+@property (readonly, nonatomic) NSUInteger numberOfSentHeartbeats;
+
+- (instancetype)initWithHostURL:(NSURL *)hostURL;
+
+/**
+ Opens a new listening endpoint and returns the URL a client should connect to. Each endpoint accepts one client connection, and its client can only ACK or NACK the messages delivered to it.
+
+ This and `close` may be called from any thread, including from a broker callback.
+ */
+- (NSURL *)connectionURL;
+
+/**
+ A client socket for a new endpoint, made by `+stompSocketWithURL:`.
+ */
+- (RBKSTOMPSocket *)stompSocket;
+
+/**
+ A client socket for `socketURL` with the STOMP serializers installed, both reporting to the socket. Nothing is sent; CONNECT is up to the caller.
+ */
++ (RBKSTOMPSocket *)stompSocketWithURL:(NSURL *)socketURL;
+
+/**
+ Delivers a MESSAGE to every subscription matching `destination`, as though a client had sent it. A `message-id` in `headers` is kept, so a test can send a message again the way a broker does after a reconnect.
+ */
+- (void)publishMessageWithDestination:(NSString *)destination headers:(NSDictionary *)headers body:(NSString *)body;
+
+/**
+ Closes every endpoint and discards all broker state.
+ */
+- (void)close;
+
+@end
@@ -0,0 +1,596 @@
+//
+//  RBKStompBroker.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import "RBKStompBroker.h"
+#import "RBKSTOMPSocket.h"
+
+#import <SocketRocket/SRServerSocket.h>
+#import <SocketRocket/SRWebSocket.h>
+
+static NSString * const RBKStompBrokerHeaderRedelivered = @"redelivered";
+
+static void * const RBKStompBrokerQueueKey = (void *)&RBKStompBrokerQueueKey;
+
+@class RBKStompBrokerConnection;
+
+#pragma mark - RBKStompBrokerSubscription
+
+@interface RBKStompBrokerSubscription : NSObject
+
+@property (strong, nonatomic) NSString *identifier;
+@property (strong, nonatomic) NSString *destination;
+@property (strong, nonatomic) NSString *acknowledgeMode;
+@property (weak, nonatomic) RBKStompBrokerConnection *connection;
+@property (strong, nonatomic) NSMutableArray *unacknowledgedMessages; // in delivery order, used for cumulative client acks
+
+- (BOOL)requiresAcknowledgement;
+- (BOOL)matchesDestination:(NSString *)destination;
+
+@end
+
+#pragma mark - RBKStompBrokerMessage
+
+@interface RBKStompBrokerMessage : NSObject
+
+@property (strong, nonatomic) NSString *messageID;
+@property (strong, nonatomic) NSString *destination;
+@property (strong, nonatomic) NSDictionary *headers;
+@property (strong, nonatomic) NSString *body;
+@property (weak, nonatomic) RBKStompBrokerSubscription *subscription;
+@property (assign, nonatomic) NSUInteger redeliveryCount;
+
+@end
+
+@implementation RBKStompBrokerMessage
+@end
+
+#pragma mark - RBKStompBrokerConnection
+
+@interface RBKStompBrokerConnection : NSObject <SRWebSocketDelegate>
+
+@property (weak, nonatomic) RBKStompBroker *broker;
+@property (strong, nonatomic) SRServerSocket *socket;
+@property (strong, nonatomic) NSMutableDictionary *subscriptions; // subscription ID -> RBKStompBrokerSubscription
+@property (strong, nonatomic) NSMutableDictionary *transactions; // transaction ID -> NSMutableArray of RBKStompFrame
+@property (strong, nonatomic) NSMutableDictionary *unacknowledgedMessages; // ack ID -> RBKStompBrokerMessage, so a client can only acknowledge its own messages
+@property (assign, nonatomic, getter = isOpen) BOOL open;
+@property (assign, nonatomic, getter = isConnected) BOOL connected;
+
+@property (assign, nonatomic) NSTimeInterval outgoingHeartbeatInterval;
+@property (assign, nonatomic) NSTimeInterval incomingHeartbeatInterval;
+@property (assign, nonatomic) NSTimeInterval mostRecentSendTime;
+@property (assign, nonatomic) NSTimeInterval mostRecentReceiveTime;
+@property (strong, nonatomic) id<RBKClockTimer> heartbeatTimer;
+@property (assign, nonatomic) uint64_t heartbeatTick; // nanoseconds on the broker's clock
+
+- (void)sendFrame:(RBKStompFrame *)frame;
+- (void)close;
+
+@end
+
+
+@interface RBKStompBroker ()
+
+@property (strong, nonatomic) NSURL *hostURL;
+@property (strong, nonatomic) dispatch_queue_t brokerQueue;
+@property (strong, nonatomic) NSMutableArray *connections;
+@property (assign, nonatomic) NSUInteger messageCounter;
+@property (assign, nonatomic) NSTimeInterval nextDeliveryTime;
+
+@property (readwrite, nonatomic) NSUInteger numberOfReceivedMessages;
+@property (readwrite, nonatomic) NSUInteger numberOfReceivedFrames;
+@property (readwrite, nonatomic) NSUInteger numberOfDeliveredMessages;
+@property (readwrite, nonatomic) NSUInteger numberOfRedeliveredMessages;
+@property (readwrite, nonatomic) NSUInteger numberOfAcknowledgedMessages;
+@property (readwrite, nonatomic) NSUInteger numberOfSentHeartbeats;
+
+- (void)connection:(RBKStompBrokerConnection *)connection didReceiveFrames:(NSArray *)frames;
+- (void)connectionDidClose:(RBKStompBrokerConnection *)connection;
+- (void)heartbeatTimerFiredForConnection:(RBKStompBrokerConnection *)connection;
+
+@end
+
+
+@implementation RBKStompBrokerSubscription
+
+- (BOOL)requiresAcknowledgement {
+    return [self.acknowledgeMode isEqualToString:RBKStompAckClient] || [self.acknowledgeMode isEqualToString:RBKStompAckClientIndividual];
+}
+
+- (BOOL)matchesDestination:(NSString *)destination {
+    if ([self.destination isEqualToString:destination]) {
+        return YES;
+    }
+
+    NSCharacterSet *separators = [NSCharacterSet characterSetWithCharactersInString:@"/."];
+    NSArray *patternSegments = [self.destination componentsSeparatedByCharactersInSet:separators];
+    NSArray *destinationSegments = [destination componentsSeparatedByCharactersInSet:separators];
+
+    for (NSUInteger idx = 0; idx < [patternSegments count]; idx++) {
+        NSString *patternSegment = patternSegments[idx];
+        if ([patternSegment isEqualToString:@">"]) {
+            return [destinationSegments count] > idx; // matches one or more remaining segments
+        }
+        if (idx >= [destinationSegments count]) {
+            return NO;
+        }
+        if (![patternSegment isEqualToString:@"*"] && ![patternSegment isEqualToString:destinationSegments[idx]]) {
+            return NO;
+        }
+    }
+    return [patternSegments count] == [destinationSegments count];
+}
+
+@end
+
+
+@implementation RBKStompBrokerConnection
+
+- (void)sendFrame:(RBKStompFrame *)frame {
+    if (!self.isOpen) {
+        return;
+    }
+    self.mostRecentSendTime = [self.broker.clock now] / (double)NSEC_PER_SEC;
+    [self.socket send:[frame frameData]];
+}
+
+- (void)close {
+    [self.heartbeatTimer cancel];
+    self.heartbeatTimer = nil;
+    self.connected = NO;
+    [self.socket close];
+}
+
+#pragma mark - SRWebSocketDelegate
+
+- (void)webSocket:(SRWebSocket *)webSocket didReceiveMessage:(id)message {
+    if ([message isKindOfClass:[NSString class]]) {
+        message = [message dataUsingEncoding:NSUTF8StringEncoding];
+    }
+    // a single message may carry several frames, e.g. a whole transaction
+    [self.broker connection:self didReceiveFrames:[RBKStompFrame responseFramesFromData:message]];
+}
+
+- (void)webSocketDidOpen:(SRWebSocket *)webSocket {
+    self.open = YES;
+}
+
+- (void)webSocket:(SRWebSocket *)webSocket didFailWithError:(NSError *)error {
+    self.open = NO;
+    [self.broker connectionDidClose:self];
+}
+
+- (void)webSocket:(SRWebSocket *)webSocket didCloseWithCode:(NSInteger)code reason:(NSString *)reason wasClean:(BOOL)wasClean {
+    self.open = NO;
+    [self.broker connectionDidClose:self];
+}
+
+@end
+
+
+@implementation RBKStompBroker
+
+- (instancetype)init {
+    @throw [NSException exceptionWithName:NSInternalInconsistencyException reason:[NSString stringWithFormat:@"%@ Failed to call designated initializer. Invoke `initWithHostURL:` instead.", NSStringFromClass([self class])] userInfo:nil];
+}
+
+- (instancetype)initWithHostURL:(NSURL *)hostURL {
+    self = [super init];
+    if (self) {
+        _hostURL = hostURL;
+        _brokerQueue = dispatch_queue_create("com.robotsandpencils.networking.stomp.broker", DISPATCH_QUEUE_SERIAL);
+        dispatch_queue_set_specific(_brokerQueue, RBKStompBrokerQueueKey, (__bridge void *)self, NULL);
+        _connections = [NSMutableArray array];
+        _heartbeat = RBKStompHeartbeatZero;
+        _clock = [RBKSystemClock sharedClock];
+        _maximumRedeliveries = 3;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    for (RBKStompBrokerConnection *connection in _connections) {
+        [connection close];
+    }
+}
+
+- (NSURL *)connectionURL {
+    RBKStompBrokerConnection *connection = [[RBKStompBrokerConnection alloc] init];
+    connection.broker = self;
+    connection.subscriptions = [NSMutableDictionary dictionary];
+    connection.transactions = [NSMutableDictionary dictionary];
+    connection.unacknowledgedMessages = [NSMutableDictionary dictionary];
+    connection.socket = [[SRServerSocket alloc] initWithURL:self.hostURL];
+    [connection.socket setDelegateDispatchQueue:self.brokerQueue];
+    connection.socket.delegate = connection;
+
+    [self performBlockOnBrokerQueueAndWait:^{
+        [self.connections addObject:connection];
+    }];
+
+    NSString *hostWithPort = [NSString stringWithFormat:@"%@:%lu", [self.hostURL absoluteString], (unsigned long)[connection.socket serverSocketPort]];
+    return [NSURL URLWithString:hostWithPort];
+}
+
+- (RBKSTOMPSocket *)stompSocket {
+    return [[self class] stompSocketWithURL:[self connectionURL]];
+}
+
++ (RBKSTOMPSocket *)stompSocketWithURL:(NSURL *)socketURL {
+    RBKSTOMPSocket *stompSocket = [[RBKSTOMPSocket alloc] initWithSocketURL:socketURL];
+    stompSocket.requestSerializer = [RBKSocketStompRequestSerializer serializer];
+    RBKSocketStompRequestSerializer *requestSerializer = (id)stompSocket.requestSerializer;
+    requestSerializer.delegate = stompSocket;
+    stompSocket.responseSerializer = [RBKSocketStompResponseSerializer serializer];
+    RBKSocketStompResponseSerializer *responseSerializer = (id)stompSocket.responseSerializer;
+    responseSerializer.delegate = stompSocket;
+    return stompSocket;
+}
+
+- (void)publishMessageWithDestination:(NSString *)destination headers:(NSDictionary *)headers body:(NSString *)body {
+    dispatch_async(self.brokerQueue, ^{
+        [self routeMessageWithDestination:destination headers:headers body:body];
+    });
+}
+
+- (void)close {
+    [self performBlockOnBrokerQueueAndWait:^{
+        for (RBKStompBrokerConnection *connection in self.connections) {
+            [connection close];
+            [connection.unacknowledgedMessages removeAllObjects];
+        }
+        [self.connections removeAllObjects];
+    }];
+}
+
+// runs `block` right away when already on the broker queue, e.g. from a delegate callback, rather than deadlocking
+- (void)performBlockOnBrokerQueueAndWait:(dispatch_block_t)block {
+    if (dispatch_get_specific(RBKStompBrokerQueueKey) == (__bridge void *)self) {
+        block();
+    } else {
+        dispatch_sync(self.brokerQueue, block);
+    }
+}
+
+#pragma mark - Connection Events
+
+- (void)connection:(RBKStompBrokerConnection *)connection didReceiveFrames:(NSArray *)frames {
+    self.numberOfReceivedMessages += 1;
+    for (RBKStompFrame *frame in frames) {
+        [self connection:connection didReceiveFrame:frame];
+    }
+}
+
+- (void)connection:(RBKStompBrokerConnection *)connection didReceiveFrame:(RBKStompFrame *)frame {
+    self.numberOfReceivedFrames += 1;
+    connection.mostRecentReceiveTime = [self.clock now] / (double)NSEC_PER_SEC;
+
+    NSString *command = frame.command;
+    if ([command length] == 0 || [command isEqualToString:RBKStompCommandHeartbeat]) {
+        return; // any frame counts as a heartbeat, so there is nothing more to do
+    }
+
+    if ([command isEqualToString:RBKStompCommandConnect] || [command isEqualToString:RBKStompCommandStompConnect]) {
+        [self handleConnectFrame:frame connection:connection];
+        return;
+    }
+
+    if (!connection.isConnected) {
+        [self sendErrorMessage:@"Not connected" forFrame:frame connection:connection];
+        return;
+    }
+
+    NSString *errorMessage = nil;
+    NSString *transactionID = [frame headerValueForKey:RBKStompHeaderTransaction];
+
+    if ([command isEqualToString:RBKStompCommandSubscribe]) {
+        errorMessage = [self handleSubscribeFrame:frame connection:connection];
+    } else if ([command isEqualToString:RBKStompCommandUnsubscribe]) {
+        errorMessage = [self handleUnsubscribeFrame:frame connection:connection];
+    } else if ([command isEqualToString:RBKStompCommandSend] || [command isEqualToString:RBKStompCommandAck] || [command isEqualToString:RBKStompCommandNack]) {
+        if (transactionID) {
+            NSMutableArray *transaction = connection.transactions[transactionID];
+            if (transaction) {
+                [transaction addObject:frame];
+            } else {
+                errorMessage = [NSString stringWithFormat:@"Unknown transaction %@", transactionID];
+            }
+        } else {
+            errorMessage = [self applyFrame:frame connection:connection];
+        }
+    } else if ([command isEqualToString:RBKStompCommandBegin]) {
+        if (!transactionID || connection.transactions[transactionID]) {
+            errorMessage = @"Invalid transaction";
+        } else {
+            connection.transactions[transactionID] = [NSMutableArray array];
+        }
+    } else if ([command isEqualToString:RBKStompCommandCommit]) {
+        NSArray *transaction = connection.transactions[transactionID];
+        if (transaction) {
+            [connection.transactions removeObjectForKey:transactionID];
+            for (RBKStompFrame *transactedFrame in transaction) {
+                errorMessage = [self applyFrame:transactedFrame connection:connection];
+                if (errorMessage) {
+                    break;
+                }
+            }
+        } else {
+            errorMessage = [NSString stringWithFormat:@"Unknown transaction %@", transactionID];
+        }
+    } else if ([command isEqualToString:RBKStompCommandAbort]) {
+        if (connection.transactions[transactionID]) {
+            [connection.transactions removeObjectForKey:transactionID];
+        } else {
+            errorMessage = [NSString stringWithFormat:@"Unknown transaction %@", transactionID];
+        }
+    } else if ([command isEqualToString:RBKStompCommandDisconnect]) {
+        [self sendReceiptForFrame:frame connection:connection];
+        [connection close];
+        return;
+    } else {
+        errorMessage = [NSString stringWithFormat:@"Unsupported command %@", command];
+    }
+
+    if (errorMessage) {
+        [self sendErrorMessage:errorMessage forFrame:frame connection:connection];
+    } else {
+        [self sendReceiptForFrame:frame connection:connection];
+    }
+}
+
+- (void)connectionDidClose:(RBKStompBrokerConnection *)connection {
+    [connection.heartbeatTimer cancel];
+    connection.heartbeatTimer = nil;
+    connection.connected = NO;
+
+    // unacknowledged messages for this connection are not redelivered elsewhere, they are simply dropped
+    for (RBKStompBrokerSubscription *subscription in [connection.subscriptions allValues]) {
+        [self removeSubscription:subscription];
+    }
+    [connection.subscriptions removeAllObjects];
+    [connection.transactions removeAllObjects];
+}
+
+#pragma mark - Frame Handling
+
+- (void)handleConnectFrame:(RBKStompFrame *)frame connection:(RBKStompBrokerConnection *)connection {
+    NSString *acceptedVersions = [frame headerValueForKey:RBKStompHeaderAcceptVersion];
+    if (acceptedVersions && ![[acceptedVersions componentsSeparatedByString:@","] containsObject:RBKStompVersion1_2]) {
+        [self sendErrorMessage:@"Supported protocol versions are 1.2" forFrame:frame connection:connection];
+        return;
+    }
+
+    // the client offers cx,cy and we offer sx,sy; each direction is the larger of the two, or off if either side is 0
+    RBKStompHeartbeat clientHeartbeat = RBKStompHeartbeatZero;
+    NSString *heartbeatString = [frame headerValueForKey:RBKStompHeaderHeartBeat];
+    if (heartbeatString) {
+        clientHeartbeat = RBKStompHeartbeatFromString(heartbeatString);
+    }
+    RBKStompHeartbeat serverHeartbeat = self.heartbeat;
+
+    NSUInteger outgoing = 0;
+    if (serverHeartbeat.supportedTransmitIntervalMinimum > 0 && clientHeartbeat.desiredReceptionIntervalMinimum > 0) {
+        outgoing = MAX(serverHeartbeat.supportedTransmitIntervalMinimum, clientHeartbeat.desiredReceptionIntervalMinimum);
+    }
+    NSUInteger incoming = 0;
+    if (clientHeartbeat.supportedTransmitIntervalMinimum > 0 && serverHeartbeat.desiredReceptionIntervalMinimum > 0) {
+        incoming = MAX(clientHeartbeat.supportedTransmitIntervalMinimum, serverHeartbeat.desiredReceptionIntervalMinimum);
+    }
+
+    connection.connected = YES;
+    connection.outgoingHeartbeatInterval = outgoing / 1000.0;
+    connection.incomingHeartbeatInterval = incoming / 1000.0;
+
+    [connection sendFrame:[RBKStompFrame connectedFrameWithVersion:RBKStompVersion1_2 heartbeat:serverHeartbeat]];
+    [self scheduleHeartbeatTimerForConnection:connection];
+}
+
+- (NSString *)handleSubscribeFrame:(RBKStompFrame *)frame connection:(RBKStompBrokerConnection *)connection {
+    NSString *identifier = [frame headerValueForKey:RBKStompHeaderID];
+    NSString *destination = [frame headerValueForKey:RBKStompHeaderDestination];
+    if (!identifier || !destination) {
+        return @"SUBSCRIBE requires id and destination headers";
+    }
+    if (connection.subscriptions[identifier]) {
+        return [NSString stringWithFormat:@"Duplicate subscription %@", identifier];
+    }
+
+    RBKStompBrokerSubscription *subscription = [[RBKStompBrokerSubscription alloc] init];
+    subscription.identifier = identifier;
+    subscription.destination = destination;
+    subscription.acknowledgeMode = [frame headerValueForKey:RBKStompHeaderAck] ?: RBKStompAckAuto;
+    subscription.connection = connection;
+    subscription.unacknowledgedMessages = [NSMutableArray array];
+    connection.subscriptions[identifier] = subscription;
+    return nil;
+}
+
+- (NSString *)handleUnsubscribeFrame:(RBKStompFrame *)frame connection:(RBKStompBrokerConnection *)connection {
+    NSString *identifier = [frame headerValueForKey:RBKStompHeaderID];
+    RBKStompBrokerSubscription *subscription = connection.subscriptions[identifier];
+    if (!subscription) {
+        return [NSString stringWithFormat:@"Unknown subscription %@", identifier];
+    }
+    [self removeSubscription:subscription];
+    [connection.subscriptions removeObjectForKey:identifier];
+    return nil;
+}
+
+// SEND, ACK and NACK, either directly or as part of a COMMIT
+- (NSString *)applyFrame:(RBKStompFrame *)frame connection:(RBKStompBrokerConnection *)connection {
+    NSString *command = frame.command;
+
+    if ([command isEqualToString:RBKStompCommandSend]) {
+        NSString *destination = [frame headerValueForKey:RBKStompHeaderDestination];
+        if (!destination) {
+            return @"SEND requires a destination header";
+        }
+        NSMutableDictionary *headers = [frame.headers mutableCopy];
+        [headers removeObjectsForKeys:@[RBKStompHeaderReceipt, RBKStompHeaderTransaction, RBKStompHeaderContentLength]];
+        [self routeMessageWithDestination:destination headers:headers body:[frame bodyValue]];
+        return nil;
+    }
+
+    NSString *ackID = [frame headerValueForKey:RBKStompHeaderID];
+    RBKStompBrokerMessage *message = connection.unacknowledgedMessages[ackID];
+    if (!message) {
+        return [NSString stringWithFormat:@"Unknown message %@", ackID];
+    }
+
+    // in client mode an ACK or NACK also covers every earlier message on the subscription
+    RBKStompBrokerSubscription *subscription = message.subscription;
+    NSArray *affectedMessages = @[message];
+    if ([subscription.acknowledgeMode isEqualToString:RBKStompAckClient]) {
+        NSUInteger index = [subscription.unacknowledgedMessages indexOfObjectIdenticalTo:message];
+        if (index != NSNotFound) {
+            affectedMessages = [subscription.unacknowledgedMessages subarrayWithRange:NSMakeRange(0, index + 1)];
+        }
+    }
+
+    for (RBKStompBrokerMessage *affectedMessage in affectedMessages) {
+        [subscription.unacknowledgedMessages removeObjectIdenticalTo:affectedMessage];
+        [connection.unacknowledgedMessages removeObjectForKey:affectedMessage.messageID];
+
+        if ([command isEqualToString:RBKStompCommandAck]) {
+            self.numberOfAcknowledgedMessages += 1;
+        } else if (affectedMessage.redeliveryCount < self.maximumRedeliveries) {
+            affectedMessage.redeliveryCount += 1;
+            self.numberOfRedeliveredMessages += 1;
+            [self deliverMessage:affectedMessage];
+        }
+    }
+    return nil;
+}
+
+- (void)sendReceiptForFrame:(RBKStompFrame *)frame connection:(RBKStompBrokerConnection *)connection {
+    NSString *receiptID = [frame headerValueForKey:RBKStompHeaderReceipt];
+    if (receiptID) {
+        [connection sendFrame:[RBKStompFrame receiptFrameWithReceiptID:receiptID]];
+    }
+}
+
+- (void)sendErrorMessage:(NSString *)errorMessage forFrame:(RBKStompFrame *)frame connection:(RBKStompBrokerConnection *)connection {
+    NSDictionary *headers = nil;
+    NSString *receiptID = [frame headerValueForKey:RBKStompHeaderReceipt];
+    if (receiptID) {
+        headers = @{RBKStompHeaderReceiptID: receiptID};
+    }
+    [connection sendFrame:[RBKStompFrame errorFrameWithMessage:errorMessage headers:headers body:[frame frameString]]];
+    [connection close]; // the server MUST close the connection after sending an ERROR frame
+}
+
+#pragma mark - Routing
+
+- (void)routeMessageWithDestination:(NSString *)destination headers:(NSDictionary *)headers body:(NSString *)body {
+    for (RBKStompBrokerConnection *connection in self.connections) {
+        if (!connection.isConnected) {
+            continue;
+        }
+        for (RBKStompBrokerSubscription *subscription in [connection.subscriptions allValues]) {
+            if (![subscription matchesDestination:destination]) {
+                continue;
+            }
+            RBKStompBrokerMessage *message = [[RBKStompBrokerMessage alloc] init];
+            message.messageID = headers[RBKStompHeaderMessageID] ?: [NSString stringWithFormat:@"brk-%lu", (unsigned long)self.messageCounter++];
+            message.destination = destination;
+            message.headers = headers;
+            message.body = body;
+            message.subscription = subscription;
+            [self deliverMessage:message];
+        }
+    }
+}
+
+- (void)deliverMessage:(RBKStompBrokerMessage *)message {
+    RBKStompBrokerSubscription *subscription = message.subscription;
+    RBKStompBrokerConnection *connection = subscription.connection;
+    if (!connection.isConnected) {
+        return;
+    }
+
+    NSMutableDictionary *headers = [NSMutableDictionary dictionaryWithDictionary:message.headers];
+    headers[RBKStompHeaderMessageID] = message.messageID;
+    if ([subscription requiresAcknowledgement]) {
+        headers[RBKStompHeaderAck] = message.messageID;
+        [subscription.unacknowledgedMessages addObject:message];
+        connection.unacknowledgedMessages[message.messageID] = message;
+    }
+    if (message.redeliveryCount > 0) {
+        headers[RBKStompBrokerHeaderRedelivered] = @"true";
+    }
+    RBKStompFrame *messageFrame = [RBKStompFrame messageFrameWithDestination:message.destination headers:headers body:message.body subscription:subscription.identifier];
+
+    // pace deliveries to the configured rate, then add the configured latency on top
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    NSTimeInterval deliveryTime = MAX(now, self.nextDeliveryTime);
+    if (self.maximumDeliveryRate > 0) {
+        self.nextDeliveryTime = deliveryTime + 1.0 / self.maximumDeliveryRate;
+    }
+    deliveryTime += self.deliveryLatency;
+
+    self.numberOfDeliveredMessages += 1;
+    NSTimeInterval delay = deliveryTime - now;
+    if (delay <= 0) {
+        [connection sendFrame:messageFrame];
+    } else {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), self.brokerQueue, ^{
+            if (connection.isConnected) {
+                [connection sendFrame:messageFrame];
+            }
+        });
+    }
+}
+
+- (void)removeSubscription:(RBKStompBrokerSubscription *)subscription {
+    for (RBKStompBrokerMessage *message in subscription.unacknowledgedMessages) {
+        [subscription.connection.unacknowledgedMessages removeObjectForKey:message.messageID];
+    }
+    [subscription.unacknowledgedMessages removeAllObjects];
+}
+
+#pragma mark - Heartbeats
+
+- (void)scheduleHeartbeatTimerForConnection:(RBKStompBrokerConnection *)connection {
+    NSTimeInterval outgoing = connection.outgoingHeartbeatInterval;
+    NSTimeInterval incoming = connection.incomingHeartbeatInterval;
+    if (outgoing <= 0 && incoming <= 0) {
+        return;
+    }
+
+    // a single timer checks both directions at half of the shortest interval
+    NSTimeInterval tick = MIN(outgoing > 0 ? outgoing : incoming, incoming > 0 ? incoming : outgoing) / 2.0;
+
+    connection.heartbeatTick = (uint64_t)(tick * NSEC_PER_SEC);
+
+    __weak typeof(self)weakSelf = self;
+    __weak RBKStompBrokerConnection *weakConnection = connection;
+    connection.heartbeatTimer = [self.clock timerWithQueue:self.brokerQueue handler:^{
+        [weakSelf heartbeatTimerFiredForConnection:weakConnection];
+    }];
+    [connection.heartbeatTimer fireAtTime:[self.clock now] + connection.heartbeatTick leeway:connection.heartbeatTick / 10];
+}
+
+- (void)heartbeatTimerFiredForConnection:(RBKStompBrokerConnection *)connection {
+    if (!connection.isConnected) {
+        return;
+    }
+    uint64_t nowNanoseconds = [self.clock now];
+    NSTimeInterval now = nowNanoseconds / (double)NSEC_PER_SEC;
+    [connection.heartbeatTimer fireAtTime:nowNanoseconds + connection.heartbeatTick leeway:connection.heartbeatTick / 10];
+
+    if (connection.outgoingHeartbeatInterval > 0 && now - connection.mostRecentSendTime >= connection.outgoingHeartbeatInterval / 2.0) {
+        self.numberOfSentHeartbeats += 1;
+        [connection sendFrame:[RBKStompFrame heartbeatFrame]];
+    }
+
+    // allow the client twice its interval before giving up on it
+    if (connection.incomingHeartbeatInterval > 0 && now - connection.mostRecentReceiveTime > connection.incomingHeartbeatInterval * 2.0) {
+        [connection close];
+    }
+}
+
+@end
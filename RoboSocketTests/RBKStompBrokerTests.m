@@ -0,0 +1,421 @@
+//
+//  RBKStompBrokerTests.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#define EXP_SHORTHAND YES
+#import <Expecta/Expecta.h>
+
+#import "RBKSTOMPSocket.h"
+#import "RBKStompBroker.h"
+
+@interface RBKStompBrokerTests : XCTestCase
+
+@property (strong, nonatomic) RBKSTOMPSocket *stompSocket;
+@property (strong, nonatomic) RBKStompBroker *broker;
+
+@end
+
+@implementation RBKStompBrokerTests
+
+- (void)setUp {
+    [super setUp];
+
+    [Expecta setAsynchronousTestTimeout:5.0];
+
+    self.broker = [[RBKStompBroker alloc] initWithHostURL:[NSURL URLWithString:@"ws://localhost"]];
+    self.stompSocket = [self.broker stompSocket];
+}
+
+- (void)tearDown {
+    [self.stompSocket closeSocket];
+    [self.broker close];
+
+    [super tearDown];
+}
+
+- (void)connectWithOutgoingHeartbeat:(NSUInteger)outgoingHeartbeat incomingHeartbeat:(NSUInteger)incomingHeartbeat {
+    RBKStompFrame *connectFrame = [RBKStompFrame connectFrameWithLogin:@"username" passcode:@"passcode" host:@"localhost" supportedOutgoingHeartbeat:outgoingHeartbeat desiredIncomingHeartbeat:incomingHeartbeat];
+
+    __block BOOL connected = NO;
+    [self.stompSocket sendSocketOperationWithFrame:connectFrame success:^(RBKSocketOperation *operation, RBKStompFrame *responseObject) {
+        connected = [responseObject.command isEqualToString:RBKStompCommandConnected];
+    } failure:nil];
+    expect(connected).will.beTruthy();
+}
+
+- (void)testBrokerWildcardFanOut {
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:0];
+
+    __block NSUInteger singleSegmentCount = 0;
+    __block NSUInteger remainingSegmentsCount = 0;
+    __block NSUInteger otherDestinationCount = 0;
+    [self.stompSocket sendSocketOperationWithFrame:[RBKStompFrame subscribeFrameWithDestination:@"/foo/*" headers:nil messageHandler:^(RBKStompFrame *responseFrame) {
+        singleSegmentCount += 1;
+    }]];
+    [self.stompSocket sendSocketOperationWithFrame:[RBKStompFrame subscribeFrameWithDestination:@"/foo/>" headers:nil messageHandler:^(RBKStompFrame *responseFrame) {
+        remainingSegmentsCount += 1;
+    }]];
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/other" headers:@{RBKStompHeaderReceipt: @"receipt-1"} messageHandler:^(RBKStompFrame *responseFrame) {
+        otherDestinationCount += 1;
+    }];
+
+    __weak typeof(self)weakSelf = self;
+    [self.stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        [weakSelf.stompSocket sendSocketOperationWithFrame:[RBKStompFrame sendFrameWithDestination:@"/foo/bar" headers:nil body:@"one"]];
+        [weakSelf.stompSocket sendSocketOperationWithFrame:[RBKStompFrame sendFrameWithDestination:@"/foo/bar/baz" headers:nil body:@"two"]];
+    } failure:nil];
+
+    expect(self.broker.numberOfDeliveredMessages).will.equal(3);
+    expect(singleSegmentCount).will.equal(1);
+    expect(remainingSegmentsCount).will.equal(2);
+    expect(otherDestinationCount).to.equal(0);
+}
+
+- (void)testBrokerReceipt {
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:0];
+
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/foo/bar" headers:@{RBKStompHeaderReceipt: @"receipt-1"} messageHandler:nil];
+
+    __block RBKStompFrame *receiptFrame = nil;
+    [self.stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        receiptFrame = responseObject;
+    } failure:nil];
+
+    expect(receiptFrame.command).will.equal(RBKStompCommandReceipt);
+    expect([receiptFrame headerValueForKey:RBKStompHeaderReceiptID]).will.equal(@"receipt-1");
+}
+
+- (void)testPublisherConfirmsPipelinedFrames {
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:0];
+
+    RBKStompPublisher *publisher = self.stompSocket.publisher;
+    publisher.maximumUnconfirmedFrames = 4;
+
+    NSUInteger const publishCount = 20;
+    __block NSUInteger confirmed = 0;
+    __block NSUInteger failed = 0;
+    for (NSUInteger idx = 0; idx < publishCount; idx++) {
+        [publisher publishToDestination:@"/foo/bar" headers:nil body:[NSString stringWithFormat:@"message %lu", (unsigned long)idx] success:^(RBKStompFrame *receiptFrame) {
+            confirmed += 1;
+        } failure:^(NSError *error) {
+            failed += 1;
+        }];
+    }
+    expect(publisher.numberOfUnconfirmedFrames).to.beLessThanOrEqualTo(4);
+
+    // a receipt must not be taken as the response of an unrelated operation that is waiting
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/other" headers:@{RBKStompHeaderReceipt: @"subscribe-receipt"} messageHandler:nil];
+    __block RBKStompFrame *subscribeReceipt = nil;
+    [self.stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        subscribeReceipt = responseObject;
+    } failure:nil];
+
+    expect(confirmed).will.equal(publishCount);
+    expect(failed).to.equal(0);
+    expect([subscribeReceipt headerValueForKey:RBKStompHeaderReceiptID]).will.equal(@"subscribe-receipt");
+    expect(publisher.numberOfUnconfirmedFrames).to.equal(0);
+    expect(publisher.numberOfQueuedFrames).to.equal(0);
+}
+
+- (void)testPublisherFollowsSocketTimeoutAndReadsFramedReceipts {
+    RBKStompPublisher *publisher = self.stompSocket.publisher;
+    self.stompSocket.operationTimeoutInterval = 30;
+    expect(publisher.receiptTimeoutInterval).to.equal(30);
+    publisher.receiptTimeoutInterval = 0;
+    expect(publisher.receiptTimeoutInterval).to.equal(0);
+
+    RBKStompFrame *frame = [RBKStompFrame sendFrameWithDestination:@"/foo/bar" headers:@{RBKStompHeaderReceipt: @"framed-receipt"} body:@"framed"];
+    [publisher publishFrame:frame receiptID:@"framed-receipt" success:nil failure:nil];
+    NSData *receiptData = [@"\n\r\nRECEIPT\r\nreceipt-id:framed-receipt\r\n\r\n" dataUsingEncoding:NSUTF8StringEncoding];
+    NSMutableData *terminatedData = [NSMutableData dataWithData:receiptData];
+    [terminatedData appendBytes:"\0" length:1];
+    expect([publisher isReceiptForUnconfirmedFrame:terminatedData]).to.beTruthy();
+    RBKStompFrame *receiptFrame = [RBKStompFrame responseFrameFromData:terminatedData];
+    expect(receiptFrame.command).to.equal(RBKStompCommandReceipt);
+    expect([receiptFrame headerValueForKey:RBKStompHeaderReceiptID]).to.equal(@"framed-receipt");
+}
+
+- (void)testTransactionCommitsInOneMessage {
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:0];
+
+    NSMutableArray *receivedBodies = [NSMutableArray array];
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/foo/bar" headers:@{RBKStompHeaderReceipt: @"receipt-1"} messageHandler:^(RBKStompFrame *responseFrame) {
+        [receivedBodies addObject:[responseFrame bodyValue]];
+    }];
+    __block BOOL subscribed = NO;
+    [self.stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        subscribed = YES;
+    } failure:nil];
+    expect(subscribed).will.beTruthy();
+
+    NSUInteger messagesBefore = self.broker.numberOfReceivedMessages;
+    NSUInteger framesBefore = self.broker.numberOfReceivedFrames;
+
+    RBKStompTransaction *transaction = [self.stompSocket beginTransaction];
+    [transaction sendToDestination:@"/foo/bar" headers:nil body:@"one"];
+    [transaction sendToDestination:@"/foo/bar" headers:nil body:@"two"];
+    [transaction sendToDestination:@"/foo/bar" headers:nil body:@"three"];
+
+    // an aborted transaction never reaches the server
+    RBKStompTransaction *abortedTransaction = [self.stompSocket beginTransaction];
+    [abortedTransaction sendToDestination:@"/foo/bar" headers:nil body:@"aborted"];
+    [self.stompSocket abortTransaction:abortedTransaction];
+
+    __block RBKStompFrame *receiptFrame = nil;
+    [self.stompSocket commitTransaction:transaction success:^(RBKStompFrame *frame) {
+        receiptFrame = frame;
+    } failure:nil];
+
+    expect(receiptFrame.command).will.equal(RBKStompCommandReceipt);
+    expect(receivedBodies).will.equal(@[@"one", @"two", @"three"]);
+    expect(self.broker.numberOfReceivedMessages - messagesBefore).to.equal(1);
+    expect(self.broker.numberOfReceivedFrames - framesBefore).to.equal(5);
+    expect(transaction.isFinished).to.beTruthy();
+}
+
+- (void)testPrefetchCountHoldsBackMessagesUntilCompleted {
+    RBKStompHeartbeat heartbeat = {100, 0};
+    self.broker.heartbeat = heartbeat;
+    __block NSError *failure = nil;
+    self.stompSocket.failureBlock = ^(NSError *error) {
+        failure = error;
+    };
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:100];
+
+    NSMutableArray *receivedFrames = [NSMutableArray array];
+    NSDictionary *headers = @{RBKStompHeaderReceipt: @"receipt-1", RBKStompHeaderAck: RBKStompAckClientIndividual};
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/foo/bar" headers:headers prefetchCount:2 messageHandler:^(RBKStompFrame *responseFrame) {
+        [receivedFrames addObject:responseFrame];
+    }];
+    __block BOOL subscribed = NO;
+    [self.stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        subscribed = YES;
+    } failure:nil];
+    expect(subscribed).will.beTruthy();
+
+    NSUInteger const messageCount = 5;
+    for (NSUInteger idx = 0; idx < messageCount; idx++) {
+        [self.broker publishMessageWithDestination:@"/foo/bar" headers:nil body:[NSString stringWithFormat:@"message %lu", (unsigned long)idx]];
+    }
+
+    expect([receivedFrames count]).will.equal(2);
+    expect(self.stompSocket.isReadingPaused).will.beTruthy();
+    // several heart-beat intervals without reading anything, which doesn't count against the broker
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+    expect([receivedFrames count]).to.equal(2); // nothing more until a message is completed
+    expect(self.broker.numberOfAcknowledgedMessages).to.equal(0); // the acks are held back too
+    expect(failure).to.beNil();
+    expect(self.stompSocket.socketOpen).to.beTruthy();
+
+    // complete each message as it arrives
+    NSUInteger completedCount = 0;
+    NSDate *timeoutDate = [NSDate dateWithTimeIntervalSinceNow:5.0];
+    while (completedCount < messageCount && [timeoutDate timeIntervalSinceNow] > 0) {
+        while (completedCount < [receivedFrames count]) {
+            [self.stompSocket completeMessage:receivedFrames[completedCount]];
+            completedCount += 1;
+        }
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+
+    expect(completedCount).to.equal(messageCount);
+    expect([[receivedFrames lastObject] bodyValue]).to.equal(@"message 4");
+    expect(self.broker.numberOfAcknowledgedMessages).will.equal(messageCount);
+    expect(self.stompSocket.isReadingPaused).to.beFalsy();
+    expect(failure).to.beNil();
+}
+
+- (void)testNackInTransactionReturnsPrefetchCredit {
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:0];
+
+    NSMutableArray *receivedFrames = [NSMutableArray array];
+    NSDictionary *headers = @{RBKStompHeaderReceipt: @"receipt-1", RBKStompHeaderAck: RBKStompAckClientIndividual};
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/foo/bar" headers:headers prefetchCount:1 messageHandler:^(RBKStompFrame *responseFrame) {
+        [receivedFrames addObject:responseFrame];
+    }];
+    __block BOOL subscribed = NO;
+    [self.stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        subscribed = YES;
+    } failure:nil];
+    expect(subscribed).will.beTruthy();
+
+    self.broker.maximumRedeliveries = 0;
+    [self.broker publishMessageWithDestination:@"/foo/bar" headers:nil body:@"rejected"];
+    [self.broker publishMessageWithDestination:@"/foo/bar" headers:nil body:@"next"];
+    expect([receivedFrames count]).will.equal(1);
+
+    // the NACK goes out inside the COMMIT's batch, and still gives the credit back
+    RBKStompTransaction *transaction = [self.stompSocket beginTransaction];
+    [transaction nackMessageWithIdentifier:[receivedFrames[0] headerValueForKey:RBKStompHeaderAck]];
+    __block BOOL committed = NO;
+    [self.stompSocket commitTransaction:transaction success:^(RBKStompFrame *receiptFrame) {
+        committed = YES;
+    } failure:nil];
+    expect(committed).will.beTruthy();
+    expect([receivedFrames count]).will.equal(2);
+    expect([receivedFrames[1] bodyValue]).to.equal(@"next");
+}
+
+- (void)testSubscriptionExecutorRunsHandlerInOrder {
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:0];
+
+    NSMutableArray *receivedBodies = [NSMutableArray array];
+    __block BOOL ranOnMainThread = NO;
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/foo/bar" headers:@{RBKStompHeaderReceipt: @"receipt-1"} messageHandler:^(RBKStompFrame *responseFrame) {
+        ranOnMainThread = ranOnMainThread || [NSThread isMainThread];
+        @synchronized(receivedBodies) {
+            [receivedBodies addObject:[responseFrame bodyValue]];
+        }
+    }];
+    [self.stompSocket setExecutor:[[RBKWorkerPool sharedPool] mailbox] forSubscriptionID:subscribeFrame.subscription.identifier];
+    __block BOOL subscribed = NO;
+    [self.stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        subscribed = YES;
+    } failure:nil];
+    expect(subscribed).will.beTruthy();
+
+    NSMutableArray *expectedBodies = [NSMutableArray array];
+    for (NSUInteger idx = 0; idx < 20; idx++) {
+        NSString *body = [NSString stringWithFormat:@"message %lu", (unsigned long)idx];
+        [expectedBodies addObject:body];
+        [self.broker publishMessageWithDestination:@"/foo/bar" headers:nil body:body];
+    }
+
+    expect([receivedBodies count]).will.equal([expectedBodies count]);
+    expect(receivedBodies).to.equal(expectedBodies);
+    expect(ranOnMainThread).to.beFalsy();
+}
+
+- (void)testConflatingSubscriptionKeepsLatestPerKey {
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:0];
+
+    NSMutableDictionary *latestBodies = [NSMutableDictionary dictionary];
+    __block NSUInteger handledCount = 0;
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/quotes" headers:@{RBKStompHeaderReceipt: @"receipt-1"} messageHandler:^(RBKStompFrame *responseFrame) {
+        @synchronized(latestBodies) {
+            latestBodies[[responseFrame headerValueForKey:@"symbol"]] = [responseFrame bodyValue];
+            handledCount += 1;
+        }
+    }];
+    NSString *subscriptionID = subscribeFrame.subscription.identifier;
+
+    // hold the handler back until every update has arrived
+    dispatch_queue_t handlerQueue = dispatch_queue_create("com.robotsandpencils.networking.tests.quotes", DISPATCH_QUEUE_SERIAL);
+    dispatch_suspend(handlerQueue);
+    [self.stompSocket setExecutor:[RBKSerialQueueExecutor executorWithQueue:handlerQueue] forSubscriptionID:subscriptionID];
+    [self.stompSocket conflateSubscriptionID:subscriptionID byHeader:@"symbol"];
+
+    __block BOOL subscribed = NO;
+    [self.stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        subscribed = YES;
+    } failure:nil];
+    expect(subscribed).will.beTruthy();
+
+    for (NSUInteger idx = 0; idx < 10; idx++) {
+        NSString *symbol = idx % 2 ? @"AAPL" : @"GOOG";
+        [self.broker publishMessageWithDestination:@"/quotes" headers:@{@"symbol": symbol} body:[NSString stringWithFormat:@"%lu", (unsigned long)idx]];
+    }
+
+    expect([self.stompSocket numberOfConflatedMessagesForSubscriptionID:subscriptionID]).will.equal(8);
+    dispatch_resume(handlerQueue);
+
+    expect(handledCount).will.equal(2);
+    expect(latestBodies).to.equal((@{@"GOOG": @"8", @"AAPL": @"9"}));
+}
+
+- (void)testHeaderFilterDropsMessagesBeforeParsing {
+    self.stompSocket.metrics = [[RBKSocketMetrics alloc] init];
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:0];
+
+    NSMutableArray *receivedBodies = [NSMutableArray array];
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/quotes" headers:@{RBKStompHeaderReceipt: @"receipt-1"} messageHandler:^(RBKStompFrame *responseFrame) {
+        [receivedBodies addObject:[responseFrame bodyValue]];
+    }];
+    NSString *subscriptionID = subscribeFrame.subscription.identifier;
+    [self.stompSocket setHeaderFilter:[RBKStompHeaderFilter filterWithHeader:@"price" minimum:100 maximum:200] forSubscriptionID:subscriptionID];
+
+    __block BOOL subscribed = NO;
+    [self.stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        subscribed = YES;
+    } failure:nil];
+    expect(subscribed).will.beTruthy();
+
+    for (NSUInteger price = 50; price <= 250; price += 50) {
+        NSString *priceString = [NSString stringWithFormat:@"%lu", (unsigned long)price];
+        [self.broker publishMessageWithDestination:@"/quotes" headers:@{@"price": priceString} body:priceString];
+    }
+
+    expect(receivedBodies).will.equal((@[@"100", @"150", @"200"]));
+    expect([self.stompSocket.metrics snapshot][RBKSocketMetricsSubscriptionsKey][subscriptionID][@"filtered"]).will.equal(2);
+}
+
+- (void)testConnectionCannotAcknowledgeAnotherConnectionsMessages {
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:0];
+
+    // the prefetch count holds this connection's ACK back until the message is completed
+    NSMutableArray *receivedFrames = [NSMutableArray array];
+    NSDictionary *headers = @{RBKStompHeaderReceipt: @"receipt-1", RBKStompHeaderAck: RBKStompAckClientIndividual};
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/foo/bar" headers:headers prefetchCount:1 messageHandler:^(RBKStompFrame *responseFrame) {
+        [receivedFrames addObject:responseFrame];
+    }];
+    __block BOOL subscribed = NO;
+    [self.stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        subscribed = YES;
+    } failure:nil];
+    expect(subscribed).will.beTruthy();
+    [self.broker publishMessageWithDestination:@"/foo/bar" headers:nil body:@"mine"];
+    expect([receivedFrames count]).will.equal(1);
+
+    RBKSTOMPSocket *otherSocket = [self.broker stompSocket];
+    __block BOOL otherConnected = NO;
+    [otherSocket sendSocketOperationWithFrame:[RBKStompFrame connectFrameWithLogin:@"username" passcode:@"passcode" host:@"localhost"] success:^(RBKSocketOperation *operation, id responseObject) {
+        otherConnected = YES;
+    } failure:nil];
+    expect(otherConnected).will.beTruthy();
+
+    [otherSocket sendSocketOperationWithFrame:[RBKStompFrame ackFrameWithIdentifier:[receivedFrames[0] headerValueForKey:RBKStompHeaderAck]]];
+    expect(self.broker.numberOfReceivedFrames).will.equal(4); // both CONNECTs, the SUBSCRIBE and the foreign ACK
+    expect(self.broker.numberOfAcknowledgedMessages).to.equal(0);
+
+    [self.stompSocket completeMessage:receivedFrames[0]];
+    expect(self.broker.numberOfAcknowledgedMessages).will.equal(1);
+
+    [otherSocket closeSocket];
+}
+
+- (void)testBrokerServerHeartbeat {
+    RBKStompHeartbeat heartbeat = {100, 0};
+    self.broker.heartbeat = heartbeat;
+
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:100];
+
+    expect(self.broker.numberOfSentHeartbeats).will.beGreaterThanOrEqualTo(2);
+    expect([self.stompSocket numberOfReceivedHeartbeats]).will.beGreaterThanOrEqualTo(2);
+}
+
+- (void)testBrokerDeliveryLatency {
+    self.broker.deliveryLatency = 0.5;
+    [self connectWithOutgoingHeartbeat:0 incomingHeartbeat:0];
+
+    __block NSDate *receivedDate = nil;
+    __block NSDate *sentDate = nil;
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/foo/bar" headers:@{RBKStompHeaderReceipt: @"receipt-1"} messageHandler:^(RBKStompFrame *responseFrame) {
+        receivedDate = [NSDate date];
+    }];
+    __weak typeof(self)weakSelf = self;
+    [self.stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        // the subscription is in place once the receipt arrives
+        sentDate = [NSDate date];
+        [weakSelf.broker publishMessageWithDestination:@"/foo/bar" headers:nil body:@"delayed"];
+    } failure:nil];
+
+    expect(receivedDate).willNot.beNil();
+    expect([receivedDate timeIntervalSinceDate:sentDate]).to.beGreaterThanOrEqualTo(0.5);
+}
+
+@end
@@ -0,0 +1,189 @@
+//
+//  RBKStompDuplicateWindowTests.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#define EXP_SHORTHAND YES
+#import <Expecta/Expecta.h>
+
+#import "RBKSTOMPSocket.h"
+#import "RBKStompBroker.h"
+#import "RBKStompDuplicateWindow.h"
+#import "RBKSocketMetrics.h"
+
+@interface RBKStompDuplicateWindowTests : XCTestCase
+
+@end
+
+@implementation RBKStompDuplicateWindowTests
+
+- (void)setUp {
+    [super setUp];
+
+    [Expecta setAsynchronousTestTimeout:5.0];
+}
+
+- (NSString *)messageIDAtIndex:(NSUInteger)idx {
+    return [NSString stringWithFormat:@"message-%lu", (unsigned long)idx];
+}
+
+- (void)testOldestIDsArePushedOut {
+    RBKStompDuplicateWindow *window = [RBKStompDuplicateWindow windowWithCapacity:50];
+    for (NSUInteger idx = 0; idx < 100; idx++) {
+        expect([window isDuplicateMessageID:[self messageIDAtIndex:idx]]).to.beFalsy();
+    }
+    expect(window.numberOfMessageIDs).to.equal(50);
+
+    for (NSUInteger idx = 50; idx < 100; idx++) {
+        expect([window isDuplicateMessageID:[self messageIDAtIndex:idx]]).to.beTruthy();
+    }
+    expect(window.numberOfDuplicates).to.equal(50);
+    expect([window isDuplicateMessageID:[self messageIDAtIndex:0]]).to.beFalsy();
+    expect([window isDuplicateMessageID:nil]).to.beFalsy();
+}
+
+- (void)testIDsExpire {
+    RBKVirtualClock *clock = [[RBKVirtualClock alloc] initWithTime:0];
+    RBKStompDuplicateWindow *window = [RBKStompDuplicateWindow windowWithCapacity:100 timeInterval:10];
+    window.clock = clock;
+
+    expect([window isDuplicateMessageID:@"message-0"]).to.beFalsy();
+    [clock advanceByInterval:5];
+    expect([window isDuplicateMessageID:@"message-0"]).to.beTruthy();
+    expect([window isDuplicateMessageID:@"message-1"]).to.beFalsy();
+
+    [clock advanceByInterval:6];
+    expect([window isDuplicateMessageID:@"message-0"]).to.beFalsy(); // 11s old, remembered again from now
+    expect([window isDuplicateMessageID:@"message-1"]).to.beTruthy(); // 6s old
+}
+
+- (void)testManyUniqueIDs {
+    NSUInteger const capacity = 1000;
+    NSUInteger const messageCount = 100000;
+    RBKStompDuplicateWindow *window = [RBKStompDuplicateWindow windowWithCapacity:capacity];
+    for (NSUInteger idx = 0; idx < messageCount; idx++) {
+        [window isDuplicateMessageID:[self messageIDAtIndex:idx]];
+    }
+    expect(window.numberOfDuplicates).to.equal(0);
+    expect(window.numberOfMessageIDs).to.equal(capacity);
+
+    // everything still remembered is found after all those removals
+    NSUInteger foundCount = 0;
+    for (NSUInteger idx = messageCount - capacity; idx < messageCount; idx++) {
+        foundCount += [window isDuplicateMessageID:[self messageIDAtIndex:idx]] ? 1 : 0;
+    }
+    expect(foundCount).to.equal(capacity);
+}
+
+- (void)testFrameDataIsReadWithoutParsing {
+    RBKStompDuplicateWindow *window = [RBKStompDuplicateWindow windowWithCapacity:10];
+    NSData *frameData = [[RBKStompFrame messageFrameWithDestination:@"/quotes" headers:@{RBKStompHeaderMessageID: @"m-1"} body:@"GOOG" subscription:@"sub-0"] frameData];
+
+    expect([window isDuplicateFrameData:frameData]).to.beFalsy();
+    expect([window isDuplicateFrameData:frameData]).to.beTruthy();
+    expect([window isDuplicateMessageID:@"m-1"]).to.beTruthy();
+
+    RBKStompFrame *messageFrame = [RBKStompFrame messageFrameWithDestination:@"/quotes" headers:nil body:@"GOOG" subscription:@"sub-0"];
+    NSData *anonymousData = [[messageFrame frameByRemovingHeadersForKeys:@[RBKStompHeaderMessageID]] frameData];
+    expect([window isDuplicateFrameData:anonymousData]).to.beFalsy();
+    expect([window isDuplicateFrameData:anonymousData]).to.beFalsy();
+}
+
+#pragma mark - Socket
+
+- (void)testRedeliveredMessageIsDropped {
+    RBKStompBroker *broker = [[RBKStompBroker alloc] initWithHostURL:[NSURL URLWithString:@"ws://localhost"]];
+    RBKSTOMPSocket *stompSocket = [broker stompSocket];
+    stompSocket.metrics = [[RBKSocketMetrics alloc] init];
+
+    __block BOOL connected = NO;
+    [stompSocket sendSocketOperationWithFrame:[RBKStompFrame connectFrameWithLogin:@"username" passcode:@"passcode" host:@"localhost"] success:^(RBKSocketOperation *operation, RBKStompFrame *responseObject) {
+        connected = YES;
+    } failure:nil];
+    expect(connected).will.beTruthy();
+
+    // the prefetch count holds the ACK back, so the handler can NACK the message instead; the NACK returns the credit for the redelivery
+    NSMutableArray *receivedFrames = [NSMutableArray array];
+    NSDictionary *headers = @{RBKStompHeaderReceipt: @"receipt-1", RBKStompHeaderAck: RBKStompAckClientIndividual};
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/quotes" headers:headers prefetchCount:1 messageHandler:^(RBKStompFrame *responseFrame) {
+        [receivedFrames addObject:responseFrame];
+    }];
+    NSString *subscriptionID = subscribeFrame.subscription.identifier;
+    [stompSocket setDuplicateWindow:[RBKStompDuplicateWindow windowWithCapacity:100] forSubscriptionID:subscriptionID];
+    __block BOOL subscribed = NO;
+    [stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        subscribed = YES;
+    } failure:nil];
+    expect(subscribed).will.beTruthy();
+
+    [broker publishMessageWithDestination:@"/quotes" headers:nil body:@"GOOG 1"];
+    expect([receivedFrames count]).will.equal(1);
+
+    [stompSocket sendSocketOperationWithFrame:[RBKStompFrame nackFrameWithIdentifier:[receivedFrames[0] headerValueForKey:RBKStompHeaderAck]]];
+    expect(broker.numberOfRedeliveredMessages).will.equal(1);
+    expect([stompSocket.metrics snapshot][RBKSocketMetricsSubscriptionsKey][subscriptionID][@"duplicates"]).will.equal(1);
+
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.2]];
+    expect([receivedFrames count]).to.equal(1);
+    expect(broker.numberOfRedeliveredMessages).to.equal(1); // the dropped copy was acknowledged, not redelivered again
+    expect(broker.numberOfAcknowledgedMessages).will.equal(1);
+
+    [stompSocket closeSocket];
+    [broker close];
+}
+
+- (RBKSTOMPSocket *)subscribedSocketWithBroker:(RBKStompBroker *)broker duplicateWindow:(RBKStompDuplicateWindow *)window receivedFrames:(NSMutableArray *)receivedFrames {
+    RBKSTOMPSocket *stompSocket = [broker stompSocket];
+    __block BOOL connected = NO;
+    [stompSocket sendSocketOperationWithFrame:[RBKStompFrame connectFrameWithLogin:@"username" passcode:@"passcode" host:@"localhost"] success:^(RBKSocketOperation *operation, RBKStompFrame *responseObject) {
+        connected = YES;
+    } failure:nil];
+    expect(connected).will.beTruthy();
+
+    NSDictionary *headers = @{RBKStompHeaderReceipt: @"receipt-1", RBKStompHeaderAck: RBKStompAckClientIndividual};
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/quotes" headers:headers prefetchCount:1 messageHandler:^(RBKStompFrame *responseFrame) {
+        [receivedFrames addObject:responseFrame];
+    }];
+    [stompSocket setDuplicateWindow:window forSubscriptionID:subscribeFrame.subscription.identifier];
+    __block BOOL subscribed = NO;
+    [stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        subscribed = YES;
+    } failure:nil];
+    expect(subscribed).will.beTruthy();
+    return stompSocket;
+}
+
+- (void)testMessageHeldForCreditIsTakenAfterReconnect {
+    RBKStompBroker *broker = [[RBKStompBroker alloc] initWithHostURL:[NSURL URLWithString:@"ws://localhost"]];
+    RBKStompDuplicateWindow *window = [RBKStompDuplicateWindow windowWithCapacity:100];
+    NSMutableArray *receivedFrames = [NSMutableArray array];
+    RBKSTOMPSocket *stompSocket = [self subscribedSocketWithBroker:broker duplicateWindow:window receivedFrames:receivedFrames];
+
+    // the second message waits for the first one's credit, and is thrown away when the connection closes
+    [broker publishMessageWithDestination:@"/quotes" headers:@{RBKStompHeaderMessageID: @"m-1"} body:@"GOOG 1"];
+    [broker publishMessageWithDestination:@"/quotes" headers:@{RBKStompHeaderMessageID: @"m-2"} body:@"GOOG 2"];
+    expect([receivedFrames count]).will.equal(1);
+    expect(broker.numberOfDeliveredMessages).will.equal(2);
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.2]];
+    expect([receivedFrames count]).to.equal(1);
+    [stompSocket closeSocket];
+
+    // sent again on the next connection, only the message the handler had is a duplicate
+    [receivedFrames removeAllObjects];
+    RBKSTOMPSocket *nextSocket = [self subscribedSocketWithBroker:broker duplicateWindow:window receivedFrames:receivedFrames];
+    [broker publishMessageWithDestination:@"/quotes" headers:@{RBKStompHeaderMessageID: @"m-1"} body:@"GOOG 1"];
+    expect(window.numberOfDuplicates).will.equal(1);
+    expect(broker.numberOfAcknowledgedMessages).will.equal(1);
+    [broker publishMessageWithDestination:@"/quotes" headers:@{RBKStompHeaderMessageID: @"m-2"} body:@"GOOG 2"];
+    expect([receivedFrames count]).will.equal(1);
+    expect([receivedFrames[0] bodyValue]).to.equal(@"GOOG 2");
+
+    [nextSocket closeSocket];
+    [broker close];
+}
+
+@end
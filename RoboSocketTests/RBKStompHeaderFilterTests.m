@@ -0,0 +1,67 @@
+//
+//  RBKStompHeaderFilterTests.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#define EXP_SHORTHAND YES
+#import <Expecta/Expecta.h>
+
+#import "RBKStompHeaderFilter.h"
+#import "RBKStompFrame.h"
+
+@interface RBKStompHeaderFilterTests : XCTestCase
+
+@property (strong, nonatomic) NSData *frameData;
+
+@end
+
+@implementation RBKStompHeaderFilterTests
+
+- (void)setUp {
+    [super setUp];
+
+    NSString *frameString = @"\nMESSAGE\r\ndestination:/quotes/AAPL\nsubscription:sub-1\nprice:101.5\nregion:us-east\nregion:eu-west\n\nregion:body-only";
+    frameString = [frameString stringByAppendingString:RBKStompNullCharString];
+    self.frameData = [frameString dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+- (void)testHeaderValueInFrameData {
+    expect(RBKStompFrameDataHasCommand(self.frameData, "MESSAGE", 7)).to.beTruthy();
+    expect(RBKStompFrameDataHasCommand(self.frameData, "MESS", 4)).to.beFalsy();
+    expect([RBKStompFrame headerValueForKey:RBKStompHeaderDestination inFrameData:self.frameData]).to.equal(@"/quotes/AAPL");
+    expect([RBKStompFrame headerValueForKey:@"region" inFrameData:self.frameData]).to.equal(@"us-east"); // the first occurrence wins
+    expect([RBKStompFrame headerValueForKey:@"missing" inFrameData:self.frameData]).to.beNil();
+}
+
+- (void)testEqualityAndPrefix {
+    expect([[RBKStompHeaderFilter filterWithHeader:@"region" equalTo:@"us-east"] matchesFrameData:self.frameData]).to.beTruthy();
+    expect([[RBKStompHeaderFilter filterWithHeader:@"region" equalTo:@"us"] matchesFrameData:self.frameData]).to.beFalsy();
+    expect([[RBKStompHeaderFilter filterWithHeader:@"region" equalTo:@"eu-west"] matchesFrameData:self.frameData]).to.beFalsy();
+    expect([[RBKStompHeaderFilter filterWithHeader:@"region" equalTo:@"body-only"] matchesFrameData:self.frameData]).to.beFalsy();
+    expect([[RBKStompHeaderFilter filterWithHeader:RBKStompHeaderDestination prefix:@"/quotes/"] matchesFrameData:self.frameData]).to.beTruthy();
+    expect([[RBKStompHeaderFilter filterWithHeader:RBKStompHeaderDestination prefix:@"/trades/"] matchesFrameData:self.frameData]).to.beFalsy();
+    expect([[RBKStompHeaderFilter filterWithHeader:@"missing" prefix:@""] matchesFrameData:self.frameData]).to.beFalsy();
+}
+
+- (void)testNumericRange {
+    expect([[RBKStompHeaderFilter filterWithHeader:@"price" minimum:100 maximum:200] matchesFrameData:self.frameData]).to.beTruthy();
+    expect([[RBKStompHeaderFilter filterWithHeader:@"price" minimum:101.5 maximum:101.5] matchesFrameData:self.frameData]).to.beTruthy();
+    expect([[RBKStompHeaderFilter filterWithHeader:@"price" minimum:0 maximum:100] matchesFrameData:self.frameData]).to.beFalsy();
+    expect([[RBKStompHeaderFilter filterWithHeader:@"region" minimum:-1e9 maximum:1e9] matchesFrameData:self.frameData]).to.beFalsy(); // not a number
+}
+
+- (void)testCompoundFilters {
+    RBKStompHeaderFilter *price = [RBKStompHeaderFilter filterWithHeader:@"price" minimum:100 maximum:200];
+    RBKStompHeaderFilter *europe = [RBKStompHeaderFilter filterWithHeader:@"region" prefix:@"eu-"];
+
+    expect([[RBKStompHeaderFilter filterMatchingAllOf:@[price, europe]] matchesFrameData:self.frameData]).to.beFalsy();
+    expect([[RBKStompHeaderFilter filterMatchingAnyOf:@[price, europe]] matchesFrameData:self.frameData]).to.beTruthy();
+    expect([[RBKStompHeaderFilter filterMatchingAllOf:@[]] matchesFrameData:self.frameData]).to.beTruthy();
+    expect([[RBKStompHeaderFilter filterMatchingAnyOf:@[]] matchesFrameData:self.frameData]).to.beFalsy();
+}
+
+@end
@@ -0,0 +1,147 @@
+//
+//  RBKStompLastValueCacheTests.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#define EXP_SHORTHAND YES
+#import <Expecta/Expecta.h>
+
+#import "RBKSTOMPSocket.h"
+#import "RBKStompBroker.h"
+#import "RBKStompLastValueCache.h"
+
+@interface RBKStompLastValueCacheTests : XCTestCase
+
+@property (strong, nonatomic) NSURL *cacheURL;
+
+@end
+
+@implementation RBKStompLastValueCacheTests
+
+- (void)setUp {
+    [super setUp];
+
+    [Expecta setAsynchronousTestTimeout:5.0];
+
+    NSString *fileName = [NSString stringWithFormat:@"last-values-%@.rbklvc", [[NSUUID UUID] UUIDString]];
+    self.cacheURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:fileName]];
+}
+
+- (void)tearDown {
+    [[NSFileManager defaultManager] removeItemAtURL:self.cacheURL error:nil];
+
+    [super tearDown];
+}
+
+- (NSData *)messageDataWithDestination:(NSString *)destination body:(NSString *)body {
+    return [[RBKStompFrame messageFrameWithDestination:destination headers:nil body:body subscription:@"sub-0"] frameData];
+}
+
+- (void)testNewestFramesSurviveReopening {
+    NSError *error = nil;
+    RBKStompLastValueCache *cache = [[RBKStompLastValueCache alloc] initWithURL:self.cacheURL error:&error];
+    expect(error).to.beNil();
+    [cache storeFrameData:[self messageDataWithDestination:@"/quotes" body:@"GOOG 1"] destination:@"/quotes" key:@"GOOG"];
+    [cache storeFrameData:[self messageDataWithDestination:@"/quotes" body:@"AAPL 1"] destination:@"/quotes" key:@"AAPL"];
+    [cache storeFrameData:[self messageDataWithDestination:@"/quotes" body:@"GOOG 2"] destination:@"/quotes" key:@"GOOG"];
+    [cache storeFrameData:[self messageDataWithDestination:@"/news" body:@"headline"] destination:@"/news" key:@""];
+    expect(cache.numberOfMessages).to.equal(3);
+    [cache close];
+
+    RBKStompLastValueCache *reopened = [[RBKStompLastValueCache alloc] initWithURL:self.cacheURL error:&error];
+    expect(error).to.beNil();
+    expect(reopened.numberOfMessages).to.equal(3);
+    expect([[reopened messageFramesForDestination:@"/quotes"] valueForKey:@"bodyValue"]).to.equal((@[@"AAPL 1", @"GOOG 2"]));
+    expect([[reopened messageFramesForDestination:@"/news"][0] command]).to.equal(RBKStompCommandMessage);
+    expect([reopened messageFramesForDestination:@"/other"]).to.haveCountOf(0);
+
+    [reopened removeMessagesForDestination:@"/quotes"];
+    [reopened close];
+    RBKStompLastValueCache *afterRemoval = [[RBKStompLastValueCache alloc] initWithURL:self.cacheURL error:nil];
+    expect(afterRemoval.numberOfMessages).to.equal(1);
+    [afterRemoval close];
+}
+
+- (void)testSupersededFramesAreCompactedAway {
+    RBKStompLastValueCache *cache = [[RBKStompLastValueCache alloc] initWithURL:self.cacheURL error:nil];
+    NSString *padding = [@"" stringByPaddingToLength:500 withString:@"x" startingAtIndex:0];
+
+    // 10MB of updates to a handful of keys
+    NSUInteger const updateCount = 20000;
+    for (NSUInteger idx = 0; idx < updateCount; idx++) {
+        NSString *body = [NSString stringWithFormat:@"%lu %@", (unsigned long)idx, padding];
+        [cache storeFrameData:[self messageDataWithDestination:@"/quotes" body:body] destination:@"/quotes" key:[NSString stringWithFormat:@"%lu", (unsigned long)(idx % 5)]];
+    }
+    [cache close];
+
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:[self.cacheURL path] error:nil];
+    expect([attributes fileSize]).to.beLessThan(1024 * 1024);
+
+    RBKStompLastValueCache *reopened = [[RBKStompLastValueCache alloc] initWithURL:self.cacheURL error:nil];
+    NSArray *frames = [reopened messageFramesForDestination:@"/quotes"];
+    expect(frames).to.haveCountOf(5);
+    expect([[frames lastObject] bodyValue]).to.equal(([NSString stringWithFormat:@"%lu %@", (unsigned long)(updateCount - 1), padding]));
+    [reopened close];
+}
+
+- (void)testOtherFilesAreStartedOver {
+    [[@"not a cache, but long enough to have a header" dataUsingEncoding:NSUTF8StringEncoding] writeToURL:self.cacheURL atomically:YES];
+
+    RBKStompLastValueCache *cache = [[RBKStompLastValueCache alloc] initWithURL:self.cacheURL error:nil];
+    expect(cache).notTo.beNil();
+    expect(cache.numberOfMessages).to.equal(0);
+    [cache close];
+}
+
+#pragma mark - Socket
+
+- (void)testSubscriptionIsPrimedFromCache {
+    RBKStompBroker *broker = [[RBKStompBroker alloc] initWithHostURL:[NSURL URLWithString:@"ws://localhost"]];
+    RBKSTOMPSocket *stompSocket = [broker stompSocket];
+    stompSocket.lastValueCache = [[RBKStompLastValueCache alloc] initWithURL:self.cacheURL error:nil];
+
+    __block BOOL connected = NO;
+    [stompSocket sendSocketOperationWithFrame:[RBKStompFrame connectFrameWithLogin:@"username" passcode:@"passcode" host:@"localhost"] success:^(RBKSocketOperation *operation, RBKStompFrame *responseObject) {
+        connected = YES;
+    } failure:nil];
+    expect(connected).will.beTruthy();
+
+    RBKStompFrame *subscribeFrame = [RBKStompFrame subscribeFrameWithDestination:@"/quotes" headers:@{RBKStompHeaderReceipt: @"receipt-1"} messageHandler:^(RBKStompFrame *responseFrame) {
+    }];
+    [stompSocket conflateSubscriptionID:subscribeFrame.subscription.identifier byHeader:@"symbol"];
+    __block BOOL subscribed = NO;
+    [stompSocket sendSocketOperationWithFrame:subscribeFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        subscribed = YES;
+    } failure:nil];
+    expect(subscribed).will.beTruthy();
+
+    [broker publishMessageWithDestination:@"/quotes" headers:@{@"symbol": @"GOOG"} body:@"GOOG 1"];
+    [broker publishMessageWithDestination:@"/quotes" headers:@{@"symbol": @"AAPL"} body:@"AAPL 1"];
+    [broker publishMessageWithDestination:@"/quotes" headers:@{@"symbol": @"GOOG"} body:@"GOOG 2"];
+    expect(stompSocket.lastValueCache.numberOfMessages).will.equal(2);
+    expect([stompSocket.lastValueCache messageFramesForDestination:@"/quotes"]).will.haveCountOf(2);
+    expect([[[stompSocket.lastValueCache messageFramesForDestination:@"/quotes"] lastObject] bodyValue]).will.equal(@"GOOG 2");
+
+    [stompSocket closeSocket];
+    [stompSocket.lastValueCache close];
+    [broker close];
+
+    // the next launch has them before it has even connected
+    RBKSTOMPSocket *nextSocket = [RBKStompBroker stompSocketWithURL:[NSURL URLWithString:@"ws://localhost"]];
+    nextSocket.lastValueCache = [[RBKStompLastValueCache alloc] initWithURL:self.cacheURL error:nil];
+    NSMutableArray *primedFrames = [NSMutableArray array];
+    [nextSocket sendSocketOperationWithFrame:[RBKStompFrame subscribeFrameWithDestination:@"/quotes" headers:nil messageHandler:^(RBKStompFrame *responseFrame) {
+        [primedFrames addObject:responseFrame];
+    }]];
+    expect([primedFrames valueForKey:@"bodyValue"]).to.equal((@[@"AAPL 1", @"GOOG 2"]));
+    expect([primedFrames[0] headerValueForKey:RBKStompHeaderSubscription]).to.beNil();
+
+    [nextSocket closeSocket];
+    [nextSocket.lastValueCache close];
+}
+
+@end
@@ -0,0 +1,95 @@
+//
+//  RBKTimingWheelTests.m
+//  RoboSocket
+//
+//  Copyright (c) 2014 Robots and Pencils Inc. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#define EXP_SHORTHAND YES
+#import <Expecta/Expecta.h>
+
+#import "RBKTimingWheel.h"
+
+@interface RBKTimingWheelTests : XCTestCase
+
+@end
+
+@implementation RBKTimingWheelTests
+
+- (void)setUp {
+    [super setUp];
+
+    [Expecta setAsynchronousTestTimeout:5.0];
+}
+
+- (void)testTimeoutFiresAfterInterval {
+    RBKTimingWheel *wheel = [[RBKTimingWheel alloc] initWithTickDuration:0.01 slotCount:8];
+
+    NSDate *start = [NSDate date];
+    __block NSTimeInterval elapsed = 0;
+    // longer than one revolution of the wheel
+    RBKTimingWheelTimeout *timeout = [wheel scheduleTimeoutWithInterval:0.25 handler:^{
+        elapsed = [[NSDate date] timeIntervalSinceDate:start];
+    }];
+    expect(wheel.count).to.equal(1);
+
+    expect(timeout.isExpired).will.beTruthy();
+    expect(elapsed).to.beGreaterThanOrEqualTo(0.25);
+    expect(wheel.count).will.equal(0);
+}
+
+- (void)testTimeoutScheduledMidTickIsNotEarly {
+    RBKTimingWheel *wheel = [[RBKTimingWheel alloc] initWithTickDuration:0.05 slotCount:8];
+    RBKTimingWheelTimeout *running = [wheel scheduleTimeoutWithInterval:1 handler:^{}];
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.075]]; // halfway through the second tick
+
+    NSDate *start = [NSDate date];
+    __block NSTimeInterval elapsed = 0;
+    RBKTimingWheelTimeout *timeout = [wheel scheduleTimeoutWithInterval:0.05 handler:^{
+        elapsed = [[NSDate date] timeIntervalSinceDate:start];
+    }];
+
+    expect(timeout.isExpired).will.beTruthy();
+    expect(elapsed).to.beGreaterThanOrEqualTo(0.05);
+    [running cancel];
+}
+
+- (void)testTimeoutFiresOnVirtualClock {
+    RBKVirtualClock *clock = [[RBKVirtualClock alloc] init];
+    RBKTimingWheel *wheel = [[RBKTimingWheel alloc] initWithTickDuration:0.1 slotCount:8 clock:clock];
+
+    __block uint64_t firedTime = 0;
+    RBKTimingWheelTimeout *timeout = [wheel scheduleTimeoutWithInterval:0.25 handler:^{
+        firedTime = [clock now];
+    }];
+    expect([clock nextDeadline]).will.equal(100 * NSEC_PER_MSEC); // scheduled on the wheel's queue
+
+    [clock advanceByInterval:0.2];
+    expect(timeout.isExpired).to.beFalsy();
+    [clock advanceByInterval:0.1];
+    expect(timeout.isExpired).to.beTruthy();
+    expect(firedTime).to.equal(300 * NSEC_PER_MSEC);
+
+    // nothing left, so the wheel stops ticking
+    expect([clock nextDeadline]).will.equal(RBKClockDistantFuture);
+}
+
+- (void)testCancelledTimeoutDoesNotFire {
+    RBKTimingWheel *wheel = [[RBKTimingWheel alloc] initWithTickDuration:0.01 slotCount:8];
+
+    __block BOOL fired = NO;
+    RBKTimingWheelTimeout *cancelled = [wheel scheduleTimeoutWithInterval:0.05 handler:^{
+        fired = YES;
+    }];
+    RBKTimingWheelTimeout *kept = [wheel scheduleTimeoutWithInterval:0.1 handler:^{}];
+    [cancelled cancel];
+
+    expect(kept.isExpired).will.beTruthy();
+    expect(fired).to.beFalsy();
+    expect(cancelled.isCancelled).to.beTruthy();
+    expect(wheel.count).will.equal(0);
+}
+
+@end
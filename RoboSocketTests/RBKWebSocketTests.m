@@ -15,10 +15,31 @@
 #import <SocketRocket/SRServerSocket.h>
 #import <SocketRocket/SRWebSocket.h>
 
+static NSString * const RBKWebSocketTestsUnansweredFrame = @"no reply";
+
+/**
+ Answers every frame with nil, as the STOMP serializer does for a MESSAGE it drops, and counts how often it is asked.
+ */
+@interface RBKWebSocketTestsNilResponseSerializer : RBKSocketStringResponseSerializer
+
+@property (assign) NSUInteger serializationCount;
+
+@end
+
+@implementation RBKWebSocketTestsNilResponseSerializer
+
+- (id)responseObjectForResponseFrame:(id)responseFrame error:(NSError *__autoreleasing *)error {
+    self.serializationCount += 1;
+    return nil;
+}
+
+@end
+
 @interface RBKWebSocketTests : XCTestCase <SRWebSocketDelegate>
 
 @property (strong, nonatomic) RBKWebSocket *webSocket;
 @property (strong, nonatomic) SRServerSocket *stubSocket;
+@property (strong, nonatomic) NSMutableArray *receivedMessages; // by the stub
 
 @end
 
@@ -35,6 +56,7 @@
 
     self.stubSocket = [[SRServerSocket alloc] initWithURL:[NSURL URLWithString:hostURL]];
     self.stubSocket.delegate = self;
+    self.receivedMessages = [NSMutableArray array];
 
     NSUInteger port = [self.stubSocket serverSocketPort];
     // get the port that we're listening on and provide it to the client socket
@@ -145,9 +167,191 @@
     expect(responseMessage).will.equal(sentMessage); // using JSON serializers, we can feed it JSON, and we get a JSON response
 }
 
+- (void)testSocketEchoFragmentedString {
+    
+    RBKSocketTracer *tracer = [[RBKSocketTracer alloc] init];
+    self.webSocket.tracer = tracer;
+    
+    NSString *sentMessage = [@"" stringByPaddingToLength:300 * 1024 withString:@"fragment " startingAtIndex:0];
+    __block NSString *responseMessage = nil;
+    [self.webSocket sendSocketOperationWithFrame:sentMessage success:^(RBKSocketOperation *operation, id responseObject) {
+        responseMessage = responseObject;
+    } failure:nil];
+    expect(responseMessage).will.equal(sentMessage);
+    
+    // 300KB goes out as 64KB fragments
+    NSUInteger encodedFrames = 0;
+    for (NSDictionary *event in [tracer events]) {
+        if ([event[@"stage"] unsignedIntValue] == RBKSocketTraceStageEncode) {
+            encodedFrames += 1;
+        }
+    }
+    expect(encodedFrames).to.equal(5);
+}
+
+- (void)testSocketEchoWithStreamsOnWorkQueue {
+
+    self.webSocket.schedulesStreamsOnWorkQueue = YES;
+
+    NSString *sentMessage = [@"" stringByPaddingToLength:300 * 1024 withString:@"queued " startingAtIndex:0];
+    __block NSString *responseMessage = nil;
+    [self.webSocket sendSocketOperationWithFrame:sentMessage success:^(RBKSocketOperation *operation, id responseObject) {
+        responseMessage = responseObject;
+    } failure:nil];
+    expect(responseMessage).will.equal(sentMessage);
+}
+
+- (void)testSocketEchoOverLoopback {
+
+    SRServerSocket *loopbackServer = [[SRServerSocket alloc] initWithURL:[NSURL URLWithString:@"ws://localhost"]];
+    loopbackServer.delegate = self;
+    RBKWebSocket *loopbackSocket = [[RBKWebSocket alloc] initWithSocketURL:[NSURL URLWithString:@"ws://localhost"]];
+    [loopbackSocket connectToLoopbackServer:loopbackServer];
+
+    NSString *sentMessage = [@"" stringByPaddingToLength:300 * 1024 withString:@"loopback " startingAtIndex:0];
+    __block NSString *responseMessage = nil;
+    [loopbackSocket sendSocketOperationWithFrame:sentMessage success:^(RBKSocketOperation *operation, id responseObject) {
+        responseMessage = responseObject;
+    } failure:nil];
+    expect(responseMessage).will.equal(sentMessage);
+
+    [loopbackServer close];
+    [loopbackSocket closeSocket];
+}
+
+- (void)testSocketEchoManySmallFrames {
+
+    // small frames arrive several to a read, and each is parsed straight from the read buffer
+    // nothing waits for a response, so the frames go out back to back; the socket only has room for one awaited response at a time
+    RBKSocketMetrics *metrics = [[RBKSocketMetrics alloc] init];
+    self.webSocket.metrics = metrics;
+    for (NSUInteger idx = 0; idx < 200; idx++) {
+        [self.webSocket sendSocketOperationWithFrame:[NSString stringWithFormat:@"%lu", (unsigned long)idx]];
+    }
+    expect([self.receivedMessages count]).will.equal(200);
+    expect([self.receivedMessages firstObject]).to.equal(@"0");
+    expect([self.receivedMessages lastObject]).to.equal(@"199");
+    expect([metrics snapshot][RBKSocketMetricsFramesReceivedKey]).will.equal(200); // and all the echoes
+}
+
+- (void)testNilResponseIsSerializedOnce {
+    RBKWebSocketTestsNilResponseSerializer *responseSerializer = [RBKWebSocketTestsNilResponseSerializer serializer];
+    self.webSocket.responseSerializer = responseSerializer;
+
+    __block BOOL success = NO;
+    __block id responseObject = @"not yet";
+    [self.webSocket sendSocketOperationWithFrame:@"Hello, World!" success:^(RBKSocketOperation *operation, id firstResponseObject) {
+        responseObject = operation.responseObject; // asked again, as callers do
+        success = YES;
+    } failure:nil];
+    expect(success).will.beTruthy();
+    expect(responseObject).to.beNil();
+    expect(responseSerializer.serializationCount).to.equal(1);
+}
+
+- (void)testSocketOperationTimeout {
+    
+    self.webSocket.operationTimeoutInterval = 0.3;
+    
+    __block NSError *timeoutError = nil;
+    [self.webSocket sendSocketOperationWithFrame:RBKWebSocketTestsUnansweredFrame success:nil failure:^(RBKSocketOperation *operation, NSError *error) {
+        timeoutError = error;
+    }];
+    expect(timeoutError.code).will.equal(NSURLErrorTimedOut);
+    
+    // the lost reply must not hold on to the response slot
+    __block NSString *responseMessage = nil;
+    [self.webSocket sendSocketOperationWithFrame:@"Hello, World!" success:^(RBKSocketOperation *operation, id responseObject) {
+        responseMessage = responseObject;
+    } failure:nil];
+    expect(responseMessage).will.equal(@"Hello, World!");
+}
+
+- (void)testSocketOperationCancel {
+    
+    __block NSError *cancelError = nil;
+    __block BOOL success = NO;
+    RBKSocketOperation *unansweredOperation = [self.webSocket sendSocketOperationWithFrame:RBKWebSocketTestsUnansweredFrame success:^(RBKSocketOperation *operation, id responseObject) {
+        success = YES;
+    } failure:^(RBKSocketOperation *operation, NSError *error) {
+        cancelError = error;
+    }];
+    [unansweredOperation cancel];
+    expect(cancelError.code).will.equal(NSURLErrorCancelled);
+    expect(success).to.beFalsy();
+}
+
+- (void)testOperationCancelledBeforeOpenIsNotSent {
+    
+    expect(self.webSocket.socketOpen).to.beFalsy();
+    __block NSError *cancelError = nil;
+    RBKSocketOperation *cancelledOperation = [self.webSocket sendSocketOperationWithFrame:@"cancelled" success:nil failure:^(RBKSocketOperation *operation, NSError *error) {
+        cancelError = error;
+    }];
+    __block NSString *responseMessage = nil;
+    [self.webSocket sendSocketOperationWithFrame:@"Hello, World!" success:^(RBKSocketOperation *operation, id responseObject) {
+        responseMessage = responseObject;
+    } failure:nil];
+    [cancelledOperation cancel];
+    
+    expect(cancelError.code).will.equal(NSURLErrorCancelled);
+    expect(responseMessage).will.equal(@"Hello, World!");
+    expect(self.receivedMessages).to.equal(@[@"Hello, World!"]);
+}
+
+- (void)testKeepaliveMeasuresRoundTripTime {
+    
+    RBKSocketKeepalive *keepalive = [[RBKSocketKeepalive alloc] init];
+    keepalive.minimumInterval = 0.05;
+    keepalive.maximumInterval = 0.1;
+    self.webSocket.keepalive = keepalive;
+    
+    __block NSError *failure = nil;
+    self.webSocket.failureBlock = ^(NSError *error) {
+        failure = error;
+    };
+    
+    // the stub answers pings on its own
+    expect(keepalive.pongsReceived).will.beGreaterThanOrEqualTo(3);
+    expect(keepalive.smoothedRoundTripTime).to.beGreaterThan(0);
+    expect(keepalive.currentInterval).to.equal(0.1);
+    expect(keepalive.missedPongs).to.equal(0);
+    expect(failure).to.beNil();
+}
+
+- (void)testKeepaliveClosesDeadConnection {
+    
+    RBKSocketKeepalive *keepalive = [[RBKSocketKeepalive alloc] init];
+    keepalive.minimumInterval = 0.05;
+    keepalive.maximumInterval = 0.1;
+    keepalive.maximumMissedPongs = 2;
+    self.webSocket.keepalive = keepalive;
+    
+    __block NSError *failure = nil;
+    self.webSocket.failureBlock = ^(NSError *error) {
+        failure = error;
+    };
+    expect(self.webSocket.socketOpen).will.beTruthy();
+    
+    // the stub stops reading, so neither pings nor the frame get an answer
+    [self.stubSocket pauseReading];
+    __block NSError *operationError = nil;
+    [self.webSocket sendSocketOperationWithFrame:RBKWebSocketTestsUnansweredFrame success:nil failure:^(RBKSocketOperation *operation, NSError *error) {
+        operationError = error;
+    }];
+    expect(failure.domain).will.equal(RBKSocketNetworkingErrorDomain);
+    expect(failure.code).to.equal(NSURLErrorTimedOut);
+    expect(operationError).willNot.beNil();
+    expect(self.webSocket.socketOpen).will.beFalsy();
+}
+
 #pragma mark - SRWebSocketDelegate
 
 - (void)webSocket:(SRWebSocket *)webSocket didReceiveMessage:(id)message; {
+    [self.receivedMessages addObject:message];
+    if ([message isEqual:RBKWebSocketTestsUnansweredFrame]) {
+        return;
+    }
     // echo
     [webSocket send:message];
 }